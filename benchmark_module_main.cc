@@ -12,27 +12,50 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <array>
+#include <chrono>  // NOLINT
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
 #include "absl/flags/flag.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "benchmark/benchmark.h"
+#include "iree/base/api.h"
 #include "iree/base/api_util.h"
 #include "iree/base/file_io.h"
+#include "iree/base/file_mapping.h"
+#include "iree/base/init.h"
 #include "iree/base/source_location.h"
 #include "iree/base/status.h"
+#include "iree/base/tracing.h"
 #include "iree/modules/hal/hal_module.h"
+#include "iree/tools/execution_profile.h"
+#include "iree/tools/module_stats.h"
+#include "iree/tools/specialization_tuning.h"
 #include "iree/tools/vm_util.h"
 #include "iree/vm/bytecode_module.h"
+#include "iree/vm/module.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/JSON.h"
 
-// TODO(gcmn): Allow stdin in a non-gross way. The benchmark framework invokes
-// the benchmarking function multiple times, so we have to do something to only
-// process stdin once. Probably requires dynamic benchmark registration.
-ABSL_FLAG(std::string, input_file, "",
+ABSL_FLAG(std::string, input_file, "-",
           "File containing the module to load that contains the entry "
-          "function. Required and cannot be stdin.");
+          "function. Defaults to stdin.");
 
 ABSL_FLAG(std::string, entry_function, "",
           "Name of a function contained in the module specified by input_file "
-          "to run.");
+          "to run. If empty, a benchmark is registered for every exported "
+          "function (excluding internal functions starting with '__'), all of "
+          "which receive the same --inputs.");
 
 ABSL_FLAG(std::string, driver, "interpreter", "Backend driver to use.");
 
@@ -46,115 +69,762 @@ ABSL_FLAG(std::vector<std::string>, inputs, {},
           "Due to the absence of repeated flags in absl, commas should not be "
           "used to separate elements. They are reserved for separating input "
           "values:\n"
-          "2x2xi32=[[1 2][3 4]], 1x2xf32=[[1 2]]");
+          "2x2xi32=[[1 2][3 4]], 1x2xf32=[[1 2]]\n"
+          "Buffers may also be memory mapped from binary files:\n"
+          "@input.npy, 2x2xf32=@raw_input.bin, @buffer_data_def.fb");
+
+ABSL_FLAG(bool, import_input_files, false,
+          "Imports file inputs (@path) directly into host heap buffers instead "
+          "of copying them into device allocations. Only valid for drivers "
+          "that execute on host memory.");
+
+ABSL_FLAG(int, throughput_threads, 0,
+          "If > 0 also runs a throughput benchmark with 1 up to this many "
+          "concurrent threads (in powers of two). Each thread invokes the "
+          "entry function in its own context over the shared modules and "
+          "device. Reports aggregate invocations per second and p50/p90/p99 "
+          "latency across all threads.");
+
+ABSL_FLAG(std::string, baseline_file, "",
+          "Optional JSON results of a previous run, as written with "
+          "--benchmark_out=<file> --benchmark_out_format=json. Benchmarks "
+          "whose real time regressed by more than --regression_threshold "
+          "relative to the baseline are reported and fail the run.");
+
+ABSL_FLAG(bool, report_cold_start, false,
+          "Before running benchmarks, reports the latency of the first "
+          "invocation of each function against that of a second one. Each "
+          "function is measured on a device of its own so that the first "
+          "invocation includes preparing all of its executables.");
+
+ABSL_FLAG(std::string, profile, "",
+          "Optional file to write an execution profile of all benchmarked "
+          "invocations to: per-function call counts with inclusive and "
+          "exclusive time as JSON if the path ends with '.json', or collapsed "
+          "stacks for flamegraph tools otherwise.");
+
+ABSL_FLAG(std::string, trace_file, "",
+          "Optional file to write a Web Tracing Framework trace of loading, "
+          "marshalling and all benchmarked invocations to. Requires a build "
+          "with tracing enabled (WTF_ENABLE).");
+
+ABSL_FLAG(std::string, tuning_file, "",
+          "Optional file of the best SPIR-V specialization variant of each "
+          "executable per device, as written by --autotune. The variants "
+          "selected for --tuning_device are applied to the module before "
+          "it is loaded.");
+
+ABSL_FLAG(std::string, tuning_device, "",
+          "Name of the device that --tuning_file entries are read and "
+          "written for, such as the GPU model. Required with --tuning_file.");
+
+ABSL_FLAG(bool, autotune, false,
+          "Instead of running benchmarks, times each specialization variant "
+          "of every tunable SPIR-V executable in the module and records the "
+          "fastest for --tuning_device in --tuning_file. Entries for other "
+          "devices are preserved.");
+
+ABSL_FLAG(int, autotune_iterations, 10,
+          "Number of timed invocations of each function per variant when "
+          "autotuning. Variants are compared by the sum of the median "
+          "latencies of all benchmarked functions.");
+
+ABSL_FLAG(double, regression_threshold, 0.05,
+          "Maximum allowed relative real time increase over --baseline_file "
+          "before a benchmark is considered regressed (0.05 = 5%).");
 
 namespace iree {
 namespace {
 
-StatusOr<std::string> GetModuleContentsFromFlags() {
-  auto input_file = absl::GetFlag(FLAGS_input_file);
-  if (input_file.empty()) {
+// Process-wide state loaded once before any benchmark runs. Benchmark threads
+// only share these objects; everything else is created per thread.
+struct SharedState {
+  iree_vm_instance_t* instance = nullptr;
+  iree_hal_device_t* device = nullptr;
+  iree_vm_module_t* hal_module = nullptr;
+  iree_vm_module_t* input_module = nullptr;
+  // Functions to benchmark, resolved from --entry_function or the exports.
+  std::vector<iree_vm_function_t> functions;
+  // Records all benchmarked invocations if --profile is set.
+  std::unique_ptr<ExecutionProfile> profile;
+};
+
+// Resolves the functions to benchmark into |shared->functions|.
+Status ResolveFunctions(SharedState* shared) {
+  iree_vm_module_t* module = shared->input_module;
+  std::string function_name = absl::GetFlag(FLAGS_entry_function);
+  if (!function_name.empty()) {
+    iree_vm_function_t function;
+    RETURN_IF_ERROR(FromApiStatus(
+        module->lookup_function(
+            module->self, IREE_VM_FUNCTION_LINKAGE_EXPORT,
+            iree_string_view_t{function_name.data(), function_name.size()},
+            &function),
+        IREE_LOC))
+        << "looking up function '" << function_name << "'";
+    RETURN_IF_ERROR(ValidateFunctionAbi(function));
+    shared->functions.push_back(function);
+    return OkStatus();
+  }
+
+  auto module_signature = iree_vm_module_signature(module);
+  for (int i = 0; i < module_signature.export_function_count; ++i) {
+    iree_vm_function_t function;
+    RETURN_IF_ERROR(FromApiStatus(
+        iree_vm_module_lookup_function_by_ordinal(
+            module, IREE_VM_FUNCTION_LINKAGE_EXPORT, i, &function),
+        IREE_LOC))
+        << "looking up function export " << i;
+    if (iree_string_view_starts_with(iree_vm_function_name(&function),
+                                     iree_make_cstring_view("__"))) {
+      // Skip internal functions.
+      continue;
+    }
+    RETURN_IF_ERROR(ValidateFunctionAbi(function));
+    shared->functions.push_back(function);
+  }
+  if (shared->functions.empty()) {
     return InvalidArgumentErrorBuilder(IREE_LOC)
-           << "input_file must be specified";
+           << "module has no exported functions to benchmark";
   }
-  return file_io::GetFileContents(input_file);
+  return OkStatus();
+}
+
+// Reports the time taken to load the module alongside the size of its rodata.
+// |module_data| is the archive the module was loaded from and has already been
+// verified by the loader.
+void ReportModuleLoad(absl::Span<const uint8_t> module_data,
+                      std::chrono::steady_clock::duration load_time) {
+  auto module_stats = ComputeModuleStats(
+      *vm::GetBytecodeModuleDef(module_data.data()), module_data.size());
+  std::cerr << "Loaded module in "
+            << std::chrono::duration<double, std::milli>(load_time).count()
+            << "ms: " << module_stats.module_byte_size << " bytes, rodata "
+            << module_stats.rodata_byte_size << " bytes in "
+            << module_stats.rodata_segments.size() << " segments\n";
+}
+
+Status ValidateTuningFlags() {
+  if (absl::GetFlag(FLAGS_autotune) &&
+      absl::GetFlag(FLAGS_tuning_file).empty()) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "--autotune requires --tuning_file";
+  }
+  if (absl::GetFlag(FLAGS_tuning_file).empty()) return OkStatus();
+  if (absl::GetFlag(FLAGS_tuning_device).empty()) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "--tuning_file requires --tuning_device";
+  }
+  if (absl::GetFlag(FLAGS_input_file) == "-") {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "--tuning_file requires --input_file to name a file";
+  }
+  return OkStatus();
+}
+
+// Loads the module at |path| with the specialization variants selected in the
+// tuning file at |tuning_path| for |device| applied. |out_module_data|
+// receives the tuned module archive.
+Status LoadTunedModule(const std::string& path, const std::string& tuning_path,
+                       absl::string_view device, iree_vm_module_t** out_module,
+                       absl::Span<const uint8_t>* out_module_data) {
+  ASSIGN_OR_RETURN(auto tuning_table, TuningTable::LoadFile(tuning_path));
+  ASSIGN_OR_RETURN(auto file_mapping, FileMapping::OpenRead(path),
+                   _ << "Mapping module file '" << path << "'");
+  ASSIGN_OR_RETURN(
+      auto module_data,
+      ApplyTuningTable(file_mapping->data(), tuning_table, device));
+  return LoadBytecodeModuleFromString(std::move(module_data), out_module,
+                                      out_module_data);
 }
 
-Status Run(::benchmark::State& state) {
+Status LoadSharedState(SharedState* shared) {
+  RETURN_IF_ERROR(ValidateTuningFlags());
   RETURN_IF_ERROR(FromApiStatus(iree_hal_module_register_types(), IREE_LOC))
       << "registering HAL types";
-  iree_vm_instance_t* instance = nullptr;
   RETURN_IF_ERROR(FromApiStatus(
-      iree_vm_instance_create(IREE_ALLOCATOR_SYSTEM, &instance), IREE_LOC))
+      iree_vm_instance_create(IREE_ALLOCATOR_SYSTEM, &shared->instance),
+      IREE_LOC))
       << "creating instance";
 
-  ASSIGN_OR_RETURN(auto module_data, GetModuleContentsFromFlags());
-  iree_vm_module_t* input_module = nullptr;
-  RETURN_IF_ERROR(LoadBytecodeModule(module_data, &input_module));
+  // Benchmarks are registered dynamically after loading so stdin is only
+  // ever consumed once.
+  auto load_start_time = std::chrono::steady_clock::now();
+  absl::Span<const uint8_t> module_data;
+  if (!absl::GetFlag(FLAGS_tuning_file).empty() &&
+      !absl::GetFlag(FLAGS_autotune)) {
+    RETURN_IF_ERROR(LoadTunedModule(
+        absl::GetFlag(FLAGS_input_file), absl::GetFlag(FLAGS_tuning_file),
+        absl::GetFlag(FLAGS_tuning_device), &shared->input_module,
+        &module_data));
+  } else {
+    RETURN_IF_ERROR(LoadBytecodeModuleFromFile(absl::GetFlag(FLAGS_input_file),
+                                               &shared->input_module,
+                                               &module_data));
+  }
+  ReportModuleLoad(module_data,
+                   std::chrono::steady_clock::now() - load_start_time);
 
-  iree_hal_device_t* device = nullptr;
-  RETURN_IF_ERROR(CreateDevice(absl::GetFlag(FLAGS_driver), &device));
-  iree_vm_module_t* hal_module = nullptr;
-  RETURN_IF_ERROR(CreateHalModule(device, &hal_module));
+  RETURN_IF_ERROR(CreateDevice(absl::GetFlag(FLAGS_driver), &shared->device));
+  RETURN_IF_ERROR(CreateHalModule(shared->device, &shared->hal_module));
+  RETURN_IF_ERROR(ResolveFunctions(shared));
+  if (!absl::GetFlag(FLAGS_profile).empty()) {
+    shared->profile = absl::make_unique<ExecutionProfile>();
+  }
+  return OkStatus();
+}
+
+Status ReleaseSharedState(SharedState* shared) {
+  RETURN_IF_ERROR(
+      FromApiStatus(iree_vm_module_release(shared->hal_module), IREE_LOC));
+  RETURN_IF_ERROR(
+      FromApiStatus(iree_vm_module_release(shared->input_module), IREE_LOC));
+  RETURN_IF_ERROR(
+      FromApiStatus(iree_hal_device_release(shared->device), IREE_LOC));
+  RETURN_IF_ERROR(
+      FromApiStatus(iree_vm_instance_release(shared->instance), IREE_LOC));
+  return OkStatus();
+}
 
+// State owned by a single benchmark thread. Each thread gets its own context
+// and input buffers so that concurrent invocations only contend on the shared
+// modules and device.
+struct ThreadState {
   iree_vm_context_t* context = nullptr;
+  iree_vm_function_t function;
+  iree_vm_variant_list_t* inputs = nullptr;
+  // Memory mapped input files backing imported |inputs| buffers.
+  std::vector<ref_ptr<FileMapping>> input_mappings;
+  // Reused for every invocation so the steady state does not allocate.
+  iree_vm_variant_list_t* outputs = nullptr;
+  // Counts host allocations made through the allocator passed to
+  // iree_vm_invoke. HAL buffers allocated from the device allocator during the
+  // invocation are not included.
+  CountingAllocator invoke_allocator;
+};
+
+Status CreateThreadState(const SharedState& shared,
+                         iree_vm_function_t function, ThreadState* thread) {
+  IREE_TRACE_THREAD_ENABLE("iree-benchmark-module");
+  IREE_TRACE_SCOPE0("iree-benchmark-module#CreateThreadState");
   // Order matters. The input module will likely be dependent on the hal module.
-  std::array<iree_vm_module_t*, 2> modules = {hal_module, input_module};
+  std::array<iree_vm_module_t*, 2> modules = {shared.hal_module,
+                                              function.module};
   RETURN_IF_ERROR(FromApiStatus(iree_vm_context_create_with_modules(
-                                    instance, modules.data(), modules.size(),
-                                    IREE_ALLOCATOR_SYSTEM, &context),
+                                    shared.instance, modules.data(),
+                                    modules.size(), IREE_ALLOCATOR_SYSTEM,
+                                    &thread->context),
                                 IREE_LOC))
       << "creating context";
 
-  std::string function_name = absl::GetFlag(FLAGS_entry_function);
-  iree_vm_function_t function;
-  RETURN_IF_ERROR(FromApiStatus(
-      input_module->lookup_function(
-          input_module->self, IREE_VM_FUNCTION_LINKAGE_EXPORT,
-          iree_string_view_t{function_name.data(), function_name.size()},
-          &function),
-      IREE_LOC))
-      << "looking up function '" << function_name << "'";
+  thread->function = function;
+  ASSIGN_OR_RETURN(auto input_descs, ParseInputSignature(thread->function));
+  ASSIGN_OR_RETURN(
+      thread->inputs,
+      ParseToVariantList(input_descs, iree_hal_device_allocator(shared.device),
+                         absl::GetFlag(FLAGS_inputs),
+                         absl::GetFlag(FLAGS_import_input_files)
+                             ? &thread->input_mappings
+                             : nullptr));
+  ASSIGN_OR_RETURN(auto output_descs, ParseOutputSignature(thread->function));
+  RETURN_IF_ERROR(AllocateReusableVariantList(
+      output_descs.size(), IREE_ALLOCATOR_SYSTEM, &thread->outputs));
+  return OkStatus();
+}
 
-  RETURN_IF_ERROR(ValidateFunctionAbi(function));
-  ASSIGN_OR_RETURN(auto input_descs, ParseInputSignature(function));
+// Releases everything CreateThreadState created, including partially created
+// state after it failed.
+Status ReleaseThreadState(ThreadState* thread) {
+  if (thread->inputs) {
+    RETURN_IF_ERROR(
+        FromApiStatus(iree_vm_variant_list_free(thread->inputs), IREE_LOC));
+    thread->inputs = nullptr;
+  }
+  if (thread->outputs) {
+    RETURN_IF_ERROR(
+        FreeReusableVariantList(thread->outputs, IREE_ALLOCATOR_SYSTEM));
+    thread->outputs = nullptr;
+  }
+  if (thread->context) {
+    RETURN_IF_ERROR(
+        FromApiStatus(iree_vm_context_release(thread->context), IREE_LOC));
+    thread->context = nullptr;
+  }
+  thread->input_mappings.clear();
+  return OkStatus();
+}
 
-  ASSIGN_OR_RETURN(
-      iree_vm_variant_list_t * inputs,
-      ParseToVariantList(input_descs, iree_hal_device_allocator(device),
-                         absl::GetFlag(FLAGS_inputs)));
+// Runs |body| on a new ThreadState for |function| and releases the state
+// afterwards, whether or not |body| succeeded.
+Status RunWithThreadState(const SharedState& shared,
+                          iree_vm_function_t function,
+                          const std::function<Status(ThreadState*)>& body) {
+  ThreadState thread;
+  Status status = CreateThreadState(shared, function, &thread);
+  if (status.ok()) status = body(&thread);
+  Status release_status = ReleaseThreadState(&thread);
+  RETURN_IF_ERROR(status);
+  return release_status;
+}
 
-  ASSIGN_OR_RETURN(auto output_descs, ParseOutputSignature(function));
+// Reports the latency of the first invocation of each function against that
+// of a second one. The first invocation on a device includes preparing the
+// executables it dispatches (such as creating the Vulkan pipelines of its
+// SPIR-V entry points), so the difference is the cold start cost that
+// pipeline caches avoid. Each function gets a new device and HAL module so
+// that executables prepared for earlier functions are not reused.
+Status ReportColdStart(const SharedState& shared) {
+  for (const auto& function : shared.functions) {
+    SharedState cold_shared;
+    cold_shared.instance = shared.instance;
+    cold_shared.input_module = shared.input_module;
+    Status status =
+        CreateDevice(absl::GetFlag(FLAGS_driver), &cold_shared.device);
+    if (status.ok()) {
+      status = CreateHalModule(cold_shared.device, &cold_shared.hal_module);
+    }
+    if (status.ok()) {
+      status = RunWithThreadState(
+          cold_shared, function, [&](ThreadState* thread) -> Status {
+            std::array<std::chrono::steady_clock::duration, 2> invoke_times;
+            for (auto& invoke_time : invoke_times) {
+              auto start_time = std::chrono::steady_clock::now();
+              RETURN_IF_ERROR(FromApiStatus(
+                  iree_vm_invoke(thread->context, thread->function,
+                                 /*policy=*/nullptr, thread->inputs,
+                                 thread->outputs, IREE_ALLOCATOR_SYSTEM),
+                  IREE_LOC));
+              invoke_time = std::chrono::steady_clock::now() - start_time;
+              RETURN_IF_ERROR(ResetVariantList(thread->outputs));
+            }
+            auto function_name = iree_vm_function_name(&function);
+            std::cerr << absl::string_view(function_name.data,
+                                           function_name.size)
+                      << ": cold invocation "
+                      << std::chrono::duration<double, std::milli>(
+                             invoke_times[0])
+                             .count()
+                      << "ms, warm invocation "
+                      << std::chrono::duration<double, std::milli>(
+                             invoke_times[1])
+                             .count()
+                      << "ms\n";
+            return OkStatus();
+          });
+    }
+    // The first error is reported; the device is released either way.
+    if (cold_shared.hal_module) {
+      Status release_status = FromApiStatus(
+          iree_vm_module_release(cold_shared.hal_module), IREE_LOC);
+      if (status.ok()) status = release_status;
+    }
+    if (cold_shared.device) {
+      Status release_status = FromApiStatus(
+          iree_hal_device_release(cold_shared.device), IREE_LOC);
+      if (status.ok()) status = release_status;
+    }
+    RETURN_IF_ERROR(status);
+  }
+  return OkStatus();
+}
 
-  iree_vm_variant_list_t* outputs = nullptr;
+// Merges per-invocation latencies from all threads of one benchmark run so
+// that percentiles are computed over the combined distribution instead of
+// being averaged per thread.
+class LatencyCollector {
+ public:
+  // Adds the samples of one thread of a run with |thread_count| threads.
+  // The last thread of the run receives the merged, sorted samples in
+  // |out_samples| and gets true returned; all others get false.
+  bool AddThreadSamples(int thread_count, const std::vector<int64_t>& samples,
+                        std::vector<int64_t>* out_samples) {
+    absl::MutexLock lock(&mutex_);
+    samples_.insert(samples_.end(), samples.begin(), samples.end());
+    if (++finished_threads_ < thread_count) return false;
+    std::sort(samples_.begin(), samples_.end());
+    out_samples->swap(samples_);
+    samples_.clear();
+    finished_threads_ = 0;
+    return true;
+  }
+
+ private:
+  absl::Mutex mutex_;
+  int finished_threads_ ABSL_GUARDED_BY(mutex_) = 0;
+  std::vector<int64_t> samples_ ABSL_GUARDED_BY(mutex_);
+};
+
+// Returns the |percentile| value from the sorted |samples|.
+double Percentile(const std::vector<int64_t>& samples, int percentile) {
+  if (samples.empty()) return 0.0;
+  size_t index =
+      std::min(samples.size() - 1, samples.size() * percentile / 100);
+  return static_cast<double>(samples[index]);
+}
+
+Status RunThread(::benchmark::State& state, const SharedState& shared,
+                 ThreadState* thread_state,
+                 LatencyCollector* latency_collector) {
+  ThreadState& thread = *thread_state;
+  iree_vm_variant_list_t* outputs = thread.outputs;
+  iree_allocator_t invoke_allocator = thread.invoke_allocator.allocator();
 
   // Execute once to make sure any first-iteration outliers are eliminated (e.g.
   // JITing the SPIR-V) and clearly separate out benchmark-related problems in
   // future debugging.
-  RETURN_IF_ERROR(
-      FromApiStatus(iree_vm_variant_list_alloc(output_descs.size(),
-                                               IREE_ALLOCATOR_SYSTEM, &outputs),
-                    IREE_LOC));
-  RETURN_IF_ERROR(
-      FromApiStatus(iree_vm_invoke(context, function, /*policy=*/nullptr,
-                                   inputs, outputs, IREE_ALLOCATOR_SYSTEM),
-                    IREE_LOC));
-  RETURN_IF_ERROR(FromApiStatus(iree_vm_variant_list_free(outputs), IREE_LOC));
+  RETURN_IF_ERROR(FromApiStatus(
+      iree_vm_invoke(thread.context, thread.function, /*policy=*/nullptr,
+                     thread.inputs, outputs, invoke_allocator),
+      IREE_LOC));
+  RETURN_IF_ERROR(ResetVariantList(outputs));
 
+  // Reserved up front so recording latencies does not allocate in the loop.
+  std::vector<int64_t> latencies_ns;
+  if (latency_collector) latencies_ns.reserve(state.max_iterations);
+
+  auto function_name_view = iree_vm_function_name(&thread.function);
+  std::string function_name(function_name_view.data, function_name_view.size);
+  int64_t start_allocation_count = thread.invoke_allocator.allocation_count();
   for (auto _ : state) {
     // No status conversions and conditional returns in the benchmarked inner
     // loop.
-    IREE_CHECK_OK(iree_vm_variant_list_alloc(output_descs.size(),
-                                             IREE_ALLOCATOR_SYSTEM, &outputs));
-    IREE_CHECK_OK(iree_vm_invoke(context, function, /*policy=*/nullptr, inputs,
-                                 outputs, IREE_ALLOCATOR_SYSTEM));
-    IREE_CHECK_OK(iree_vm_variant_list_free(outputs));
-  }
-
-  // TODO(gcmn): Some nice wrappers to make this pattern shorter with generated
-  // error messages.
-  // Deallocate:
-  RETURN_IF_ERROR(FromApiStatus(iree_vm_variant_list_free(inputs), IREE_LOC));
-  RETURN_IF_ERROR(FromApiStatus(iree_vm_module_release(hal_module), IREE_LOC));
-  RETURN_IF_ERROR(
-      FromApiStatus(iree_vm_module_release(input_module), IREE_LOC));
-  RETURN_IF_ERROR(FromApiStatus(iree_hal_device_release(device), IREE_LOC));
-  RETURN_IF_ERROR(FromApiStatus(iree_vm_context_release(context), IREE_LOC));
-  RETURN_IF_ERROR(FromApiStatus(iree_vm_instance_release(instance), IREE_LOC));
+    auto start_time = std::chrono::steady_clock::now();
+    {
+      ScopedProfileFunction profile_function(shared.profile.get(),
+                                             function_name);
+      IREE_TRACE_SCOPE0("iree-benchmark-module#Invoke");
+      IREE_CHECK_OK(iree_vm_invoke(thread.context, thread.function,
+                                   /*policy=*/nullptr, thread.inputs, outputs,
+                                   invoke_allocator));
+    }
+    IREE_CHECK_OK(ResetVariantListRaw(outputs));
+    if (latency_collector) {
+      latencies_ns.push_back(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - start_time)
+              .count());
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  // Host allocations made by the VM per invocation; ideally 0. Device
+  // allocator traffic is not included.
+  state.counters["vm_host_allocs_per_invoke"] = ::benchmark::Counter(
+      static_cast<double>(thread.invoke_allocator.allocation_count() -
+                          start_allocation_count),
+      ::benchmark::Counter::kAvgIterations);
+
+  if (latency_collector) {
+    // Counters are summed across threads, so only the thread that observes
+    // the merged distribution reports the percentiles.
+    std::vector<int64_t> all_latencies_ns;
+    if (latency_collector->AddThreadSamples(state.threads, latencies_ns,
+                                            &all_latencies_ns)) {
+      state.counters["p50_ns"] = Percentile(all_latencies_ns, 50);
+      state.counters["p90_ns"] = Percentile(all_latencies_ns, 90);
+      state.counters["p99_ns"] = Percentile(all_latencies_ns, 99);
+    }
+  }
   return OkStatus();
 }
 
-void BM_RunModule(benchmark::State& state) {
+Status Run(::benchmark::State& state, const SharedState& shared,
+           iree_vm_function_t function, LatencyCollector* latency_collector) {
+  return RunWithThreadState(shared, function, [&](ThreadState* thread) {
+    return RunThread(state, shared, thread, latency_collector);
+  });
+}
+
+void BM_RunModule(benchmark::State& state, const SharedState* shared,
+                  iree_vm_function_t function) {
   // Delegate to a status-returning function so we can use the status macros.
-  CHECK_OK(Run(state));
+  CHECK_OK(Run(state, *shared, function, /*latency_collector=*/nullptr));
+}
+
+void BM_RunModuleThroughput(benchmark::State& state, const SharedState* shared,
+                            iree_vm_function_t function,
+                            LatencyCollector* latency_collector) {
+  CHECK_OK(Run(state, *shared, function, latency_collector));
+}
+
+void RegisterBenchmarks(const SharedState* shared) {
+  int throughput_threads = absl::GetFlag(FLAGS_throughput_threads);
+  for (const auto& function : shared->functions) {
+    auto function_name = iree_vm_function_name(&function);
+    std::string benchmark_name = absl::StrCat(
+        "BM_", absl::string_view(function_name.data, function_name.size));
+
+    // By default only the main thread is included in CPU time. Include all the
+    // threads instead. To make single and multi-threaded benchmarks more
+    // comparable, use the wall time to determine how many iterations to run.
+    // See https://github.com/google/benchmark#cpu-timers,
+    ::benchmark::RegisterBenchmark(benchmark_name.c_str(), BM_RunModule, shared,
+                                   function)
+        ->MeasureProcessCPUTime()
+        ->UseRealTime();
+
+    if (throughput_threads > 0) {
+      // Owned by the registered benchmark for the lifetime of the process.
+      auto* latency_collector = new LatencyCollector();
+      ::benchmark::RegisterBenchmark(
+          absl::StrCat(benchmark_name, "_throughput").c_str(),
+          BM_RunModuleThroughput, shared, function, latency_collector)
+          ->MeasureProcessCPUTime()
+          ->UseRealTime()
+          ->ThreadRange(1, throughput_threads);
+    }
+  }
+}
+
+// Returns the sum over the benchmarked functions of the median latency of
+// invoking the same function in |module|.
+StatusOr<int64_t> TimeFunctions(const SharedState& shared,
+                                iree_vm_module_t* module) {
+  int64_t total_ns = 0;
+  for (const auto& shared_function : shared.functions) {
+    iree_vm_function_t function;
+    RETURN_IF_ERROR(FromApiStatus(
+        module->lookup_function(module->self, IREE_VM_FUNCTION_LINKAGE_EXPORT,
+                                iree_vm_function_name(&shared_function),
+                                &function),
+        IREE_LOC));
+    std::vector<int64_t> latencies_ns;
+    RETURN_IF_ERROR(RunWithThreadState(
+        shared, function, [&](ThreadState* thread) -> Status {
+          // The first invocation prepares executables and is not timed.
+          for (int i = 0; i <= absl::GetFlag(FLAGS_autotune_iterations); ++i) {
+            auto start_time = std::chrono::steady_clock::now();
+            RETURN_IF_ERROR(FromApiStatus(
+                iree_vm_invoke(thread->context, thread->function,
+                               /*policy=*/nullptr, thread->inputs,
+                               thread->outputs, IREE_ALLOCATOR_SYSTEM),
+                IREE_LOC));
+            if (i > 0) {
+              latencies_ns.push_back(
+                  std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now() - start_time)
+                      .count());
+            }
+            RETURN_IF_ERROR(ResetVariantList(thread->outputs));
+          }
+          return OkStatus();
+        }));
+    std::sort(latencies_ns.begin(), latencies_ns.end());
+    total_ns += static_cast<int64_t>(Percentile(latencies_ns, 50));
+  }
+  return total_ns;
+}
+
+// Times the module with |tuning_table| applied.
+StatusOr<int64_t> TimeTunedModule(const SharedState& shared,
+                                  absl::Span<const uint8_t> module_data,
+                                  const TuningTable& tuning_table) {
+  ASSIGN_OR_RETURN(auto tuned_module_data,
+                   ApplyTuningTable(module_data, tuning_table,
+                                    absl::GetFlag(FLAGS_tuning_device)));
+  iree_vm_module_t* module = nullptr;
+  RETURN_IF_ERROR(
+      LoadBytecodeModuleFromString(std::move(tuned_module_data), &module));
+  auto total_ns_or = TimeFunctions(shared, module);
+  RETURN_IF_ERROR(FromApiStatus(iree_vm_module_release(module), IREE_LOC));
+  return total_ns_or;
+}
+
+// Times every specialization variant of each tunable executable in the input
+// module and records the fastest in --tuning_file. Executables are tuned one
+// at a time with the variants already selected for earlier ones applied.
+Status Autotune(const SharedState& shared) {
+  std::string input_file = absl::GetFlag(FLAGS_input_file);
+  std::string tuning_file = absl::GetFlag(FLAGS_tuning_file);
+  std::string device = absl::GetFlag(FLAGS_tuning_device);
+  ASSIGN_OR_RETURN(auto file_mapping, FileMapping::OpenRead(input_file),
+                   _ << "Mapping module file '" << input_file << "'");
+  ASSIGN_OR_RETURN(auto tunable_executables,
+                   FindTunableExecutables(file_mapping->data()));
+  if (tunable_executables.empty()) {
+    std::cerr << "Module has no executables with specialization variants\n";
+  }
+
+  TuningTable tuning_table;
+  auto tuning_table_or = TuningTable::LoadFile(tuning_file);
+  if (tuning_table_or.ok()) {
+    tuning_table = std::move(tuning_table_or).ValueOrDie();
+  } else if (!IsNotFound(tuning_table_or.status())) {
+    return tuning_table_or.status();
+  }
+
+  for (const auto& tunable_executable : tunable_executables) {
+    std::vector<std::string> variant_names = {kDefaultSpecializationVariant};
+    variant_names.insert(variant_names.end(),
+                         tunable_executable.variant_names.begin(),
+                         tunable_executable.variant_names.end());
+    std::string best_variant_name = kDefaultSpecializationVariant;
+    int64_t best_ns = std::numeric_limits<int64_t>::max();
+    for (const auto& variant_name : variant_names) {
+      TuningTable candidate_table = tuning_table;
+      candidate_table.Set(device, tunable_executable.tag, variant_name);
+      ASSIGN_OR_RETURN(int64_t total_ns,
+                       TimeTunedModule(shared, file_mapping->data(),
+                                       candidate_table),
+                       _ << "Timing variant '" << variant_name << "' of '"
+                         << tunable_executable.tag << "'");
+      std::cerr << tunable_executable.tag << " " << variant_name << ": "
+                << total_ns / 1e3 << "us\n";
+      if (total_ns < best_ns) {
+        best_ns = total_ns;
+        best_variant_name = variant_name;
+      }
+    }
+    std::cerr << "Selected " << best_variant_name << " for "
+              << tunable_executable.tag << "\n";
+    tuning_table.Set(device, tunable_executable.tag, best_variant_name);
+  }
+  return tuning_table.SaveFile(tuning_file);
+}
+
+// Converts |time| in |unit| to nanoseconds.
+double ToNanoseconds(double time, ::benchmark::TimeUnit unit) {
+  switch (unit) {
+    case ::benchmark::kMillisecond:
+      return time * 1e6;
+    case ::benchmark::kMicrosecond:
+      return time * 1e3;
+    case ::benchmark::kNanosecond:
+    default:
+      return time;
+  }
+}
+
+// Console reporter that also records the real time of every completed run so
+// it can be compared against a baseline once all benchmarks have finished.
+class RecordingReporter : public ::benchmark::ConsoleReporter {
+ public:
+  void ReportRuns(const std::vector<Run>& runs) override {
+    for (const auto& run : runs) {
+      if (run.error_occurred) continue;
+      real_time_ns_[run.benchmark_name()] =
+          ToNanoseconds(run.GetAdjustedRealTime(), run.time_unit);
+    }
+    ::benchmark::ConsoleReporter::ReportRuns(runs);
+  }
+
+  const std::map<std::string, double>& real_time_ns() const {
+    return real_time_ns_;
+  }
+
+ private:
+  std::map<std::string, double> real_time_ns_;
+};
+
+// Parses the real times (in nanoseconds) of all benchmark iterations in a
+// JSON file written by the benchmark library's JSON reporter. Aggregates such
+// as means and medians of repetitions are skipped.
+StatusOr<std::map<std::string, double>> ParseBaselineFile(
+    const std::string& path) {
+  ASSIGN_OR_RETURN(auto contents, file_io::GetFileContents(path));
+  auto json_or = llvm::json::parse(contents);
+  if (!json_or) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "Baseline '" << path
+           << "' is not valid JSON: " << llvm::toString(json_or.takeError());
+  }
+  const llvm::json::Object* root = json_or->getAsObject();
+  const llvm::json::Array* benchmarks =
+      root ? root->getArray("benchmarks") : nullptr;
+  if (!benchmarks) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "Baseline '" << path << "' has no benchmarks array";
+  }
+
+  std::map<std::string, double> real_time_ns;
+  for (const auto& value : *benchmarks) {
+    const llvm::json::Object* benchmark = value.getAsObject();
+    if (!benchmark) continue;
+    if (benchmark->getString("run_type").getValueOr("iteration") ==
+        "aggregate") {
+      continue;
+    }
+    auto name = benchmark->getString("name");
+    auto real_time = benchmark->getNumber("real_time");
+    if (!name || !real_time) continue;
+    auto unit = benchmark->getString("time_unit").getValueOr("ns");
+    ::benchmark::TimeUnit time_unit = ::benchmark::kNanosecond;
+    if (unit == "us") {
+      time_unit = ::benchmark::kMicrosecond;
+    } else if (unit == "ms") {
+      time_unit = ::benchmark::kMillisecond;
+    }
+    real_time_ns[name->str()] = ToNanoseconds(*real_time, time_unit);
+  }
+  return real_time_ns;
 }
 
-// By default only the main thread is included in CPU time. Include all the
-// threads instead. To make single and multi-threaded benchmarks more
-// comparable, use the wall time to determine how many iterations to run.
-// See https://github.com/google/benchmark#cpu-timers,
-BENCHMARK(BM_RunModule)->MeasureProcessCPUTime()->UseRealTime();
+// Compares |results| against the baseline in |baseline_path| and fails if any
+// benchmark present in both regressed by more than |threshold|.
+Status CompareToBaseline(const std::map<std::string, double>& results,
+                         const std::string& baseline_path, double threshold) {
+  ASSIGN_OR_RETURN(auto baseline, ParseBaselineFile(baseline_path));
+  int regression_count = 0;
+  for (const auto& result : results) {
+    auto it = baseline.find(result.first);
+    if (it == baseline.end()) {
+      LOG(WARNING) << "No baseline for benchmark " << result.first;
+      continue;
+    }
+    double ratio = it->second > 0.0 ? result.second / it->second : 1.0;
+    if (ratio > 1.0 + threshold) {
+      ++regression_count;
+      std::cerr << "REGRESSION " << result.first << ": " << result.second
+                << "ns vs baseline " << it->second << "ns (+"
+                << (ratio - 1.0) * 100.0 << "%)\n";
+    }
+  }
+  if (regression_count > 0) {
+    return FailedPreconditionErrorBuilder(IREE_LOC)
+           << regression_count << " benchmark(s) regressed by more than "
+           << threshold * 100.0 << "% relative to " << baseline_path;
+  }
+  return OkStatus();
+}
 
 }  // namespace
 
+extern "C" int main(int argc, char** argv) {
+  // The benchmark library strips its own --benchmark_* flags so that the
+  // remaining flags can be handled by absl.
+  ::benchmark::Initialize(&argc, argv);
+  InitializeEnvironment(&argc, &argv);
+
+  SharedState shared;
+  CHECK_OK(LoadSharedState(&shared));
+  if (absl::GetFlag(FLAGS_autotune)) {
+    CHECK_OK(Autotune(shared));
+    CHECK_OK(ReleaseSharedState(&shared));
+    return 0;
+  }
+  if (absl::GetFlag(FLAGS_report_cold_start)) {
+    CHECK_OK(ReportColdStart(shared));
+  }
+  RegisterBenchmarks(&shared);
+  RecordingReporter reporter;
+  ::benchmark::RunSpecifiedBenchmarks(&reporter);
+  if (shared.profile) {
+    CHECK_OK(shared.profile->WriteFile(absl::GetFlag(FLAGS_profile)));
+  }
+  CHECK_OK(ReleaseSharedState(&shared));
+  std::string trace_file = absl::GetFlag(FLAGS_trace_file);
+  if (!trace_file.empty()) FlushTrace(absl::string_view(trace_file));
+
+  auto baseline_file = absl::GetFlag(FLAGS_baseline_file);
+  if (!baseline_file.empty()) {
+    auto status =
+        CompareToBaseline(reporter.real_time_ns(), baseline_file,
+                          absl::GetFlag(FLAGS_regression_threshold));
+    if (!status.ok()) {
+      std::cerr << "ERROR comparing to baseline: " << status << "\n";
+      return 1;
+    }
+  }
+  return 0;
+}
+
 }  // namespace iree
@@ -0,0 +1,83 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "iree/tools/cache_util.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <thread>  // NOLINT
+
+#include "absl/strings/str_cat.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/VCSRevision.h"
+
+namespace iree {
+
+std::string GetCompileCacheVersion() {
+#if defined(IREE_COMPILE_CACHE_VERSION)
+  return IREE_COMPILE_CACHE_VERSION;
+#else
+  std::string version = "llvm-" LLVM_VERSION_STRING;
+#if defined(LLVM_REVISION)
+  absl::StrAppend(&version, "-", LLVM_REVISION);
+#endif  // LLVM_REVISION
+  return version;
+#endif  // IREE_COMPILE_CACHE_VERSION
+}
+
+Status CreateDirectories(const std::string& path) {
+  for (size_t pos = path.find('/', 1);; pos = path.find('/', pos + 1)) {
+    std::string prefix = path.substr(0, pos);
+    if (::mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) {
+      return InternalErrorBuilder(IREE_LOC)
+             << "Unable to create directory '" << prefix << "'";
+    }
+    if (pos == std::string::npos) break;
+  }
+  return OkStatus();
+}
+
+Status WriteFileAtomically(const std::string& path,
+                           absl::string_view contents) {
+  std::string temp_path = absl::StrCat(
+      path, ".tmp.", ::getpid(), ".",
+      std::hash<std::thread::id>()(std::this_thread::get_id()));
+  {
+    std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+    file.write(contents.data(), contents.size());
+    // Closing flushes the last of the contents, which may still fail (such
+    // as when the disk is full).
+    file.close();
+    if (file.fail()) {
+      std::remove(temp_path.c_str());
+      return InternalErrorBuilder(IREE_LOC)
+             << "Unable to write '" << temp_path << "'";
+    }
+  }
+  if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+    std::remove(temp_path.c_str());
+    return InternalErrorBuilder(IREE_LOC)
+           << "Unable to move '" << temp_path << "' into place at '" << path
+           << "'";
+  }
+  return OkStatus();
+}
+
+}  // namespace iree
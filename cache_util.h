@@ -0,0 +1,42 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef IREE_TOOLS_CACHE_UTIL_H_
+#define IREE_TOOLS_CACHE_UTIL_H_
+
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "iree/base/status.h"
+
+namespace iree {
+
+// Returns the version of the compiler mixed into all cache keys so that
+// entries produced by a different compiler are never returned. Build systems
+// may define IREE_COMPILE_CACHE_VERSION to the IREE source revision; otherwise
+// the version and revision of LLVM the compiler was built against are used.
+std::string GetCompileCacheVersion();
+
+// Creates |path| and any missing parent directories.
+Status CreateDirectories(const std::string& path);
+
+// Writes |contents| to a unique temporary file next to |path| and renames it
+// into place so that concurrent readers never observe partially written
+// files.
+Status WriteFileAtomically(const std::string& path,
+                           absl::string_view contents);
+
+}  // namespace iree
+
+#endif  // IREE_TOOLS_CACHE_UTIL_H_
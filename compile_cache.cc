@@ -0,0 +1,175 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "iree/tools/compile_cache.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <utime.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "iree/tools/cache_util.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/SHA1.h"
+
+namespace iree {
+
+namespace {
+
+constexpr char kEntryExtension[] = ".module";
+
+// Adds a length-prefixed |value| to |hasher| so that adjacent fields cannot
+// alias each other.
+void HashField(llvm::SHA1* hasher, absl::string_view value) {
+  std::string length_prefix = absl::StrCat(value.size(), ":");
+  hasher->update(length_prefix);
+  hasher->update(llvm::StringRef(value.data(), value.size()));
+}
+
+}  // namespace
+
+std::string ComputeCompileCacheKey(
+    absl::string_view input_ir,
+    const mlir::iree_compiler::IREE::VM::BytecodeTargetOptions& options,
+    absl::Span<const std::string> target_backends, absl::string_view extra) {
+  llvm::SHA1 hasher;
+  HashField(&hasher, GetCompileCacheVersion());
+  HashField(&hasher, input_ir);
+  HashField(&hasher,
+            absl::StrCat(static_cast<int>(options.outputFormat), ",",
+                         options.optimize, ",", options.stripDebugOps, ",",
+                         options.stripSourceMap, ",", options.stripSymbols));
+  for (const auto& target_backend : target_backends) {
+    HashField(&hasher, target_backend);
+  }
+  HashField(&hasher, extra);
+  return llvm::toHex(hasher.final(), /*LowerCase=*/true);
+}
+
+std::vector<std::string> GetUnkeyedCompilerOptions() {
+  std::vector<std::string> names;
+  for (const auto& entry : llvm::cl::getRegisteredOptions()) {
+    llvm::StringRef name = entry.getKey();
+    if (!name.startswith("iree-") ||
+        entry.getValue()->getNumOccurrences() == 0) {
+      continue;
+    }
+    // The target backend and the bytecode options are part of the key.
+    if (name == "iree-hal-target-backends" ||
+        name.startswith("iree-vm-bytecode-module-")) {
+      continue;
+    }
+    names.push_back(name.str());
+  }
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+// static
+StatusOr<std::unique_ptr<CompileCache>> CompileCache::Open(
+    std::string directory, uint64_t max_size_bytes) {
+  RETURN_IF_ERROR(CreateDirectories(directory))
+      << "Opening compile cache '" << directory << "'";
+  return std::unique_ptr<CompileCache>(
+      new CompileCache(std::move(directory), max_size_bytes));
+}
+
+std::string CompileCache::EntryPath(const std::string& key) const {
+  return absl::StrCat(directory_, "/", key, kEntryExtension);
+}
+
+StatusOr<ref_ptr<FileMapping>> CompileCache::Lookup(const std::string& key) {
+  std::string path = EntryPath(key);
+  struct stat entry_stat;
+  if (::stat(path.c_str(), &entry_stat) != 0) {
+    absl::MutexLock lock(&mutex_);
+    ++stats_.misses;
+    return NotFoundErrorBuilder(IREE_LOC) << "No cache entry for " << key;
+  }
+  auto file_mapping_or = FileMapping::OpenRead(path);
+  absl::MutexLock lock(&mutex_);
+  if (!file_mapping_or.ok()) {
+    // Treat unreadable entries (such as ones evicted by another process) as
+    // misses.
+    ++stats_.misses;
+    return NotFoundErrorBuilder(IREE_LOC) << "No cache entry for " << key;
+  }
+  ++stats_.hits;
+  // Bump the modification time so that eviction is least-recently-used.
+  ::utime(path.c_str(), nullptr);
+  return std::move(file_mapping_or).ValueOrDie();
+}
+
+Status CompileCache::Store(const std::string& key,
+                           absl::string_view contents) {
+  // Readers never observe partially written entries.
+  RETURN_IF_ERROR(WriteFileAtomically(EntryPath(key), contents))
+      << "Storing compile cache entry " << key;
+  absl::MutexLock lock(&mutex_);
+  ++stats_.stores;
+  return EvictIfNeeded();
+}
+
+Status CompileCache::EvictIfNeeded() {
+  if (max_size_bytes_ == 0) return OkStatus();
+
+  struct Entry {
+    std::string path;
+    uint64_t size;
+    time_t mtime;
+  };
+  std::vector<Entry> entries;
+  uint64_t total_size = 0;
+  DIR* dir = ::opendir(directory_.c_str());
+  if (!dir) {
+    return InternalErrorBuilder(IREE_LOC)
+           << "Unable to list compile cache '" << directory_ << "'";
+  }
+  while (struct dirent* dir_entry = ::readdir(dir)) {
+    if (!absl::EndsWith(dir_entry->d_name, kEntryExtension)) continue;
+    std::string path = absl::StrCat(directory_, "/", dir_entry->d_name);
+    struct stat entry_stat;
+    if (::stat(path.c_str(), &entry_stat) != 0) continue;
+    entries.push_back({path, static_cast<uint64_t>(entry_stat.st_size),
+                       entry_stat.st_mtime});
+    total_size += entry_stat.st_size;
+  }
+  ::closedir(dir);
+
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry& a, const Entry& b) { return a.mtime < b.mtime; });
+  for (const auto& entry : entries) {
+    if (total_size <= max_size_bytes_) break;
+    // Mapped entries remain valid after unlinking on POSIX systems.
+    if (std::remove(entry.path.c_str()) == 0) {
+      total_size -= entry.size;
+      ++stats_.evictions;
+    }
+  }
+  return OkStatus();
+}
+
+CompileCache::Stats CompileCache::stats() const {
+  absl::MutexLock lock(&mutex_);
+  return stats_;
+}
+
+}  // namespace iree
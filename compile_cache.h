@@ -0,0 +1,93 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef IREE_TOOLS_COMPILE_CACHE_H_
+#define IREE_TOOLS_COMPILE_CACHE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
+#include "iree/base/file_mapping.h"
+#include "iree/base/ref_ptr.h"
+#include "iree/base/status.h"
+#include "iree/compiler/Dialect/VM/Target/Bytecode/BytecodeModuleTarget.h"
+#include "iree/tools/cache_util.h"
+
+namespace iree {
+
+// Returns a content-addressed cache key for compiling |input_ir| with the
+// given bytecode |options| for |target_backends|. |extra| may contain any
+// additional state that affects the result (such as tool flags).
+std::string ComputeCompileCacheKey(
+    absl::string_view input_ir,
+    const mlir::iree_compiler::IREE::VM::BytecodeTargetOptions& options,
+    absl::Span<const std::string> target_backends,
+    absl::string_view extra = "");
+
+// Returns the sorted names of the "iree-*" command line options that were set
+// explicitly but are not covered by ComputeCompileCacheKey, such as backend
+// target triples or target environments. Modules compiled while any of them
+// is set must not be looked up in or stored to the cache.
+std::vector<std::string> GetUnkeyedCompilerOptions();
+
+// On-disk cache of compiled modules keyed by ComputeCompileCacheKey.
+// Entries are written atomically so that a cache directory may be shared by
+// concurrent processes. When the total size of the entries exceeds the
+// configured maximum the least recently used entries are evicted.
+// Thread-safe.
+class CompileCache {
+ public:
+  struct Stats {
+    int64_t hits = 0;
+    int64_t misses = 0;
+    int64_t stores = 0;
+    int64_t evictions = 0;
+  };
+
+  // Opens (creating if needed) a cache in |directory|. A |max_size_bytes| of
+  // 0 disables eviction.
+  static StatusOr<std::unique_ptr<CompileCache>> Open(std::string directory,
+                                                      uint64_t max_size_bytes);
+
+  // Returns a read-only mapping of the entry for |key| or NotFound on a miss.
+  StatusOr<ref_ptr<FileMapping>> Lookup(const std::string& key);
+
+  // Stores |contents| for |key|, replacing any existing entry, and evicts
+  // entries as required to stay under the maximum size.
+  Status Store(const std::string& key, absl::string_view contents);
+
+  Stats stats() const;
+  const std::string& directory() const { return directory_; }
+
+ private:
+  CompileCache(std::string directory, uint64_t max_size_bytes)
+      : directory_(std::move(directory)), max_size_bytes_(max_size_bytes) {}
+
+  std::string EntryPath(const std::string& key) const;
+  Status EvictIfNeeded() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  const std::string directory_;
+  const uint64_t max_size_bytes_;
+  mutable absl::Mutex mutex_;
+  Stats stats_ ABSL_GUARDED_BY(mutex_);
+};
+
+}  // namespace iree
+
+#endif  // IREE_TOOLS_COMPILE_CACHE_H_
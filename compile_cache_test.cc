@@ -0,0 +1,81 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "iree/tools/compile_cache.h"
+
+#include <string>
+
+#include "iree/base/status_matchers.h"
+#include "iree/testing/gtest.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace iree {
+namespace {
+
+using mlir::iree_compiler::IREE::VM::BytecodeTargetOptions;
+
+TEST(CompileCacheTest, KeyDependsOnInputs) {
+  BytecodeTargetOptions options;
+  std::string key = ComputeCompileCacheKey("module {}", options, {"vmla"});
+  EXPECT_EQ(key, ComputeCompileCacheKey("module {}", options, {"vmla"}));
+  EXPECT_NE(key, ComputeCompileCacheKey("module { }", options, {"vmla"}));
+  EXPECT_NE(key, ComputeCompileCacheKey("module {}", options, {"vulkan"}));
+  options.stripSymbols = !options.stripSymbols;
+  EXPECT_NE(key, ComputeCompileCacheKey("module {}", options, {"vmla"}));
+}
+
+TEST(CompileCacheTest, ExplicitCompilerOptionsAreUnkeyed) {
+  static llvm::cl::opt<int> test_option{"iree-compile-cache-test-option",
+                                        llvm::cl::init(1)};
+  EXPECT_TRUE(GetUnkeyedCompilerOptions().empty());
+  const char* argv[] = {"compile_cache_test",
+                        "-iree-compile-cache-test-option=2"};
+  ASSERT_TRUE(llvm::cl::ParseCommandLineOptions(2, argv, "", &llvm::nulls()));
+  EXPECT_THAT(GetUnkeyedCompilerOptions(),
+              ::testing::ElementsAre("iree-compile-cache-test-option"));
+}
+
+TEST(CompileCacheTest, VersionIsNotEmpty) {
+  EXPECT_FALSE(GetCompileCacheVersion().empty());
+}
+
+TEST(CompileCacheTest, StoreLookup) {
+  ASSERT_OK_AND_ASSIGN(
+      auto cache,
+      CompileCache::Open(::testing::TempDir() + "/store_lookup_cache", 0));
+  EXPECT_TRUE(IsNotFound(cache->Lookup("missing").status()));
+  ASSERT_OK(cache->Store("entry", "contents"));
+  ASSERT_OK_AND_ASSIGN(auto mapping, cache->Lookup("entry"));
+  EXPECT_EQ(std::string(reinterpret_cast<const char*>(mapping->data().data()),
+                        mapping->data().size()),
+            "contents");
+  auto stats = cache->stats();
+  EXPECT_EQ(stats.hits, 1);
+  EXPECT_EQ(stats.misses, 1);
+  EXPECT_EQ(stats.stores, 1);
+}
+
+TEST(CompileCacheTest, EvictsToMaxSize) {
+  ASSERT_OK_AND_ASSIGN(
+      auto cache, CompileCache::Open(::testing::TempDir() + "/evict_cache", 8));
+  ASSERT_OK(cache->Store("first", "12345"));
+  ASSERT_OK(cache->Store("second", "67890"));
+  EXPECT_EQ(cache->stats().evictions, 1);
+  EXPECT_TRUE(IsNotFound(cache->Lookup("first").status()) ||
+              IsNotFound(cache->Lookup("second").status()));
+}
+
+}  // namespace
+}  // namespace iree
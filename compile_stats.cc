@@ -0,0 +1,200 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "iree/tools/compile_stats.h"
+
+#include <sys/resource.h>
+
+#include <fstream>
+#include <memory>
+
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+#include "mlir/Pass/Pass.h"
+#include "mlir/Pass/PassInstrumentation.h"
+
+namespace iree {
+
+namespace {
+
+double MillisecondsSince(std::chrono::steady_clock::time_point start_time) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start_time)
+      .count();
+}
+
+// Forwards the time and memory of each pass run to a CompileStats.
+class CompileStatsInstrumentation : public mlir::PassInstrumentation {
+ public:
+  CompileStatsInstrumentation(CompileStats* compile_stats,
+                              absl::string_view pipeline)
+      : compile_stats_(compile_stats), pipeline_(pipeline) {}
+
+  void runBeforePass(mlir::Pass* pass, mlir::Operation* op) override {
+    if (IsAdaptor(pass)) return;
+    PassRun run;
+    run.start_time = std::chrono::steady_clock::now();
+    run.start_peak_memory_bytes = GetPeakResidentMemoryBytes();
+    absl::MutexLock lock(&mutex_);
+    active_runs_[{pass, op}] = run;
+  }
+
+  void runAfterPass(mlir::Pass* pass, mlir::Operation* op) override {
+    EndRun(pass, op);
+  }
+
+  void runAfterPassFailed(mlir::Pass* pass, mlir::Operation* op) override {
+    EndRun(pass, op);
+  }
+
+ private:
+  struct PassRun {
+    std::chrono::steady_clock::time_point start_time;
+    int64_t start_peak_memory_bytes = 0;
+  };
+
+  // Pass adaptors run nested pipelines whose passes are recorded directly, so
+  // they are skipped to avoid counting their passes twice.
+  static bool IsAdaptor(mlir::Pass* pass) {
+    return pass->getName().startswith("OpToOpPassAdaptor");
+  }
+
+  void EndRun(mlir::Pass* pass, mlir::Operation* op) {
+    if (IsAdaptor(pass)) return;
+    PassRun run;
+    {
+      absl::MutexLock lock(&mutex_);
+      auto it = active_runs_.find({pass, op});
+      if (it == active_runs_.end()) return;
+      run = it->second;
+      active_runs_.erase(it);
+    }
+    compile_stats_->Record(
+        pipeline_, absl::string_view(pass->getName().data(),
+                                     pass->getName().size()),
+        MillisecondsSince(run.start_time),
+        GetPeakResidentMemoryBytes() - run.start_peak_memory_bytes);
+  }
+
+  CompileStats* compile_stats_;
+  std::string pipeline_;
+  absl::Mutex mutex_;
+  absl::flat_hash_map<std::pair<mlir::Pass*, mlir::Operation*>, PassRun>
+      active_runs_ ABSL_GUARDED_BY(mutex_);
+};
+
+}  // namespace
+
+int64_t GetPeakResidentMemoryBytes() {
+  struct rusage usage;
+  if (::getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+  // Reported in bytes on macOS.
+  return static_cast<int64_t>(usage.ru_maxrss);
+#else
+  // Reported in kilobytes on Linux.
+  return static_cast<int64_t>(usage.ru_maxrss) * 1024;
+#endif  // __APPLE__
+}
+
+void CompileStats::Instrument(mlir::PassManager* pass_manager,
+                              absl::string_view pipeline) {
+  pass_manager->addInstrumentation(
+      std::make_unique<CompileStatsInstrumentation>(this, pipeline));
+}
+
+void CompileStats::Record(absl::string_view pipeline, absl::string_view name,
+                          double wall_time_ms,
+                          int64_t peak_memory_increase_bytes) {
+  absl::MutexLock lock(&mutex_);
+  auto key = std::make_pair(std::string(pipeline), std::string(name));
+  auto it = pass_indices_.find(key);
+  if (it == pass_indices_.end()) {
+    it = pass_indices_.emplace(key, pass_stats_.size()).first;
+    pass_stats_.emplace_back();
+    pass_stats_.back().pipeline = key.first;
+    pass_stats_.back().pass_name = key.second;
+  }
+  auto& pass_stats = pass_stats_[it->second];
+  ++pass_stats.run_count;
+  pass_stats.wall_time_ms += wall_time_ms;
+  pass_stats.peak_memory_increase_bytes += peak_memory_increase_bytes;
+}
+
+std::vector<CompileStats::PassStats> CompileStats::pass_stats() const {
+  absl::MutexLock lock(&mutex_);
+  return pass_stats_;
+}
+
+double CompileStats::total_wall_time_ms() const {
+  absl::MutexLock lock(&mutex_);
+  double total_wall_time_ms = 0;
+  for (const auto& pass_stats : pass_stats_) {
+    total_wall_time_ms += pass_stats.wall_time_ms;
+  }
+  return total_wall_time_ms;
+}
+
+std::string CompileStats::ToJson() const {
+  llvm::json::Array passes;
+  for (const auto& pass_stats : pass_stats()) {
+    passes.push_back(llvm::json::Object{
+        {"pipeline", pass_stats.pipeline},
+        {"pass", pass_stats.pass_name},
+        {"runs", pass_stats.run_count},
+        {"wall_time_ms", pass_stats.wall_time_ms},
+        {"peak_memory_increase_bytes", pass_stats.peak_memory_increase_bytes},
+    });
+  }
+  llvm::json::Value root = llvm::json::Object{
+      {"total_wall_time_ms", total_wall_time_ms()},
+      {"peak_memory_bytes", GetPeakResidentMemoryBytes()},
+      {"passes", std::move(passes)},
+  };
+  std::string json;
+  llvm::raw_string_ostream os(json);
+  os << llvm::formatv("{0:2}", root) << "\n";
+  return os.str();
+}
+
+Status CompileStats::WriteJsonFile(const std::string& path) const {
+  std::ofstream file(path, std::ios::trunc);
+  file << ToJson();
+  if (!file.good()) {
+    return InternalErrorBuilder(IREE_LOC)
+           << "Unable to write compile stats to '" << path << "'";
+  }
+  return OkStatus();
+}
+
+ScopedCompileStep::ScopedCompileStep(CompileStats* compile_stats,
+                                     absl::string_view pipeline,
+                                     absl::string_view name)
+    : compile_stats_(compile_stats) {
+  if (!compile_stats_) return;
+  pipeline_ = std::string(pipeline);
+  name_ = std::string(name);
+  start_time_ = std::chrono::steady_clock::now();
+  start_peak_memory_bytes_ = GetPeakResidentMemoryBytes();
+}
+
+ScopedCompileStep::~ScopedCompileStep() {
+  if (!compile_stats_) return;
+  compile_stats_->Record(
+      pipeline_, name_, MillisecondsSince(start_time_),
+      GetPeakResidentMemoryBytes() - start_peak_memory_bytes_);
+}
+
+}  // namespace iree
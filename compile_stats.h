@@ -0,0 +1,106 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef IREE_TOOLS_COMPILE_STATS_H_
+#define IREE_TOOLS_COMPILE_STATS_H_
+
+#include <chrono>  // NOLINT
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "iree/base/status.h"
+#include "mlir/Pass/PassManager.h"
+
+namespace iree {
+
+// Returns the peak resident memory of the process in bytes, or 0 if unknown.
+int64_t GetPeakResidentMemoryBytes();
+
+// Per-pass wall time and memory statistics collected from the pass managers
+// instrumented with Instrument(). Results are aggregated per pipeline and pass
+// name across all runs (such as one run per function for nested passes) and
+// reported in the order the passes first ran.
+// Thread-safe; nested passes may run concurrently.
+class CompileStats {
+ public:
+  struct PassStats {
+    // Label of the pipeline the pass ran in, such as "flow".
+    std::string pipeline;
+    std::string pass_name;
+    int64_t run_count = 0;
+    // Total wall time of all runs. Concurrent runs of nested passes are
+    // summed and may exceed the elapsed time of the pipeline.
+    double wall_time_ms = 0;
+    // Amount by which runs of the pass raised the peak resident memory of the
+    // process. Summed over all passes this is the peak attributable to the
+    // compiler. The peak is process-wide, so while other passes or pipelines
+    // run concurrently their allocations are attributed to whichever pass
+    // raised the peak.
+    int64_t peak_memory_increase_bytes = 0;
+  };
+
+  // Adds an instrumentation to |pass_manager| that records all passes it runs
+  // under |pipeline|. The pass manager must not outlive this object.
+  void Instrument(mlir::PassManager* pass_manager, absl::string_view pipeline);
+
+  // Records a compilation step that is not a pass, such as serialization.
+  void Record(absl::string_view pipeline, absl::string_view name,
+              double wall_time_ms, int64_t peak_memory_increase_bytes);
+
+  std::vector<PassStats> pass_stats() const;
+
+  // Sum of the wall time of all passes and steps.
+  double total_wall_time_ms() const;
+
+  // Returns the statistics as a JSON object of the form:
+  //   {"total_wall_time_ms": ..., "peak_memory_bytes": ...,
+  //    "passes": [{"pipeline": ..., "pass": ..., "runs": ...,
+  //                "wall_time_ms": ..., "peak_memory_increase_bytes": ...}]}
+  std::string ToJson() const;
+
+  // Writes ToJson() to |path|.
+  Status WriteJsonFile(const std::string& path) const;
+
+ private:
+  mutable absl::Mutex mutex_;
+  std::vector<PassStats> pass_stats_ ABSL_GUARDED_BY(mutex_);
+  // Index into |pass_stats_| keyed by (pipeline, pass name).
+  absl::flat_hash_map<std::pair<std::string, std::string>, size_t>
+      pass_indices_ ABSL_GUARDED_BY(mutex_);
+};
+
+// Records the enclosing scope as a step named |name| in |compile_stats|, if
+// not null.
+class ScopedCompileStep {
+ public:
+  ScopedCompileStep(CompileStats* compile_stats, absl::string_view pipeline,
+                    absl::string_view name);
+  ~ScopedCompileStep();
+
+ private:
+  CompileStats* compile_stats_;
+  std::string pipeline_;
+  std::string name_;
+  std::chrono::steady_clock::time_point start_time_;
+  int64_t start_peak_memory_bytes_ = 0;
+};
+
+}  // namespace iree
+
+#endif  // IREE_TOOLS_COMPILE_STATS_H_
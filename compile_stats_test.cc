@@ -0,0 +1,54 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "iree/tools/compile_stats.h"
+
+#include <string>
+
+#include "iree/testing/gtest.h"
+
+namespace iree {
+namespace {
+
+TEST(CompileStatsTest, AggregatesRuns) {
+  CompileStats compile_stats;
+  compile_stats.Record("flow", "Canonicalizer", 1.0, 0);
+  compile_stats.Record("flow", "CSE", 2.0, 1024);
+  compile_stats.Record("flow", "Canonicalizer", 3.0, 0);
+  compile_stats.Record("vmla", "Canonicalizer", 4.0, 0);
+
+  auto pass_stats = compile_stats.pass_stats();
+  ASSERT_EQ(pass_stats.size(), 3);
+  EXPECT_EQ(pass_stats[0].pipeline, "flow");
+  EXPECT_EQ(pass_stats[0].pass_name, "Canonicalizer");
+  EXPECT_EQ(pass_stats[0].run_count, 2);
+  EXPECT_DOUBLE_EQ(pass_stats[0].wall_time_ms, 4.0);
+  EXPECT_EQ(pass_stats[1].pass_name, "CSE");
+  EXPECT_EQ(pass_stats[1].peak_memory_increase_bytes, 1024);
+  EXPECT_EQ(pass_stats[2].pipeline, "vmla");
+  EXPECT_DOUBLE_EQ(compile_stats.total_wall_time_ms(), 10.0);
+}
+
+TEST(CompileStatsTest, ToJson) {
+  CompileStats compile_stats;
+  { ScopedCompileStep step(&compile_stats, "vm", "serialize"); }
+  std::string json = compile_stats.ToJson();
+  EXPECT_NE(json.find("\"pipeline\": \"vm\""), std::string::npos);
+  EXPECT_NE(json.find("\"pass\": \"serialize\""), std::string::npos);
+  EXPECT_NE(json.find("\"runs\": 1"), std::string::npos);
+  EXPECT_NE(json.find("\"peak_memory_bytes\""), std::string::npos);
+}
+
+}  // namespace
+}  // namespace iree
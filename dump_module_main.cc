@@ -16,13 +16,23 @@
 #include <string>
 #include <utility>
 
+#include "absl/flags/flag.h"
 #include "flatbuffers/flatbuffers.h"
 #include "flatbuffers/minireflect.h"
 #include "flatbuffers/reflection.h"
 #include "flatbuffers/util.h"
+#include "iree/base/file_mapping.h"
 #include "iree/base/flatbuffer_util.h"
 #include "iree/base/init.h"
 #include "iree/schemas/bytecode_module_def_generated.h"
+#include "iree/tools/module_stats.h"
+
+ABSL_FLAG(bool, stats, false,
+          "Prints structural statistics (function bytecode sizes, register "
+          "counts, rodata segments and import/export counts) instead of the "
+          "full contents of the module.");
+ABSL_FLAG(std::string, stats_format, "table",
+          "Format of the --stats output: 'table' or 'json'.");
 
 namespace {
 
@@ -162,10 +172,29 @@ extern "C" int main(int argc, char** argv) {
   iree::InitializeEnvironment(&argc, &argv);
 
   if (argc < 2) {
-    std::cerr << "Syntax: iree-dump-module filename\n";
+    std::cerr << "Syntax: iree-dump-module [--stats] filename\n";
     return 1;
   }
   std::string module_path = argv[1];
+
+  // Statistics only read table headers and vector sizes, so the module is
+  // mapped rather than loaded and nothing is stringified.
+  if (absl::GetFlag(FLAGS_stats)) {
+    auto file_mapping = iree::FileMapping::OpenRead(module_path).ValueOrDie();
+    auto module_stats =
+        iree::ComputeModuleStats(file_mapping->data()).ValueOrDie();
+    std::string format = absl::GetFlag(FLAGS_stats_format);
+    if (format == "json") {
+      std::cout << iree::ModuleStatsToJson(module_stats);
+    } else if (format == "table") {
+      std::cout << iree::ModuleStatsToTable(module_stats);
+    } else {
+      std::cerr << "Unknown --stats_format '" << format << "'\n";
+      return 1;
+    }
+    return 0;
+  }
+
   auto module_fb = iree::FlatBufferFile<iree::vm::BytecodeModuleDef>::LoadFile(
                        iree::vm::BytecodeModuleDefIdentifier(), module_path)
                        .ValueOrDie();
@@ -0,0 +1,193 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "iree/tools/execution_profile.h"
+
+#include <algorithm>
+#include <fstream>
+#include <utility>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "flatbuffers/util.h"
+
+namespace iree {
+
+namespace {
+
+std::atomic<uint64_t> next_profile_id{1};
+
+std::string JsonString(absl::string_view value) {
+  std::string json;
+  flatbuffers::EscapeString(value.data(), value.size(), &json,
+                            /*allow_non_utf8=*/true, /*natural_utf8=*/false);
+  return json;
+}
+
+}  // namespace
+
+ExecutionProfile::ExecutionProfile() : id_(next_profile_id++) {}
+
+ExecutionProfile::~ExecutionProfile() = default;
+
+ExecutionProfile::ThreadState* ExecutionProfile::GetThreadState() {
+  struct CachedThreadState {
+    uint64_t profile_id = 0;
+    ThreadState* thread_state = nullptr;
+  };
+  thread_local CachedThreadState cached;
+  if (cached.profile_id == id_) return cached.thread_state;
+
+  absl::MutexLock lock(&mutex_);
+  auto& thread_state = thread_states_[std::this_thread::get_id()];
+  if (!thread_state) thread_state = absl::make_unique<ThreadState>();
+  cached.profile_id = id_;
+  cached.thread_state = thread_state.get();
+  return cached.thread_state;
+}
+
+size_t ExecutionProfile::InternFunction(absl::string_view name) {
+  absl::MutexLock lock(&mutex_);
+  auto it = function_indices_.find(name);
+  if (it == function_indices_.end()) {
+    it = function_indices_.emplace(std::string(name), function_names_.size())
+             .first;
+    function_names_.push_back(std::string(name));
+  }
+  return it->second;
+}
+
+void ExecutionProfile::EnterFunction(absl::string_view name) {
+  auto start_time = std::chrono::steady_clock::now();
+  auto* thread_state = GetThreadState();
+  auto it = thread_state->function_indices.find(name);
+  if (it == thread_state->function_indices.end()) {
+    it = thread_state->function_indices
+             .emplace(std::string(name), InternFunction(name))
+             .first;
+  }
+  size_t function_index = it->second;
+
+  StackNode* parent = thread_state->stack.empty()
+                          ? &thread_state->root
+                          : thread_state->stack.back().node;
+  auto& node = parent->children[function_index];
+  if (!node) {
+    auto new_node = absl::make_unique<StackNode>();
+    new_node->function_index = function_index;
+    new_node->parent = parent;
+    node = new_node.get();
+    absl::MutexLock lock(&thread_state->mutex);
+    thread_state->nodes.push_back(std::move(new_node));
+  }
+  thread_state->stack.push_back({node, start_time});
+}
+
+void ExecutionProfile::ExitFunction() {
+  auto end_time = std::chrono::steady_clock::now();
+  auto& stack = GetThreadState()->stack;
+  if (stack.empty()) return;
+
+  Frame frame = stack.back();
+  stack.pop_back();
+  int64_t inclusive_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             end_time - frame.start_time)
+                             .count();
+  int64_t exclusive_ns = std::max<int64_t>(inclusive_ns - frame.callee_ns, 0);
+  frame.node->call_count.fetch_add(1, std::memory_order_relaxed);
+  frame.node->inclusive_ns.fetch_add(inclusive_ns, std::memory_order_relaxed);
+  frame.node->exclusive_ns.fetch_add(exclusive_ns, std::memory_order_relaxed);
+  if (!stack.empty()) stack.back().callee_ns += inclusive_ns;
+}
+
+std::vector<ExecutionProfile::FunctionStats> ExecutionProfile::function_stats()
+    const {
+  absl::MutexLock lock(&mutex_);
+  std::vector<FunctionStats> function_stats(function_names_.size());
+  for (size_t i = 0; i < function_names_.size(); ++i) {
+    function_stats[i].name = function_names_[i];
+  }
+  for (const auto& thread_state : thread_states_) {
+    absl::MutexLock thread_lock(&thread_state.second->mutex);
+    for (const auto& node : thread_state.second->nodes) {
+      auto& stats = function_stats[node->function_index];
+      stats.call_count += node->call_count.load(std::memory_order_relaxed);
+      stats.inclusive_ns += node->inclusive_ns.load(std::memory_order_relaxed);
+      stats.exclusive_ns += node->exclusive_ns.load(std::memory_order_relaxed);
+    }
+  }
+  return function_stats;
+}
+
+std::string ExecutionProfile::ToJson() const {
+  std::string json = "{\n  \"functions\": [";
+  auto all_function_stats = function_stats();
+  for (size_t i = 0; i < all_function_stats.size(); ++i) {
+    const auto& function_stats = all_function_stats[i];
+    absl::StrAppend(&json, i ? ",\n" : "\n",
+                    "    {\"name\": ", JsonString(function_stats.name),
+                    ", \"calls\": ", function_stats.call_count,
+                    ", \"inclusive_ns\": ", function_stats.inclusive_ns,
+                    ", \"exclusive_ns\": ", function_stats.exclusive_ns, "}");
+  }
+  absl::StrAppend(&json, all_function_stats.empty() ? "]\n" : "\n  ]\n");
+  json += "}\n";
+  return json;
+}
+
+std::string ExecutionProfile::ToCollapsedStacks() const {
+  // The same call stack on different threads is reported once.
+  absl::flat_hash_map<std::string, int64_t> stack_exclusive_ns;
+  {
+    absl::MutexLock lock(&mutex_);
+    for (const auto& thread_state : thread_states_) {
+      absl::MutexLock thread_lock(&thread_state.second->mutex);
+      for (const auto& node : thread_state.second->nodes) {
+        if (!node->call_count.load(std::memory_order_relaxed)) continue;
+        // Keys are only built here, outermost function first.
+        std::vector<absl::string_view> names;
+        for (const auto* frame = node.get(); frame->parent;
+             frame = frame->parent) {
+          names.push_back(function_names_[frame->function_index]);
+        }
+        std::reverse(names.begin(), names.end());
+        stack_exclusive_ns[absl::StrJoin(names, ";")] +=
+            node->exclusive_ns.load(std::memory_order_relaxed);
+      }
+    }
+  }
+  std::vector<std::pair<std::string, int64_t>> stacks(
+      stack_exclusive_ns.begin(), stack_exclusive_ns.end());
+  std::sort(stacks.begin(), stacks.end());
+  std::string collapsed_stacks;
+  for (const auto& stack : stacks) {
+    absl::StrAppend(&collapsed_stacks, stack.first, " ", stack.second / 1000,
+                    "\n");
+  }
+  return collapsed_stacks;
+}
+
+Status ExecutionProfile::WriteFile(const std::string& path) const {
+  std::ofstream file(path, std::ios::trunc);
+  file << (absl::EndsWith(path, ".json") ? ToJson() : ToCollapsedStacks());
+  if (!file.good()) {
+    return InternalErrorBuilder(IREE_LOC)
+           << "Unable to write profile to '" << path << "'";
+  }
+  return OkStatus();
+}
+
+}  // namespace iree
@@ -0,0 +1,139 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef IREE_TOOLS_EXECUTION_PROFILE_H_
+#define IREE_TOOLS_EXECUTION_PROFILE_H_
+
+#include <atomic>
+#include <chrono>  // NOLINT
+#include <cstdint>
+#include <string>
+#include <memory>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "iree/base/status.h"
+
+namespace iree {
+
+// Per-function call counts with inclusive and exclusive wall time of the
+// function scopes opened by the caller, such as the entry functions invoked by
+// the tools.
+// Function scopes nest per thread: the time spent in the functions called by
+// a function counts towards its inclusive but not its exclusive time.
+// Thread-safe. Each thread records into call stacks of its own, so entering
+// and exiting functions only takes a lock the first time a thread sees a
+// function or call stack.
+class ExecutionProfile {
+ public:
+  ExecutionProfile();
+  ~ExecutionProfile();
+
+  struct FunctionStats {
+    std::string name;
+    int64_t call_count = 0;
+    int64_t inclusive_ns = 0;
+    int64_t exclusive_ns = 0;
+  };
+
+  // Opens a scope for a call of the function |name| on the calling thread.
+  void EnterFunction(absl::string_view name);
+  // Closes the innermost scope opened on the calling thread.
+  void ExitFunction();
+
+  // Functions in the order they were first called.
+  std::vector<FunctionStats> function_stats() const;
+
+  // Returns the profile as a JSON object of the form:
+  //   {"functions": [{"name": ..., "calls": ..., "inclusive_ns": ...,
+  //                   "exclusive_ns": ...}]}
+  std::string ToJson() const;
+
+  // Returns the exclusive time of each call stack in microseconds in the
+  // collapsed stack format read by flamegraph tools:
+  //   outer;inner 1234
+  std::string ToCollapsedStacks() const;
+
+  // Writes ToJson() to |path| if it ends with ".json" and
+  // ToCollapsedStacks() otherwise.
+  Status WriteFile(const std::string& path) const;
+
+ private:
+  // A call stack of one thread, interned as the call of |function_index| from
+  // the |parent| stack. The root stack of each thread has no parent.
+  struct StackNode {
+    size_t function_index = 0;
+    const StackNode* parent = nullptr;
+    std::atomic<int64_t> call_count{0};
+    std::atomic<int64_t> inclusive_ns{0};
+    std::atomic<int64_t> exclusive_ns{0};
+    // Calls made from this stack keyed by function index. Only used by the
+    // owning thread.
+    absl::flat_hash_map<size_t, StackNode*> children;
+  };
+
+  struct Frame {
+    StackNode* node;
+    std::chrono::steady_clock::time_point start_time;
+    // Inclusive time of the calls made from this frame.
+    int64_t callee_ns = 0;
+  };
+
+  struct ThreadState {
+    StackNode root;
+    // Open scopes, innermost last. Only used by the owning thread.
+    std::vector<Frame> stack;
+    // Cache of the global function indices. Only used by the owning thread.
+    absl::flat_hash_map<std::string, size_t> function_indices;
+    // Guards |nodes| against readers; only taken to add a node.
+    mutable absl::Mutex mutex;
+    std::vector<std::unique_ptr<StackNode>> nodes ABSL_GUARDED_BY(mutex);
+  };
+
+  // Returns the state of the calling thread, registering it on first use.
+  ThreadState* GetThreadState();
+  size_t InternFunction(absl::string_view name);
+
+  // Distinguishes profiles in the per-thread state cache even when one is
+  // allocated at the address of a destroyed one.
+  const uint64_t id_;
+  mutable absl::Mutex mutex_;
+  std::vector<std::string> function_names_ ABSL_GUARDED_BY(mutex_);
+  absl::flat_hash_map<std::string, size_t> function_indices_
+      ABSL_GUARDED_BY(mutex_);
+  absl::flat_hash_map<std::thread::id, std::unique_ptr<ThreadState>>
+      thread_states_ ABSL_GUARDED_BY(mutex_);
+};
+
+// Records the enclosing scope as a call of |name| in |profile|, if not null.
+class ScopedProfileFunction {
+ public:
+  ScopedProfileFunction(ExecutionProfile* profile, absl::string_view name)
+      : profile_(profile) {
+    if (profile_) profile_->EnterFunction(name);
+  }
+  ~ScopedProfileFunction() {
+    if (profile_) profile_->ExitFunction();
+  }
+
+ private:
+  ExecutionProfile* profile_;
+};
+
+}  // namespace iree
+
+#endif  // IREE_TOOLS_EXECUTION_PROFILE_H_
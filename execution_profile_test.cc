@@ -0,0 +1,86 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "iree/tools/execution_profile.h"
+
+#include <string>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "iree/testing/gtest.h"
+
+namespace iree {
+namespace {
+
+TEST(ExecutionProfileTest, NestedFunctions) {
+  ExecutionProfile profile;
+  {
+    ScopedProfileFunction outer(&profile, "outer");
+    for (int i = 0; i < 2; ++i) {
+      ScopedProfileFunction inner(&profile, "inner");
+    }
+  }
+
+  auto function_stats = profile.function_stats();
+  ASSERT_EQ(function_stats.size(), 2);
+  EXPECT_EQ(function_stats[0].name, "outer");
+  EXPECT_EQ(function_stats[0].call_count, 1);
+  EXPECT_EQ(function_stats[1].name, "inner");
+  EXPECT_EQ(function_stats[1].call_count, 2);
+  EXPECT_GE(function_stats[0].inclusive_ns, function_stats[1].inclusive_ns);
+  EXPECT_LE(function_stats[0].exclusive_ns, function_stats[0].inclusive_ns);
+
+  std::string collapsed_stacks = profile.ToCollapsedStacks();
+  EXPECT_NE(collapsed_stacks.find("outer;inner "), std::string::npos);
+  EXPECT_NE(collapsed_stacks.find("outer "), std::string::npos);
+}
+
+TEST(ExecutionProfileTest, ConcurrentThreads) {
+  ExecutionProfile profile;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&profile]() {
+      for (int j = 0; j < 100; ++j) {
+        ScopedProfileFunction outer(&profile, "outer");
+        ScopedProfileFunction inner(&profile, "inner");
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  auto function_stats = profile.function_stats();
+  ASSERT_EQ(function_stats.size(), 2);
+  EXPECT_EQ(function_stats[0].call_count, 400);
+  EXPECT_EQ(function_stats[1].call_count, 400);
+
+  // Stacks of all threads are merged.
+  std::string collapsed_stacks = profile.ToCollapsedStacks();
+  EXPECT_EQ(collapsed_stacks.find("outer;inner "),
+            collapsed_stacks.rfind("outer;inner "));
+}
+
+TEST(ExecutionProfileTest, Json) {
+  ExecutionProfile profile;
+  EXPECT_EQ(profile.ToJson(), "{\n  \"functions\": []\n}\n");
+  {
+    ScopedProfileFunction outer(&profile, "outer");
+  }
+  EXPECT_NE(profile.ToJson().find("{\"name\": \"outer\", \"calls\": 1, "),
+            std::string::npos);
+}
+
+}  // namespace
+}  // namespace iree
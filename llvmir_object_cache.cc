@@ -0,0 +1,198 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "iree/tools/llvmir_object_cache.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/strip.h"
+#include "iree/base/file_io.h"
+#include "iree/base/logging.h"
+#include "iree/tools/cache_util.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/SHA1.h"
+
+namespace iree {
+
+namespace {
+
+constexpr char kEntryExtension[] = ".o";
+
+absl::string_view ToStringView(const flatbuffers::String* value) {
+  return value ? absl::string_view(value->c_str(), value->size())
+               : absl::string_view();
+}
+
+// Returns the number of features |object_def| requires.
+int RequiredFeatureCount(const LLVMIRObjectDef& object_def) {
+  int count = 0;
+  for (absl::string_view feature : absl::StrSplit(
+           ToStringView(object_def.cpu_features()), ',', absl::SkipEmpty())) {
+    if (absl::StartsWith(feature, "+")) ++count;
+  }
+  return count;
+}
+
+// Adds a length-prefixed |value| to |hasher| so that adjacent fields cannot
+// alias each other.
+void HashField(llvm::SHA1* hasher, absl::string_view value) {
+  std::string length_prefix = absl::StrCat(value.size(), ":");
+  hasher->update(length_prefix);
+  hasher->update(llvm::StringRef(value.data(), value.size()));
+}
+
+}  // namespace
+
+HostCpuInfo GetHostCpuInfo() {
+  HostCpuInfo host;
+  host.target_triple = llvm::Triple::normalize(llvm::sys::getProcessTriple());
+  host.cpu = llvm::sys::getHostCPUName().str();
+  llvm::StringMap<bool> host_features;
+  if (llvm::sys::getHostCPUFeatures(host_features)) {
+    for (const auto& feature : host_features) {
+      if (feature.getValue()) host.features.push_back(feature.getKey().str());
+    }
+  }
+  std::sort(host.features.begin(), host.features.end());
+  return host;
+}
+
+bool LLVMIRObjectMatchesHost(const LLVMIRObjectDef& object_def,
+                             const HostCpuInfo& host) {
+  if (!object_def.object() || !object_def.target_triple() ||
+      llvm::Triple::normalize(object_def.target_triple()->str()) !=
+          host.target_triple) {
+    return false;
+  }
+  absl::string_view cpu = ToStringView(object_def.cpu());
+  if (!cpu.empty() && cpu != host.cpu) return false;
+  for (absl::string_view feature : absl::StrSplit(
+           ToStringView(object_def.cpu_features()), ',', absl::SkipEmpty())) {
+    if (!absl::ConsumePrefix(&feature, "+")) continue;
+    if (!std::binary_search(host.features.begin(), host.features.end(),
+                            feature)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+const LLVMIRObjectDef* FindPrecompiledObject(
+    const LLVMIRExecutableDef& executable_def, const HostCpuInfo& host) {
+  if (!executable_def.objects()) return nullptr;
+  const LLVMIRObjectDef* best_object_def = nullptr;
+  auto specificity = [](const LLVMIRObjectDef& object_def) {
+    return std::make_pair(!ToStringView(object_def.cpu()).empty(),
+                          RequiredFeatureCount(object_def));
+  };
+  for (const auto* object_def : *executable_def.objects()) {
+    if (!LLVMIRObjectMatchesHost(*object_def, host)) continue;
+    if (!best_object_def ||
+        specificity(*object_def) > specificity(*best_object_def)) {
+      best_object_def = object_def;
+    }
+  }
+  return best_object_def;
+}
+
+std::string ComputeLLVMIRObjectCacheKey(absl::string_view llvmir_module,
+                                        const HostCpuInfo& host,
+                                        absl::string_view codegen_options) {
+  llvm::SHA1 hasher;
+  HashField(&hasher, GetCompileCacheVersion());
+  HashField(&hasher, codegen_options);
+  HashField(&hasher, llvmir_module);
+  HashField(&hasher, host.target_triple);
+  HashField(&hasher, host.cpu);
+  HashField(&hasher, absl::StrJoin(host.features, ","));
+  return llvm::toHex(hasher.final(), /*LowerCase=*/true);
+}
+
+// static
+StatusOr<std::unique_ptr<LLVMIRObjectCache>> LLVMIRObjectCache::Open(
+    std::string directory) {
+  RETURN_IF_ERROR(CreateDirectories(directory))
+      << "Opening LLVMIR object cache '" << directory << "'";
+  return std::unique_ptr<LLVMIRObjectCache>(
+      new LLVMIRObjectCache(std::move(directory)));
+}
+
+std::string LLVMIRObjectCache::EntryPath(const std::string& key) const {
+  return absl::StrCat(directory_, "/", key, kEntryExtension);
+}
+
+StatusOr<std::string> LLVMIRObjectCache::Lookup(const std::string& key) const {
+  auto contents_or = file_io::GetFileContents(EntryPath(key));
+  if (!contents_or.ok()) {
+    return NotFoundErrorBuilder(IREE_LOC) << "No cached object for " << key;
+  }
+  return std::move(contents_or).ValueOrDie();
+}
+
+Status LLVMIRObjectCache::Store(const std::string& key,
+                                absl::string_view object) {
+  // Readers never observe partially written entries.
+  RETURN_IF_ERROR(WriteFileAtomically(EntryPath(key), object))
+      << "Storing cached object " << key;
+  return OkStatus();
+}
+
+StatusOr<std::string> ResolveLLVMIRObject(
+    const LLVMIRExecutableDef& executable_def, const HostCpuInfo& host,
+    LLVMIRObjectCache* cache, const LLVMIRCompileFn& compile,
+    absl::string_view codegen_options, LLVMIRObjectSource* out_source) {
+  if (const auto* object_def = FindPrecompiledObject(executable_def, host)) {
+    if (out_source) *out_source = LLVMIRObjectSource::kPrecompiled;
+    return std::string(
+        reinterpret_cast<const char*>(object_def->object()->data()),
+        object_def->object()->size());
+  }
+
+  if (!executable_def.llvmir_module()) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "Executable has no LLVMIR module and no precompiled object for "
+           << host.target_triple << " (" << host.cpu << ")";
+  }
+  absl::string_view llvmir_module(
+      reinterpret_cast<const char*>(executable_def.llvmir_module()->data()),
+      executable_def.llvmir_module()->size());
+  std::string key;
+  if (cache) {
+    key = ComputeLLVMIRObjectCacheKey(llvmir_module, host, codegen_options);
+    auto object_or = cache->Lookup(key);
+    if (object_or.ok()) {
+      if (out_source) *out_source = LLVMIRObjectSource::kCached;
+      return object_or;
+    }
+  }
+
+  ASSIGN_OR_RETURN(auto object, compile(llvmir_module, host));
+  if (cache) {
+    // Failing to populate the cache only costs later processes a compile.
+    auto status = cache->Store(key, object);
+    if (!status.ok()) LOG(WARNING) << status;
+  }
+  if (out_source) *out_source = LLVMIRObjectSource::kCompiled;
+  return object;
+}
+
+}  // namespace iree
@@ -0,0 +1,120 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef IREE_TOOLS_LLVMIR_OBJECT_CACHE_H_
+#define IREE_TOOLS_LLVMIR_OBJECT_CACHE_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "iree/base/status.h"
+#include "iree/schemas/llvmir_executable_def_generated.h"
+
+namespace iree {
+
+// Target the native code for an LLVMIRExecutableDef is generated for.
+struct HostCpuInfo {
+  // Normalized target triple, such as 'x86_64-unknown-linux-gnu'.
+  std::string target_triple;
+  // CPU name, such as 'skylake'.
+  std::string cpu;
+  // Names of the enabled LLVM target features without their '+' prefix, in
+  // sorted order.
+  std::vector<std::string> features;
+};
+
+// Returns the target of the process as detected by LLVM.
+HostCpuInfo GetHostCpuInfo();
+
+// Returns true if |object_def| can run on |host|: the triples match, its CPU
+// is either unspecified or the host CPU, and the host has all of its required
+// features.
+bool LLVMIRObjectMatchesHost(const LLVMIRObjectDef& object_def,
+                             const HostCpuInfo& host);
+
+// Returns the most specific precompiled object in |executable_def| that can
+// run on |host| or null if none can. Objects for the host CPU are preferred
+// over generic ones and then those requiring more features.
+const LLVMIRObjectDef* FindPrecompiledObject(
+    const LLVMIRExecutableDef& executable_def, const HostCpuInfo& host);
+
+// Returns a key naming the object code of |llvmir_module| compiled for |host|
+// with |codegen_options| by the compiler of GetCompileCacheVersion().
+// |codegen_options| may be any string that changes whenever the code
+// generated for the same module and host would, such as the optimization
+// level and code model.
+std::string ComputeLLVMIRObjectCacheKey(absl::string_view llvmir_module,
+                                        const HostCpuInfo& host,
+                                        absl::string_view codegen_options);
+
+// On-disk cache of object code compiled at load time, keyed by
+// ComputeLLVMIRObjectCacheKey. Entries are written atomically so that a cache
+// directory may be shared by concurrent processes.
+// Thread-safe.
+class LLVMIRObjectCache {
+ public:
+  // Opens (creating if needed) a cache in |directory|.
+  static StatusOr<std::unique_ptr<LLVMIRObjectCache>> Open(
+      std::string directory);
+
+  // Returns the object stored for |key| or NotFound on a miss.
+  StatusOr<std::string> Lookup(const std::string& key) const;
+
+  // Stores |object| for |key|, replacing any existing entry.
+  Status Store(const std::string& key, absl::string_view object);
+
+  const std::string& directory() const { return directory_; }
+
+ private:
+  explicit LLVMIRObjectCache(std::string directory)
+      : directory_(std::move(directory)) {}
+
+  std::string EntryPath(const std::string& key) const;
+
+  const std::string directory_;
+};
+
+// Where the object returned by ResolveLLVMIRObject came from.
+enum class LLVMIRObjectSource {
+  // An ahead-of-time compiled object embedded in the executable.
+  kPrecompiled,
+  // An object compiled by an earlier process and stored in the cache.
+  kCached,
+  // An object compiled by |compile| in this call.
+  kCompiled,
+};
+
+// Compiles |llvmir_module| to a relocatable object for |host|.
+using LLVMIRCompileFn = std::function<StatusOr<std::string>(
+    absl::string_view llvmir_module, const HostCpuInfo& host)>;
+
+// Returns native object code for |executable_def| on |host|. A matching
+// precompiled object is used when there is one. Otherwise the object is read
+// from |cache|, if not null, or produced by |compile| and then stored in
+// |cache| for later processes. |codegen_options| describes the options
+// |compile| generates code with (see ComputeLLVMIRObjectCacheKey).
+// |out_source|, if not null, receives where the object came from.
+StatusOr<std::string> ResolveLLVMIRObject(
+    const LLVMIRExecutableDef& executable_def, const HostCpuInfo& host,
+    LLVMIRObjectCache* cache, const LLVMIRCompileFn& compile,
+    absl::string_view codegen_options,
+    LLVMIRObjectSource* out_source = nullptr);
+
+}  // namespace iree
+
+#endif  // IREE_TOOLS_LLVMIR_OBJECT_CACHE_H_
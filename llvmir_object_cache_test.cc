@@ -0,0 +1,137 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "iree/tools/llvmir_object_cache.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "flatbuffers/flatbuffers.h"
+#include "iree/base/status_matchers.h"
+#include "iree/testing/gtest.h"
+
+namespace iree {
+namespace {
+
+HostCpuInfo TestHost() {
+  HostCpuInfo host;
+  host.target_triple = "x86_64-unknown-linux-gnu";
+  host.cpu = "skylake";
+  host.features = {"avx", "avx2", "fma", "sse4.2"};
+  return host;
+}
+
+void AddObject(LLVMIRExecutableDefT* executable_def, std::string target_triple,
+               std::string cpu, std::string cpu_features,
+               absl::string_view object) {
+  auto object_def = absl::make_unique<LLVMIRObjectDefT>();
+  object_def->target_triple = std::move(target_triple);
+  object_def->cpu = std::move(cpu);
+  object_def->cpu_features = std::move(cpu_features);
+  object_def->object.assign(object.begin(), object.end());
+  executable_def->objects.push_back(std::move(object_def));
+}
+
+// Packs |executable_def| into |fbb| and returns the packed table.
+const LLVMIRExecutableDef* Pack(const LLVMIRExecutableDefT& executable_def,
+                                flatbuffers::FlatBufferBuilder* fbb) {
+  fbb->Finish(LLVMIRExecutableDef::Pack(*fbb, &executable_def),
+              LLVMIRExecutableDefIdentifier());
+  return GetLLVMIRExecutableDef(fbb->GetBufferPointer());
+}
+
+TEST(LLVMIRObjectCacheTest, SelectsMostSpecificObject) {
+  LLVMIRExecutableDefT executable_def;
+  AddObject(&executable_def, "aarch64-unknown-linux-gnu", "", "", "arm");
+  AddObject(&executable_def, "x86_64-unknown-linux-gnu", "", "", "generic");
+  AddObject(&executable_def, "x86_64-unknown-linux-gnu", "", "+avx2,+fma",
+            "avx2");
+  AddObject(&executable_def, "x86_64-unknown-linux-gnu", "", "+avx512f",
+            "avx512");
+  flatbuffers::FlatBufferBuilder fbb;
+  const auto* packed_def = Pack(executable_def, &fbb);
+
+  auto host = TestHost();
+  EXPECT_FALSE(LLVMIRObjectMatchesHost(*packed_def->objects()->Get(0), host));
+  EXPECT_FALSE(LLVMIRObjectMatchesHost(*packed_def->objects()->Get(3), host));
+  const auto* object_def = FindPrecompiledObject(*packed_def, host);
+  ASSERT_NE(object_def, nullptr);
+  EXPECT_EQ(object_def, packed_def->objects()->Get(2));
+
+  host.features = {"sse4.2"};
+  EXPECT_EQ(FindPrecompiledObject(*packed_def, host),
+            packed_def->objects()->Get(1));
+  host.target_triple = "riscv64-unknown-linux-gnu";
+  EXPECT_EQ(FindPrecompiledObject(*packed_def, host), nullptr);
+}
+
+TEST(LLVMIRObjectCacheTest, KeyDependsOnModuleHostAndOptions) {
+  auto host = TestHost();
+  std::string key = ComputeLLVMIRObjectCacheKey("module", host, "O3");
+  EXPECT_EQ(key, ComputeLLVMIRObjectCacheKey("module", host, "O3"));
+  EXPECT_NE(key, ComputeLLVMIRObjectCacheKey("other module", host, "O3"));
+  EXPECT_NE(key, ComputeLLVMIRObjectCacheKey("module", host, "O0"));
+  auto other_host = host;
+  other_host.cpu = "haswell";
+  EXPECT_NE(key, ComputeLLVMIRObjectCacheKey("module", other_host, "O3"));
+}
+
+TEST(LLVMIRObjectCacheTest, ResolveFallsBackToCompileAndCaches) {
+  LLVMIRExecutableDefT executable_def;
+  std::string llvmir_module = "define void @main() { ret void }";
+  executable_def.llvmir_module.assign(llvmir_module.begin(),
+                                      llvmir_module.end());
+  AddObject(&executable_def, "aarch64-unknown-linux-gnu", "", "", "arm");
+  flatbuffers::FlatBufferBuilder fbb;
+  const auto* packed_def = Pack(executable_def, &fbb);
+
+  ASSERT_OK_AND_ASSIGN(auto cache,
+                       LLVMIRObjectCache::Open(::testing::TempDir() +
+                                               "/llvmir_object_cache"));
+  int compile_count = 0;
+  LLVMIRCompileFn compile =
+      [&](absl::string_view module,
+          const HostCpuInfo& host) -> StatusOr<std::string> {
+    ++compile_count;
+    EXPECT_EQ(module, llvmir_module);
+    return std::string("compiled for ") + host.cpu;
+  };
+
+  auto host = TestHost();
+  LLVMIRObjectSource source;
+  ASSERT_OK_AND_ASSIGN(auto object, ResolveLLVMIRObject(*packed_def, host,
+                                                        cache.get(), compile,
+                                                        "O3", &source));
+  EXPECT_EQ(object, "compiled for skylake");
+  EXPECT_EQ(source, LLVMIRObjectSource::kCompiled);
+  ASSERT_OK_AND_ASSIGN(object, ResolveLLVMIRObject(*packed_def, host,
+                                                   cache.get(), compile,
+                                                   "O3", &source));
+  EXPECT_EQ(object, "compiled for skylake");
+  EXPECT_EQ(source, LLVMIRObjectSource::kCached);
+  EXPECT_EQ(compile_count, 1);
+
+  host.target_triple = "aarch64-unknown-linux-gnu";
+  ASSERT_OK_AND_ASSIGN(object, ResolveLLVMIRObject(*packed_def, host,
+                                                   cache.get(), compile,
+                                                   "O3", &source));
+  EXPECT_EQ(object, "arm");
+  EXPECT_EQ(source, LLVMIRObjectSource::kPrecompiled);
+  EXPECT_EQ(compile_count, 1);
+}
+
+}  // namespace
+}  // namespace iree
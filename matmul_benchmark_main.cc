@@ -0,0 +1,118 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks RuyMatMul on a set of GEMM shapes with 1 up to --max_cpu_threads
+// threads, to pick how many cores to pin per inference process.
+//
+// Example:
+//   iree-matmul-benchmark --gemm_shapes=384x384x384,1x1024x4096 \
+//     --max_cpu_threads=8
+
+#include <algorithm>
+#include <string>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "benchmark/benchmark.h"
+#include "iree/base/init.h"
+#include "iree/base/status.h"
+#include "iree/tools/ruy_matmul.h"
+
+ABSL_FLAG(std::vector<std::string>, gemm_shapes,
+          std::vector<std::string>({"128x128x128", "384x384x384",
+                                    "1024x1024x1024", "1x1024x4096",
+                                    "64x768x3072"}),
+          "Comma separated MxKxN shapes of the [M, K] x [K, N] matmuls to "
+          "benchmark.");
+
+ABSL_FLAG(int, max_cpu_threads, 0,
+          "Largest thread count to benchmark each shape with; thread counts "
+          "double from 1. Defaults to the number of hardware threads.");
+
+namespace iree {
+namespace {
+
+struct GemmShape {
+  int m;
+  int k;
+  int n;
+};
+
+StatusOr<GemmShape> ParseGemmShape(absl::string_view value) {
+  std::vector<absl::string_view> dims = absl::StrSplit(value, 'x');
+  GemmShape shape;
+  if (dims.size() != 3 || !absl::SimpleAtoi(dims[0], &shape.m) ||
+      !absl::SimpleAtoi(dims[1], &shape.k) ||
+      !absl::SimpleAtoi(dims[2], &shape.n) || shape.m <= 0 || shape.k <= 0 ||
+      shape.n <= 0) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "GEMM shape '" << value << "' is not of the form MxKxN";
+  }
+  return shape;
+}
+
+void BM_RuyMatMul(benchmark::State& state, GemmShape shape) {
+  int thread_count = state.range(0);
+  std::vector<float> lhs(static_cast<size_t>(shape.m) * shape.k, 1.0f);
+  std::vector<float> rhs(static_cast<size_t>(shape.k) * shape.n, 1.0f);
+  std::vector<float> out(static_cast<size_t>(shape.m) * shape.n);
+  SetCpuThreadCount(thread_count);
+  // Spins up the worker threads outside of the timed loop.
+  CHECK_OK(RuyMatMul(lhs, rhs, {}, shape.m, shape.k, shape.n,
+                     absl::MakeSpan(out)));
+  for (auto _ : state) {
+    CHECK_OK(RuyMatMul(lhs, rhs, {}, shape.m, shape.k, shape.n,
+                       absl::MakeSpan(out)));
+    ::benchmark::DoNotOptimize(out.data());
+  }
+  state.counters["GFLOPS"] = ::benchmark::Counter(
+      2.0 * shape.m * shape.k * shape.n * 1e-9,
+      ::benchmark::Counter::kIsIterationInvariantRate);
+}
+
+Status RegisterBenchmarks() {
+  int max_cpu_threads = absl::GetFlag(FLAGS_max_cpu_threads);
+  if (max_cpu_threads <= 0) {
+    max_cpu_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (const auto& value : absl::GetFlag(FLAGS_gemm_shapes)) {
+    ASSIGN_OR_RETURN(auto shape, ParseGemmShape(value));
+    ::benchmark::RegisterBenchmark(
+        absl::StrCat("BM_RuyMatMul/", value, "/threads").c_str(),
+        BM_RuyMatMul, shape)
+        ->RangeMultiplier(2)
+        ->Range(1, max_cpu_threads)
+        ->MeasureProcessCPUTime()
+        ->UseRealTime();
+  }
+  return OkStatus();
+}
+
+}  // namespace
+
+extern "C" int main(int argc, char** argv) {
+  // The benchmark library strips its own --benchmark_* flags so that the
+  // remaining flags can be handled by absl.
+  ::benchmark::Initialize(&argc, argv);
+  InitializeEnvironment(&argc, &argv);
+  CHECK_OK(RegisterBenchmarks());
+  ::benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
+
+}  // namespace iree
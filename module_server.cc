@@ -0,0 +1,412 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "iree/tools/module_server.h"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <streambuf>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/strip.h"
+#include "iree/base/api_util.h"
+#include "iree/base/logging.h"
+#include "iree/base/tracing.h"
+#include "iree/vm/invocation.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif  // MSG_NOSIGNAL
+
+namespace iree {
+
+namespace {
+
+// Reads the next line of |is| without its line ending into |out_line|.
+// Returns false at the end of the stream.
+bool ReadLine(std::istream* is, std::string* out_line) {
+  if (!std::getline(*is, *out_line)) return false;
+  if (!out_line->empty() && out_line->back() == '\r') out_line->pop_back();
+  return true;
+}
+
+// Reads one input line and its binary payload, if any.
+Status ReadInput(std::istream* is, ModuleServerInput* out_input) {
+  std::string line;
+  if (!ReadLine(is, &line)) {
+    return DataLossErrorBuilder(IREE_LOC)
+           << "Stream ended before all inputs of the request were read";
+  }
+  absl::string_view value = absl::StripAsciiWhitespace(line);
+  size_t hash_pos = std::string::npos;
+  if (absl::StartsWith(value, "#")) {
+    hash_pos = 0;
+  } else if (absl::StrContains(value, "=#")) {
+    hash_pos = value.find("=#") + 1;
+  }
+  if (hash_pos == std::string::npos) {
+    out_input->value = std::string(value);
+    out_input->is_binary = false;
+    out_input->data.clear();
+    return OkStatus();
+  }
+
+  // The payload cannot be skipped without its size so the stream is unusable.
+  size_t byte_length = 0;
+  if (!absl::SimpleAtoi(value.substr(hash_pos + 1), &byte_length)) {
+    return DataLossErrorBuilder(IREE_LOC)
+           << "Invalid payload size in binary input '" << value << "'";
+  }
+  if (byte_length > kMaxModuleServerPayloadSize) {
+    return ResourceExhaustedErrorBuilder(IREE_LOC)
+           << "Payload of " << byte_length << " bytes of binary input '"
+           << value << "' exceeds the limit of " << kMaxModuleServerPayloadSize
+           << " bytes";
+  }
+  out_input->value =
+      std::string(absl::StripSuffix(value.substr(0, hash_pos), "="));
+  out_input->is_binary = true;
+  out_input->data.resize(byte_length);
+  is->read(&out_input->data[0], byte_length);
+  if (static_cast<size_t>(is->gcount()) != byte_length) {
+    return DataLossErrorBuilder(IREE_LOC)
+           << "Stream ended after " << is->gcount() << " of " << byte_length
+           << " payload bytes of binary input '" << value << "'";
+  }
+  return OkStatus();
+}
+
+// A streambuf reading from and writing to a connected socket.
+class SocketStreamBuf : public std::streambuf {
+ public:
+  explicit SocketStreamBuf(int fd) : fd_(fd) {
+    setg(read_buffer_, read_buffer_, read_buffer_);
+    setp(write_buffer_, write_buffer_ + sizeof(write_buffer_));
+  }
+  ~SocketStreamBuf() override { sync(); }
+
+ protected:
+  int_type underflow() override {
+    ssize_t read_length;
+    do {
+      read_length = ::recv(fd_, read_buffer_, sizeof(read_buffer_), 0);
+    } while (read_length < 0 && errno == EINTR);
+    if (read_length <= 0) return traits_type::eof();
+    setg(read_buffer_, read_buffer_, read_buffer_ + read_length);
+    return traits_type::to_int_type(read_buffer_[0]);
+  }
+
+  int_type overflow(int_type c) override {
+    if (!Flush()) return traits_type::eof();
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  int sync() override { return Flush() ? 0 : -1; }
+
+ private:
+  bool Flush() {
+    const char* data = pbase();
+    while (data < pptr()) {
+      // MSG_NOSIGNAL reports clients that went away as errors instead of
+      // terminating the server with SIGPIPE.
+      ssize_t written = ::send(fd_, data, pptr() - data, MSG_NOSIGNAL);
+      if (written < 0 && errno == EINTR) continue;
+      if (written <= 0) return false;
+      data += written;
+    }
+    setp(write_buffer_, write_buffer_ + sizeof(write_buffer_));
+    return true;
+  }
+
+  int fd_;
+  char read_buffer_[64 * 1024];
+  char write_buffer_[64 * 1024];
+};
+
+}  // namespace
+
+Status ReadModuleServerRequest(std::istream* is,
+                               ModuleServerRequest* out_request) {
+  std::string line;
+  absl::string_view header;
+  // Blank lines between requests are ignored.
+  while (header.empty()) {
+    if (!ReadLine(is, &line)) {
+      out_request->command = ModuleServerCommand::kQuit;
+      return OkStatus();
+    }
+    header = absl::StripAsciiWhitespace(line);
+  }
+
+  std::vector<absl::string_view> tokens =
+      absl::StrSplit(header, ' ', absl::SkipWhitespace());
+  if (tokens[0] == "quit" && tokens.size() == 1) {
+    out_request->command = ModuleServerCommand::kQuit;
+    return OkStatus();
+  } else if (tokens[0] == "shutdown" && tokens.size() == 1) {
+    out_request->command = ModuleServerCommand::kShutdown;
+    return OkStatus();
+  }
+  int input_count = 0;
+  if (tokens[0] != "call" || tokens.size() < 3 || tokens.size() > 4 ||
+      !absl::SimpleAtoi(tokens[2], &input_count) || input_count < 0) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "Invalid request '" << header
+           << "'; expected 'call <function> <input_count> [format]', 'quit' "
+              "or 'shutdown'";
+  }
+  out_request->command = ModuleServerCommand::kCall;
+  out_request->function_name = std::string(tokens[1]);
+  out_request->output_format = OutputFormat::kText;
+  auto output_format_or =
+      ParseOutputFormat(tokens.size() == 4 ? tokens[3] : "text");
+
+  // Inputs are read even if the format is invalid to keep the stream in sync.
+  out_request->inputs.resize(input_count);
+  for (auto& input : out_request->inputs) {
+    RETURN_IF_ERROR(ReadInput(is, &input));
+  }
+  ASSIGN_OR_RETURN(out_request->output_format, std::move(output_format_or));
+  return OkStatus();
+}
+
+Status WriteModuleServerResponse(const Status& status,
+                                 absl::string_view results, std::ostream* os) {
+  if (status.ok()) {
+    *os << "ok " << results.size() << "\n";
+    os->write(results.data(), results.size());
+  } else {
+    std::string message = status.ToString();
+    *os << "error " << message.size() << "\n" << message;
+  }
+  // Clients wait for each response before sending more requests.
+  os->flush();
+  if (!os->good()) {
+    return InternalErrorBuilder(IREE_LOC) << "Unable to write response";
+  }
+  return OkStatus();
+}
+
+ModuleServer::ModuleServer(iree_vm_context_t* context,
+                           iree_vm_module_t* module,
+                           iree_hal_allocator_t* allocator)
+    : context_(context), module_(module), allocator_(allocator) {}
+
+ModuleServer::~ModuleServer() {
+  for (auto& entry : functions_) {
+    Function* function = entry.second.get();
+    if (function->inputs) {
+      CHECK_OK(
+          FreeReusableVariantList(function->inputs, IREE_ALLOCATOR_SYSTEM));
+    }
+    if (function->outputs) {
+      CHECK_OK(
+          FreeReusableVariantList(function->outputs, IREE_ALLOCATOR_SYSTEM));
+    }
+  }
+}
+
+StatusOr<ModuleServer::Function*> ModuleServer::LookupFunction(
+    absl::string_view function_name) {
+  auto it = functions_.find(function_name);
+  if (it != functions_.end()) return it->second.get();
+
+  IREE_TRACE_SCOPE0("ModuleServer#LookupFunction");
+  auto function = absl::make_unique<Function>();
+  RETURN_IF_ERROR(FromApiStatus(
+      module_->lookup_function(
+          module_->self, IREE_VM_FUNCTION_LINKAGE_EXPORT,
+          iree_string_view_t{function_name.data(), function_name.size()},
+          &function->function),
+      IREE_LOC))
+      << "looking up function '" << function_name << "'";
+  RETURN_IF_ERROR(ValidateFunctionAbi(function->function));
+  ASSIGN_OR_RETURN(function->input_descs,
+                   ParseInputSignature(function->function));
+  ASSIGN_OR_RETURN(function->output_descs,
+                   ParseOutputSignature(function->function));
+  RETURN_IF_ERROR(AllocateReusableVariantList(function->input_descs.size(),
+                                              IREE_ALLOCATOR_SYSTEM,
+                                              &function->inputs));
+  RETURN_IF_ERROR(AllocateReusableVariantList(function->output_descs.size(),
+                                              IREE_ALLOCATOR_SYSTEM,
+                                              &function->outputs));
+  Function* function_ptr = function.get();
+  functions_[std::string(function_name)] = std::move(function);
+  return function_ptr;
+}
+
+Status ModuleServer::Invoke(const ModuleServerRequest& request,
+                            std::ostream* os) {
+  IREE_TRACE_SCOPE0("ModuleServer#Invoke");
+  ASSIGN_OR_RETURN(Function * function, LookupFunction(request.function_name));
+  if (request.inputs.size() != function->input_descs.size()) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "Function '" << request.function_name << "' takes "
+           << function->input_descs.size() << " inputs but received "
+           << request.inputs.size();
+  }
+
+  RETURN_IF_ERROR(ResetVariantList(function->inputs));
+  RETURN_IF_ERROR(ResetVariantList(function->outputs));
+  Status status = InvokeFunction(function, request, os);
+
+  // Buffers are released after each call, failed or not, instead of being
+  // held until the next call of the same function.
+  Status inputs_status = ResetVariantList(function->inputs);
+  Status outputs_status = ResetVariantList(function->outputs);
+  RETURN_IF_ERROR(status);
+  RETURN_IF_ERROR(inputs_status);
+  return outputs_status;
+}
+
+Status ModuleServer::InvokeFunction(Function* function,
+                                    const ModuleServerRequest& request,
+                                    std::ostream* os) {
+  for (int i = 0; i < request.inputs.size(); ++i) {
+    const auto& input = request.inputs[i];
+    if (input.is_binary) {
+      RETURN_IF_ERROR(AppendBufferDataToVariantList(
+          function->input_descs[i], allocator_, input.value,
+          absl::MakeConstSpan(
+              reinterpret_cast<const uint8_t*>(input.data.data()),
+              input.data.size()),
+          function->inputs))
+          << "parsing input " << i;
+    } else {
+      RETURN_IF_ERROR(AppendInputToVariantList(function->input_descs[i],
+                                               allocator_, input.value,
+                                               function->inputs))
+          << "parsing input " << i;
+    }
+  }
+
+  RETURN_IF_ERROR(FromApiStatus(
+      iree_vm_invoke(context_, function->function, /*policy=*/nullptr,
+                     function->inputs, function->outputs,
+                     IREE_ALLOCATOR_SYSTEM),
+      IREE_LOC))
+      << "invoking function " << request.function_name;
+  RETURN_IF_ERROR(WriteVariantList(function->output_descs, function->outputs,
+                                   request.output_format, os))
+      << "writing results";
+  return OkStatus();
+}
+
+Status ModuleServer::Serve(std::istream* is, std::ostream* os) {
+  while (true) {
+    ModuleServerRequest request;
+    Status status = ReadModuleServerRequest(is, &request);
+    if (IsInvalidArgument(status)) {
+      RETURN_IF_ERROR(WriteModuleServerResponse(status, {}, os));
+      continue;
+    }
+    RETURN_IF_ERROR(status);
+    switch (request.command) {
+      case ModuleServerCommand::kQuit:
+        return OkStatus();
+      case ModuleServerCommand::kShutdown:
+        shutdown_requested_ = true;
+        return OkStatus();
+      case ModuleServerCommand::kCall:
+        break;
+    }
+
+    std::ostringstream results;
+    status = Invoke(request, &results);
+    ++request_count_;
+    RETURN_IF_ERROR(WriteModuleServerResponse(status, results.str(), os));
+  }
+}
+
+Status ModuleServer::ServeUnixSocket(absl::string_view path) {
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "Invalid socket path '" << path << "'";
+  }
+  std::memcpy(address.sun_path, path.data(), path.size());
+
+  // Replaces the socket file left behind by a previous server but never
+  // anything else that happens to be at |path|.
+  struct stat path_stat;
+  if (::lstat(address.sun_path, &path_stat) == 0) {
+    if (!S_ISSOCK(path_stat.st_mode)) {
+      return FailedPreconditionErrorBuilder(IREE_LOC)
+             << "'" << path << "' exists and is not a socket";
+    }
+    ::unlink(address.sun_path);
+  } else if (errno != ENOENT) {
+    return InternalErrorBuilder(IREE_LOC)
+           << "Unable to stat socket path '" << path << "'";
+  }
+
+  int listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    return InternalErrorBuilder(IREE_LOC) << "Unable to create socket";
+  }
+  // Restricting the socket before listening leaves no window in which other
+  // users could connect.
+  if (::bind(listen_fd, reinterpret_cast<sockaddr*>(&address),
+             sizeof(address)) != 0 ||
+      ::chmod(address.sun_path, S_IRUSR | S_IWUSR) != 0 ||
+      ::listen(listen_fd, /*backlog=*/16) != 0) {
+    ::close(listen_fd);
+    return InternalErrorBuilder(IREE_LOC)
+           << "Unable to listen on socket '" << path << "'";
+  }
+
+  Status status;
+  while (!shutdown_requested_) {
+    int fd = ::accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR) continue;
+      status = InternalErrorBuilder(IREE_LOC)
+               << "Unable to accept connections on '" << path << "'";
+      break;
+    }
+    {
+      SocketStreamBuf stream_buf(fd);
+      std::iostream stream(&stream_buf);
+      // A client that misbehaves or goes away only ends its own session.
+      Status session_status = Serve(&stream, &stream);
+      if (!session_status.ok()) {
+        LOG(WARNING) << "Ending module server session: " << session_status;
+      }
+    }
+    ::close(fd);
+  }
+  ::close(listen_fd);
+  ::unlink(address.sun_path);
+  return status;
+}
+
+}  // namespace iree
@@ -0,0 +1,156 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef IREE_TOOLS_MODULE_SERVER_H_
+#define IREE_TOOLS_MODULE_SERVER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "iree/base/signature_mangle.h"
+#include "iree/base/status.h"
+#include "iree/hal/api.h"
+#include "iree/tools/vm_util.h"
+#include "iree/vm/api.h"
+
+namespace iree {
+
+// A long-running module server reads a stream of requests and answers each
+// with one response. Requests are text lines, each optionally followed by a
+// binary payload:
+//
+//   call <function> <input_count> [text|npy|npz|binary]
+//       Invokes the exported |function| with the next |input_count| inputs
+//       and returns its results in the given format (text by default).
+//       Each input is one line in the --inputs format:
+//         2x2xf32=1 2 3 4, i32=5, @input.npy, 2x2xf32=@raw_input.bin
+//       or a binary input whose line gives the size of the payload that
+//       directly follows its newline:
+//         2x2xf32=#16     16 bytes of raw little-endian element data
+//         #128            a 128 byte .npy file
+//       Payloads are at most kMaxModuleServerPayloadSize bytes.
+//   quit
+//       Ends the session. The end of the stream does the same.
+//   shutdown
+//       Ends the session and stops a socket server from accepting more.
+//
+// Every call gets a response line followed by a payload of the given size:
+//   ok <byte_length>     results in the requested format
+//   error <byte_length>  the status message of the failed request
+enum class ModuleServerCommand {
+  kCall,
+  kQuit,
+  kShutdown,
+};
+
+// Largest binary input payload a request may carry. Larger payloads end the
+// session, as the stream cannot be resynchronized without reading them.
+constexpr size_t kMaxModuleServerPayloadSize = size_t{1} << 30;
+
+struct ModuleServerInput {
+  // A text input in the --inputs format or, if |is_binary|, the
+  // '[shape]xtype' of the raw element data in |data| (empty for .npy data).
+  std::string value;
+  bool is_binary = false;
+  std::string data;
+};
+
+struct ModuleServerRequest {
+  ModuleServerCommand command = ModuleServerCommand::kQuit;
+  std::string function_name;
+  OutputFormat output_format = OutputFormat::kText;
+  std::vector<ModuleServerInput> inputs;
+};
+
+// Reads the next request from |is| into |out_request|. The end of the stream
+// is read as a quit request. Returns InvalidArgument for malformed request
+// lines, after which reading may continue with the next line, DataLoss if the
+// stream ends within a request and ResourceExhausted for payloads larger than
+// kMaxModuleServerPayloadSize.
+Status ReadModuleServerRequest(std::istream* is,
+                               ModuleServerRequest* out_request);
+
+// Writes the response for a request that finished with |status| to |os|.
+// |results| holds the formatted results of successful requests.
+Status WriteModuleServerResponse(const Status& status,
+                                 absl::string_view results, std::ostream* os);
+
+// Serves invocations of the exported functions of |module| within |context|,
+// which are loaded once and reused for every request.
+class ModuleServer {
+ public:
+  // |context|, |module| and |allocator| (used for input buffers) must outlive
+  // the server.
+  ModuleServer(iree_vm_context_t* context, iree_vm_module_t* module,
+               iree_hal_allocator_t* allocator);
+  ~ModuleServer();
+
+  ModuleServer(const ModuleServer&) = delete;
+  ModuleServer& operator=(const ModuleServer&) = delete;
+
+  // Invokes the call |request| and writes its results to |os| in the
+  // requested output format.
+  Status Invoke(const ModuleServerRequest& request, std::ostream* os);
+
+  // Answers requests read from |is| on |os| until a quit or shutdown request
+  // or the end of the stream. Failed requests are reported in their response;
+  // only errors that leave the stream unusable are returned.
+  Status Serve(std::istream* is, std::ostream* os);
+
+  // Serves each connection to the Unix domain socket at |path| in turn until
+  // one of them requests a shutdown. The socket is only accessible to the
+  // owning user, as requests may read any file the server can. A socket left
+  // at |path| by a previous server is replaced; any other file there is
+  // rejected with FailedPrecondition.
+  Status ServeUnixSocket(absl::string_view path);
+
+  // Total number of call requests answered so far.
+  int64_t request_count() const { return request_count_; }
+  bool shutdown_requested() const { return shutdown_requested_; }
+
+ private:
+  // A function looked up on first use. Its variant lists keep their storage
+  // across calls.
+  struct Function {
+    iree_vm_function_t function;
+    std::vector<RawSignatureParser::Description> input_descs;
+    std::vector<RawSignatureParser::Description> output_descs;
+    iree_vm_variant_list_t* inputs = nullptr;
+    iree_vm_variant_list_t* outputs = nullptr;
+  };
+
+  StatusOr<Function*> LookupFunction(absl::string_view function_name);
+  // Invokes |function| after its variant lists were reset. The caller resets
+  // them again afterwards, whether or not the call succeeded.
+  Status InvokeFunction(Function* function, const ModuleServerRequest& request,
+                        std::ostream* os);
+
+  iree_vm_context_t* context_;
+  iree_vm_module_t* module_;
+  iree_hal_allocator_t* allocator_;
+  absl::flat_hash_map<std::string, std::unique_ptr<Function>> functions_;
+  int64_t request_count_ = 0;
+  bool shutdown_requested_ = false;
+};
+
+}  // namespace iree
+
+#endif  // IREE_TOOLS_MODULE_SERVER_H_
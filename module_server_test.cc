@@ -0,0 +1,247 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "iree/tools/module_server.h"
+
+#include <sys/un.h>
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "absl/strings/numbers.h"
+#include "iree/base/api.h"
+#include "iree/base/status_matchers.h"
+#include "iree/hal/api.h"
+#include "iree/modules/hal/hal_module.h"
+#include "iree/testing/gtest.h"
+#include "iree/tools/module_server_test_module.h"
+#include "iree/tools/vm_util.h"
+#include "iree/vm/api.h"
+
+namespace iree {
+namespace {
+
+using ::testing::HasSubstr;
+
+TEST(ModuleServerTest, ReadTextAndBinaryInputs) {
+  std::string payload("\x01\x00\x00\x00\x02\x00\x00\x00", 8);
+  std::stringstream stream;
+  stream << "\n"
+         << "call predict 3 npy\n"
+         << "2xi32=1 2\n"
+         << "2xi32=#8\n"
+         << payload << "@input.npy\r\n"
+         << "quit\n";
+
+  ModuleServerRequest request;
+  ASSERT_OK(ReadModuleServerRequest(&stream, &request));
+  EXPECT_EQ(request.command, ModuleServerCommand::kCall);
+  EXPECT_EQ(request.function_name, "predict");
+  EXPECT_EQ(request.output_format, OutputFormat::kNumpy);
+  ASSERT_EQ(request.inputs.size(), 3);
+  EXPECT_EQ(request.inputs[0].value, "2xi32=1 2");
+  EXPECT_FALSE(request.inputs[0].is_binary);
+  EXPECT_EQ(request.inputs[1].value, "2xi32");
+  EXPECT_TRUE(request.inputs[1].is_binary);
+  EXPECT_EQ(request.inputs[1].data, payload);
+  EXPECT_EQ(request.inputs[2].value, "@input.npy");
+  EXPECT_FALSE(request.inputs[2].is_binary);
+
+  ASSERT_OK(ReadModuleServerRequest(&stream, &request));
+  EXPECT_EQ(request.command, ModuleServerCommand::kQuit);
+}
+
+TEST(ModuleServerTest, ReadNpyInputAndEndOfStream) {
+  std::stringstream stream;
+  stream << "call main 1\n#4\nabcd\nshutdown\n";
+
+  ModuleServerRequest request;
+  ASSERT_OK(ReadModuleServerRequest(&stream, &request));
+  EXPECT_EQ(request.output_format, OutputFormat::kText);
+  ASSERT_EQ(request.inputs.size(), 1);
+  EXPECT_EQ(request.inputs[0].value, "");
+  EXPECT_TRUE(request.inputs[0].is_binary);
+  EXPECT_EQ(request.inputs[0].data, "abcd");
+
+  ASSERT_OK(ReadModuleServerRequest(&stream, &request));
+  EXPECT_EQ(request.command, ModuleServerCommand::kShutdown);
+  ASSERT_OK(ReadModuleServerRequest(&stream, &request));
+  EXPECT_EQ(request.command, ModuleServerCommand::kQuit);
+}
+
+TEST(ModuleServerTest, ReadMalformedRequests) {
+  std::stringstream stream;
+  stream << "invoke main\n"
+         << "call main 1 yaml\ni32=1\n"
+         << "call main 0\n";
+
+  ModuleServerRequest request;
+  EXPECT_TRUE(IsInvalidArgument(ReadModuleServerRequest(&stream, &request)));
+  // Inputs of a request with an invalid format are still consumed.
+  EXPECT_TRUE(IsInvalidArgument(ReadModuleServerRequest(&stream, &request)));
+  ASSERT_OK(ReadModuleServerRequest(&stream, &request));
+  EXPECT_EQ(request.function_name, "main");
+  EXPECT_TRUE(request.inputs.empty());
+}
+
+TEST(ModuleServerTest, ReadTruncatedRequests) {
+  std::stringstream missing_input("call main 2\ni32=1\n");
+  ModuleServerRequest request;
+  EXPECT_TRUE(IsDataLoss(ReadModuleServerRequest(&missing_input, &request)));
+
+  std::stringstream missing_payload("call main 1\n2xi32=#8\nabc");
+  EXPECT_TRUE(IsDataLoss(ReadModuleServerRequest(&missing_payload, &request)));
+
+  std::stringstream invalid_size("call main 1\n2xi32=#eight\n");
+  EXPECT_TRUE(IsDataLoss(ReadModuleServerRequest(&invalid_size, &request)));
+}
+
+TEST(ModuleServerTest, ReadOversizedPayload) {
+  std::stringstream stream;
+  stream << "call main 1\n2xi32=#" << kMaxModuleServerPayloadSize + 1 << "\n";
+  ModuleServerRequest request;
+  EXPECT_TRUE(
+      IsResourceExhausted(ReadModuleServerRequest(&stream, &request)));
+}
+
+TEST(ModuleServerTest, WriteResponses) {
+  std::stringstream stream;
+  ASSERT_OK(WriteModuleServerResponse(OkStatus(), "2xi32=[1 2]\n", &stream));
+  EXPECT_EQ(stream.str(), "ok 12\n2xi32=[1 2]\n");
+
+  stream.str("");
+  Status error = InvalidArgumentErrorBuilder(IREE_LOC) << "bad input";
+  ASSERT_OK(WriteModuleServerResponse(error, {}, &stream));
+  std::string message = error.ToString();
+  EXPECT_EQ(stream.str(),
+            "error " + std::to_string(message.size()) + "\n" + message);
+}
+
+// Serves the module of module_server_test.mlir on the interpreter.
+class ModuleServerServeTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    IREE_ASSERT_OK(iree_hal_module_register_types());
+    IREE_ASSERT_OK(iree_vm_instance_create(IREE_ALLOCATOR_SYSTEM, &instance_));
+    ASSERT_OK(CreateDevice("interpreter", &device_));
+    ASSERT_OK(CreateHalModule(device_, &hal_module_));
+    const auto* module_file = tools::module_server_test_module_create();
+    ASSERT_OK(LoadBytecodeModule(
+        absl::string_view(module_file->data, module_file->size),
+        &input_module_));
+    // The input module depends on the hal module.
+    iree_vm_module_t* modules[] = {hal_module_, input_module_};
+    IREE_ASSERT_OK(iree_vm_context_create_with_modules(
+        instance_, modules, 2, IREE_ALLOCATOR_SYSTEM, &context_));
+  }
+
+  virtual void TearDown() {
+    IREE_ASSERT_OK(iree_vm_context_release(context_));
+    IREE_ASSERT_OK(iree_vm_module_release(input_module_));
+    IREE_ASSERT_OK(iree_vm_module_release(hal_module_));
+    IREE_ASSERT_OK(iree_hal_device_release(device_));
+    IREE_ASSERT_OK(iree_vm_instance_release(instance_));
+  }
+
+  // Reads the next response from |is| into its |out_kind| ("ok" or "error")
+  // and |out_payload|.
+  void ReadResponse(std::istream* is, std::string* out_kind,
+                    std::string* out_payload) {
+    std::string line;
+    ASSERT_TRUE(std::getline(*is, line));
+    size_t space_pos = line.find(' ');
+    ASSERT_NE(space_pos, std::string::npos) << line;
+    size_t byte_length = 0;
+    ASSERT_TRUE(absl::SimpleAtoi(line.substr(space_pos + 1), &byte_length));
+    *out_kind = line.substr(0, space_pos);
+    out_payload->resize(byte_length);
+    is->read(&(*out_payload)[0], byte_length);
+    ASSERT_EQ(static_cast<size_t>(is->gcount()), byte_length);
+  }
+
+  iree_vm_instance_t* instance_ = nullptr;
+  iree_hal_device_t* device_ = nullptr;
+  iree_vm_module_t* hal_module_ = nullptr;
+  iree_vm_module_t* input_module_ = nullptr;
+  iree_vm_context_t* context_ = nullptr;
+};
+
+TEST_F(ModuleServerServeTest, ServeCallsUntilShutdown) {
+  const float ones[] = {1.0f, 1.0f, 1.0f, 1.0f};
+  std::string payload(sizeof(ones), '\0');
+  std::memcpy(&payload[0], ones, sizeof(ones));
+  std::stringstream requests;
+  requests << "call add 2\n4xf32=1 2 3 4\n4xf32=#16\n"
+           << payload
+           // Wrong input count, unknown function and an invalid input.
+           << "call add 1\n4xf32=1 2 3 4\n"
+           << "call missing 0\n"
+           << "call add 2\n4xf32=1 2 3 4\n4xf32=1 2\n"
+           << "invoke add\n"
+           // Failed calls leave nothing behind for the next one.
+           << "call add 2\n4xf32=1 2 3 4\n4xf32=4 3 2 1\n"
+           << "shutdown\n"
+           << "call add 0\n";
+
+  std::stringstream responses;
+  ModuleServer server(context_, input_module_,
+                      iree_hal_device_allocator(device_));
+  ASSERT_OK(server.Serve(&requests, &responses));
+  EXPECT_EQ(server.request_count(), 5);
+  EXPECT_TRUE(server.shutdown_requested());
+
+  std::string kind, payload_out;
+  ReadResponse(&responses, &kind, &payload_out);
+  EXPECT_EQ(kind, "ok");
+  EXPECT_THAT(payload_out, HasSubstr("4xf32=2 3 4 5"));
+  for (int i = 0; i < 4; ++i) {
+    ReadResponse(&responses, &kind, &payload_out);
+    EXPECT_EQ(kind, "error") << i;
+  }
+  ReadResponse(&responses, &kind, &payload_out);
+  EXPECT_EQ(kind, "ok");
+  EXPECT_THAT(payload_out, HasSubstr("4xf32=5 5 5 5"));
+  EXPECT_EQ(responses.peek(), std::char_traits<char>::eof());
+}
+
+TEST_F(ModuleServerServeTest, OversizedPayloadEndsSession) {
+  std::stringstream requests;
+  requests << "call add 2\n4xf32=1 2 3 4\n4xf32=#"
+           << kMaxModuleServerPayloadSize + 1 << "\n";
+  std::stringstream responses;
+  ModuleServer server(context_, input_module_,
+                      iree_hal_device_allocator(device_));
+  EXPECT_TRUE(IsResourceExhausted(server.Serve(&requests, &responses)));
+  EXPECT_EQ(server.request_count(), 0);
+  EXPECT_EQ(responses.str(), "");
+}
+
+TEST_F(ModuleServerServeTest, ServeUnixSocketKeepsOtherFiles) {
+  std::string path = ::testing::TempDir() + "/not_a_socket";
+  if (path.size() >= sizeof(sockaddr_un::sun_path)) {
+    GTEST_SKIP() << "Temporary directory path is too long for a socket";
+  }
+  std::ofstream(path) << "contents";
+  ModuleServer server(context_, input_module_,
+                      iree_hal_device_allocator(device_));
+  EXPECT_TRUE(IsFailedPrecondition(server.ServeUnixSocket(path)));
+  std::string contents;
+  std::ifstream(path) >> contents;
+  EXPECT_EQ(contents, "contents");
+}
+
+}  // namespace
+}  // namespace iree
@@ -0,0 +1,5 @@
+// Module served by module_server_test.
+func @add(%lhs : tensor<4xf32>, %rhs : tensor<4xf32>) -> tensor<4xf32> attributes { iree.module.export } {
+  %result = "xla_hlo.add"(%lhs, %rhs) : (tensor<4xf32>, tensor<4xf32>) -> tensor<4xf32>
+  return %result : tensor<4xf32>
+}
@@ -0,0 +1,213 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "iree/tools/module_stats.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "flatbuffers/flatbuffers.h"
+#include "flatbuffers/util.h"
+#include "iree/schemas/bytecode_module_def_generated.h"
+
+namespace iree {
+
+namespace {
+
+using ::iree::vm::CompressionTypeDef;
+
+// Returns the size of |vector| or 0 if it is omitted.
+template <typename T>
+int64_t SizeOf(const flatbuffers::Vector<T>* vector) {
+  return vector ? static_cast<int64_t>(vector->size()) : 0;
+}
+
+std::string JsonString(absl::string_view value) {
+  std::string json;
+  flatbuffers::EscapeString(value.data(), value.size(), &json,
+                            /*allow_non_utf8=*/true, /*natural_utf8=*/false);
+  return json;
+}
+
+}  // namespace
+
+StatusOr<ModuleStats> ComputeModuleStats(
+    absl::Span<const uint8_t> module_data) {
+  flatbuffers::Verifier verifier(module_data.data(), module_data.size());
+  if (!vm::VerifyBytecodeModuleDefBuffer(verifier)) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "Data is not a valid BytecodeModuleDef";
+  }
+  return ComputeModuleStats(*vm::GetBytecodeModuleDef(module_data.data()),
+                            module_data.size());
+}
+
+ModuleStats ComputeModuleStats(const vm::BytecodeModuleDef& module_def,
+                               int64_t module_byte_size) {
+  ModuleStats module_stats;
+  module_stats.name = module_def.name()->str();
+  module_stats.module_byte_size = module_byte_size;
+  module_stats.bytecode_byte_size = SizeOf(module_def.bytecode_data());
+  module_stats.type_count = SizeOf(module_def.types());
+  module_stats.import_count = SizeOf(module_def.imported_functions());
+  module_stats.export_count = SizeOf(module_def.exported_functions());
+  if (module_def.module_state()) {
+    module_stats.global_bytes_capacity =
+        module_def.module_state()->global_bytes_capacity();
+    module_stats.global_ref_count =
+        module_def.module_state()->global_ref_count();
+  }
+
+  // Descriptors are indexed by internal function ordinal.
+  const auto* internal_functions = module_def.internal_functions();
+  const auto* function_descriptors = module_def.function_descriptors();
+  int64_t function_count = std::max(SizeOf(internal_functions),
+                                    SizeOf(function_descriptors));
+  module_stats.functions.resize(function_count);
+  for (int64_t i = 0; i < function_count; ++i) {
+    auto& function_stats = module_stats.functions[i];
+    if (i < SizeOf(internal_functions) &&
+        internal_functions->Get(i)->local_name()) {
+      function_stats.name = internal_functions->Get(i)->local_name()->str();
+    }
+    if (i < SizeOf(function_descriptors)) {
+      const auto* descriptor = function_descriptors->Get(i);
+      function_stats.bytecode_length = descriptor->bytecode_length();
+      function_stats.i32_register_count = descriptor->i32_register_count();
+      function_stats.ref_register_count = descriptor->ref_register_count();
+    }
+  }
+
+  if (module_def.rodata_segments()) {
+    for (const auto* segment_def : *module_def.rodata_segments()) {
+      ModuleStats::RodataSegmentStats segment_stats;
+      segment_stats.byte_size = SizeOf(segment_def->data());
+      switch (segment_def->compression_type_type()) {
+        case CompressionTypeDef::NONE:
+        case CompressionTypeDef::UncompressedDataDef:
+          segment_stats.compression = "none";
+          break;
+        default:
+          segment_stats.compression = vm::EnumNameCompressionTypeDef(
+              segment_def->compression_type_type());
+          break;
+      }
+      module_stats.rodata_byte_size += segment_stats.byte_size;
+      module_stats.rodata_segments.push_back(std::move(segment_stats));
+    }
+  }
+  if (module_def.rwdata_segments()) {
+    for (const auto* segment_def : *module_def.rwdata_segments()) {
+      module_stats.rwdata_byte_size += segment_def->byte_size();
+    }
+  }
+  return module_stats;
+}
+
+std::string ModuleStatsToTable(const ModuleStats& module_stats) {
+  std::string table;
+  absl::StrAppendFormat(&table, "module: %s\n", module_stats.name);
+  absl::StrAppendFormat(&table, "  module bytes:   %d\n",
+                        module_stats.module_byte_size);
+  absl::StrAppendFormat(&table, "  bytecode bytes: %d\n",
+                        module_stats.bytecode_byte_size);
+  absl::StrAppendFormat(&table, "  rodata bytes:   %d in %d segments\n",
+                        module_stats.rodata_byte_size,
+                        module_stats.rodata_segments.size());
+  absl::StrAppendFormat(&table, "  rwdata bytes:   %d\n",
+                        module_stats.rwdata_byte_size);
+  absl::StrAppendFormat(&table, "  globals:        %d bytes, %d refs\n",
+                        module_stats.global_bytes_capacity,
+                        module_stats.global_ref_count);
+  absl::StrAppendFormat(&table, "  types:          %d\n",
+                        module_stats.type_count);
+  absl::StrAppendFormat(&table, "  imports:        %d\n",
+                        module_stats.import_count);
+  absl::StrAppendFormat(&table, "  exports:        %d\n",
+                        module_stats.export_count);
+
+  absl::StrAppendFormat(&table, "\n%8s %12s %6s %6s  %s\n", "ordinal",
+                        "bytecode", "i32", "ref", "function");
+  for (size_t i = 0; i < module_stats.functions.size(); ++i) {
+    const auto& function_stats = module_stats.functions[i];
+    absl::StrAppendFormat(
+        &table, "%8d %12d %6d %6d  %s\n", i, function_stats.bytecode_length,
+        function_stats.i32_register_count, function_stats.ref_register_count,
+        function_stats.name.empty() ? "(stripped)" : function_stats.name);
+  }
+
+  if (!module_stats.rodata_segments.empty()) {
+    absl::StrAppendFormat(&table, "\n%8s %12s  %s\n", "rodata", "bytes",
+                          "compression");
+    for (size_t i = 0; i < module_stats.rodata_segments.size(); ++i) {
+      const auto& segment_stats = module_stats.rodata_segments[i];
+      absl::StrAppendFormat(&table, "%8d %12d  %s\n", i,
+                            segment_stats.byte_size,
+                            segment_stats.compression);
+    }
+  }
+  return table;
+}
+
+std::string ModuleStatsToJson(const ModuleStats& module_stats) {
+  std::string json = "{\n";
+  absl::StrAppend(&json, "  \"name\": ", JsonString(module_stats.name), ",\n");
+  absl::StrAppend(&json, "  \"module_byte_size\": ",
+                  module_stats.module_byte_size, ",\n");
+  absl::StrAppend(&json, "  \"bytecode_byte_size\": ",
+                  module_stats.bytecode_byte_size, ",\n");
+  absl::StrAppend(&json, "  \"type_count\": ", module_stats.type_count, ",\n");
+  absl::StrAppend(&json, "  \"import_count\": ", module_stats.import_count,
+                  ",\n");
+  absl::StrAppend(&json, "  \"export_count\": ", module_stats.export_count,
+                  ",\n");
+  absl::StrAppend(&json, "  \"rodata_byte_size\": ",
+                  module_stats.rodata_byte_size, ",\n");
+  absl::StrAppend(&json, "  \"rwdata_byte_size\": ",
+                  module_stats.rwdata_byte_size, ",\n");
+  absl::StrAppend(&json, "  \"global_bytes_capacity\": ",
+                  module_stats.global_bytes_capacity, ",\n");
+  absl::StrAppend(&json, "  \"global_ref_count\": ",
+                  module_stats.global_ref_count, ",\n");
+
+  absl::StrAppend(&json, "  \"functions\": [");
+  for (size_t i = 0; i < module_stats.functions.size(); ++i) {
+    const auto& function_stats = module_stats.functions[i];
+    absl::StrAppend(&json, i ? ",\n" : "\n", "    {\"ordinal\": ", i,
+                    ", \"name\": ", JsonString(function_stats.name),
+                    ", \"bytecode_length\": ", function_stats.bytecode_length,
+                    ", \"i32_register_count\": ",
+                    function_stats.i32_register_count,
+                    ", \"ref_register_count\": ",
+                    function_stats.ref_register_count, "}");
+  }
+  absl::StrAppend(&json, module_stats.functions.empty() ? "],\n" : "\n  ],\n");
+
+  absl::StrAppend(&json, "  \"rodata_segments\": [");
+  for (size_t i = 0; i < module_stats.rodata_segments.size(); ++i) {
+    const auto& segment_stats = module_stats.rodata_segments[i];
+    absl::StrAppend(&json, i ? ",\n" : "\n", "    {\"ordinal\": ", i,
+                    ", \"byte_size\": ", segment_stats.byte_size,
+                    ", \"compression\": ",
+                    JsonString(segment_stats.compression), "}");
+  }
+  absl::StrAppend(&json,
+                  module_stats.rodata_segments.empty() ? "]\n" : "\n  ]\n");
+  json += "}\n";
+  return json;
+}
+
+}  // namespace iree
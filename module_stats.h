@@ -0,0 +1,89 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef IREE_TOOLS_MODULE_STATS_H_
+#define IREE_TOOLS_MODULE_STATS_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/types/span.h"
+#include "iree/base/status.h"
+#include "iree/schemas/bytecode_module_def_generated.h"
+
+namespace iree {
+
+// Structural statistics of a bytecode module, gathered from the sizes of its
+// tables and vectors without visiting their elements.
+struct ModuleStats {
+  struct FunctionStats {
+    // Local name of the internal function or empty if stripped.
+    std::string name;
+    int32_t bytecode_length = 0;
+    int32_t i32_register_count = 0;
+    int32_t ref_register_count = 0;
+  };
+
+  struct RodataSegmentStats {
+    // Stored size of the segment contents.
+    int64_t byte_size = 0;
+    // "none" or the name of a newer CompressionTypeDef.
+    std::string compression;
+  };
+
+  std::string name;
+  // Size of the whole module flatbuffer.
+  int64_t module_byte_size = 0;
+  // Size of the bytecode block shared by all functions.
+  int64_t bytecode_byte_size = 0;
+  int64_t type_count = 0;
+  int64_t import_count = 0;
+  int64_t export_count = 0;
+  int64_t rodata_byte_size = 0;
+  int64_t rwdata_byte_size = 0;
+  int64_t global_bytes_capacity = 0;
+  int64_t global_ref_count = 0;
+  // Internal functions in ordinal order.
+  std::vector<FunctionStats> functions;
+  // Rodata segments in ordinal order.
+  std::vector<RodataSegmentStats> rodata_segments;
+};
+
+// Computes the statistics of the bytecode module flatbuffer in |module_data|.
+// The flatbuffer is verified before it is inspected.
+StatusOr<ModuleStats> ComputeModuleStats(absl::Span<const uint8_t> module_data);
+
+// Computes the statistics of |module_def| in a flatbuffer of |module_byte_size|
+// bytes that was already verified, such as by the module loader.
+ModuleStats ComputeModuleStats(const vm::BytecodeModuleDef& module_def,
+                               int64_t module_byte_size);
+
+// Returns the statistics as human readable tables.
+std::string ModuleStatsToTable(const ModuleStats& module_stats);
+
+// Returns the statistics as a JSON object of the form:
+//   {"name": ..., "module_byte_size": ..., "bytecode_byte_size": ...,
+//    "type_count": ..., "import_count": ..., "export_count": ...,
+//    "rodata_byte_size": ..., "rwdata_byte_size": ...,
+//    "global_bytes_capacity": ..., "global_ref_count": ...,
+//    "functions": [{"ordinal": ..., "name": ..., "bytecode_length": ...,
+//                   "i32_register_count": ..., "ref_register_count": ...}],
+//    "rodata_segments": [{"ordinal": ..., "byte_size": ...,
+//                         "compression": ...}]}
+std::string ModuleStatsToJson(const ModuleStats& module_stats);
+
+}  // namespace iree
+
+#endif  // IREE_TOOLS_MODULE_STATS_H_
@@ -0,0 +1,111 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "iree/tools/module_stats.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "flatbuffers/flatbuffers.h"
+#include "iree/base/status_matchers.h"
+#include "iree/schemas/bytecode_module_def_generated.h"
+#include "iree/testing/gtest.h"
+
+namespace iree {
+namespace {
+
+using ::iree::vm::BytecodeModuleDef;
+using ::iree::vm::BytecodeModuleDefT;
+using ::iree::vm::FunctionDescriptor;
+
+// Builds a module with two internal functions (one exported and one with a
+// stripped name), an uncompressed and an explicitly uncompressed rodata
+// segment.
+std::vector<uint8_t> BuildModule() {
+  BytecodeModuleDefT module_def;
+  module_def.name = "module";
+  module_def.imported_functions.push_back(
+      absl::make_unique<vm::ImportFunctionDefT>());
+  module_def.exported_functions.push_back(
+      absl::make_unique<vm::ExportFunctionDefT>());
+  module_def.internal_functions.push_back(
+      absl::make_unique<vm::InternalFunctionDefT>());
+  module_def.internal_functions.back()->local_name = "main";
+  module_def.internal_functions.push_back(
+      absl::make_unique<vm::InternalFunctionDefT>());
+  module_def.function_descriptors.emplace_back(0, 12, 3, 1);
+  module_def.function_descriptors.emplace_back(12, 4, 1, 0);
+  module_def.bytecode_data.resize(16);
+  module_def.rodata_segments.push_back(
+      absl::make_unique<vm::RodataSegmentDefT>());
+  module_def.rodata_segments.back()->data.resize(64);
+  module_def.rodata_segments.push_back(
+      absl::make_unique<vm::RodataSegmentDefT>());
+  module_def.rodata_segments.back()->data.resize(8);
+  module_def.rodata_segments.back()->compression_type.Set(
+      vm::UncompressedDataDefT());
+  module_def.rwdata_segments.push_back(
+      absl::make_unique<vm::RwdataSegmentDefT>());
+  module_def.rwdata_segments.back()->byte_size = 32;
+
+  flatbuffers::FlatBufferBuilder fbb;
+  fbb.Finish(BytecodeModuleDef::Pack(fbb, &module_def),
+             vm::BytecodeModuleDefIdentifier());
+  return std::vector<uint8_t>(fbb.GetBufferPointer(),
+                              fbb.GetBufferPointer() + fbb.GetSize());
+}
+
+TEST(ModuleStatsTest, ComputesStats) {
+  auto module_data = BuildModule();
+  ASSERT_OK_AND_ASSIGN(auto module_stats, ComputeModuleStats(module_data));
+  EXPECT_EQ(module_stats.name, "module");
+  EXPECT_EQ(module_stats.module_byte_size, module_data.size());
+  EXPECT_EQ(module_stats.bytecode_byte_size, 16);
+  EXPECT_EQ(module_stats.import_count, 1);
+  EXPECT_EQ(module_stats.export_count, 1);
+  EXPECT_EQ(module_stats.rwdata_byte_size, 32);
+  ASSERT_EQ(module_stats.functions.size(), 2);
+  EXPECT_EQ(module_stats.functions[0].name, "main");
+  EXPECT_EQ(module_stats.functions[0].bytecode_length, 12);
+  EXPECT_EQ(module_stats.functions[0].i32_register_count, 3);
+  EXPECT_EQ(module_stats.functions[0].ref_register_count, 1);
+  EXPECT_EQ(module_stats.functions[1].name, "");
+  ASSERT_EQ(module_stats.rodata_segments.size(), 2);
+  EXPECT_EQ(module_stats.rodata_segments[0].byte_size, 64);
+  EXPECT_EQ(module_stats.rodata_segments[0].compression, "none");
+  EXPECT_EQ(module_stats.rodata_segments[1].byte_size, 8);
+  EXPECT_EQ(module_stats.rodata_segments[1].compression, "none");
+  EXPECT_EQ(module_stats.rodata_byte_size, 72);
+}
+
+TEST(ModuleStatsTest, RejectsInvalidModules) {
+  std::vector<uint8_t> module_data(64, 0xFF);
+  EXPECT_FALSE(ComputeModuleStats(module_data).ok());
+}
+
+TEST(ModuleStatsTest, Formats) {
+  ASSERT_OK_AND_ASSIGN(auto module_stats, ComputeModuleStats(BuildModule()));
+  std::string table = ModuleStatsToTable(module_stats);
+  EXPECT_NE(table.find("module: module"), std::string::npos);
+  EXPECT_NE(table.find("(stripped)"), std::string::npos);
+  std::string json = ModuleStatsToJson(module_stats);
+  EXPECT_NE(json.find("\"name\": \"main\""), std::string::npos);
+  EXPECT_NE(json.find("\"compression\": \"none\""), std::string::npos);
+}
+
+}  // namespace
+}  // namespace iree
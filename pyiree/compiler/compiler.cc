@@ -73,6 +73,26 @@ OwningModuleRef parseMLIRModuleFromString(StringRef contents,
   return mlir_module;
 }
 
+// Converts |compile_stats| to a dict of the same form as its JSON.
+py::dict CompileStatsToDict(const CompileStats& compile_stats) {
+  py::list passes;
+  for (const auto& pass_stats : compile_stats.pass_stats()) {
+    py::dict pass_dict;
+    pass_dict["pipeline"] = pass_stats.pipeline;
+    pass_dict["pass"] = pass_stats.pass_name;
+    pass_dict["runs"] = pass_stats.run_count;
+    pass_dict["wall_time_ms"] = pass_stats.wall_time_ms;
+    pass_dict["peak_memory_increase_bytes"] =
+        pass_stats.peak_memory_increase_bytes;
+    passes.append(std::move(pass_dict));
+  }
+  py::dict stats_dict;
+  stats_dict["total_wall_time_ms"] = compile_stats.total_wall_time_ms();
+  stats_dict["peak_memory_bytes"] = GetPeakResidentMemoryBytes();
+  stats_dict["passes"] = std::move(passes);
+  return stats_dict;
+}
+
 }  // namespace
 
 DiagnosticCapture::DiagnosticCapture(mlir::MLIRContext* mlir_context,
@@ -256,24 +276,68 @@ std::string CompilerModuleBundle::ToAsm(bool enableDebugInfo, bool prettyForm,
   return sout.str();
 }
 
+void CompilerModuleBundle::RunFlowPipeline(CompileStats* compile_stats) {
+  if (flow_lowered_) return;
+  mlir::PassManager pass_manager(context_->mlir_context());
+  auto crash_reproducer_path = context_->crash_reproducer_path();
+  if (crash_reproducer_path) {
+    pass_manager.enableCrashReproducerGeneration(*crash_reproducer_path);
+  }
+  if (compile_stats) compile_stats->Instrument(&pass_manager, "flow");
+  mlir::iree_compiler::IREE::Flow::buildFlowTransformPassPipeline(pass_manager);
+
+  auto diag_capture = context_->CaptureDiagnostics();
+  if (failed(pass_manager.run(module_op_))) {
+    throw RaisePyError(
+        PyExc_RuntimeError,
+        diag_capture.ConsumeDiagnosticsAsString("Error running Flow pipeline:")
+            .c_str());
+  }
+  flow_lowered_ = true;
+}
+
 std::shared_ptr<OpaqueBlob> CompilerModuleBundle::Compile(
-    BytecodeTargetOptions options, std::vector<std::string> target_backends) {
+    BytecodeTargetOptions options, std::vector<std::string> target_backends,
+    CompileStats* compile_stats) {
+  // Cache hits return the stored module without running any passes.
+  auto* compile_cache = context_->compile_cache();
+  std::string cache_key;
+  if (compile_cache) {
+    cache_key = ComputeCompileCacheKey(
+        ToAsm(/*enableDebugInfo=*/true, /*prettyForm=*/false,
+              /*largeElementLimit=*/-1),
+        options, target_backends, flow_lowered_ ? "flow" : "");
+    auto cached_module_or = compile_cache->Lookup(cache_key);
+    if (cached_module_or.ok()) {
+      return std::make_shared<OpaqueFileMappingBlob>(
+          std::move(cached_module_or).ValueOrDie());
+    }
+  }
+
   mlir::PassManager pass_manager(context_->mlir_context());
   auto crash_reproducer_path = context_->crash_reproducer_path();
   if (crash_reproducer_path) {
     pass_manager.enableCrashReproducerGeneration(*crash_reproducer_path);
   }
+  if (compile_stats) compile_stats->Instrument(&pass_manager, "compile");
   mlir::iree_compiler::IREE::HAL::ExecutableTargetOptions executable_options;
   executable_options.targets = std::move(target_backends);
 
-  mlir::iree_compiler::IREE::Flow::buildFlowTransformPassPipeline(pass_manager);
+  // The pipelines operate on a clone so that this module is left as it was,
+  // exactly as on a cache hit, and can be compiled again for other backends.
+  OwningModuleRef cloned_module = module_op_.clone();
+  ModuleOp compile_module = cloned_module.get();
+  if (!flow_lowered_) {
+    mlir::iree_compiler::IREE::Flow::buildFlowTransformPassPipeline(
+        pass_manager);
+  }
   mlir::iree_compiler::IREE::HAL::buildHALTransformPassPipeline(
       pass_manager, executable_options);
   mlir::iree_compiler::IREE::VM::buildVMTransformPassPipeline(pass_manager);
 
   // Run primary passes.
   auto diag_capture = context_->CaptureDiagnostics();
-  if (failed(pass_manager.run(module_op_))) {
+  if (failed(pass_manager.run(compile_module))) {
     throw RaisePyError(
         PyExc_RuntimeError,
         diag_capture.ConsumeDiagnosticsAsString("Error compiling IREE module:")
@@ -283,26 +347,34 @@ std::shared_ptr<OpaqueBlob> CompilerModuleBundle::Compile(
   // Run serialization.
   std::string contents;
   raw_string_ostream out(contents);
-  if (failed(mlir::iree_compiler::IREE::VM::translateModuleToBytecode(
-          module_op_, options, out))) {
-    throw RaisePyError(
-        PyExc_RuntimeError,
-        diag_capture
-            .ConsumeDiagnosticsAsString("Error serializing to flatbuffer:")
-            .c_str());
+  {
+    ScopedCompileStep step(compile_stats, "compile",
+                           "translateModuleToBytecode");
+    if (failed(mlir::iree_compiler::IREE::VM::translateModuleToBytecode(
+            compile_module, options, out))) {
+      throw RaisePyError(
+          PyExc_RuntimeError,
+          diag_capture
+              .ConsumeDiagnosticsAsString("Error serializing to flatbuffer:")
+              .c_str());
+    }
+    out.flush();
+  }
+  if (compile_cache) {
+    // Failing to populate the cache is not fatal to compilation.
+    compile_cache->Store(cache_key, out.str()).IgnoreError();
   }
-
-  out.flush();
   return std::make_shared<OpaqueStringBlob>(std::move(out.str()));
 }
 
 void CompilerModuleBundle::RunPassPipeline(
-    const std::vector<std::string>& pipelines) {
+    const std::vector<std::string>& pipelines, CompileStats* compile_stats) {
   mlir::PassManager pm(context_->mlir_context());
   auto crash_reproducer_path = context_->crash_reproducer_path();
   if (crash_reproducer_path) {
     pm.enableCrashReproducerGeneration(*crash_reproducer_path);
   }
+  if (compile_stats) compile_stats->Instrument(&pm, "pass_pipeline");
 
   // Parse the pass pipelines.
   std::string error;
@@ -334,7 +406,8 @@ void SetupCommonCompilerBindings(pybind11::module m) {
                                                     // format
             1,                                      // Number of dimensions
             {self->size()},                         // Buffer dimensions
-            {self->size()}                          // Strides
+            {self->size()},                         // Strides
+            self->read_only()                       // Read-only
         );
       })
       .def_property_readonly("bytes",
@@ -368,7 +441,32 @@ void SetupCommonCompilerBindings(pybind11::module m) {
           })
       .def_property("crash_reproducer_path",
                     &CompilerContextBundle::crash_reproducer_path,
-                    &CompilerContextBundle::set_crash_reproducer_path);
+                    &CompilerContextBundle::set_crash_reproducer_path)
+      .def(
+          "set_compile_cache",
+          [](CompilerContextBundle* self, absl::optional<std::string> directory,
+             uint64_t max_size_mb) {
+            if (!directory) {
+              self->set_compile_cache(nullptr);
+              return;
+            }
+            self->set_compile_cache(PyConsumeStatusOr(
+                CompileCache::Open(*directory, max_size_mb << 20)));
+          },
+          py::arg("directory"), py::arg("max_size_mb") = 1024)
+      .def_property_readonly(
+          "compile_cache_stats",
+          [](CompilerContextBundle* self) -> py::object {
+            auto* compile_cache = self->compile_cache();
+            if (!compile_cache) return py::none();
+            auto stats = compile_cache->stats();
+            py::dict stats_dict;
+            stats_dict["hits"] = stats.hits;
+            stats_dict["misses"] = stats.misses;
+            stats_dict["stores"] = stats.stores;
+            stats_dict["evictions"] = stats.evictions;
+            return std::move(stats_dict);
+          });
   py::enum_<BytecodeOutputFormat>(m, "OutputFormat")
       .value("FLATBUFFER_BINARY", BytecodeOutputFormat::kFlatBufferBinary)
       .value("FLATBUFFER_TEXT", BytecodeOutputFormat::kFlatBufferText)
@@ -385,11 +483,52 @@ void SetupCommonCompilerBindings(pybind11::module m) {
       .def("to_asm", &CompilerModuleBundle::ToAsm,
            py::arg("debug_info") = false, py::arg("pretty") = false,
            py::arg("large_element_limit") = -1)
-      .def("compile", &CompilerModuleBundle::Compile,
-           py::arg("options") = BytecodeTargetOptions{},
-           py::arg("target_backends") = std::vector<std::string>())
-      .def("run_pass_pipeline", &CompilerModuleBundle::RunPassPipeline,
-           py::arg("pipelines") = std::vector<std::string>());
+      .def(
+          "compile",
+          [](CompilerModuleBundle* self, BytecodeTargetOptions options,
+             std::vector<std::string> target_backends,
+             bool return_stats) -> py::object {
+            if (!return_stats) {
+              return py::cast(self->Compile(std::move(options),
+                                            std::move(target_backends)));
+            }
+            CompileStats compile_stats;
+            auto blob = self->Compile(std::move(options),
+                                      std::move(target_backends),
+                                      &compile_stats);
+            return py::make_tuple(std::move(blob),
+                                  CompileStatsToDict(compile_stats));
+          },
+          py::arg("options") = BytecodeTargetOptions{},
+          py::arg("target_backends") = std::vector<std::string>(),
+          py::arg("return_stats") = false)
+      .def(
+          "run_pass_pipeline",
+          [](CompilerModuleBundle* self,
+             const std::vector<std::string>& pipelines,
+             bool return_stats) -> py::object {
+            if (!return_stats) {
+              self->RunPassPipeline(pipelines);
+              return py::none();
+            }
+            CompileStats compile_stats;
+            self->RunPassPipeline(pipelines, &compile_stats);
+            return CompileStatsToDict(compile_stats);
+          },
+          py::arg("pipelines") = std::vector<std::string>(),
+          py::arg("return_stats") = false)
+      .def(
+          "run_flow_pipeline",
+          [](CompilerModuleBundle* self, bool return_stats) -> py::object {
+            if (!return_stats) {
+              self->RunFlowPipeline();
+              return py::none();
+            }
+            CompileStats compile_stats;
+            self->RunFlowPipeline(&compile_stats);
+            return CompileStatsToDict(compile_stats);
+          },
+          py::arg("return_stats") = false);
 }
 
 }  // namespace python
@@ -19,7 +19,11 @@
 #include <string>
 
 #include "bindings/python/pyiree/common/binding.h"
+#include "iree/base/file_mapping.h"
+#include "iree/base/ref_ptr.h"
 #include "iree/compiler/Dialect/VM/Target/Bytecode/BytecodeModuleTarget.h"
+#include "iree/tools/compile_cache.h"
+#include "iree/tools/compile_stats.h"
 #include "mlir/IR/Diagnostics.h"
 #include "mlir/IR/MLIRContext.h"
 #include "mlir/IR/Module.h"
@@ -38,6 +42,8 @@ class OpaqueBlob {
   void* data() { return data_; }
   const void* data() const { return data_; }
   size_t size() const { return size_; }
+  // Whether the contents must not be modified through data().
+  bool read_only() const { return read_only_; }
 
   // Create a free function from the OpaqueBlob shared pointer.
   using BufferFreeFn = void (*)(void* self, iree_byte_span_t);
@@ -76,6 +82,7 @@ class OpaqueBlob {
  protected:
   void* data_;
   size_t size_;
+  bool read_only_ = false;
 };
 
 // Opaque blob that owns a vector.
@@ -102,6 +109,21 @@ class OpaqueStringBlob : public OpaqueBlob {
   std::string s_;
 };
 
+// Opaque blob that owns a read-only file mapping (such as a compile cache
+// entry). The mapping is not writable so the blob is read_only().
+class OpaqueFileMappingBlob : public OpaqueBlob {
+ public:
+  OpaqueFileMappingBlob(ref_ptr<FileMapping> mapping)
+      : OpaqueBlob(), mapping_(std::move(mapping)) {
+    data_ = const_cast<uint8_t*>(mapping_->data().data());
+    size_ = mapping_->data().size();
+    read_only_ = true;
+  }
+
+ private:
+  ref_ptr<FileMapping> mapping_;
+};
+
 class CompilerContextBundle;
 class CompilerModuleBundle;
 
@@ -117,16 +139,29 @@ class CompilerModuleBundle {
                     int64_t largeElementLimit);
 
   // Runs one or more pass pipelines (as is mlir::parsePassPipeline).
-  void RunPassPipeline(const std::vector<std::string>& pipelines);
-
-  // Compile to a VM module.
+  // If |compile_stats| is provided the time and memory of each pass is
+  // recorded into it.
+  void RunPassPipeline(const std::vector<std::string>& pipelines,
+                       CompileStats* compile_stats = nullptr);
+
+  // Runs the target independent Flow transformation pipeline in place.
+  // Once run, Compile() only runs the backend specific pipelines, so that the
+  // module can be compiled for additional backends without repeating the Flow
+  // work.
+  void RunFlowPipeline(CompileStats* compile_stats = nullptr);
+
+  // Compile to a VM module. The pipelines run on a clone and this module is
+  // left unchanged, whether or not the result comes from the compile cache.
   std::shared_ptr<OpaqueBlob> Compile(
       mlir::iree_compiler::IREE::VM::BytecodeTargetOptions options,
-      std::vector<std::string> target_backends);
+      std::vector<std::string> target_backends,
+      CompileStats* compile_stats = nullptr);
 
  private:
   std::shared_ptr<CompilerContextBundle> context_;
   mlir::ModuleOp module_op_;
+  // Whether RunFlowPipeline() has been run on |module_op_|.
+  bool flow_lowered_ = false;
 };
 
 // Registers to receive diagnostics for a scope.
@@ -203,6 +238,13 @@ class CompilerContextBundle
     crash_reproducer_path_ = std::move(crash_reproducer_path);
   }
 
+  // On-disk cache of compiled modules used by CompilerModuleBundle::Compile.
+  // Disabled (nullptr) by default.
+  CompileCache* compile_cache() { return compile_cache_.get(); }
+  void set_compile_cache(std::unique_ptr<CompileCache> compile_cache) {
+    compile_cache_ = std::move(compile_cache);
+  }
+
  private:
   static std::mutex static_config_lock_;
   static absl::optional<std::string> default_crash_reproducer_path_;
@@ -210,6 +252,7 @@ class CompilerContextBundle
   mlir::MLIRContext mlir_context_;
   DiagnosticCapture default_capture_;
   absl::optional<std::string> crash_reproducer_path_;
+  std::unique_ptr<CompileCache> compile_cache_;
 };
 
 void SetupCommonCompilerBindings(pybind11::module m);
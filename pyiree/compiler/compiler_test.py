@@ -13,6 +13,9 @@
 # See the License for the specific language governing permissions and
 # limitations under the License.
 
+import os
+import tempfile
+
 from absl.testing import absltest
 from pyiree import compiler
 
@@ -58,6 +61,52 @@ class CompilerTest(absltest.TestCase):
     text = blob.text
     self.assertTrue(text)
 
+  def testCompileAfterFlowPipeline(self):
+    ctx = compiler.Context()
+    input_module = ctx.parse_asm(SIMPLE_MUL_ASM)
+    input_module.run_flow_pipeline()
+    flow_asm = input_module.to_asm()
+    first_binary = input_module.compile()
+    # The module stays at the Flow level and can be compiled again.
+    self.assertEqual(flow_asm, input_module.to_asm())
+    second_binary = input_module.compile()
+    self.assertTrue(first_binary.bytes)
+    self.assertEqual(first_binary.bytes, second_binary.bytes)
+
+  def testCompileCache(self):
+    ctx = compiler.Context()
+    ctx.set_compile_cache(
+        os.path.join(tempfile.mkdtemp(), "compile_cache"), max_size_mb=16)
+    first_module = ctx.parse_asm(SIMPLE_MUL_ASM)
+    input_asm = first_module.to_asm()
+    first_binary = first_module.compile()
+    second_module = ctx.parse_asm(SIMPLE_MUL_ASM)
+    second_binary = second_module.compile()
+    self.assertEqual(first_binary.bytes, second_binary.bytes)
+    # Neither a miss nor a hit modifies the compiled module.
+    self.assertEqual(input_asm, first_module.to_asm())
+    self.assertEqual(input_asm, second_module.to_asm())
+    # Hits are backed by the read-only cache entry.
+    self.assertFalse(memoryview(first_binary).readonly)
+    self.assertTrue(memoryview(second_binary).readonly)
+    stats = ctx.compile_cache_stats
+    self.assertEqual(1, stats["misses"])
+    self.assertEqual(1, stats["hits"])
+    self.assertEqual(1, stats["stores"])
+
+  def testCompileStats(self):
+    ctx = compiler.Context()
+    input_module = ctx.parse_asm(SIMPLE_MUL_ASM)
+    binary, stats = input_module.compile(return_stats=True)
+    self.assertTrue(binary.bytes)
+    self.assertTrue(stats["passes"])
+    self.assertGreaterEqual(stats["total_wall_time_ms"], 0)
+    pass_names = [p["pass"] for p in stats["passes"]]
+    self.assertIn("translateModuleToBytecode", pass_names)
+    for pass_stats in stats["passes"]:
+      self.assertEqual("compile", pass_stats["pipeline"])
+      self.assertGreaterEqual(pass_stats["runs"], 1)
+
 
 if __name__ == "__main__":
   absltest.main()
@@ -24,10 +24,12 @@ from . import binding
 # FunctionAbi imports
 from .binding import FunctionAbi
 # Hal imports
-from .binding import BufferUsage, HalBuffer, HalDevice, HalDriver, MemoryAccess, MemoryType, Shape
+from .binding import BufferPlacement, BufferUsage, HalBuffer, HalBufferPool, HalDevice, HalDriver, MemoryAccess, MemoryType, Shape
 # HostTypeFactory imports
-from .binding import HostTypeFactory
+from .binding import DlpackTensor, HostTypeFactory, from_dlpack
 # Vm imports
 from .binding import create_hal_module, Linkage, VmVariantList, VmFunction, VmInstance, VmContext, VmModule
+# Tracing (flush(path) writes a WTF trace of the zones recorded so far)
+from .binding import tracing
 # SystemApi
 from .system_api import *
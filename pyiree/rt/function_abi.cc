@@ -14,6 +14,9 @@
 
 #include "bindings/python/pyiree/rt/function_abi.h"
 
+#include <algorithm>
+#include <cstring>
+
 #include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
 #include "absl/types/span.h"
@@ -22,6 +25,7 @@
 #include "bindings/python/pyiree/rt/vm.h"
 #include "iree/base/api.h"
 #include "iree/base/signature_mangle.h"
+#include "iree/base/tracing.h"
 #include "iree/hal/api.h"
 #include "iree/modules/hal/hal_module.h"
 #include "iree/vm/ref.h"
@@ -49,37 +53,63 @@ std::unique_ptr<FunctionAbi> PyCreateAbi(
   return FunctionAbi::Create(device, std::move(host_type_factory), lookup);
 }
 
-VmVariantList PyRawPack(FunctionAbi* self,
-                        absl::Span<const FunctionAbi::Description> descs,
-                        py::sequence py_args, bool writable) {
-  if (py_args.size() != descs.size()) {
+// Packs py_args into an existing (reset) f_args list. The list must have
+// been created with sufficient capacity for all args.
+void PyRawPackInto(FunctionAbi* self,
+                   absl::Span<const FunctionAbi::Value> values,
+                   py::sequence py_args, VmVariantList& f_args,
+                   bool writable) {
+  if (py_args.size() != values.size()) {
     throw RaiseValueError("Mismatched pack arity");
   }
+  if (f_args.capacity() < py_args.size()) {
+    throw RaiseValueError("Variant list capacity too small for pack");
+  }
 
-  VmVariantList f_args = VmVariantList::Create(py_args.size());
+  f_args.Reset();
   absl::InlinedVector<py::handle, 8> local_py_args(py_args.begin(),
                                                    py_args.end());
-  self->RawPack(descs, absl::MakeSpan(local_py_args), f_args, writable);
+  self->RawPack(values, absl::MakeSpan(local_py_args), f_args, writable);
+}
+
+VmVariantList PyRawPack(FunctionAbi* self,
+                        absl::Span<const FunctionAbi::Value> values,
+                        py::sequence py_args, bool writable) {
+  VmVariantList f_args = VmVariantList::Create(py_args.size());
+  PyRawPackInto(self, values, py_args, f_args, writable);
   return f_args;
 }
 
-VmVariantList PyAllocateResults(FunctionAbi* self, VmVariantList& f_args,
-                                bool static_alloc) {
-  auto f_results = VmVariantList::Create(self->raw_result_arity());
+// Resets an existing f_results list and (optionally) allocates results into
+// it. The list must have been created with capacity for all results.
+void PyAllocateResultsInto(FunctionAbi* self, VmVariantList& f_args,
+                           VmVariantList& f_results, bool static_alloc) {
+  if (f_results.capacity() < self->raw_result_arity()) {
+    throw RaiseValueError("Variant list capacity too small for results");
+  }
+
+  f_results.Reset();
   if (static_alloc) {
     // For static dispatch, attempt to fully allocate and perform shape
     // inference.
-    self->AllocateResults(absl::MakeConstSpan(self->raw_config().results),
-                          f_args, f_results);
+    self->AllocateResults(absl::MakeConstSpan(self->plan().results), f_args,
+                          f_results);
   }
+}
+
+VmVariantList PyAllocateResults(FunctionAbi* self, VmVariantList& f_args,
+                                bool static_alloc) {
+  auto f_results = VmVariantList::Create(self->raw_result_arity());
+  PyAllocateResultsInto(self, f_args, f_results, static_alloc);
   return f_results;
 }
 
-py::object PyRawUnpackResults(FunctionAbi* self, VmVariantList& f_args) {
+py::object PyRawUnpackResults(FunctionAbi* self, VmVariantList& f_results,
+                              VmVariantList* f_args) {
   absl::InlinedVector<py::object, 4> py_results;
-  py_results.resize(f_args.size());
-  self->RawUnpack(absl::MakeConstSpan(self->raw_config().results), f_args,
-                  absl::MakeSpan(py_results));
+  py_results.resize(f_results.size());
+  self->RawUnpack(absl::MakeConstSpan(self->plan().results), f_results,
+                  absl::MakeSpan(py_results), f_args);
   py::tuple py_result_tuple(py_results.size());
   for (size_t i = 0, e = py_results.size(); i < e; ++i) {
     py_result_tuple[i] = std::move(py_results[i]);
@@ -87,17 +117,42 @@ py::object PyRawUnpackResults(FunctionAbi* self, VmVariantList& f_args) {
   return py_result_tuple;
 }
 
+// Minimum alignment of host memory imported by PackBuffer. Executables may
+// assume their buffers are at least this aligned.
+constexpr uintptr_t kHostBufferImportAlignment = 16;
+
 // RAII wrapper for a Py_buffer which calls PyBuffer_Release when it goes
-// out of scope.
+// out of scope, unless ownership has been transferred with Cancel().
 class PyBufferReleaser {
  public:
   PyBufferReleaser(Py_buffer& b) : b_(b) {}
-  ~PyBufferReleaser() { PyBuffer_Release(&b_); }
+  ~PyBufferReleaser() {
+    if (!cancelled_) PyBuffer_Release(&b_);
+  }
+  void Cancel() { cancelled_ = true; }
 
  private:
   Py_buffer& b_;
+  bool cancelled_ = false;
 };
 
+// Returns a data allocator for a HAL buffer wrapping the memory of |py_view|
+// that releases a copy of the view when the buffer is destroyed, so that the
+// exporting object stays alive exactly as long as the buffer does.
+iree_allocator_t CreateHostBufferDeallocator(const Py_buffer& py_view) {
+  Py_buffer* owned_view = new Py_buffer(py_view);
+  auto free_fn = +([](void* self, void*) -> iree_status_t {
+    // The last reference to the buffer may be released on any thread, such
+    // as while the GIL is released for an invocation.
+    py::gil_scoped_acquire acquire;
+    Py_buffer* owned_view = static_cast<Py_buffer*>(self);
+    PyBuffer_Release(owned_view);
+    delete owned_view;
+    return IREE_STATUS_OK;
+  });
+  return {owned_view /* self */, nullptr /* alloc */, free_fn /* free */};
+}
+
 pybind11::error_already_set RaiseBufferMismatchError(
     std::string message, py::handle obj,
     const RawSignatureParser::Description& desc) {
@@ -112,10 +167,12 @@ pybind11::error_already_set RaiseBufferMismatchError(
 }
 
 // Verifies and maps the py buffer shape and layout to the bound argument.
-// Returns false if not compatible.
-void MapBufferAttrs(Py_buffer& py_view,
-                    const RawSignatureParser::Description& desc,
-                    absl::InlinedVector<int, 2>& dynamic_dims) {
+// Throws if not compatible. Sets |is_contiguous| if the buffer is laid out
+// in C order (and can be used or copied as is) rather than only strided.
+void MapBufferAttrs(Py_buffer& py_view, const MarshallingPlan::Value& value,
+                    absl::InlinedVector<int, 2>& dynamic_dims,
+                    bool& is_contiguous) {
+  const auto& desc = value.desc;
   // Verify that rank matches.
   if (py_view.ndim != desc.dims.size()) {
     throw RaiseBufferMismatchError(
@@ -125,25 +182,21 @@ void MapBufferAttrs(Py_buffer& py_view,
   }
 
   // Verify that the item size matches.
-  size_t f_item_size =
-      AbiConstants::kScalarTypeSize[static_cast<int>(desc.buffer.scalar_type)];
-  if (f_item_size != py_view.itemsize) {
+  if (value.item_size != py_view.itemsize) {
     throw RaiseBufferMismatchError(
         absl::StrCat("Mismatched buffer item size (received: ",
-                     py_view.itemsize, ", expected: ", f_item_size, "): "),
+                     py_view.itemsize, ", expected: ", value.item_size, "): "),
         py::handle(py_view.obj), desc);
   }
 
   // Note: The python buffer format does not map precisely to IREE's type
   // system, so the below is only advisory for where they do match. Otherwise,
   // it is basically a bitcast.
-  const char* f_expected_format =
-      kScalarTypePyFormat[static_cast<int>(desc.buffer.scalar_type)];
-  if (f_expected_format != nullptr &&
-      strcmp(f_expected_format, py_view.format) != 0) {
+  if (value.py_format != nullptr &&
+      strcmp(value.py_format, py_view.format) != 0) {
     throw RaiseBufferMismatchError(
         absl::StrCat("Mismatched buffer format (received: ", py_view.format,
-                     ", expected: ", f_expected_format, "): "),
+                     ", expected: ", value.py_format, "): "),
         py::handle(py_view.obj), desc);
   }
 
@@ -162,28 +215,205 @@ void MapBufferAttrs(Py_buffer& py_view,
           py::handle(py_view.obj), desc);
     }
   }
+
+  // Verify the layout. Any strides (including negative and zero strides of
+  // reversed and broadcast views) can be packed, but indirect buffers cannot.
+  if (py_view.suboffsets) {
+    throw RaiseBufferMismatchError("Indirect buffers are not supported: ",
+                                   py::handle(py_view.obj), desc);
+  }
+  is_contiguous = true;
+  if (py_view.strides) {
+    py::ssize_t expected_stride = py_view.itemsize;
+    for (int i = py_view.ndim - 1; i >= 0; --i) {
+      // Strides of unit dimensions are never used to address memory.
+      if (py_view.shape[i] != 1 && py_view.strides[i] != expected_stride) {
+        is_contiguous = false;
+        break;
+      }
+      expected_stride *= py_view.shape[i];
+    }
+  }
+}
+
+// Strided layout of an array with unit dimensions removed and adjacent
+// dimensions that can be addressed as one merged.
+struct StridedLayout {
+  absl::InlinedVector<py::ssize_t, 6> shape;
+  absl::InlinedVector<py::ssize_t, 6> strides;
+
+  static StridedLayout FromView(const Py_buffer& py_view) {
+    StridedLayout layout;
+    for (int i = 0; i < py_view.ndim; ++i) {
+      if (py_view.shape[i] == 1) continue;
+      if (!layout.shape.empty() &&
+          layout.strides.back() == py_view.strides[i] * py_view.shape[i]) {
+        layout.shape.back() *= py_view.shape[i];
+        layout.strides.back() = py_view.strides[i];
+        continue;
+      }
+      layout.shape.push_back(py_view.shape[i]);
+      layout.strides.push_back(py_view.strides[i]);
+    }
+    return layout;
+  }
+};
+
+// Gathers |count| elements |src_stride| bytes apart into contiguous |dst|.
+template <typename T>
+void GatherRow(const uint8_t* src, py::ssize_t src_stride, py::ssize_t count,
+               uint8_t* dst) {
+  T* typed_dst = reinterpret_cast<T*>(dst);
+  for (py::ssize_t i = 0; i < count; ++i) {
+    std::memcpy(&typed_dst[i], src + i * src_stride, sizeof(T));
+  }
+}
+
+// Copies a |rows| x |cols| matrix whose columns are contiguous and whose
+// elements along a row are |col_stride| bytes apart (such as a transposed
+// view) into row-major |dst|. The copy is tiled so that the contiguous reads
+// and strided writes of a tile stay in cache.
+template <typename T>
+void TransposeTiled(const uint8_t* src, py::ssize_t rows, py::ssize_t cols,
+                    py::ssize_t col_stride, uint8_t* dst) {
+  constexpr py::ssize_t kTileSize = 32;
+  T* typed_dst = reinterpret_cast<T*>(dst);
+  for (py::ssize_t row_tile = 0; row_tile < rows; row_tile += kTileSize) {
+    py::ssize_t row_end = std::min(row_tile + kTileSize, rows);
+    for (py::ssize_t col_tile = 0; col_tile < cols; col_tile += kTileSize) {
+      py::ssize_t col_end = std::min(col_tile + kTileSize, cols);
+      for (py::ssize_t col = col_tile; col < col_end; ++col) {
+        const uint8_t* src_col = src + col * col_stride;
+        for (py::ssize_t row = row_tile; row < row_end; ++row) {
+          std::memcpy(&typed_dst[row * cols + col], src_col + row * sizeof(T),
+                      sizeof(T));
+        }
+      }
+    }
+  }
+}
+
+// Element of arbitrary size for the kernels above.
+template <size_t kSize>
+struct Element {
+  uint8_t bytes[kSize];
+};
+
+// Packs one block of the innermost dimension(s) via a kernel specialized for
+// |element_size|.
+void PackBlock(size_t element_size, bool transpose, const uint8_t* src,
+               py::ssize_t rows, py::ssize_t cols, py::ssize_t col_stride,
+               uint8_t* dst) {
+#define IREE_PACK_BLOCK_CASE(size)                                     \
+  case size:                                                           \
+    if (transpose) {                                                   \
+      TransposeTiled<Element<size>>(src, rows, cols, col_stride, dst); \
+    } else {                                                           \
+      GatherRow<Element<size>>(src, col_stride, cols, dst);            \
+    }                                                                  \
+    return;
+  switch (element_size) {
+    IREE_PACK_BLOCK_CASE(1);
+    IREE_PACK_BLOCK_CASE(2);
+    IREE_PACK_BLOCK_CASE(4);
+    IREE_PACK_BLOCK_CASE(8);
+    IREE_PACK_BLOCK_CASE(16);
+    default:
+      break;
+  }
+#undef IREE_PACK_BLOCK_CASE
+  for (py::ssize_t row = 0; row < rows; ++row) {
+    for (py::ssize_t col = 0; col < cols; ++col) {
+      std::memcpy(dst + (row * cols + col) * element_size,
+                  src + row * (transpose ? element_size : 0) + col * col_stride,
+                  element_size);
+    }
+  }
+}
+
+// Packs the elements of the strided |py_view| into |dst| in C order in a
+// single pass. Runs of contiguous elements are copied with memcpy, and the
+// innermost one (gather) or two (transpose) strided dimensions with a kernel.
+void PackStrided(const Py_buffer& py_view, uint8_t* dst) {
+  auto layout = StridedLayout::FromView(py_view);
+  const auto* src = static_cast<const uint8_t*>(py_view.buf);
+  size_t element_size = py_view.itemsize;
+  for (auto dim : layout.shape) {
+    if (dim == 0) return;
+  }
+  if (layout.shape.empty()) {
+    std::memcpy(dst, src, element_size);
+    return;
+  }
+
+  int rank = layout.shape.size();
+  py::ssize_t cols = layout.shape[rank - 1];
+  py::ssize_t col_stride = layout.strides[rank - 1];
+  bool transpose = rank >= 2 && col_stride != element_size &&
+                   layout.strides[rank - 2] == element_size;
+  py::ssize_t rows = transpose ? layout.shape[rank - 2] : 1;
+  int outer_rank = rank - (transpose ? 2 : 1);
+  size_t block_size = rows * cols * element_size;
+
+  absl::InlinedVector<py::ssize_t, 6> index(outer_rank, 0);
+  while (true) {
+    if (!transpose && col_stride == element_size) {
+      std::memcpy(dst, src, block_size);
+    } else {
+      PackBlock(element_size, transpose, src, rows, cols, col_stride, dst);
+    }
+    dst += block_size;
+
+    // Advance to the next block in C order.
+    int dim = outer_rank - 1;
+    for (; dim >= 0; --dim) {
+      src += layout.strides[dim];
+      if (++index[dim] < layout.shape[dim]) break;
+      src -= layout.strides[dim] * layout.shape[dim];
+      index[dim] = 0;
+    }
+    if (dim < 0) break;
+  }
 }
 
 }  // namespace
 
 //------------------------------------------------------------------------------
-// FunctionAbi
+// MarshallingPlan
 //------------------------------------------------------------------------------
 
-std::string FunctionAbi::DebugString() const {
-  RawSignatureParser p;
-  auto s = p.FunctionSignatureToString(raw_config_.signature);
-  if (!s) {
-    return "<FunctionAbi NO_DEBUG_INFO>";
+namespace {
+
+MarshallingPlan::Value PlanValue(const RawSignatureParser::Description& desc) {
+  MarshallingPlan::Value value;
+  value.desc = desc;
+  value.type = desc.type;
+  if (desc.type != RawSignatureParser::Type::kBuffer) return value;
+
+  value.scalar_type = desc.buffer.scalar_type;
+  int scalar_type_index = static_cast<int>(desc.buffer.scalar_type);
+  value.item_size = AbiConstants::kScalarTypeSize[scalar_type_index];
+  value.py_format = kScalarTypePyFormat[scalar_type_index];
+  iree_device_size_t byte_size = value.item_size;
+  for (auto dim : desc.dims) {
+    if (dim < 0) {
+      value.has_dynamic_dims = true;
+      break;
+    }
+    byte_size *= dim;
   }
-  return absl::StrCat("<FunctionAbi ", *s, ">");
+  if (!value.has_dynamic_dims) {
+    value.byte_size = byte_size;
+    value.allocation = MarshallingPlan::ResultAllocation::kStatic;
+  }
+  return value;
 }
 
-std::unique_ptr<FunctionAbi> FunctionAbi::Create(
-    HalDevice& device, std::shared_ptr<HostTypeFactory> host_type_factory,
+}  // namespace
+
+std::shared_ptr<const MarshallingPlan> MarshallingPlan::Create(
     AttributeLookup lookup) {
-  auto abi =
-      absl::make_unique<FunctionAbi>(device, std::move(host_type_factory));
+  auto plan = std::make_shared<MarshallingPlan>();
 
   // Fetch key attributes for the raw ABI.
   auto raw_version = lookup("fv");
@@ -198,15 +428,17 @@ std::unique_ptr<FunctionAbi> FunctionAbi::Create(
   }
 
   // Parse signature.
-  abi->raw_config().signature = std::string(*raw_fsig_str);
+  plan->raw_config.signature = std::string(*raw_fsig_str);
   RawSignatureParser raw_parser;
   raw_parser.VisitInputs(*raw_fsig_str,
-                         [&abi](const RawSignatureParser::Description& d) {
-                           abi->raw_config().inputs.push_back(d);
+                         [&plan](const RawSignatureParser::Description& d) {
+                           plan->raw_config.inputs.push_back(d);
+                           plan->inputs.push_back(PlanValue(d));
                          });
   raw_parser.VisitResults(*raw_fsig_str,
-                          [&abi](const RawSignatureParser::Description& d) {
-                            abi->raw_config().results.push_back(d);
+                          [&plan](const RawSignatureParser::Description& d) {
+                            plan->raw_config.results.push_back(d);
+                            plan->results.push_back(PlanValue(d));
                           });
   if (raw_parser.GetError()) {
     auto message = absl::StrCat(
@@ -216,21 +448,42 @@ std::unique_ptr<FunctionAbi> FunctionAbi::Create(
   }
 
   // TODO(laurenzo): Detect sip ABI and add a translation layer.
-  return abi;
+  return plan;
 }
 
-void FunctionAbi::RawPack(absl::Span<const Description> descs,
+//------------------------------------------------------------------------------
+// FunctionAbi
+//------------------------------------------------------------------------------
+
+std::string FunctionAbi::DebugString() const {
+  RawSignatureParser p;
+  auto s = p.FunctionSignatureToString(raw_config().signature);
+  if (!s) {
+    return "<FunctionAbi NO_DEBUG_INFO>";
+  }
+  return absl::StrCat("<FunctionAbi ", *s, ">");
+}
+
+std::unique_ptr<FunctionAbi> FunctionAbi::Create(
+    HalDevice& device, std::shared_ptr<HostTypeFactory> host_type_factory,
+    AttributeLookup lookup) {
+  return absl::make_unique<FunctionAbi>(device, std::move(host_type_factory),
+                                        MarshallingPlan::Create(lookup));
+}
+
+void FunctionAbi::RawPack(absl::Span<const Value> values,
                           absl::Span<py::handle> py_args, VmVariantList& f_args,
                           bool writable) {
-  if (descs.size() != py_args.size()) {
+  IREE_TRACE_SCOPE0("FunctionAbi#RawPack");
+  if (values.size() != py_args.size()) {
     throw RaiseValueError("Mismatched RawPack() input arity");
   }
 
-  for (size_t i = 0, e = descs.size(); i < e; ++i) {
-    const Description& desc = descs[i];
-    switch (desc.type) {
+  for (size_t i = 0, e = values.size(); i < e; ++i) {
+    const Value& value = values[i];
+    switch (value.type) {
       case RawSignatureParser::Type::kBuffer:
-        PackBuffer(desc, py_args[i], f_args, writable);
+        PackBuffer(value, py_args[i], f_args, writable);
         break;
       case RawSignatureParser::Type::kRefObject:
         throw RaisePyError(PyExc_NotImplementedError,
@@ -243,17 +496,20 @@ void FunctionAbi::RawPack(absl::Span<const Description> descs,
   }
 }
 
-void FunctionAbi::RawUnpack(absl::Span<const Description> descs,
+void FunctionAbi::RawUnpack(absl::Span<const Value> values,
                             VmVariantList& f_results,
-                            absl::Span<py::object> py_results) {
-  if (descs.size() != f_results.size() || descs.size() != py_results.size()) {
+                            absl::Span<py::object> py_results,
+                            VmVariantList* f_args) {
+  IREE_TRACE_SCOPE0("FunctionAbi#RawUnpack");
+  if (values.size() != f_results.size() ||
+      values.size() != py_results.size()) {
     throw RaiseValueError("Mismatched RawUnpack() result arity");
   }
-  for (size_t i = 0, e = descs.size(); i < e; ++i) {
-    const Description& desc = descs[i];
+  for (size_t i = 0, e = values.size(); i < e; ++i) {
+    const Value& value = values[i];
     iree_vm_variant_t* f_result =
         iree_vm_variant_list_get(f_results.raw_ptr(), i);
-    switch (desc.type) {
+    switch (value.type) {
       case RawSignatureParser::Type::kBuffer: {
         iree_hal_buffer* raw_buffer = iree_hal_buffer_deref(&f_result->ref);
         if (!raw_buffer) {
@@ -263,9 +519,30 @@ void FunctionAbi::RawUnpack(absl::Span<const Description> descs,
         // TODO(laurenzo): In the case of dynamic dims, the full dims will
         // need to be splied together based on known static dims and dynamic
         // dims from a subsequent result.
-        absl::Span<const int> dims = absl::MakeSpan(desc.dims);
+        absl::Span<const int> dims = absl::MakeSpan(value.desc.dims);
+        // Pooled result buffers are handed over to the ndarray.
         py_results[i] = host_type_factory_->CreateImmediateNdarray(
-            desc.buffer.scalar_type, dims, std::move(buffer));
+            value.scalar_type, dims, std::move(buffer),
+            f_results.TakePooledBuffer(raw_buffer));
+        if (f_args) {
+          Py_buffer py_view;
+          if (PyObject_GetBuffer(py_results[i].ptr(), &py_view,
+                                 PyBUF_SIMPLE) != 0) {
+            throw py::error_already_set();
+          }
+          bool aliases_args = f_args->AliasesHostBuffer(py_view.buf,
+                                                        py_view.len);
+          // Pooled argument buffers the result shares must not be recycled
+          // with the arguments.
+          f_args->DropPooledBuffersAliasing(raw_buffer, py_view.buf,
+                                            py_view.len);
+          PyBuffer_Release(&py_view);
+          if (aliases_args) {
+            // The function returned (part of) an imported argument.
+            py_results[i] = py_results[i].attr("copy")();
+            ++copied_buffer_count_;
+          }
+        }
         break;
       }
       case RawSignatureParser::Type::kRefObject:
@@ -279,45 +556,47 @@ void FunctionAbi::RawUnpack(absl::Span<const Description> descs,
   }
 }
 
-void FunctionAbi::AllocateResults(absl::Span<const Description> descs,
+void FunctionAbi::AllocateResults(absl::Span<const Value> values,
                                   VmVariantList& f_args,
                                   VmVariantList& f_results) {
-  if (f_args.size() != raw_config().inputs.size()) {
+  IREE_TRACE_SCOPE0("FunctionAbi#AllocateResults");
+  if (f_args.size() != raw_input_arity()) {
     throw RaiseValueError("Mismatched AllocatResults() input arity");
   }
 
-  for (size_t i = 0, e = descs.size(); i < e; ++i) {
-    const Description& desc = descs[i];
-    iree_device_size_t alloc_size =
-        AbiConstants::kScalarTypeSize[static_cast<int>(
-            desc.buffer.scalar_type)];
-    switch (desc.type) {
+  for (size_t i = 0, e = values.size(); i < e; ++i) {
+    const Value& value = values[i];
+    switch (value.type) {
       case RawSignatureParser::Type::kBuffer: {
-        for (auto dim : desc.dims) {
-          if (dim < 0) {
-            // If there is a dynamic dim, fallback to completely func allocated
-            // result. This is the worst case because it will force a
-            // pipeline stall.
-            // TODO(laurenzo): Invoke shape resolution function if available
-            // to allocate full result.
-            f_results.AppendNullRef();
-          }
-          alloc_size *= dim;
+        if (value.allocation == MarshallingPlan::ResultAllocation::kDeferred) {
+          // If there is a dynamic dim, fallback to completely func allocated
+          // result. This is the worst case because it will force a
+          // pipeline stall.
+          // TODO(laurenzo): Invoke shape resolution function if available
+          // to allocate full result.
+          f_results.AppendNullRef();
+          break;
         }
 
         // Static cases are easy.
         iree_hal_buffer_t* raw_buffer;
-        CheckApiStatus(iree_hal_allocator_allocate_buffer(
-                           device_.allocator(),
-                           static_cast<iree_hal_memory_type_t>(
-                               IREE_HAL_MEMORY_TYPE_DEVICE_LOCAL |
-                               IREE_HAL_MEMORY_TYPE_HOST_VISIBLE),
-                           IREE_HAL_BUFFER_USAGE_ALL, alloc_size, &raw_buffer),
-                       "Error allocating host visible buffer");
+        if (buffer_pool_) {
+          raw_buffer = buffer_pool_->Acquire(value.byte_size).steal_raw_ptr();
+        } else {
+          CheckApiStatus(iree_hal_allocator_allocate_buffer(
+                             device_.allocator(),
+                             MemoryTypeForPlacement(placement_),
+                             IREE_HAL_BUFFER_USAGE_ALL, value.byte_size,
+                             &raw_buffer),
+                         "Error allocating result buffer");
+        }
         iree_vm_ref_t buffer_ref = iree_hal_buffer_move_ref(raw_buffer);
         CheckApiStatus(iree_vm_variant_list_append_ref_move(f_results.raw_ptr(),
                                                             &buffer_ref),
                        "Error moving buffer");
+        if (buffer_pool_) {
+          f_results.RetainPooledBuffer(raw_buffer, buffer_pool_);
+        }
         break;
       }
       case RawSignatureParser::Type::kRefObject:
@@ -331,17 +610,24 @@ void FunctionAbi::AllocateResults(absl::Span<const Description> descs,
   }
 }
 
-void FunctionAbi::PackBuffer(const RawSignatureParser::Description& desc,
-                             py::handle py_arg, VmVariantList& f_args,
-                             bool writable) {
+void FunctionAbi::PackBuffer(const Value& value, py::handle py_arg,
+                             VmVariantList& f_args, bool writable) {
+  // DLPack capsules are consumed into an object viewing their memory, which
+  // is then packed like any other buffer.
+  py::object dlpack_tensor;
+  if (IsDlpackCapsule(py_arg)) {
+    dlpack_tensor = ImportDlpackCapsule(py_arg);
+    py_arg = dlpack_tensor;
+  }
+
   // Request a view of the buffer (use the raw python C API to avoid some
   // allocation and copying at the pybind level).
   Py_buffer py_view;
-  // Note that only C-Contiguous ND-arrays are presently supported, so
-  // only request that via PyBUF_ND. Long term, we should consult an
-  // "oracle" in the runtime to determine the precise required format and
-  // set flags accordingly (and fallback/copy on failure).
-  int flags = PyBUF_FORMAT | PyBUF_ND;
+  // Strided views (such as transposes and slices) are accepted and packed
+  // into C order. Long term, we should consult an "oracle" in the runtime to
+  // determine the precise required format and set flags accordingly (and
+  // fallback/copy on failure).
+  int flags = PyBUF_FORMAT | PyBUF_STRIDES;
   if (writable) {
     flags |= PyBUF_WRITABLE;
   }
@@ -353,47 +639,77 @@ void FunctionAbi::PackBuffer(const RawSignatureParser::Description& desc,
   }
   PyBufferReleaser py_view_releaser(py_view);
 
-  // Whether the py object needs to be retained with the argument.
-  // Should be set to true if directly mapping, false if copied.
-  bool depends_on_pyobject = false;
-
   // Verify compatibility.
   absl::InlinedVector<int, 2> dynamic_dims;
-  MapBufferAttrs(py_view, desc, dynamic_dims);
+  bool is_contiguous = false;
+  MapBufferAttrs(py_view, value, dynamic_dims, is_contiguous);
   if (!dynamic_dims.empty()) {
     throw RaisePyError(PyExc_NotImplementedError,
                        "Dynamic argument dimensions not implemented");
   }
 
-  // Allocate a HalBuffer.
-  // This is hard-coded to C-contiguous right now.
-  // TODO(laurenzo): Expand to other layouts as needed.
-  // TODO(laurenzo): Wrap and retain original buffer (depends_on_pyobject=true).
+  // Host memory is wrapped directly when the device can access it and it is
+  // contiguous and sufficiently aligned; otherwise it is copied (packing
+  // strided layouts into C order) into a new HalBuffer.
+  bool depends_on_pyobject =
+      import_host_buffers_ && is_contiguous &&
+      reinterpret_cast<uintptr_t>(py_view.buf) % kHostBufferImportAlignment ==
+          0;
   iree_hal_buffer_t* raw_buffer;
-  CheckApiStatus(iree_hal_allocator_allocate_buffer(
-                     device_.allocator(),
-                     static_cast<iree_hal_memory_type_t>(
-                         IREE_HAL_MEMORY_TYPE_HOST_LOCAL |
-                         IREE_HAL_MEMORY_TYPE_DEVICE_VISIBLE),
-                     IREE_HAL_BUFFER_USAGE_ALL, py_view.len, &raw_buffer),
-                 "Failed to allocate device visible buffer");
-  CheckApiStatus(
-      iree_hal_buffer_write_data(raw_buffer, 0, py_view.buf, py_view.len),
-      "Error writing to input buffer");
+  if (depends_on_pyobject) {
+    iree_byte_span_t contents{static_cast<uint8_t*>(py_view.buf),
+                              static_cast<iree_host_size_t>(py_view.len)};
+    iree_allocator_t deallocator = CreateHostBufferDeallocator(py_view);
+    iree_status_t status = iree_hal_heap_buffer_wrap(
+        static_cast<iree_hal_memory_type_t>(
+            IREE_HAL_MEMORY_TYPE_HOST_LOCAL |
+            IREE_HAL_MEMORY_TYPE_DEVICE_VISIBLE),
+        writable ? IREE_HAL_MEMORY_ACCESS_ALL : IREE_HAL_MEMORY_ACCESS_READ,
+        IREE_HAL_BUFFER_USAGE_ALL, contents, deallocator, &raw_buffer);
+    if (status != IREE_STATUS_OK) {
+      // The view was not transferred and is released by |py_view_releaser|.
+      delete static_cast<Py_buffer*>(deallocator.self);
+      CheckApiStatus(status, "Failed to wrap host buffer");
+    }
+    // The buffer now owns the view (and with it the reference to the
+    // exporting object).
+    py_view_releaser.Cancel();
+  } else {
+    if (buffer_pool_) {
+      raw_buffer = buffer_pool_->Acquire(py_view.len).steal_raw_ptr();
+    } else {
+      CheckApiStatus(
+          iree_hal_allocator_allocate_buffer(
+              device_.allocator(), MemoryTypeForPlacement(placement_),
+              IREE_HAL_BUFFER_USAGE_ALL, py_view.len, &raw_buffer),
+          "Failed to allocate device visible buffer");
+    }
+    if (is_contiguous) {
+      CheckApiStatus(
+          iree_hal_buffer_write_data(raw_buffer, 0, py_view.buf, py_view.len),
+          "Error writing to input buffer");
+    } else {
+      iree_hal_mapped_memory_t mapped_memory;
+      CheckApiStatus(
+          iree_hal_buffer_map(raw_buffer, IREE_HAL_MEMORY_ACCESS_WRITE, 0,
+                              py_view.len, &mapped_memory),
+          "Error mapping input buffer");
+      PackStrided(py_view, mapped_memory.contents.data);
+      CheckApiStatus(iree_hal_buffer_unmap(raw_buffer, &mapped_memory),
+                     "Error unmapping input buffer");
+    }
+  }
   iree_vm_ref_t buffer_ref = iree_hal_buffer_move_ref(raw_buffer);
   CheckApiStatus(
       iree_vm_variant_list_append_ref_move(f_args.raw_ptr(), &buffer_ref),
       "Error moving buffer");
 
-  // Only capture the reference to the exporting object (incrementing it)
-  // once guaranteed successful.
   if (depends_on_pyobject) {
-    // Note for future implementation: there needs to be a place to stash
-    // references to be kept alive which back a buffer. This is likely an
-    // additional bag of refs returned from this function, which can then
-    // be attached to an invocation.
-    throw RaisePyError(PyExc_NotImplementedError,
-                       "Dependent buffer arguments not implemented");
+    f_args.RecordHostBuffer(py_view);
+    ++imported_buffer_count_;
+  } else {
+    if (buffer_pool_) f_args.RetainPooledBuffer(raw_buffer, buffer_pool_);
+    ++copied_buffer_count_;
   }
 }
 
@@ -405,13 +721,31 @@ void SetupFunctionAbiBindings(pybind11::module m) {
       .def_property_readonly("raw_result_arity", &FunctionAbi::raw_result_arity)
       .def("raw_pack_inputs",
            [](FunctionAbi* self, py::sequence py_args) {
-             return PyRawPack(self,
-                              absl::MakeConstSpan(self->raw_config().inputs),
+             return PyRawPack(self, absl::MakeConstSpan(self->plan().inputs),
                               py_args, false /* writable */);
            })
+      .def("raw_pack_inputs_into",
+           [](FunctionAbi* self, py::sequence py_args, VmVariantList& f_args) {
+             PyRawPackInto(self, absl::MakeConstSpan(self->plan().inputs),
+                           py_args, f_args, false /* writable */);
+           },
+           py::arg("py_args"), py::arg("f_args"))
       .def("allocate_results", &PyAllocateResults, py::arg("f_results"),
            py::arg("static_alloc") = true)
-      .def("raw_unpack_results", &PyRawUnpackResults);
+      .def("allocate_results_into", &PyAllocateResultsInto, py::arg("f_args"),
+           py::arg("f_results"), py::arg("static_alloc") = true)
+      .def("raw_unpack_results", &PyRawUnpackResults, py::arg("f_results"),
+           py::arg("f_args") = nullptr)
+      .def_property("import_host_buffers", &FunctionAbi::import_host_buffers,
+                    &FunctionAbi::set_import_host_buffers)
+      .def_property("placement", &FunctionAbi::placement,
+                    &FunctionAbi::set_placement)
+      .def_property("buffer_pool", &FunctionAbi::buffer_pool,
+                    &FunctionAbi::set_buffer_pool)
+      .def_property_readonly("imported_buffer_count",
+                             &FunctionAbi::imported_buffer_count)
+      .def_property_readonly("copied_buffer_count",
+                             &FunctionAbi::copied_buffer_count);
 }
 
 }  // namespace python
@@ -15,6 +15,9 @@
 #ifndef IREE_BINDINGS_PYTHON_PYIREE_RT_FUNCTION_ABI_H_
 #define IREE_BINDINGS_PYTHON_PYIREE_RT_FUNCTION_ABI_H_
 
+#include <functional>
+#include <memory>
+#include <string>
 #include <utility>
 #include <vector>
 
@@ -34,58 +37,112 @@ namespace python {
 // Forward declarations.
 class HalDevice;
 
-// Instantiated with function attributes in order to process inputs/outputs.
-class FunctionAbi {
- public:
+// Marshalling plan of a function, precomputed from its raw signature so that
+// packing, result allocation and unpacking run over a flat table instead of
+// re-deriving sizes, formats and shapes from signature descriptions on every
+// call. Plans are immutable and are shared by all FunctionAbi instances of a
+// function (see VmModule::GetMarshallingPlan).
+struct MarshallingPlan {
   using AttributeLookup =
       std::function<absl::optional<absl::string_view>(absl::string_view)>;
-  FunctionAbi(HalDevice& device,
-              std::shared_ptr<HostTypeFactory> host_type_factory)
-      : device_(HalDevice::RetainAndCreate(device.raw_ptr())),
-        host_type_factory_(std::move(host_type_factory)) {}
-  virtual ~FunctionAbi() = default;
-
   using Description = RawSignatureParser::Description;
-  using InputDescriptionVector = absl::InlinedVector<Description, 4>;
-  using ResultDescriptionVector = absl::InlinedVector<Description, 1>;
+
+  // How a result is allocated ahead of the invocation.
+  enum class ResultAllocation {
+    // Allocated with |byte_size| bytes.
+    kStatic,
+    // Left to the function (such as results with dynamic dims).
+    kDeferred,
+  };
+
+  // Precomputed layout of one raw input or result.
+  struct Value {
+    // The description the value was planned from, kept for diagnostics.
+    Description desc;
+    RawSignatureParser::Type type{};
+    AbiConstants::ScalarType scalar_type{};
+    size_t item_size = 0;
+    // Python buffer format expected of arrays or nullptr if the format does
+    // not map to the scalar type (in which case only the item size is
+    // verified).
+    const char* py_format = nullptr;
+    bool has_dynamic_dims = false;
+    // Total size in bytes if all dims are static, otherwise 0.
+    iree_device_size_t byte_size = 0;
+    ResultAllocation allocation = ResultAllocation::kDeferred;
+  };
+  using InputVector = absl::InlinedVector<Value, 4>;
+  using ResultVector = absl::InlinedVector<Value, 1>;
 
   struct RawConfig {
-    InputDescriptionVector inputs;
-    ResultDescriptionVector results;
+    absl::InlinedVector<Description, 4> inputs;
+    absl::InlinedVector<Description, 1> results;
 
     // The following are retained to aid debugging but may be empty if
     // disabled.
     std::string signature;
   };
 
-  // Creates an instance based on the function attributes.
+  // Creates a plan from the function attributes. Throws if the function has
+  // no (or unsupported) raw ABI metadata.
+  static std::shared_ptr<const MarshallingPlan> Create(AttributeLookup lookup);
+
+  RawConfig raw_config;
+  InputVector inputs;
+  ResultVector results;
+};
+
+// Instantiated with function attributes in order to process inputs/outputs.
+class FunctionAbi {
+ public:
+  using AttributeLookup = MarshallingPlan::AttributeLookup;
+  FunctionAbi(HalDevice& device,
+              std::shared_ptr<HostTypeFactory> host_type_factory,
+              std::shared_ptr<const MarshallingPlan> plan)
+      : device_(HalDevice::RetainAndCreate(device.raw_ptr())),
+        host_type_factory_(std::move(host_type_factory)),
+        plan_(std::move(plan)) {}
+  virtual ~FunctionAbi() = default;
+
+  using Description = RawSignatureParser::Description;
+  using Value = MarshallingPlan::Value;
+  using RawConfig = MarshallingPlan::RawConfig;
+
+  // Creates an instance based on the function attributes. The plan is built
+  // anew; prefer VmModule::CreateFunctionAbi, which caches it.
   static std::unique_ptr<FunctionAbi> Create(
       HalDevice& device, std::shared_ptr<HostTypeFactory> host_type_factory,
       AttributeLookup lookup);
 
-  RawConfig& raw_config() { return raw_config_; }
-  int raw_input_arity() const { return raw_config_.inputs.size(); }
-  int raw_result_arity() const { return raw_config_.results.size(); }
+  const MarshallingPlan& plan() const { return *plan_; }
+  const RawConfig& raw_config() const { return plan_->raw_config; }
+  int raw_input_arity() const { return plan_->inputs.size(); }
+  int raw_result_arity() const { return plan_->results.size(); }
 
   // Raw packing. These always operate on the linear span of raw inputs and
   // results. Some ABIs perform a higher level of mapping on top of this,
   // which can be accessed via the non-prefixed Pack/Unpack methods.
-  // Given a span of descriptions, packs the given py_args into the span
+  // Given a span of planned values, packs the given py_args into the span
   // of function args. All spans must be of the same size.
-  void RawPack(absl::Span<const Description> descs,
-               absl::Span<py::handle> py_args, VmVariantList& args,
-               bool writable);
+  void RawPack(absl::Span<const Value> values, absl::Span<py::handle> py_args,
+               VmVariantList& args, bool writable);
 
   // Raw unpacks f_results into py_results.
   // Note that this consumes entries in f_results as needed, leaving them
   // as nullptr.
   // Ordinarily, this will be invoked along with AllocateResults() but it
   // is broken out for testing.
-  void RawUnpack(absl::Span<const Description> descs, VmVariantList& f_results,
-                 absl::Span<py::object> py_results);
-
-  // Given bound function arguments (from RawPack or equiv) and signature
-  // descriptors, allocates results for the function invocation. For fully
+  // If |f_args| is provided, results that alias host memory imported into it
+  // are copied so that they never share memory with the argument arrays.
+  // Imported memory itself stays valid for as long as any buffer wrapping it.
+  // Pooled argument buffers that results share are no longer recycled with
+  // |f_args|.
+  void RawUnpack(absl::Span<const Value> values, VmVariantList& f_results,
+                 absl::Span<py::object> py_results,
+                 VmVariantList* f_args = nullptr);
+
+  // Given bound function arguments (from RawPack or equiv) and planned
+  // results, allocates results for the function invocation. For fully
   // specified result types, this can be done purely by matching up
   // reflection metadata and an oracle for determining layout. For dynamically
   // shaped or data-dependent shaped results, the metadata about the function
@@ -94,19 +151,58 @@ class FunctionAbi {
   // ahead of time, resulting in a nullptr in f_results. In such cases, the
   // invocation must ensure proper barriers are in place to fully execute the
   // function prior to delivering results to the user layer.
-  void AllocateResults(absl::Span<const Description> descs,
-                       VmVariantList& f_args, VmVariantList& f_results);
+  void AllocateResults(absl::Span<const Value> values, VmVariantList& f_args,
+                       VmVariantList& f_results);
 
   // Gets the string representation.
   std::string DebugString() const;
 
+  // Whether host memory of buffer arguments may be used directly by the
+  // device rather than being copied. Only valid for devices that can access
+  // host memory (such as the interpreter).
+  bool import_host_buffers() const { return import_host_buffers_; }
+  void set_import_host_buffers(bool import_host_buffers) {
+    import_host_buffers_ = import_host_buffers;
+  }
+
+  // Where buffers for copied arguments are allocated. Device-local placement
+  // has the host write arguments straight into device memory it maps; it
+  // should be used for devices that do not share host memory.
+  HalBufferPlacement placement() const { return placement_; }
+  void set_placement(HalBufferPlacement placement) { placement_ = placement; }
+
+  // Pool that buffers allocated for copied arguments and static results are
+  // acquired from (using its placement), or nullptr to allocate each one.
+  // Argument buffers are recycled when their list is reset; result buffers
+  // when the ndarrays unpacked from them are released. Only results allocated
+  // with static_alloc use the pool; functions invoked with results they
+  // allocate themselves (as done by BoundFunction) never return pooled
+  // buffers. A function must not keep pooled arguments beyond the call (such
+  // as in a module global), as the pool cannot tell.
+  const std::shared_ptr<HalBufferPool>& buffer_pool() const {
+    return buffer_pool_;
+  }
+  void set_buffer_pool(std::shared_ptr<HalBufferPool> buffer_pool) {
+    buffer_pool_ = std::move(buffer_pool);
+  }
+
+  // Number of buffer arguments packed by importing their host memory.
+  int64_t imported_buffer_count() const { return imported_buffer_count_; }
+  // Number of buffer arguments (and aliasing results) packed by copying.
+  int64_t copied_buffer_count() const { return copied_buffer_count_; }
+
  private:
-  void PackBuffer(const RawSignatureParser::Description& desc,
-                  py::handle py_arg, VmVariantList& f_args, bool writable);
+  void PackBuffer(const Value& value, py::handle py_arg,
+                  VmVariantList& f_args, bool writable);
 
   HalDevice device_;
   std::shared_ptr<HostTypeFactory> host_type_factory_;
-  RawConfig raw_config_;
+  std::shared_ptr<const MarshallingPlan> plan_;
+  std::shared_ptr<HalBufferPool> buffer_pool_;
+  HalBufferPlacement placement_ = HalBufferPlacement::kHostLocal;
+  bool import_host_buffers_ = false;
+  int64_t imported_buffer_count_ = 0;
+  int64_t copied_buffer_count_ = 0;
 };
 
 void SetupFunctionAbiBindings(pybind11::module m);
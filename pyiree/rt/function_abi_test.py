@@ -15,6 +15,7 @@
 """Tests for the function abi."""
 
 import re
+import sys
 
 from absl.testing import absltest
 
@@ -35,6 +36,20 @@ ATTRS_1ARG_FLOAT32_DYNX128X64_TO_SINT32_DYNX8X64_V1 = (
     ("f", "I15!B11!d-1d128d64R15!B11!t6d-1d8d64"),
 )
 
+ATTRS_1ARG_FLOAT32_4_TO_FLOAT32_4_V1 = (
+    ("fv", "1"),
+    # Equiv to:
+    # (Buffer<float32[4]>) -> (Buffer<float32[4]>)
+    ("f", "I6!B3!d4R6!B3!d4"),
+)
+
+ATTRS_1ARG_FLOAT32_3X37X45_TO_FLOAT32_3X37X45_V1 = (
+    ("fv", "1"),
+    # Equiv to:
+    # (Buffer<float32[3x37x45]>) -> (Buffer<float32[3x37x45]>)
+    ("f", "I12!B9!d3d37d45R12!B9!d3d37d45"),
+)
+
 
 class HostTypeFactory(absltest.TestCase):
 
@@ -93,6 +108,169 @@ class FunctionAbiTest(absltest.TestCase):
     print(f_results)
     self.assertEqual("<VmVariantList(0): []>", repr(f_results))
 
+  def test_reuse_lists_success(self):
+    fabi = rt.FunctionAbi(self.device, self.htf,
+                          ATTRS_1ARG_FLOAT32_10X128X64_TO_SINT32_32X8X64_V1)
+    f_args = rt.VmVariantList(fabi.raw_input_arity)
+    f_results = rt.VmVariantList(fabi.raw_result_arity)
+    arg = np.zeros((10, 128, 64), dtype=np.float32)
+    for _ in range(2):
+      fabi.raw_pack_inputs_into([arg], f_args)
+      fabi.allocate_results_into(f_args, f_results)
+      self.assertEqual(1, f_args.size)
+      self.assertEqual(1, f_args.capacity)
+      self.assertEqual("<VmVariantList(1): [HalBuffer(65536)]>",
+                       repr(f_results))
+    f_results.reset()
+    self.assertEqual(0, f_results.size)
+    self.assertEqual(1, f_results.capacity)
+
+  def test_import_host_buffers(self):
+    fabi = rt.FunctionAbi(self.device, self.htf,
+                          ATTRS_1ARG_FLOAT32_10X128X64_TO_SINT32_32X8X64_V1)
+    self.assertFalse(fabi.import_host_buffers)
+    arg = np.zeros((10, 128, 64), dtype=np.float32)
+    fabi.raw_pack_inputs([arg])
+    self.assertEqual(0, fabi.imported_buffer_count)
+    self.assertEqual(1, fabi.copied_buffer_count)
+    fabi.import_host_buffers = True
+    refcount = sys.getrefcount(arg)
+    packed = fabi.raw_pack_inputs([arg])
+    self.assertEqual("<VmVariantList(1): [HalBuffer(327680)]>", repr(packed))
+    self.assertEqual(1, fabi.imported_buffer_count)
+    self.assertEqual(1, fabi.copied_buffer_count)
+    # The wrapping buffer holds the view of the array until it is released.
+    self.assertEqual(refcount + 1, sys.getrefcount(arg))
+    packed.reset()
+    self.assertEqual(refcount, sys.getrefcount(arg))
+
+  def test_buffer_pool_args(self):
+    fabi = rt.FunctionAbi(self.device, self.htf,
+                          ATTRS_1ARG_FLOAT32_10X128X64_TO_SINT32_32X8X64_V1)
+    pool = rt.HalBufferPool(self.device)
+    fabi.buffer_pool = pool
+    f_args = rt.VmVariantList(fabi.raw_input_arity)
+    arg = np.zeros((10, 128, 64), dtype=np.float32)
+    for _ in range(3):
+      fabi.raw_pack_inputs_into([arg], f_args)
+      self.assertEqual(0, pool.bytes_held)
+    # Each pack recycles the buffer of the previous one.
+    self.assertEqual(1, pool.miss_count)
+    self.assertEqual(2, pool.hit_count)
+    f_args.reset()
+    self.assertEqual(327680, pool.bytes_held)
+
+  def test_buffer_pool_results(self):
+    fabi = rt.FunctionAbi(self.device, self.htf,
+                          ATTRS_1ARG_FLOAT32_10X128X64_TO_SINT32_32X8X64_V1)
+    pool = rt.HalBufferPool(self.device, max_bytes_held=65536)
+    fabi.buffer_pool = pool
+    arg = np.zeros((10, 128, 64), dtype=np.float32)
+    f_args = fabi.raw_pack_inputs([arg])
+    f_results = fabi.allocate_results(f_args)
+    py_result, = fabi.raw_unpack_results(f_results)
+    f_results.reset()
+    # Held by the ndarray until it is released.
+    self.assertEqual(0, pool.bytes_held)
+    del py_result
+    self.assertEqual(65536, pool.bytes_held)
+    f_results = fabi.allocate_results(f_args)
+    self.assertEqual(1, pool.hit_count)
+    self.assertEqual(2, pool.miss_count)
+    pool.clear()
+    self.assertEqual(0, pool.bytes_held)
+
+  def test_device_local_placement(self):
+    fabi = rt.FunctionAbi(self.device, self.htf,
+                          ATTRS_1ARG_FLOAT32_10X128X64_TO_SINT32_32X8X64_V1)
+    self.assertEqual(rt.BufferPlacement.HOST_LOCAL, fabi.placement)
+    fabi.placement = rt.BufferPlacement.DEVICE_LOCAL
+    pool = rt.HalBufferPool(
+        self.device, placement=rt.BufferPlacement.DEVICE_LOCAL)
+    self.assertEqual(rt.BufferPlacement.DEVICE_LOCAL, pool.placement)
+    arg = np.zeros((10, 128, 64), dtype=np.float32)
+    fabi.raw_pack_inputs([arg])
+    fabi.buffer_pool = pool
+    fabi.raw_pack_inputs([arg])
+    self.assertEqual(2, fabi.copied_buffer_count)
+    self.assertEqual(1, pool.miss_count)
+    # Without a pool, results are allocated with the placement too.
+    fabi.buffer_pool = None
+    f_results = fabi.allocate_results(fabi.raw_pack_inputs([arg]))
+    self.assertEqual("<VmVariantList(1): [HalBuffer(65536)]>", repr(f_results))
+
+  def test_device_allocate_buffer(self):
+    memory_type = rt.memory_type_for_placement(rt.BufferPlacement.DEVICE_LOCAL)
+    self.assertEqual(
+        int(rt.MemoryType.DEVICE_LOCAL) | int(rt.MemoryType.HOST_VISIBLE),
+        int(memory_type))
+    buffer = self.device.allocate_buffer(
+        memory_type=int(memory_type),
+        usage=int(rt.BufferUsage.ALL),
+        allocation_size=4096)
+    self.assertEqual(4096, buffer.byte_length)
+    # The placement is host visible, so the buffer can be filled from the host.
+    buffer.fill_zero(0, 4096)
+
+  def test_dlpack_round_trip(self):
+    fabi = rt.FunctionAbi(self.device, rt.HostTypeFactory.get_dlpack(),
+                          ATTRS_1ARG_FLOAT32_4_TO_FLOAT32_4_V1)
+    self.assertEqual(
+        "<FunctionAbi (Buffer<float32[4]>) -> (Buffer<float32[4]>)>",
+        repr(fabi))
+    arg = np.array([1., 2., 3., 4.], dtype=np.float32)
+    f_args = fabi.raw_pack_inputs([arg])
+    capsule, = fabi.raw_unpack_results(fabi.allocate_results(f_args))
+    # The consumer views the result memory without copying.
+    tensor = rt.from_dlpack(capsule)
+    view = np.asarray(tensor)
+    self.assertEqual(np.float32, view.dtype)
+    self.assertEqual((4,), view.shape)
+    view[:] = arg
+    np.testing.assert_array_equal(arg, np.asarray(tensor))
+    with self.assertRaisesRegex(ValueError, "unconsumed DLPack capsule"):
+      rt.from_dlpack(capsule)
+    # Consumed tensors and capsules can be passed as arguments.
+    packed = fabi.raw_pack_inputs([tensor])
+    self.assertEqual("<VmVariantList(1): [HalBuffer(16)]>", repr(packed))
+    other_capsule, = fabi.raw_unpack_results(fabi.allocate_results(f_args))
+    packed = fabi.raw_pack_inputs([other_capsule])
+    self.assertEqual("<VmVariantList(1): [HalBuffer(16)]>", repr(packed))
+    with self.assertRaisesRegex(ValueError, "unconsumed DLPack capsule"):
+      rt.from_dlpack(other_capsule)
+
+  def test_strided_arg_success(self):
+    fabi = rt.FunctionAbi(self.device, self.htf,
+                          ATTRS_1ARG_FLOAT32_10X128X64_TO_SINT32_32X8X64_V1)
+    fabi.import_host_buffers = True
+    base = np.arange(64 * 128 * 20, dtype=np.float32).reshape((64, 128, 20))
+    # A transposed and sliced view that is not contiguous.
+    arg = base.transpose((2, 1, 0))[::2]
+    self.assertFalse(arg.flags.c_contiguous)
+    packed = fabi.raw_pack_inputs([arg])
+    self.assertEqual("<VmVariantList(1): [HalBuffer(327680)]>", repr(packed))
+    # Strided arguments are always packed into a copy.
+    self.assertEqual(0, fabi.imported_buffer_count)
+    self.assertEqual(1, fabi.copied_buffer_count)
+
+  def test_strided_transpose_matches_reference(self):
+    fabi = rt.FunctionAbi(self.device, self.htf,
+                          ATTRS_1ARG_FLOAT32_3X37X45_TO_FLOAT32_3X37X45_V1)
+    base = np.arange(3 * 45 * 37, dtype=np.float32).reshape((3, 45, 37))
+    # A non-square transpose whose dimensions are not multiples of the tile
+    # size, so that every tile edge case is packed.
+    arg = base.transpose((0, 2, 1))
+    packed = fabi.raw_pack_inputs([arg])
+    self.assertEqual(1, fabi.copied_buffer_count)
+    # Unpacking the packed list exposes the buffer contents in C order.
+    packed_arg, = fabi.raw_unpack_results(packed)
+    reference = np.empty((3, 37, 45), dtype=np.float32)
+    for i in range(3):
+      for j in range(37):
+        for k in range(45):
+          reference[i, j, k] = base[i, k, j]
+    np.testing.assert_array_equal(reference, packed_arg)
+
   def test_dynamic_arg_success(self):
     fabi = rt.FunctionAbi(self.device, self.htf,
                           ATTRS_1ARG_FLOAT32_DYNX128X64_TO_SINT32_DYNX8X64_V1)
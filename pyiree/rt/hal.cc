@@ -14,8 +14,15 @@
 
 #include "bindings/python/pyiree/rt/hal.h"
 
+#include <cstdint>
+#include <memory>
+#include <utility>
+
 #include "absl/container/inlined_vector.h"
+#include "iree/base/tracing.h"
 #include "iree/hal/api.h"
+#include "iree/modules/hal/hal_module.h"
+#include "iree/vm/ref.h"
 
 namespace iree {
 namespace python {
@@ -31,6 +38,7 @@ class HalMappedMemory {
   }
   ~HalMappedMemory() {
     if (bv_) {
+      IREE_TRACE_SCOPE0("HalMappedMemory#Unmap");
       iree_hal_buffer_t* buffer = iree_hal_buffer_view_buffer(bv_);
       CHECK_EQ(iree_hal_buffer_unmap(buffer, &mapped_memory_), IREE_STATUS_OK);
       iree_hal_buffer_view_release(bv_);
@@ -42,6 +50,7 @@ class HalMappedMemory {
   }
 
   static HalMappedMemory Create(HalBufferView& bv) {
+    IREE_TRACE_SCOPE0("HalMappedMemory#Map");
     iree_hal_buffer_t* buffer = iree_hal_buffer_view_buffer(bv.raw_ptr());
     iree_device_size_t byte_length = iree_hal_buffer_byte_length(buffer);
     iree_hal_mapped_memory_t mapped_memory;
@@ -124,6 +133,56 @@ HalDevice HalDriver::CreateDefaultDevice() {
   return HalDevice::CreateRetained(device);
 }
 
+//------------------------------------------------------------------------------
+// HalDevice
+//------------------------------------------------------------------------------
+
+HalBuffer HalDevice::AllocateBuffer(int32_t memory_type, int32_t usage,
+                                    iree_device_size_t allocation_size) {
+  iree_hal_buffer_t* buffer = nullptr;
+  CheckApiStatus(iree_hal_allocator_allocate_buffer(
+                     allocator(),
+                     static_cast<iree_hal_memory_type_t>(memory_type),
+                     static_cast<iree_hal_buffer_usage_t>(usage),
+                     allocation_size, &buffer),
+                 "Error allocating device buffer");
+  return HalBuffer::CreateRetained(buffer);
+}
+
+//------------------------------------------------------------------------------
+// HalBufferPool
+//------------------------------------------------------------------------------
+
+HalBuffer HalBufferPool::Acquire(iree_device_size_t byte_length) {
+  auto it = idle_buffers_.find(byte_length);
+  if (it != idle_buffers_.end() && !it->second.empty()) {
+    HalBuffer buffer = std::move(it->second.back());
+    it->second.pop_back();
+    bytes_held_ -= byte_length;
+    ++hit_count_;
+    return buffer;
+  }
+  ++miss_count_;
+  iree_hal_buffer_t* raw_buffer;
+  CheckApiStatus(iree_hal_allocator_allocate_buffer(
+                     device_.allocator(), MemoryTypeForPlacement(placement_),
+                     usage_, byte_length, &raw_buffer),
+                 "Error allocating pooled buffer");
+  return HalBuffer::CreateRetained(raw_buffer);
+}
+
+void HalBufferPool::Recycle(HalBuffer buffer) {
+  iree_device_size_t byte_length = buffer.byte_length();
+  if (bytes_held_ + byte_length > max_bytes_held_) return;
+  idle_buffers_[byte_length].push_back(std::move(buffer));
+  bytes_held_ += byte_length;
+}
+
+void HalBufferPool::Clear() {
+  idle_buffers_.clear();
+  bytes_held_ = 0;
+}
+
 void SetupHalBindings(pybind11::module m) {
   // Enums.
   py::enum_<iree_hal_memory_type_t>(m, "MemoryType")
@@ -153,7 +212,14 @@ void SetupHalBindings(pybind11::module m) {
       .value("ALL", IREE_HAL_MEMORY_ACCESS_ALL)
       .export_values();
 
-  py::class_<HalDevice>(m, "HalDevice");
+  py::enum_<HalBufferPlacement>(m, "BufferPlacement")
+      .value("HOST_LOCAL", HalBufferPlacement::kHostLocal)
+      .value("DEVICE_LOCAL", HalBufferPlacement::kDeviceLocal);
+
+  py::class_<HalDevice>(m, "HalDevice")
+      .def("allocate_buffer", &HalDevice::AllocateBuffer,
+           py::arg("memory_type"), py::arg("usage"),
+           py::arg("allocation_size"));
   py::class_<HalDriver>(m, "HalDriver")
       .def_static("query", &HalDriver::Query)
       .def_static("create", &HalDriver::Create, py::arg("driver_name"))
@@ -168,10 +234,29 @@ void SetupHalBindings(pybind11::module m) {
       .def_static("allocate_heap", &HalBuffer::AllocateHeapBuffer,
                   py::arg("memory_type"), py::arg("usage"),
                   py::arg("allocation_size"))
+      .def_property_readonly("byte_length", &HalBuffer::byte_length)
       .def("fill_zero", &HalBuffer::FillZero, py::arg("byte_offset"),
            py::arg("byte_length"))
       .def("create_view", &HalBuffer::CreateView, py::arg("shape"),
            py::arg("element_size"));
+  py::class_<HalBufferPool, std::shared_ptr<HalBufferPool>>(m, "HalBufferPool")
+      .def(py::init([](HalDevice& device, iree_device_size_t max_bytes_held,
+                       HalBufferPlacement placement) {
+             return std::make_shared<HalBufferPool>(device, max_bytes_held,
+                                                    placement);
+           }),
+           py::arg("device"), py::arg("max_bytes_held") = 64 * 1024 * 1024,
+           py::arg("placement") = HalBufferPlacement::kHostLocal)
+      .def_property_readonly("placement", &HalBufferPool::placement)
+      .def("clear", &HalBufferPool::Clear)
+      .def_property_readonly("hit_count", &HalBufferPool::hit_count)
+      .def_property_readonly("miss_count", &HalBufferPool::miss_count)
+      .def_property_readonly("hit_rate", &HalBufferPool::hit_rate)
+      .def_property_readonly("bytes_held", &HalBufferPool::bytes_held)
+      .def_property_readonly("max_bytes_held", &HalBufferPool::max_bytes_held);
+
+  m.def("memory_type_for_placement", &MemoryTypeForPlacement,
+        py::arg("placement"));
 }
 
 }  // namespace python
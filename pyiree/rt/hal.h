@@ -15,6 +15,10 @@
 #ifndef IREE_BINDINGS_PYTHON_PYIREE_RT_HAL_H_
 #define IREE_BINDINGS_PYTHON_PYIREE_RT_HAL_H_
 
+#include <memory>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
 #include "absl/container/inlined_vector.h"
 #include "bindings/python/pyiree/common/binding.h"
 #include "bindings/python/pyiree/common/status_utils.h"
@@ -59,11 +63,39 @@ struct ApiPtrAdapter<iree_hal_buffer_view_t> {
 // ApiRefCounted types
 //------------------------------------------------------------------------------
 
+class HalBuffer;
+
+// Where buffers exchanged with the host are placed.
+enum class HalBufferPlacement {
+  // Host memory that the device accesses directly (such as over PCIe). Best
+  // for devices that share host memory, which can also import host arrays.
+  kHostLocal,
+  // Device memory that the host maps for uploads, so that kernels read it at
+  // device bandwidth. Best for discrete GPUs.
+  kDeviceLocal,
+};
+
+// Returns the memory type of buffers with |placement|.
+inline iree_hal_memory_type_t MemoryTypeForPlacement(
+    HalBufferPlacement placement) {
+  return static_cast<iree_hal_memory_type_t>(
+      placement == HalBufferPlacement::kDeviceLocal
+          ? IREE_HAL_MEMORY_TYPE_DEVICE_LOCAL |
+                IREE_HAL_MEMORY_TYPE_HOST_VISIBLE
+          : IREE_HAL_MEMORY_TYPE_HOST_LOCAL |
+                IREE_HAL_MEMORY_TYPE_DEVICE_VISIBLE);
+}
+
 class HalDevice : public ApiRefCounted<HalDevice, iree_hal_device_t> {
  public:
   iree_hal_allocator_t* allocator() {
     return iree_hal_device_allocator(raw_ptr());
   }
+
+  // Allocates a buffer of |allocation_size| bytes from the device allocator.
+  // Unlike HalBuffer::AllocateHeapBuffer, this may allocate device memory.
+  HalBuffer AllocateBuffer(int32_t memory_type, int32_t usage,
+                           iree_device_size_t allocation_size);
 };
 
 class HalDriver : public ApiRefCounted<HalDriver, iree_hal_driver_t> {
@@ -127,6 +159,59 @@ class HalBuffer : public ApiRefCounted<HalBuffer, iree_hal_buffer_t> {
   }
 };
 
+// Recycles idle HAL buffers of one placement and usage, bucketed by byte
+// length, so that repeated calls with the same shapes stop allocating once
+// warm. Buffers are handed back with Recycle() by their last user and at most
+// |max_bytes_held| bytes of idle buffers are kept.
+// Not thread-safe; all uses must hold the GIL.
+class HalBufferPool {
+ public:
+  HalBufferPool(
+      HalDevice& device, iree_device_size_t max_bytes_held,
+      HalBufferPlacement placement = HalBufferPlacement::kHostLocal,
+      iree_hal_buffer_usage_t usage = IREE_HAL_BUFFER_USAGE_ALL)
+      : device_(HalDevice::RetainAndCreate(device.raw_ptr())),
+        max_bytes_held_(max_bytes_held),
+        placement_(placement),
+        usage_(usage) {}
+
+  // Returns an idle buffer of exactly |byte_length| bytes if one is held,
+  // allocating a new one otherwise. Contents are undefined.
+  HalBuffer Acquire(iree_device_size_t byte_length);
+
+  // Returns |buffer|, which must have been acquired from this pool, to the
+  // pool. The caller must own its last reference: owners that share a pooled
+  // buffer (such as a result aliasing a pooled argument, directly or through
+  // a subspan) stop tracking it instead of recycling it. It is released
+  // instead if holding it would exceed the maximum.
+  void Recycle(HalBuffer buffer);
+
+  // Releases all idle buffers.
+  void Clear();
+
+  int64_t hit_count() const { return hit_count_; }
+  int64_t miss_count() const { return miss_count_; }
+  double hit_rate() const {
+    int64_t total = hit_count_ + miss_count_;
+    return total ? static_cast<double>(hit_count_) / total : 0.0;
+  }
+  iree_device_size_t bytes_held() const { return bytes_held_; }
+  iree_device_size_t max_bytes_held() const { return max_bytes_held_; }
+  HalBufferPlacement placement() const { return placement_; }
+
+ private:
+  HalDevice device_;
+  const iree_device_size_t max_bytes_held_;
+  const HalBufferPlacement placement_;
+  const iree_hal_buffer_usage_t usage_;
+  // Idle buffers keyed by byte length.
+  absl::flat_hash_map<iree_device_size_t, std::vector<HalBuffer>>
+      idle_buffers_;
+  iree_device_size_t bytes_held_ = 0;
+  int64_t hit_count_ = 0;
+  int64_t miss_count_ = 0;
+};
+
 void SetupHalBindings(pybind11::module m);
 
 }  // namespace python
@@ -14,11 +14,17 @@
 
 #include "bindings/python/pyiree/rt/host_types.h"
 
+#include <cstdint>
+#include <memory>
+#include <utility>
+
 #include "absl/container/inlined_vector.h"
 #include "absl/memory/memory.h"
+#include "absl/types/optional.h"
 #include "bindings/python/pyiree/common/status_utils.h"
 #include "bindings/python/pyiree/rt/hal.h"
 #include "iree/base/signature_mangle.h"
+#include "iree/base/tracing.h"
 #include "pybind11/numpy.h"
 
 namespace iree {
@@ -47,6 +53,50 @@ static_assert(kScalarTypePyFormat.size() ==
 
 namespace {
 
+// Fills |view| with the layout of |data| without allocating. |shape| and
+// |strides| (in bytes) must live as long as the exporter.
+int FillBufferView(PyObject* exporter, Py_buffer* view, int flags, void* data,
+                   size_t element_size, const char* format,
+                   absl::Span<const py::ssize_t> shape,
+                   absl::Span<const py::ssize_t> strides, bool readonly) {
+  if ((flags & PyBUF_WRITABLE) == PyBUF_WRITABLE && readonly) {
+    PyErr_SetString(PyExc_BufferError, "Buffer is not writable");
+    return -1;
+  }
+  py::ssize_t len = element_size;
+  for (auto dim : shape) len *= dim;
+  view->buf = data;
+  view->obj = exporter;
+  Py_INCREF(exporter);
+  view->len = len;
+  view->readonly = readonly;
+  view->itemsize = element_size;
+  view->format = (flags & PyBUF_FORMAT) ? const_cast<char*>(format) : nullptr;
+  view->ndim = shape.size();
+  view->shape = (flags & PyBUF_ND) == PyBUF_ND
+                    ? const_cast<py::ssize_t*>(shape.data())
+                    : nullptr;
+  view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES
+                      ? const_cast<py::ssize_t*>(strides.data())
+                      : nullptr;
+  view->suboffsets = nullptr;
+  view->internal = nullptr;
+  return 0;
+}
+
+// Computes C-contiguous byte strides for |dims|.
+template <typename T>
+absl::InlinedVector<py::ssize_t, 4> ContiguousStrides(
+    size_t element_size, absl::Span<const T> dims) {
+  absl::InlinedVector<py::ssize_t, 4> strides(dims.size());
+  py::ssize_t stride = element_size;
+  for (int i = dims.size() - 1; i >= 0; --i) {
+    strides[i] = stride;
+    stride *= dims[i];
+  }
+  return strides;
+}
+
 class PyMappedMemory {
  public:
   struct Description {
@@ -70,40 +120,38 @@ class PyMappedMemory {
         throw RaisePyError(PyExc_NotImplementedError,
                            "Unimplemented ScalarType");
       }
-      if (!dims.empty()) {
-        d.dims.resize(dims.size());
-        d.strides.resize(dims.size());
-
-        for (size_t i = 0, e = dims.size(); i < e; ++i) {
-          d.dims[i] = dims[i];
-        }
-        d.strides[dims.size() - 1] = d.element_size;
-        for (int i = dims.size() - 2; i >= 0; --i) {
-          d.strides[i] = d.strides[i + 1] * dims[i + 1];
-        }
-      }
+      d.dims.assign(dims.begin(), dims.end());
+      d.strides = ContiguousStrides(d.element_size, dims);
       return d;
     }
   };
 
   PyMappedMemory(Description desc, iree_hal_mapped_memory_t mapped_memory,
-                 HalBuffer buffer)
+                 HalBuffer buffer, std::shared_ptr<HalBufferPool> recycle_pool)
       : desc_(std::move(desc)),
         mapped_memory_(mapped_memory),
-        buf_(std::move(buffer)) {}
+        buf_(std::move(buffer)),
+        recycle_pool_(std::move(recycle_pool)) {}
   ~PyMappedMemory() {
     if (buf_) {
+      IREE_TRACE_SCOPE0("PyMappedMemory#Unmap");
       CheckApiStatus(iree_hal_buffer_unmap(buf_.raw_ptr(), &mapped_memory_),
                      "Error unmapping memory");
+      if (recycle_pool_) recycle_pool_->Recycle(std::move(buf_));
     }
   }
   PyMappedMemory(PyMappedMemory&& other)
-      : mapped_memory_(other.mapped_memory_), buf_(std::move(other.buf_)) {}
+      : mapped_memory_(other.mapped_memory_),
+        buf_(std::move(other.buf_)),
+        recycle_pool_(std::move(other.recycle_pool_)) {}
 
   const Description& desc() const { return desc_; }
+  void* data() const { return mapped_memory_.contents.data; }
 
-  static std::unique_ptr<PyMappedMemory> Read(Description desc,
-                                              HalBuffer buffer) {
+  static std::unique_ptr<PyMappedMemory> Read(
+      Description desc, HalBuffer buffer,
+      std::shared_ptr<HalBufferPool> recycle_pool) {
+    IREE_TRACE_SCOPE0("PyMappedMemory#Map");
     iree_device_size_t byte_length =
         iree_hal_buffer_byte_length(buffer.raw_ptr());
     iree_hal_mapped_memory_t mapped_memory;
@@ -112,40 +160,286 @@ class PyMappedMemory {
                        0 /* element_offset */, byte_length, &mapped_memory),
                    "Could not map memory");
     return absl::make_unique<PyMappedMemory>(std::move(desc), mapped_memory,
-                                             std::move(buffer));
+                                             std::move(buffer),
+                                             std::move(recycle_pool));
   }
 
-  py::buffer_info ToBufferInfo() {
-    // TODO(laurenzo): py::buffer_info is a heavy-weight way to get the
-    // buffer. See about implementing the lower level buffer protocol.
-    // Unfortunately, this part of the pybind C++ API is all defined in terms
-    // of std::vector, making it less efficient than necessary.
-    return py::buffer_info(mapped_memory_.contents.data, desc_.element_size,
-                           desc_.format, desc_.dims.size(), desc_.dims,
-                           desc_.strides);
+  // Implements the buffer protocol directly (rather than via a
+  // py::buffer_info, which allocates vectors of the dims and strides for
+  // each request) by pointing the view at the description.
+  static int GetBuffer(PyObject* exporter, Py_buffer* view, int flags) {
+    auto* self = py::cast<PyMappedMemory*>(py::handle(exporter));
+    const auto& desc = self->desc();
+    return FillBufferView(exporter, view, flags, self->data(),
+                          desc.element_size, desc.format, desc.dims,
+                          desc.strides, /*readonly=*/false);
   }
 
  private:
   Description desc_;
   iree_hal_mapped_memory_t mapped_memory_;
   HalBuffer buf_;
+  std::shared_ptr<HalBufferPool> recycle_pool_;
+};
+
+//------------------------------------------------------------------------------
+// DLPack
+//------------------------------------------------------------------------------
+
+// Mirrors the ABI of DLPack v0.2 (dlpack.h), the interchange format
+// exchanged in "dltensor" PyCapsules by frameworks such as PyTorch, JAX and
+// CuPy.
+namespace dlpack {
+
+enum DeviceType : int32_t {
+  kDLCPU = 1,
+  kDLCPUPinned = 3,
+};
+
+enum DataTypeCode : uint8_t {
+  kDLInt = 0,
+  kDLUInt = 1,
+  kDLFloat = 2,
+  kDLBfloat = 4,
+};
+
+struct DLContext {
+  int32_t device_type;
+  int32_t device_id;
+};
+
+struct DLDataType {
+  uint8_t code;
+  uint8_t bits;
+  uint16_t lanes;
+};
+
+struct DLTensor {
+  void* data;
+  DLContext ctx;
+  int ndim;
+  DLDataType dtype;
+  int64_t* shape;
+  // In elements; nullptr for compact row-major tensors.
+  int64_t* strides;
+  uint64_t byte_offset;
+};
+
+struct DLManagedTensor {
+  DLTensor dl_tensor;
+  void* manager_ctx;
+  void (*deleter)(DLManagedTensor* self);
 };
 
+constexpr const char kCapsuleName[] = "dltensor";
+// Name of capsules whose tensor has been taken over by a consumer.
+constexpr const char kUsedCapsuleName[] = "used_dltensor";
+
+}  // namespace dlpack
+
+absl::optional<dlpack::DLDataType> DLDataTypeForScalarType(
+    AbiConstants::ScalarType scalar_type) {
+  uint8_t bits = AbiConstants::kScalarTypeSize[static_cast<int>(scalar_type)] *
+                 8;
+  switch (scalar_type) {
+    case AbiConstants::ScalarType::kIeeeFloat16:
+    case AbiConstants::ScalarType::kIeeeFloat32:
+    case AbiConstants::ScalarType::kIeeeFloat64:
+      return dlpack::DLDataType{dlpack::kDLFloat, bits, 1};
+    case AbiConstants::ScalarType::kGoogleBfloat16:
+      return dlpack::DLDataType{dlpack::kDLBfloat, bits, 1};
+    case AbiConstants::ScalarType::kSint8:
+    case AbiConstants::ScalarType::kSint16:
+    case AbiConstants::ScalarType::kSint32:
+    case AbiConstants::ScalarType::kSint64:
+      return dlpack::DLDataType{dlpack::kDLInt, bits, 1};
+    case AbiConstants::ScalarType::kUint8:
+    case AbiConstants::ScalarType::kUint16:
+    case AbiConstants::ScalarType::kUint32:
+    case AbiConstants::ScalarType::kUint64:
+      return dlpack::DLDataType{dlpack::kDLUInt, bits, 1};
+    default:
+      return absl::nullopt;
+  }
+}
+
+// Returns the struct module format of |dtype| or nullptr if there is none.
+const char* FormatForDLDataType(dlpack::DLDataType dtype) {
+  // Indexed by log2 of the byte size.
+  static const char* const kFloatFormats[] = {nullptr, "e", "f", "d"};
+  static const char* const kIntFormats[] = {"b", "h", "i", "q"};
+  static const char* const kUintFormats[] = {"B", "H", "I", "Q"};
+  if (dtype.lanes != 1) return nullptr;
+  int size_index;
+  switch (dtype.bits) {
+    case 8:
+      size_index = 0;
+      break;
+    case 16:
+      size_index = 1;
+      break;
+    case 32:
+      size_index = 2;
+      break;
+    case 64:
+      size_index = 3;
+      break;
+    default:
+      return nullptr;
+  }
+  switch (dtype.code) {
+    case dlpack::kDLFloat:
+      return kFloatFormats[size_index];
+    case dlpack::kDLInt:
+      return kIntFormats[size_index];
+    case dlpack::kDLUInt:
+      return kUintFormats[size_index];
+    default:
+      return nullptr;
+  }
+}
+
+// Producer: owns the mapped memory of a result exported as a DLPack tensor.
+struct DlpackExport {
+  dlpack::DLManagedTensor managed_tensor;
+  absl::InlinedVector<int64_t, 4> shape;
+  // The PyMappedMemory keeping the buffer mapped.
+  py::object mapped_memory;
+
+  static void Delete(dlpack::DLManagedTensor* managed_tensor) {
+    // Consumers may release the tensor from any thread.
+    py::gil_scoped_acquire acquire;
+    delete static_cast<DlpackExport*>(managed_tensor->manager_ctx);
+  }
+};
+
+void DeleteUnconsumedCapsule(PyObject* capsule) {
+  if (!PyCapsule_IsValid(capsule, dlpack::kCapsuleName)) return;
+  auto* managed_tensor = static_cast<dlpack::DLManagedTensor*>(
+      PyCapsule_GetPointer(capsule, dlpack::kCapsuleName));
+  managed_tensor->deleter(managed_tensor);
+}
+
+// Consumer: exposes a DLPack tensor of host memory via the buffer protocol
+// and releases it to its producer once collected.
+class DlpackTensor {
+ public:
+  explicit DlpackTensor(dlpack::DLManagedTensor* managed_tensor)
+      : managed_tensor_(managed_tensor) {
+    const auto& dl_tensor = managed_tensor_->dl_tensor;
+    element_size_ = dl_tensor.dtype.bits / 8;
+    format_ = FormatForDLDataType(dl_tensor.dtype);
+    shape_.assign(dl_tensor.shape, dl_tensor.shape + dl_tensor.ndim);
+    if (dl_tensor.strides) {
+      strides_.resize(dl_tensor.ndim);
+      for (int i = 0; i < dl_tensor.ndim; ++i) {
+        strides_[i] = dl_tensor.strides[i] * element_size_;
+      }
+    }
+    auto contiguous_strides =
+        ContiguousStrides(element_size_, absl::MakeConstSpan(shape_));
+    if (!dl_tensor.strides) strides_ = contiguous_strides;
+    is_contiguous_ = strides_ == contiguous_strides;
+  }
+  ~DlpackTensor() {
+    if (managed_tensor_->deleter) managed_tensor_->deleter(managed_tensor_);
+  }
+  DlpackTensor(const DlpackTensor&) = delete;
+  DlpackTensor& operator=(const DlpackTensor&) = delete;
+
+  void* data() const {
+    return static_cast<uint8_t*>(managed_tensor_->dl_tensor.data) +
+           managed_tensor_->dl_tensor.byte_offset;
+  }
+
+  static int GetBuffer(PyObject* exporter, Py_buffer* view, int flags) {
+    auto* self = py::cast<DlpackTensor*>(py::handle(exporter));
+    if (!self->format_) {
+      PyErr_SetString(PyExc_BufferError,
+                      "DLPack dtype has no buffer protocol format");
+      return -1;
+    }
+    // Strided views are only described when requested.
+    if ((flags & PyBUF_STRIDES) != PyBUF_STRIDES && !self->is_contiguous_) {
+      PyErr_SetString(PyExc_BufferError, "DLPack tensor is not contiguous");
+      return -1;
+    }
+    return FillBufferView(exporter, view, flags, self->data(),
+                          self->element_size_, self->format_, self->shape_,
+                          self->strides_, /*readonly=*/false);
+  }
+
+ private:
+  dlpack::DLManagedTensor* managed_tensor_;
+  size_t element_size_ = 0;
+  const char* format_ = nullptr;
+  bool is_contiguous_ = true;
+  absl::InlinedVector<py::ssize_t, 4> shape_;
+  absl::InlinedVector<py::ssize_t, 4> strides_;
+};
+
+// Routes the buffer protocol of the pybind11 class |cls| to |get_buffer|.
+template <typename T>
+void SetGetBuffer(py::class_<T, std::unique_ptr<T>>& cls,
+                  getbufferproc get_buffer) {
+  auto* heap_type = reinterpret_cast<PyHeapTypeObject*>(cls.ptr());
+  heap_type->as_buffer.bf_getbuffer = get_buffer;
+  heap_type->as_buffer.bf_releasebuffer = nullptr;
+}
+
+// Maps a result and wraps it in a PyMappedMemory.
+py::object MapResult(AbiConstants::ScalarType element_type,
+                     absl::Span<const int> dims, HalBuffer buffer,
+                     std::shared_ptr<HalBufferPool> recycle_pool) {
+  auto mapped_memory = PyMappedMemory::Read(
+      PyMappedMemory::Description::ForNdarray(element_type, dims),
+      std::move(buffer), std::move(recycle_pool));
+  return py::cast(mapped_memory.release(),
+                  py::return_value_policy::take_ownership);
+}
+
 class NumpyHostTypeFactory : public HostTypeFactory {
-  py::object CreateImmediateNdarray(AbiConstants::ScalarType element_type,
-                                    absl::Span<const int> dims,
-                                    HalBuffer buffer) override {
-    auto mapped_memory = PyMappedMemory::Read(
-        PyMappedMemory::Description::ForNdarray(element_type, dims),
-        std::move(buffer));
+  py::object CreateImmediateNdarray(
+      AbiConstants::ScalarType element_type, absl::Span<const int> dims,
+      HalBuffer buffer, std::shared_ptr<HalBufferPool> recycle_pool) override {
     // Since an immediate ndarray was requested, we can just return a native
     // ndarray directly (versus a proxy that needs to lazily map on access).
-    auto buffer_info = mapped_memory->ToBufferInfo();
-    auto py_mapped_memory = py::cast(mapped_memory.release(),
-                                     py::return_value_policy::take_ownership);
-    return py::array(py::dtype(buffer_info), buffer_info.shape,
-                     buffer_info.strides, buffer_info.ptr,
-                     std::move(py_mapped_memory) /* base */);
+    // numpy views the mapped memory through its buffer protocol.
+    return py::array(MapResult(element_type, dims, std::move(buffer),
+                               std::move(recycle_pool)));
+  }
+};
+
+class DlpackHostTypeFactory : public HostTypeFactory {
+  py::object CreateImmediateNdarray(
+      AbiConstants::ScalarType element_type, absl::Span<const int> dims,
+      HalBuffer buffer, std::shared_ptr<HalBufferPool> recycle_pool) override {
+    auto dtype = DLDataTypeForScalarType(element_type);
+    if (!dtype) {
+      throw RaisePyError(PyExc_NotImplementedError,
+                         "ScalarType has no DLPack equivalent");
+    }
+    auto export_ctx = absl::make_unique<DlpackExport>();
+    export_ctx->mapped_memory = MapResult(
+        element_type, dims, std::move(buffer), std::move(recycle_pool));
+    export_ctx->shape.assign(dims.begin(), dims.end());
+    auto& dl_tensor = export_ctx->managed_tensor.dl_tensor;
+    dl_tensor.data =
+        py::cast<PyMappedMemory*>(export_ctx->mapped_memory)->data();
+    dl_tensor.ctx = {dlpack::kDLCPU, 0};
+    dl_tensor.ndim = dims.size();
+    dl_tensor.dtype = *dtype;
+    dl_tensor.shape = export_ctx->shape.data();
+    dl_tensor.strides = nullptr;
+    dl_tensor.byte_offset = 0;
+    export_ctx->managed_tensor.manager_ctx = export_ctx.get();
+    export_ctx->managed_tensor.deleter = &DlpackExport::Delete;
+    PyObject* capsule =
+        PyCapsule_New(&export_ctx->managed_tensor, dlpack::kCapsuleName,
+                      &DeleteUnconsumedCapsule);
+    if (!capsule) throw py::error_already_set();
+    export_ctx.release();
+    return py::reinterpret_steal<py::object>(capsule);
   }
 };
 
@@ -160,21 +454,59 @@ std::shared_ptr<HostTypeFactory> HostTypeFactory::GetNumpyFactory() {
   return global_instance;
 }
 
+std::shared_ptr<HostTypeFactory> HostTypeFactory::GetDlpackFactory() {
+  static auto global_instance = std::make_shared<DlpackHostTypeFactory>();
+  return global_instance;
+}
+
 py::object HostTypeFactory::CreateImmediateNdarray(
     AbiConstants::ScalarType element_type, absl::Span<const int> dims,
-    HalBuffer buffer) {
+    HalBuffer buffer, std::shared_ptr<HalBufferPool> recycle_pool) {
   throw RaisePyError(PyExc_NotImplementedError,
                      "CreateImmediateNdarray not implemented");
 }
 
+//------------------------------------------------------------------------------
+// DLPack
+//------------------------------------------------------------------------------
+
+bool IsDlpackCapsule(py::handle obj) {
+  return PyCapsule_IsValid(obj.ptr(), dlpack::kCapsuleName);
+}
+
+py::object ImportDlpackCapsule(py::handle capsule) {
+  if (!IsDlpackCapsule(capsule)) {
+    throw RaiseValueError("Expected an unconsumed DLPack capsule");
+  }
+  auto* managed_tensor = static_cast<dlpack::DLManagedTensor*>(
+      PyCapsule_GetPointer(capsule.ptr(), dlpack::kCapsuleName));
+  auto device_type = managed_tensor->dl_tensor.ctx.device_type;
+  if (device_type != dlpack::kDLCPU && device_type != dlpack::kDLCPUPinned) {
+    throw RaisePyError(PyExc_NotImplementedError,
+                       "Only DLPack tensors in host memory can be imported");
+  }
+  // Take over the tensor before anything may throw so that it is released
+  // exactly once.
+  if (PyCapsule_SetName(capsule.ptr(), dlpack::kUsedCapsuleName) != 0) {
+    throw py::error_already_set();
+  }
+  return py::cast(new DlpackTensor(managed_tensor),
+                  py::return_value_policy::take_ownership);
+}
+
 void SetupHostTypesBindings(pybind11::module m) {
   py::class_<HostTypeFactory, std::shared_ptr<HostTypeFactory>>(
       m, "HostTypeFactory")
       .def(py::init<>())
-      .def_static("get_numpy", &HostTypeFactory::GetNumpyFactory);
-  py::class_<PyMappedMemory, std::unique_ptr<PyMappedMemory>>(
-      m, "PyMappedMemory", py::buffer_protocol())
-      .def_buffer(&PyMappedMemory::ToBufferInfo);
+      .def_static("get_numpy", &HostTypeFactory::GetNumpyFactory)
+      .def_static("get_dlpack", &HostTypeFactory::GetDlpackFactory);
+  py::class_<PyMappedMemory, std::unique_ptr<PyMappedMemory>> mapped_memory(
+      m, "PyMappedMemory", py::buffer_protocol());
+  SetGetBuffer(mapped_memory, &PyMappedMemory::GetBuffer);
+  py::class_<DlpackTensor, std::unique_ptr<DlpackTensor>> dlpack_tensor(
+      m, "DlpackTensor", py::buffer_protocol());
+  SetGetBuffer(dlpack_tensor, &DlpackTensor::GetBuffer);
+  m.def("from_dlpack", &ImportDlpackCapsule, py::arg("capsule"));
 }
 
 }  // namespace python
@@ -16,6 +16,7 @@
 #define IREE_BINDINGS_PYTHON_PYIREE_RT_HOST_TYPES_H_
 
 #include <array>
+#include <memory>
 
 #include "absl/types/span.h"
 #include "bindings/python/pyiree/common/binding.h"
@@ -37,17 +38,31 @@ class HostTypeFactory {
   // Creates a default implementation which interops with numpy.
   static std::shared_ptr<HostTypeFactory> GetNumpyFactory();
 
+  // Creates an implementation which returns results as DLPack capsules of
+  // host memory (as consumed by torch.utils.dlpack.from_dlpack, for example)
+  // without copying.
+  static std::shared_ptr<HostTypeFactory> GetDlpackFactory();
+
   // Creates a C-contiguous ndarray of the given element_type/dims and backed
   // by the given buffer. The resulting array has no synchronization and is
-  // available for use immediately.
+  // available for use immediately. If |recycle_pool| is not null, the buffer
+  // is recycled into it once the array is released.
   virtual py::object CreateImmediateNdarray(
       AbiConstants::ScalarType element_type, absl::Span<const int> dims,
-      HalBuffer buffer);
+      HalBuffer buffer, std::shared_ptr<HalBufferPool> recycle_pool);
 
   // TODO(laurenzo): Add a CreateDelayedNdarray() which is conditioned on
   // a semaphore. This is actually what should be used for async results.
 };
 
+// Returns whether |obj| is a DLPack capsule that has not been consumed.
+bool IsDlpackCapsule(py::handle obj);
+
+// Consumes a DLPack capsule of host memory, returning an object that exposes
+// the tensor through the buffer protocol (without copying) and releases it
+// to its producer once collected.
+py::object ImportDlpackCapsule(py::handle capsule);
+
 void SetupHostTypesBindings(pybind11::module m);
 
 }  // namespace python
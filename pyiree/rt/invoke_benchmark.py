@@ -0,0 +1,104 @@
+# Lint as: python3
+# Copyright 2020 Google LLC
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      https://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""Measures invocation throughput as the number of Python threads grows.
+
+Each thread invokes a matmul through its own SystemContext, sharing the
+config (instance, driver and device) and the module. Since invocations release
+the GIL, throughput should scale with the thread count up to the number of
+cores available to the driver.
+
+Example:
+  python -m pyiree.rt.invoke_benchmark --driver=interpreter --threads=1,2,4,8
+"""
+
+import threading
+import time
+
+from absl import app
+from absl import flags
+import numpy as np
+from pyiree import compiler
+from pyiree import rt
+
+FLAGS = flags.FLAGS
+
+flags.DEFINE_string("driver", None, "Driver to invoke with (or the default)")
+flags.DEFINE_list("threads", ["1", "2", "4", "8"], "Thread counts to measure")
+flags.DEFINE_integer("size", 256, "Dimension of the square matmul operands")
+flags.DEFINE_float("duration", 2.0, "Seconds to measure each thread count")
+
+MATMUL_ASM = """
+func @matmul(%lhs: tensor<{n}x{n}xf32>, %rhs: tensor<{n}x{n}xf32>)
+    -> tensor<{n}x{n}xf32> attributes {{ iree.module.export }} {{
+  %0 = "xla_hlo.dot"(%lhs, %rhs)
+      : (tensor<{n}x{n}xf32>, tensor<{n}x{n}xf32>) -> tensor<{n}x{n}xf32>
+  return %0 : tensor<{n}x{n}xf32>
+}}
+"""
+
+
+def measure(config, module, thread_count, duration, lhs, rhs):
+  """Returns the invocations per second of |thread_count| threads."""
+  functions = [
+      rt.load_module(module, config=config).matmul for _ in range(thread_count)
+  ]
+  start_barrier = threading.Barrier(thread_count + 1)
+  stop = threading.Event()
+  counts = [0] * thread_count
+
+  def run(index):
+    matmul = functions[index]
+    # Warm up outside of the measured region.
+    matmul(lhs, rhs)
+    start_barrier.wait()
+    while not stop.is_set():
+      matmul(lhs, rhs)
+      counts[index] += 1
+
+  threads = [
+      threading.Thread(target=run, args=(i,)) for i in range(thread_count)
+  ]
+  for thread in threads:
+    thread.start()
+  start_barrier.wait()
+  start_time = time.perf_counter()
+  time.sleep(duration)
+  stop.set()
+  for thread in threads:
+    thread.join()
+  return sum(counts) / (time.perf_counter() - start_time)
+
+
+def main(argv):
+  del argv  # Unused.
+  ctx = compiler.Context()
+  input_module = ctx.parse_asm(MATMUL_ASM.format(n=FLAGS.size))
+  module = rt.VmModule.from_flatbuffer(input_module.compile())
+  config = rt.Config(FLAGS.driver)
+
+  lhs = np.random.rand(FLAGS.size, FLAGS.size).astype(np.float32)
+  rhs = np.random.rand(FLAGS.size, FLAGS.size).astype(np.float32)
+  baseline = None
+  for thread_count in [int(t) for t in FLAGS.threads]:
+    throughput = measure(config, module, thread_count, FLAGS.duration, lhs,
+                         rhs)
+    if baseline is None:
+      baseline = throughput
+    print("threads=%d invocations/s=%.1f speedup=%.2fx" %
+          (thread_count, throughput, throughput / baseline))
+
+
+if __name__ == "__main__":
+  app.run(main)
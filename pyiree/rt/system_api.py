@@ -23,10 +23,15 @@ and functions.
 # pylint: disable=unused-argument
 # pylint: disable=g-explicit-length-test
 
-__all__ = ["load_module", "load_modules", "Config", "SystemContext"]
+__all__ = [
+    "load_module", "load_modules", "Config", "SystemContext", "AsyncInvocation"
+]
 
+import asyncio
+import concurrent.futures
 import os
 import sys
+import threading
 
 from typing import Optional, Sequence, Tuple
 
@@ -41,10 +46,19 @@ PREFERRED_DRIVER_ENV_KEY = "IREE_DEFAULT_DRIVER"
 # Default value for IREE_DRIVER
 DEFAULT_IREE_DRIVER_VALUE = "vulkan,interpreter"
 
+# Drivers whose devices can directly access host memory, allowing arguments to
+# be passed without copying.
+HOST_LOCAL_DRIVER_NAMES = ("interpreter", "vmla", "llvm")
+
+# Default limit on the idle argument and result buffers kept for reuse by a
+# Config.
+DEFAULT_BUFFER_POOL_MAX_BYTES = 64 * 1024 * 1024
+
 
 def _create_default_iree_driver(
-    driver_names: Optional[Sequence[str]] = None) -> _binding.HalDriver:
-  """Returns a default driver based on environment settings."""
+    driver_names: Optional[Sequence[str]] = None
+) -> Tuple[str, _binding.HalDriver]:
+  """Returns a default driver (and its name) based on environment settings."""
   # TODO(laurenzo): Ideally this should take a module and join any explicitly
   # provided driver list with environmental constraints and what the module
   # was compiled for.
@@ -72,7 +86,7 @@ def _create_default_iree_driver(
           file=sys.stderr)
       driver_exceptions[driver_name] = ex
     print("Created IREE driver %s: %r" % (driver_name, driver), file=sys.stderr)
-    return driver
+    return driver_name, driver
 
   # All failed.
   raise RuntimeError("Could not create any requested driver "
@@ -81,51 +95,201 @@ def _create_default_iree_driver(
 
 
 class Config:
-  """System configuration."""
+  """System configuration.
+
+  Buffers that functions of all SystemContexts using the config allocate for
+  copied arguments are recycled through |buffer_pool| (None if disabled with a
+  buffer_pool_max_bytes of 0), whose counters show how often calls allocated.
+  Argument buffers that a result shares are left to the result instead.
+  Results are allocated by the invoked functions themselves and are not
+  pooled; only FunctionAbi.allocate_results with static_alloc=True draws them
+  from the pool.
+  They are placed in host memory for drivers in HOST_LOCAL_DRIVER_NAMES and in
+  host-visible device memory otherwise (see |placement|).
+  """
 
+  driver_name: str
   driver: _binding.HalDriver
   device: _binding.HalDevice
   vm_instance: _binding.VmInstance
   host_type_factory: _binding.HostTypeFactory
   default_modules: Tuple[AnyModule]
+  buffer_pool: Optional[_binding.HalBufferPool]
+  placement: _binding.BufferPlacement
 
-  def __init__(self, driver_name: Optional[str] = None):
+  def __init__(self,
+               driver_name: Optional[str] = None,
+               buffer_pool_max_bytes: int = DEFAULT_BUFFER_POOL_MAX_BYTES):
     self.vm_instance = _binding.VmInstance()
-    self.driver = _create_default_iree_driver(
+    self.driver_name, self.driver = _create_default_iree_driver(
         driver_name.split(",") if driver_name is not None else None)
     self.device = self.driver.create_default_device()
     hal_module = _binding.create_hal_module(self.device)
     self.host_type_factory = _binding.HostTypeFactory.get_numpy()
     self.default_modules = (hal_module,)
+    self.placement = (
+        _binding.BufferPlacement.HOST_LOCAL
+        if self.driver_name in HOST_LOCAL_DRIVER_NAMES else
+        _binding.BufferPlacement.DEVICE_LOCAL)
+    self.buffer_pool = (
+        _binding.HalBufferPool(self.device, buffer_pool_max_bytes,
+                               self.placement)
+        if buffer_pool_max_bytes > 0 else None)
 
 
 _global_config = None
+_global_config_lock = threading.Lock()
 
 
 def _get_global_config():
   global _global_config
-  if _global_config is None:
-    _global_config = Config()
-  return _global_config
+  with _global_config_lock:
+    if _global_config is None:
+      _global_config = Config()
+    return _global_config
+
+
+class AsyncInvocation:
+  """Pending result of BoundFunction.invoke_async.
+
+  Results are unpacked on the thread that first asks for them (via result()
+  or by awaiting), leaving the context's invocation thread free to run the
+  next invocation in the meantime.
+  """
+
+  def __init__(self, bound_function: "BoundFunction",
+               inputs: _binding.VmVariantList,
+               results: _binding.VmVariantList,
+               invoke_future: concurrent.futures.Future):
+    self._bound_function = bound_function
+    self._inputs = inputs
+    self._results = results
+    self._invoke_future = invoke_future
+    self._unpack_lock = threading.Lock()
+    self._unpacked = False
+    self._unpacked_results = None
+
+  def done(self) -> bool:
+    """Returns whether the invocation has completed (or failed)."""
+    return self._invoke_future.done()
+
+  def result(self, timeout: Optional[float] = None):
+    """Waits for the invocation and returns its results as __call__ would.
+
+    Args:
+      timeout: Seconds to wait, or None to wait indefinitely.
+
+    Raises:
+      concurrent.futures.TimeoutError: if the timeout expires.
+      Any error raised by the invocation.
+    """
+    self._invoke_future.result(timeout)
+    return self._unpack()
+
+  def __await__(self):
+    yield from asyncio.wrap_future(self._invoke_future).__await__()
+    return self._unpack()
+
+  def _unpack(self):
+    with self._unpack_lock:
+      if not self._unpacked:
+        abi = self._bound_function._abi
+        self._unpacked_results = self._bound_function._normalize_results(
+            abi.raw_unpack_results(self._results, self._inputs))
+        self._unpacked = True
+        # Release argument memory as soon as possible.
+        self._inputs = None
+        self._results = None
+      return self._unpacked_results
 
 
 class BoundFunction:
-  """Wraps a VmFunction, VmContext and ABI into a pythonic function."""
+  """Wraps a VmFunction, VmContext and ABI into a pythonic function.
+
+  Calls release the GIL while the function executes. Calls on the same
+  SystemContext are serialized; use a SystemContext per thread to execute
+  concurrently.
+
+  On host-local devices, suitably aligned contiguous array arguments are passed
+  without copying and must not be modified until the call returns. The
+  function's abi records how many arguments were imported versus copied.
+  """
 
-  def __init__(self, context: "SystemContext",
-               vm_function: _binding.VmFunction):
+  def __init__(self,
+               context: "SystemContext",
+               vm_function: _binding.VmFunction,
+               vm_module: Optional[_binding.VmModule] = None):
     self._context = context
     self._vm_function = vm_function
-    self._abi = context.create_function_abi(vm_function)
+    self._abi = context.create_function_abi(vm_function, vm_module)
+    # Input/result lists are allocated once and reset on each call so that
+    # repeated invocations do not allocate list storage.
+    self._inputs = _binding.VmVariantList(self._abi.raw_input_arity)
+    self._results = _binding.VmVariantList(self._abi.raw_result_arity)
 
   def __call__(self, *args):
     # NOTE: This is just doing sync dispatch right now. In the future,
     # this should default to async and potentially have some kind of policy
     # flag that can allow it to be overriden.
-    inputs = self._abi.raw_pack_inputs(args)
-    results = self._abi.allocate_results(inputs, static_alloc=False)
-    self._context._vm_context.invoke(self._vm_function, inputs, results)
-    unpacked_results = self._abi.raw_unpack_results(results)
+    inputs = self._inputs
+    results = self._results
+    # The context and the reused lists must not be used by concurrent calls.
+    with self._context._invoke_lock:
+      self._abi.raw_pack_inputs_into(args, inputs)
+      self._abi.allocate_results_into(inputs, results, static_alloc=False)
+      self._context._vm_context.invoke(self._vm_function, inputs, results)
+      unpacked_results = self._abi.raw_unpack_results(results, inputs)
+    return self._normalize_results(unpacked_results)
+
+  def invoke_batch(self, batch: Sequence[Sequence]) -> list:
+    """Invokes the function once for each tuple of arguments in |batch|.
+
+    All arguments are packed up front and the invocations run in a single
+    native loop, so the fixed cost of packing, invoking and unpacking through
+    Python is paid once per batch rather than once per call.
+
+    Args:
+      batch: Sequence of argument tuples, one per invocation.
+
+    Returns:
+      A list with the results of each invocation, as returned by __call__.
+    """
+    with self._context._invoke_lock:
+      batch_results = self._context._vm_context.invoke_batch(
+          self._vm_function, self._abi, batch)
+    return [self._normalize_results(r) for r in batch_results]
+
+  def invoke_async(self, *args) -> AsyncInvocation:
+    """Starts invoking the function with |args| and returns immediately.
+
+    Arguments are packed on the calling thread before returning, and
+    invocations run in order on a thread owned by the SystemContext. Callers
+    can therefore pack the next request and unpack the previous one while the
+    current one executes.
+
+    Args:
+      *args: Arguments as passed to __call__. Arrays imported without copying
+        must not be modified until the invocation completes.
+
+    Returns:
+      An AsyncInvocation that can be waited on with result() or awaited.
+    """
+    # Each pending invocation needs its own lists.
+    inputs = _binding.VmVariantList(self._abi.raw_input_arity)
+    results = _binding.VmVariantList(self._abi.raw_result_arity)
+    self._abi.raw_pack_inputs_into(args, inputs)
+    self._abi.allocate_results_into(inputs, results, static_alloc=False)
+    invoke_future = self._context._get_invoke_executor().submit(
+        self._invoke_packed, inputs, results)
+    return AsyncInvocation(self, inputs, results, invoke_future)
+
+  def _invoke_packed(self, inputs: _binding.VmVariantList,
+                     results: _binding.VmVariantList):
+    with self._context._invoke_lock:
+      self._context._vm_context.invoke(self._vm_function, inputs, results)
+
+  @staticmethod
+  def _normalize_results(unpacked_results):
     # TODO(laurenzo): When switching from 'raw' to structured pack/unpack,
     # the ABI should take care of this one-arg special case.
     if len(unpacked_results) == 1:
@@ -172,7 +336,7 @@ class BoundModule:
     if vm_function is None:
       raise KeyError("Function '%s' not found in module '%s'" %
                      (name, self.name))
-    bound_function = BoundFunction(self._context, vm_function)
+    bound_function = BoundFunction(self._context, vm_function, self._vm_module)
     self._lazy_functions[name] = bound_function
     return bound_function
 
@@ -191,10 +355,20 @@ class Modules(dict):
 
 
 class SystemContext:
-  """Global system."""
+  """Global system.
+
+  Threading: the Config (and with it the VM instance, driver and device) and
+  modules may be shared by SystemContexts on any number of threads. Functions
+  of a single SystemContext may be called from any thread but execute one at a
+  time, so concurrent execution requires a SystemContext per thread.
+  """
 
   def __init__(self, modules=None, config: Optional[Config] = None):
     self._config = config if config is not None else _get_global_config()
+    self._invoke_lock = threading.Lock()
+    # Runs invoke_async invocations in order; created on first use.
+    self._invoke_executor = None
+    self._invoke_executor_lock = threading.Lock()
     print("SystemContext driver=%r" % self._config.driver, file=sys.stderr)
     self._is_dynamic = modules is None
     if not self._is_dynamic:
@@ -231,10 +405,51 @@ class SystemContext:
   def modules(self) -> Modules:
     return self._modules
 
-  def create_function_abi(self, f: _binding.VmFunction) -> _binding.FunctionAbi:
-    return self._vm_context.create_function_abi(self._config.device,
-                                                self._config.host_type_factory,
-                                                f)
+  def close(self):
+    """Waits for pending invoke_async invocations and stops their thread.
+
+    A later invoke_async starts a new thread. Contexts that are collected
+    without being closed stop the thread without waiting.
+    """
+    with self._invoke_executor_lock:
+      invoke_executor = self._invoke_executor
+      self._invoke_executor = None
+    if invoke_executor is not None:
+      invoke_executor.shutdown(wait=True)
+
+  def __del__(self):
+    # May run on a partially initialized context.
+    invoke_executor = getattr(self, "_invoke_executor", None)
+    if invoke_executor is not None:
+      invoke_executor.shutdown(wait=False)
+
+  def _get_invoke_executor(self) -> concurrent.futures.ThreadPoolExecutor:
+    with self._invoke_executor_lock:
+      if self._invoke_executor is None:
+        self._invoke_executor = concurrent.futures.ThreadPoolExecutor(
+            max_workers=1, thread_name_prefix="iree-invoke")
+      return self._invoke_executor
+
+  def create_function_abi(
+      self,
+      f: _binding.VmFunction,
+      vm_module: Optional[_binding.VmModule] = None) -> _binding.FunctionAbi:
+    """Creates an ABI for |f|.
+
+    If the module of |f| is given, the marshalling plan cached on the module is
+    used so that it is only built once across all SystemContexts.
+    """
+    if vm_module is not None:
+      abi = vm_module.create_function_abi(self._config.device,
+                                          self._config.host_type_factory, f)
+    else:
+      abi = self._vm_context.create_function_abi(
+          self._config.device, self._config.host_type_factory, f)
+    abi.import_host_buffers = (
+        self._config.driver_name in HOST_LOCAL_DRIVER_NAMES)
+    abi.placement = self._config.placement
+    abi.buffer_pool = self._config.buffer_pool
+    return abi
 
   def add_modules(self, modules):
     assert self._is_dynamic, "Cannot 'add_module' on a static context"
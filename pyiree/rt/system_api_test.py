@@ -15,7 +15,9 @@
 
 # pylint: disable=unused-variable
 
+import asyncio
 import re
+import threading
 
 from absl.testing import absltest
 import numpy as np
@@ -39,6 +41,21 @@ def create_simple_mul_module():
   return m
 
 
+def create_identity_module():
+  ctx = compiler.Context()
+  input_module = ctx.parse_asm("""
+  module @identity {
+    func @identity(%arg0: tensor<4xf32>) -> tensor<4xf32>
+          attributes { iree.module.export } {
+        return %arg0 : tensor<4xf32>
+    }
+  }
+  """)
+  binary = input_module.compile()
+  m = rt.VmModule.from_flatbuffer(binary)
+  return m
+
+
 class SystemApiTest(absltest.TestCase):
 
   def test_non_existing_driver(self):
@@ -92,6 +109,108 @@ class SystemApiTest(absltest.TestCase):
     results = f(arg0, arg1)
     np.testing.assert_allclose(results, [4., 10., 18., 28.])
 
+  def test_import_host_buffers(self):
+    arithmetic = rt.load_module(
+        create_simple_mul_module(), config=rt.Config("interpreter"))
+    f = arithmetic.simple_mul
+    arg0 = np.array([1., 2., 3., 4.], dtype=np.float32)
+    arg1 = np.array([4., 5., 6., 7.], dtype=np.float32)
+    results = f(arg0, arg1)
+    np.testing.assert_allclose(results, [4., 10., 18., 28.])
+    self.assertEqual(2, f._abi.imported_buffer_count)
+    self.assertEqual(0, f._abi.copied_buffer_count)
+    # Misaligned arguments are copied.
+    misaligned = np.zeros(17, dtype=np.uint8)[1:].view(np.float32)
+    misaligned[:] = arg0
+    results = f(misaligned, arg1)
+    np.testing.assert_allclose(results, [4., 10., 18., 28.])
+    self.assertEqual(3, f._abi.imported_buffer_count)
+    self.assertEqual(1, f._abi.copied_buffer_count)
+
+  def test_buffer_pool(self):
+    config = rt.Config("interpreter")
+    arithmetic = rt.load_module(create_simple_mul_module(), config=config)
+    # Strided arguments are copied into buffers from the config's pool.
+    arg0 = np.array([1., 0., 2., 0., 3., 0., 4., 0.], dtype=np.float32)[::2]
+    arg1 = np.array([7., 6., 5., 4.], dtype=np.float32)[::-1]
+    for _ in range(3):
+      results = arithmetic.simple_mul(arg0, arg1)
+      np.testing.assert_allclose(results, [4., 10., 18., 28.])
+    self.assertEqual(2, config.buffer_pool.miss_count)
+    self.assertEqual(4, config.buffer_pool.hit_count)
+
+  def test_buffer_pool_result_aliases_arg(self):
+    config = rt.Config("interpreter")
+    identity = rt.load_module(create_identity_module(), config=config)
+    # Strided arguments are copied into pooled buffers, which the function
+    # returns as its result.
+    first = identity.identity(np.arange(8, dtype=np.float32)[::2])
+    second = identity.identity(np.arange(8, 16, dtype=np.float32)[::2])
+    # The first result still references its buffer, so it was not recycled
+    # for the second argument.
+    np.testing.assert_array_equal(first, [0., 2., 4., 6.])
+    np.testing.assert_array_equal(second, [8., 10., 12., 14.])
+    self.assertEqual(0, config.buffer_pool.hit_count)
+
+  def test_buffer_pool_disabled(self):
+    config = rt.Config("interpreter", buffer_pool_max_bytes=0)
+    self.assertIsNone(config.buffer_pool)
+    arithmetic = rt.load_module(create_simple_mul_module(), config=config)
+    self.assertIsNone(arithmetic.simple_mul._abi.buffer_pool)
+
+  def test_strided_invoke(self):
+    arithmetic = rt.load_module(create_simple_mul_module())
+    arg0 = np.array([1., 0., 2., 0., 3., 0., 4., 0.], dtype=np.float32)[::2]
+    arg1 = np.array([7., 6., 5., 4.], dtype=np.float32)[::-1]
+    results = arithmetic.simple_mul(arg0, arg1)
+    np.testing.assert_allclose(results, [4., 10., 18., 28.])
+
+  def test_invoke_batch(self):
+    arithmetic = rt.load_module(create_simple_mul_module())
+    arg1 = np.array([4., 5., 6., 7.], dtype=np.float32)
+    batch = [(np.full(4, i, dtype=np.float32), arg1) for i in range(5)]
+    batch_results = arithmetic.simple_mul.invoke_batch(batch)
+    self.assertLen(batch_results, 5)
+    for i, results in enumerate(batch_results):
+      np.testing.assert_allclose(results, arg1 * i)
+    self.assertEqual([], arithmetic.simple_mul.invoke_batch([]))
+
+  def test_invoke_async(self):
+    arithmetic = rt.load_module(create_simple_mul_module())
+    arg1 = np.array([4., 5., 6., 7.], dtype=np.float32)
+    # Pack each request while the previous ones execute.
+    invocations = [
+        arithmetic.simple_mul.invoke_async(
+            np.full(4, i, dtype=np.float32), arg1) for i in range(5)
+    ]
+    for i, invocation in enumerate(invocations):
+      np.testing.assert_allclose(invocation.result(), arg1 * i)
+      self.assertTrue(invocation.done())
+
+  def test_await_invoke_async(self):
+    arithmetic = rt.load_module(create_simple_mul_module())
+    arg0 = np.array([1., 2., 3., 4.], dtype=np.float32)
+    arg1 = np.array([4., 5., 6., 7.], dtype=np.float32)
+
+    async def run():
+      return await arithmetic.simple_mul.invoke_async(arg0, arg1)
+
+    results = asyncio.run(run())
+    np.testing.assert_allclose(results, [4., 10., 18., 28.])
+
+  def test_close_stops_invoke_thread(self):
+    ctx = rt.SystemContext(modules=[create_simple_mul_module()])
+    arithmetic = ctx.modules.arithmetic
+    arg0 = np.array([1., 2., 3., 4.], dtype=np.float32)
+    arg1 = np.array([4., 5., 6., 7.], dtype=np.float32)
+    invocation = arithmetic.simple_mul.invoke_async(arg0, arg1)
+    ctx.close()
+    # Closing waits for pending invocations.
+    self.assertTrue(invocation.done())
+    np.testing.assert_allclose(invocation.result(), [4., 10., 18., 28.])
+    for thread in threading.enumerate():
+      self.assertFalse(thread.name.startswith("iree-invoke"))
+
   def test_load_module(self):
     arithmetic = rt.load_module(create_simple_mul_module())
     arg0 = np.array([1., 2., 3., 4.], dtype=np.float32)
@@ -99,6 +218,48 @@ class SystemApiTest(absltest.TestCase):
     results = arithmetic.simple_mul(arg0, arg1)
     np.testing.assert_allclose(results, [4., 10., 18., 28.])
 
+  def test_shared_marshalling_plan(self):
+    module = create_simple_mul_module()
+    self.assertEqual(0, module.marshalling_plan_count)
+    arg0 = np.array([1., 2., 3., 4.], dtype=np.float32)
+    arg1 = np.array([4., 5., 6., 7.], dtype=np.float32)
+    for _ in range(3):
+      arithmetic = rt.load_module(module)
+      results = arithmetic.simple_mul(arg0, arg1)
+      np.testing.assert_allclose(results, [4., 10., 18., 28.])
+    # Built by the first context and reused by the others.
+    self.assertEqual(1, module.marshalling_plan_count)
+
+  def test_concurrent_invoke(self):
+    module = create_simple_mul_module()
+    shared_arithmetic = rt.load_module(module)
+    arg0 = np.array([1., 2., 3., 4.], dtype=np.float32)
+    arg1 = np.array([4., 5., 6., 7.], dtype=np.float32)
+    errors = []
+
+    def run(arithmetic):
+      try:
+        for _ in range(10):
+          results = arithmetic.simple_mul(arg0, arg1)
+          np.testing.assert_allclose(results, [4., 10., 18., 28.])
+      except Exception as ex:  # pylint: disable=broad-except
+        errors.append(ex)
+
+    # Both a context per thread and a context shared by all threads.
+    threads = [
+        threading.Thread(target=run, args=(rt.load_module(module),))
+        for _ in range(4)
+    ]
+    threads += [
+        threading.Thread(target=run, args=(shared_arithmetic,))
+        for _ in range(4)
+    ]
+    for thread in threads:
+      thread.start()
+    for thread in threads:
+      thread.join()
+    self.assertEqual([], errors)
+
 
 if __name__ == "__main__":
   absltest.main()
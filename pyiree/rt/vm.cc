@@ -14,11 +14,19 @@
 
 #include "bindings/python/pyiree/rt/vm.h"
 
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
 #include "absl/types/optional.h"
 #include "bindings/python/pyiree/common/status_utils.h"
 #include "bindings/python/pyiree/rt/function_abi.h"
 #include "iree/base/api.h"
+#include "iree/base/file_mapping.h"
+#include "iree/base/ref_ptr.h"
+#include "iree/base/tracing.h"
 #include "iree/modules/hal/hal_module.h"
 #include "iree/vm/invocation.h"
 #include "iree/vm/module.h"
@@ -36,6 +44,36 @@ VmModule CreateHalModule(HalDevice* device) {
   return VmModule::CreateRetained(module);
 }
 
+// Builds the marshalling plan of |f| from its reflection attributes.
+std::shared_ptr<const MarshallingPlan> CreateMarshallingPlan(
+    iree_vm_function_t f) {
+  // Only the raw ABI attributes are used, so they are picked out in a single
+  // pass over the reflection attrs.
+  absl::optional<absl::string_view> raw_version;
+  absl::optional<absl::string_view> raw_fsig_str;
+  for (int i = 0;; ++i) {
+    iree_string_view_t key;
+    iree_string_view_t value;
+    auto status = iree_vm_get_function_reflection_attr(f, i, &key, &value);
+    if (status == IREE_STATUS_NOT_FOUND) break;
+    CheckApiStatus(status, "Error getting reflection attr");
+    absl::string_view found_key(key.data, key.size);
+    absl::string_view found_value(value.data, value.size);
+    if (found_key == "fv") {
+      raw_version = found_value;
+    } else if (found_key == "f") {
+      raw_fsig_str = found_value;
+    }
+  }
+  auto attr_lookup =
+      [&](absl::string_view key) -> absl::optional<absl::string_view> {
+    if (key == "fv") return raw_version;
+    if (key == "f") return raw_fsig_str;
+    return absl::nullopt;
+  };
+  return MarshallingPlan::Create(attr_lookup);
+}
+
 }  // namespace
 
 //------------------------------------------------------------------------------
@@ -55,6 +93,7 @@ VmInstance VmInstance::Create() {
 
 VmContext VmContext::Create(VmInstance* instance,
                             absl::optional<std::vector<VmModule*>> modules) {
+  IREE_TRACE_SCOPE0("VmContext#Create");
   iree_vm_context_t* context;
   if (!modules) {
     // Simple create with open allowed modules.
@@ -92,37 +131,113 @@ void VmContext::RegisterModules(std::vector<VmModule*> modules) {
 std::unique_ptr<FunctionAbi> VmContext::CreateFunctionAbi(
     HalDevice& device, std::shared_ptr<HostTypeFactory> host_type_factory,
     iree_vm_function_t f) {
-  // Resolve attrs.
-  absl::InlinedVector<std::pair<iree_string_view_t, iree_string_view_t>, 4>
-      attrs;
-  for (int i = 0;; ++i) {
-    attrs.push_back({});
-    auto status = iree_vm_get_function_reflection_attr(
-        f, i, &attrs.back().first, &attrs.back().second);
-    if (status == IREE_STATUS_NOT_FOUND) {
-      attrs.pop_back();
-      break;
-    }
-    CheckApiStatus(status, "Error getting reflection attr");
-  }
-  auto attr_lookup =
-      [&attrs](absl::string_view key) -> absl::optional<absl::string_view> {
-    for (const auto& attr : attrs) {
-      absl::string_view found_key(attr.first.data, attr.first.size);
-      absl::string_view found_value(attr.second.data, attr.second.size);
-      if (found_key == key) return found_value;
-    }
-    return absl::nullopt;
-  };
-
-  return FunctionAbi::Create(device, std::move(host_type_factory), attr_lookup);
+  return absl::make_unique<FunctionAbi>(device, std::move(host_type_factory),
+                                        CreateMarshallingPlan(f));
 }
 
 void VmContext::Invoke(iree_vm_function_t f, VmVariantList& inputs,
                        VmVariantList& outputs) {
-  CheckApiStatus(iree_vm_invoke(raw_ptr(), f, nullptr, inputs.raw_ptr(),
-                                outputs.raw_ptr(), IREE_ALLOCATOR_SYSTEM),
-                 "Error invoking function");
+  // The invocation only touches native objects, so other Python threads may
+  // run (including invocations on other contexts) until it completes.
+  iree_status_t status;
+  {
+    py::gil_scoped_release release;
+    IREE_TRACE_SCOPE0("VmContext#Invoke");
+    status = iree_vm_invoke(raw_ptr(), f, nullptr, inputs.raw_ptr(),
+                            outputs.raw_ptr(), IREE_ALLOCATOR_SYSTEM);
+  }
+  CheckApiStatus(status, "Error invoking function");
+}
+
+py::list VmContext::InvokeBatch(iree_vm_function_t f, FunctionAbi& abi,
+                                py::sequence batch) {
+  IREE_TRACE_SCOPE0("VmContext#InvokeBatch");
+  size_t batch_size = batch.size();
+  if (batch_size == 0) return py::list();
+  const auto& plan = abi.plan();
+  iree_host_size_t input_arity = plan.inputs.size();
+  iree_host_size_t result_arity = plan.results.size();
+
+  // Allocate storage for all lists at once.
+  auto align = [](iree_host_size_t size) {
+    constexpr iree_host_size_t kAlignment = alignof(std::max_align_t);
+    return (size + kAlignment - 1) / kAlignment * kAlignment;
+  };
+  iree_host_size_t input_list_size =
+      align(iree_vm_variant_list_alloc_size(input_arity));
+  iree_host_size_t result_list_size =
+      align(iree_vm_variant_list_alloc_size(result_arity));
+  void* arena = nullptr;
+  CheckApiStatus(
+      iree_allocator_alloc(IREE_ALLOCATOR_SYSTEM,
+                           IREE_ALLOCATION_MODE_ZERO_CONTENTS,
+                           batch_size * (input_list_size + result_list_size),
+                           &arena),
+      "Error allocating batch lists");
+  struct ArenaReleaser {
+    ~ArenaReleaser() { iree_allocator_free(IREE_ALLOCATOR_SYSTEM, arena); }
+    void* arena;
+  } arena_releaser{arena};
+  std::vector<VmVariantList> inputs;
+  std::vector<VmVariantList> results;
+  inputs.reserve(batch_size);
+  results.reserve(batch_size);
+  auto* arena_ptr = static_cast<uint8_t*>(arena);
+  for (size_t i = 0; i < batch_size; ++i) {
+    inputs.push_back(VmVariantList::CreateInPlace(arena_ptr, input_arity));
+    arena_ptr += input_list_size;
+    results.push_back(VmVariantList::CreateInPlace(arena_ptr, result_arity));
+    arena_ptr += result_list_size;
+  }
+
+  // Pack all arguments.
+  absl::InlinedVector<py::handle, 8> py_args;
+  for (size_t i = 0; i < batch_size; ++i) {
+    py::sequence py_arg_tuple = batch[i];
+    if (py_arg_tuple.size() != input_arity) {
+      throw RaiseValueError(
+          absl::StrCat("Mismatched arity for batch item ", i).c_str());
+    }
+    py_args.assign(py_arg_tuple.begin(), py_arg_tuple.end());
+    abi.RawPack(absl::MakeConstSpan(plan.inputs), absl::MakeSpan(py_args),
+                inputs[i], /*writable=*/false);
+  }
+
+  // Run all invocations without returning to Python.
+  iree_status_t status = IREE_STATUS_OK;
+  size_t failed_index = 0;
+  {
+    py::gil_scoped_release release;
+    for (; failed_index < batch_size; ++failed_index) {
+      IREE_TRACE_SCOPE0("VmContext#Invoke");
+      status = iree_vm_invoke(raw_ptr(), f, nullptr,
+                              inputs[failed_index].raw_ptr(),
+                              results[failed_index].raw_ptr(),
+                              IREE_ALLOCATOR_SYSTEM);
+      if (status != IREE_STATUS_OK) break;
+    }
+  }
+  if (status != IREE_STATUS_OK) {
+    auto message =
+        absl::StrCat("Error invoking function for batch item ", failed_index);
+    CheckApiStatus(status, message.c_str());
+  }
+
+  // Unpack all results.
+  py::list py_batch_results(batch_size);
+  absl::InlinedVector<py::object, 4> py_results;
+  for (size_t i = 0; i < batch_size; ++i) {
+    py_results.clear();
+    py_results.resize(results[i].size());
+    abi.RawUnpack(absl::MakeConstSpan(plan.results), results[i],
+                  absl::MakeSpan(py_results), &inputs[i]);
+    py::tuple py_result_tuple(py_results.size());
+    for (size_t j = 0, e = py_results.size(); j < e; ++j) {
+      py_result_tuple[j] = std::move(py_results[j]);
+    }
+    py_batch_results[i] = std::move(py_result_tuple);
+  }
+  return py_batch_results;
 }
 
 //------------------------------------------------------------------------------
@@ -130,6 +245,7 @@ void VmContext::Invoke(iree_vm_function_t f, VmVariantList& inputs,
 //------------------------------------------------------------------------------
 
 VmModule VmModule::FromFlatbufferBlob(py::buffer flatbuffer_blob) {
+  IREE_TRACE_SCOPE0("VmModule#FromFlatbufferBlob");
   auto buffer_info = flatbuffer_blob.request();
   iree_vm_module_t* module;
 
@@ -156,6 +272,41 @@ VmModule VmModule::FromFlatbufferBlob(py::buffer flatbuffer_blob) {
   return VmModule::CreateRetained(module);
 }
 
+VmModule VmModule::FromFile(const std::string& path) {
+  // Errors are only raised once the GIL has been reacquired.
+  StatusOr<ref_ptr<FileMapping>> file_mapping_or;
+  iree_status_t status = IREE_STATUS_OK;
+  iree_vm_module_t* module = nullptr;
+  {
+    py::gil_scoped_release release;
+    IREE_TRACE_SCOPE0("VmModule#FromFile");
+    file_mapping_or = FileMapping::OpenRead(path);
+    if (file_mapping_or.ok()) {
+      auto file_data = file_mapping_or.ValueOrDie()->data();
+
+      // The mapping is kept alive until the module frees its flatbuffer.
+      auto* retained_mapping =
+          new ref_ptr<FileMapping>(std::move(file_mapping_or).ValueOrDie());
+      auto free_fn = +([](void* self, void*) -> iree_status_t {
+        delete static_cast<ref_ptr<FileMapping>*>(self);
+        return IREE_STATUS_OK;
+      });
+      iree_allocator_t deallocator{retained_mapping /* self */,
+                                   nullptr /* alloc */, free_fn /* dealloc */};
+
+      status = iree_vm_bytecode_module_create(
+          {file_data.data(), static_cast<iree_host_size_t>(file_data.size())},
+          deallocator, IREE_ALLOCATOR_SYSTEM, &module);
+      if (status != IREE_STATUS_OK) {
+        deallocator.free(retained_mapping, nullptr);
+      }
+    }
+  }
+  if (!file_mapping_or.ok()) throw StatusToPyExc(file_mapping_or.status());
+  CheckApiStatus(status, "Error creating vm module from file");
+  return VmModule::CreateRetained(module);
+}
+
 absl::optional<iree_vm_function_t> VmModule::LookupFunction(
     const std::string& name, iree_vm_function_linkage_t linkage) {
   iree_vm_function_t f;
@@ -168,6 +319,27 @@ absl::optional<iree_vm_function_t> VmModule::LookupFunction(
   return f;
 }
 
+std::shared_ptr<const MarshallingPlan> VmModule::GetMarshallingPlan(
+    iree_vm_function_t f) {
+  if (f.module != raw_ptr()) {
+    throw RaiseValueError("Function does not belong to this module");
+  }
+  auto key = std::make_pair(static_cast<int>(f.linkage),
+                            static_cast<int>(f.ordinal));
+  auto it = marshalling_plans_.find(key);
+  if (it != marshalling_plans_.end()) return it->second;
+  auto plan = CreateMarshallingPlan(f);
+  marshalling_plans_.emplace(key, plan);
+  return plan;
+}
+
+std::unique_ptr<FunctionAbi> VmModule::CreateFunctionAbi(
+    HalDevice& device, std::shared_ptr<HostTypeFactory> host_type_factory,
+    iree_vm_function_t f) {
+  return absl::make_unique<FunctionAbi>(device, std::move(host_type_factory),
+                                        GetMarshallingPlan(f));
+}
+
 //------------------------------------------------------------------------------
 // VmVariantList
 //------------------------------------------------------------------------------
@@ -221,6 +393,8 @@ void SetupVmBindings(pybind11::module m) {
   py::class_<VmVariantList>(m, "VmVariantList")
       .def(py::init(&VmVariantList::Create))
       .def_property_readonly("size", &VmVariantList::size)
+      .def_property_readonly("capacity", &VmVariantList::capacity)
+      .def("reset", &VmVariantList::Reset)
       .def("__repr__", &VmVariantList::DebugString);
 
   py::class_<iree_vm_function_t>(m, "VmFunction")
@@ -236,13 +410,20 @@ void SetupVmBindings(pybind11::module m) {
       .def_property_readonly("context_id", &VmContext::context_id)
       .def("create_function_abi", &VmContext::CreateFunctionAbi,
            py::arg("device"), py::arg("host_type_factory"), py::arg("f"))
-      .def("invoke", &VmContext::Invoke);
+      .def("invoke", &VmContext::Invoke)
+      .def("invoke_batch", &VmContext::InvokeBatch, py::arg("f"),
+           py::arg("abi"), py::arg("batch"));
 
   py::class_<VmModule>(m, "VmModule")
       .def_static("from_flatbuffer", &VmModule::FromFlatbufferBlob)
+      .def_static("from_file", &VmModule::FromFile, py::arg("path"))
       .def_property_readonly("name", &VmModule::name)
       .def("lookup_function", &VmModule::LookupFunction, py::arg("name"),
-           py::arg("linkage") = IREE_VM_FUNCTION_LINKAGE_EXPORT);
+           py::arg("linkage") = IREE_VM_FUNCTION_LINKAGE_EXPORT)
+      .def("create_function_abi", &VmModule::CreateFunctionAbi,
+           py::arg("device"), py::arg("host_type_factory"), py::arg("f"))
+      .def_property_readonly("marshalling_plan_count",
+                             &VmModule::marshalling_plan_count);
 }
 
 }  // namespace python
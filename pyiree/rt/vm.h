@@ -15,18 +15,26 @@
 #ifndef IREE_BINDINGS_PYTHON_PYIREE_RT_VM_H_
 #define IREE_BINDINGS_PYTHON_PYIREE_RT_VM_H_
 
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/container/flat_hash_map.h"
 #include "absl/types/optional.h"
 #include "bindings/python/pyiree/common/binding.h"
 #include "bindings/python/pyiree/rt/host_types.h"
 #include "iree/base/api.h"
 #include "iree/vm/api.h"
 #include "iree/vm/bytecode_module.h"
+#include "iree/vm/ref.h"
 #include "iree/vm/variant_list.h"
 
 namespace iree {
 namespace python {
 
 class FunctionAbi;
+struct MarshallingPlan;
 
 //------------------------------------------------------------------------------
 // Retain/release bindings
@@ -67,27 +75,58 @@ class VmVariantList {
   VmVariantList() : list_(nullptr) {}
   ~VmVariantList() {
     if (list_) {
-      CheckApiStatus(iree_vm_variant_list_free(list_), "Error freeing list");
+      ReleaseRefs();
+      if (owns_storage_) iree_allocator_free(IREE_ALLOCATOR_SYSTEM, list_);
     }
+    RecyclePooledBuffers();
   }
 
-  VmVariantList(VmVariantList&& other) {
+  VmVariantList(VmVariantList&& other)
+      : owns_storage_(other.owns_storage_),
+        host_buffers_(std::move(other.host_buffers_)),
+        pooled_buffers_(std::move(other.pooled_buffers_)) {
     list_ = other.list_;
     other.list_ = nullptr;
+    other.host_buffers_.clear();
+    other.pooled_buffers_.clear();
   }
 
   VmVariantList& operator=(const VmVariantList&) = delete;
   VmVariantList(const VmVariantList&) = delete;
 
+  // Creates a list with storage for |capacity| values. The storage is owned
+  // by the wrapper (rather than the list) so that Reset() can reuse it.
   static VmVariantList Create(iree_host_size_t capacity) {
-    iree_vm_variant_list_t* list;
+    void* list_storage;
     CheckApiStatus(
-        iree_vm_variant_list_alloc(capacity, IREE_ALLOCATOR_SYSTEM, &list),
+        iree_allocator_alloc(IREE_ALLOCATOR_SYSTEM,
+                             IREE_ALLOCATION_MODE_ZERO_CONTENTS,
+                             iree_vm_variant_list_alloc_size(capacity),
+                             &list_storage),
         "Error allocating variant list");
+    iree_vm_variant_list_t* list;
+    CheckApiStatus(iree_vm_variant_list_init(list_storage, capacity, &list),
+                   "Error initializing variant list");
     return VmVariantList(list);
   }
 
+  // Creates a list with storage for |capacity| values in |list_storage|,
+  // which must be at least iree_vm_variant_list_alloc_size(capacity) bytes
+  // and outlive the list. Used to allocate many lists from one arena.
+  static VmVariantList CreateInPlace(void* list_storage,
+                                     iree_host_size_t capacity) {
+    iree_vm_variant_list_t* list;
+    CheckApiStatus(iree_vm_variant_list_init(list_storage, capacity, &list),
+                   "Error initializing variant list");
+    VmVariantList variant_list(list);
+    variant_list.owns_storage_ = false;
+    return variant_list;
+  }
+
   iree_host_size_t size() const { return iree_vm_variant_list_size(list_); }
+  iree_host_size_t capacity() const {
+    return iree_vm_variant_list_capacity(list_);
+  }
 
   iree_vm_variant_list_t* raw_ptr() { return list_; }
   const iree_vm_variant_list_t* raw_ptr() const { return list_; }
@@ -97,11 +136,131 @@ class VmVariantList {
                    "Error appending to list");
   }
 
+  // Releases all values and resets the size to 0, retaining the capacity so
+  // that the list can be reused for another invocation without allocating.
+  void Reset() {
+    ReleaseRefs();
+    host_buffers_.clear();
+    RecyclePooledBuffers();
+    iree_host_size_t list_capacity = capacity();
+    CheckApiStatus(iree_vm_variant_list_init(list_, list_capacity, &list_),
+                   "Error resetting variant list");
+  }
+
+  // Records that a buffer in the list wraps the host memory of |py_view|.
+  // The view itself is owned by the buffer, which keeps the exporting object
+  // alive until its last reference is released.
+  void RecordHostBuffer(const Py_buffer& py_view) {
+    host_buffers_.push_back(
+        {static_cast<const uint8_t*>(py_view.buf),
+         static_cast<size_t>(py_view.len)});
+  }
+
+  // Returns true if [data, data + length) overlaps the memory of any buffer
+  // recorded with RecordHostBuffer().
+  bool AliasesHostBuffer(const void* data, size_t length) const {
+    auto* begin = static_cast<const uint8_t*>(data);
+    for (const auto& host_buffer : host_buffers_) {
+      if (begin < host_buffer.data + host_buffer.length &&
+          host_buffer.data < begin + length) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Records that |buffer| in the list was acquired from |pool|. It is
+  // recycled into the pool once the list is reset or destroyed, unless
+  // ownership is taken with TakePooledBuffer() or dropped with
+  // DropPooledBuffersAliasing() first. The host memory it maps to is recorded
+  // to find results that share it.
+  void RetainPooledBuffer(iree_hal_buffer_t* buffer,
+                          std::shared_ptr<HalBufferPool> pool) {
+    iree_hal_mapped_memory_t mapped_memory;
+    CheckApiStatus(iree_hal_buffer_map(buffer, IREE_HAL_MEMORY_ACCESS_READ, 0,
+                                       iree_hal_buffer_byte_length(buffer),
+                                       &mapped_memory),
+                   "Error mapping pooled buffer");
+    pooled_buffers_.push_back(
+        {HalBuffer::RetainAndCreate(buffer), std::move(pool),
+         mapped_memory.contents.data, mapped_memory.contents.data_length});
+    CheckApiStatus(iree_hal_buffer_unmap(buffer, &mapped_memory),
+                   "Error unmapping pooled buffer");
+  }
+
+  // Stops tracking the pooled buffers of the list that are |buffer| or whose
+  // host memory overlaps [data, data + length), such as arguments that a
+  // result returns directly or through a subspan. The result shares them from
+  // now on, so they are released with it instead of being recycled.
+  void DropPooledBuffersAliasing(iree_hal_buffer_t* buffer, const void* data,
+                                 size_t length) {
+    auto* begin = static_cast<const uint8_t*>(data);
+    pooled_buffers_.erase(
+        std::remove_if(pooled_buffers_.begin(), pooled_buffers_.end(),
+                       [&](const PooledBuffer& pooled_buffer) {
+                         return pooled_buffer.buffer.raw_ptr() == buffer ||
+                                (begin < pooled_buffer.data +
+                                             pooled_buffer.length &&
+                                 pooled_buffer.data < begin + length);
+                       }),
+        pooled_buffers_.end());
+  }
+
+  // Stops tracking |buffer| and returns the pool it must be recycled into by
+  // its new owner, or nullptr if it is not a pooled buffer of the list.
+  std::shared_ptr<HalBufferPool> TakePooledBuffer(iree_hal_buffer_t* buffer) {
+    for (auto it = pooled_buffers_.begin(); it != pooled_buffers_.end();
+         ++it) {
+      if (it->buffer.raw_ptr() == buffer) {
+        auto pool = std::move(it->pool);
+        pooled_buffers_.erase(it);
+        return pool;
+      }
+    }
+    return nullptr;
+  }
+
   std::string DebugString() const;
 
  private:
+  struct HostBuffer {
+    const uint8_t* data;
+    size_t length;
+  };
+  struct PooledBuffer {
+    HalBuffer buffer;
+    std::shared_ptr<HalBufferPool> pool;
+    // Host memory the buffer maps to.
+    const uint8_t* data;
+    size_t length;
+  };
+
   VmVariantList(iree_vm_variant_list_t* list) : list_(list) {}
+
+  void ReleaseRefs() {
+    for (iree_host_size_t i = 0, e = size(); i < e; ++i) {
+      iree_vm_variant_t* variant = iree_vm_variant_list_get(list_, i);
+      if (IREE_VM_VARIANT_IS_REF(variant)) {
+        iree_vm_ref_release(&variant->ref);
+      }
+    }
+  }
+
+  // Must follow ReleaseRefs() so that the list no longer references the
+  // buffers. Buffers still shared with results were dropped before.
+  void RecyclePooledBuffers() {
+    for (auto& pooled_buffer : pooled_buffers_) {
+      pooled_buffer.pool->Recycle(std::move(pooled_buffer.buffer));
+    }
+    pooled_buffers_.clear();
+  }
+
   iree_vm_variant_list_t* list_;
+  bool owns_storage_ = true;
+  // Host memory imported (rather than copied) into the list.
+  std::vector<HostBuffer> host_buffers_;
+  // Buffers to return to their pool with the list.
+  std::vector<PooledBuffer> pooled_buffers_;
 };
 
 //------------------------------------------------------------------------------
@@ -115,8 +274,15 @@ class VmInstance : public ApiRefCounted<VmInstance, iree_vm_instance_t> {
 
 class VmModule : public ApiRefCounted<VmModule, iree_vm_module_t> {
  public:
+  // Creates a module that references the memory of |flatbuffer_blob| (such
+  // as an OpaqueBlob returned by the compiler) without copying it. The blob
+  // is retained until the module is freed and must not be modified.
   static VmModule FromFlatbufferBlob(py::buffer flatbuffer_blob);
 
+  // Creates a module from a read-only mapping of the file at |path|, which is
+  // unmapped when the module is freed.
+  static VmModule FromFile(const std::string& path);
+
   absl::optional<iree_vm_function_t> LookupFunction(
       const std::string& name, iree_vm_function_linkage_t linkage);
 
@@ -124,6 +290,26 @@ class VmModule : public ApiRefCounted<VmModule, iree_vm_module_t> {
     auto name_sv = iree_vm_module_name(raw_ptr());
     return std::string(name_sv.data, name_sv.size);
   }
+
+  // Returns the marshalling plan of |f|, which must be a function of this
+  // module. Plans are built from the reflection attributes on first use and
+  // shared by the ABIs of all contexts the module is used with. Requires the
+  // GIL.
+  std::shared_ptr<const MarshallingPlan> GetMarshallingPlan(
+      iree_vm_function_t f);
+
+  // Creates a function ABI for |f| using its cached marshalling plan.
+  std::unique_ptr<FunctionAbi> CreateFunctionAbi(
+      HalDevice& device, std::shared_ptr<HostTypeFactory> host_type_factory,
+      iree_vm_function_t f);
+
+  size_t marshalling_plan_count() const { return marshalling_plans_.size(); }
+
+ private:
+  // Keyed by function (linkage, ordinal).
+  absl::flat_hash_map<std::pair<int, int>,
+                      std::shared_ptr<const MarshallingPlan>>
+      marshalling_plans_;
 };
 
 class VmContext : public ApiRefCounted<VmContext, iree_vm_context_t> {
@@ -141,11 +327,27 @@ class VmContext : public ApiRefCounted<VmContext, iree_vm_context_t> {
   // Unique id for this context.
   int context_id() const { return iree_vm_context_id(raw_ptr()); }
 
-  // Synchronously invokes the given function.
+  // Synchronously invokes the given function. The GIL is released for the
+  // duration of the invocation.
+  //
+  // Threading: instances, modules and devices may be shared by any number of
+  // threads. A context, and the |inputs| and |outputs| lists, must only be
+  // used by one invocation at a time; use a context per thread to invoke
+  // concurrently.
   void Invoke(iree_vm_function_t f, VmVariantList& inputs,
               VmVariantList& outputs);
 
+  // Invokes |f| once for each tuple of arguments in |batch| and returns a
+  // list with a tuple of results per invocation. All arguments are packed
+  // with |abi| into lists allocated from a single arena before running the
+  // invocations in one native loop with the GIL released, and all results are
+  // unpacked afterwards. Stops at (and raises) the first failed invocation.
+  py::list InvokeBatch(iree_vm_function_t f, FunctionAbi& abi,
+                       py::sequence batch);
+
   // Creates a function ABI suitable for marshalling function inputs/results.
+  // The marshalling plan is built for each call; VmModule::CreateFunctionAbi
+  // reuses it across contexts.
   std::unique_ptr<FunctionAbi> CreateFunctionAbi(
       HalDevice& device, std::shared_ptr<HostTypeFactory> host_type_factory,
       iree_vm_function_t f);
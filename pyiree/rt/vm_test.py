@@ -15,13 +15,16 @@
 
 # pylint: disable=unused-variable
 
+import os
+import tempfile
+
 from absl.testing import absltest
 import numpy as np
 from pyiree import compiler
 from pyiree import rt
 
 
-def create_simple_mul_module():
+def compile_simple_mul_module():
   ctx = compiler.Context()
   input_module = ctx.parse_asm("""
     func @simple_mul(%arg0: tensor<4xf32>, %arg1: tensor<4xf32>) -> tensor<4xf32>
@@ -30,9 +33,12 @@ def create_simple_mul_module():
         return %0 : tensor<4xf32>
     }
     """)
-  binary = input_module.compile()
-  m = rt.VmModule.from_flatbuffer(binary)
-  return m
+  return input_module.compile()
+
+
+def create_simple_mul_module():
+  # The compiled blob is referenced by the module rather than copied.
+  return rt.VmModule.from_flatbuffer(compile_simple_mul_module())
 
 
 class VmTest(absltest.TestCase):
@@ -65,6 +71,41 @@ class VmTest(absltest.TestCase):
     notfound = m.lookup_function("notfound")
     self.assertIs(notfound, None)
 
+  def test_module_from_file(self):
+    binary = compile_simple_mul_module()
+    fd, path = tempfile.mkstemp(suffix=".vmfb")
+    with os.fdopen(fd, "wb") as module_file:
+      module_file.write(binary)
+    m = rt.VmModule.from_file(path)
+    f = m.lookup_function("simple_mul")
+    self.assertGreater(f.ordinal, 0)
+    del f, m
+    os.remove(path)
+
+  def test_module_from_missing_file(self):
+    # A NotFound status is raised as a RuntimeError.
+    with self.assertRaises(RuntimeError):
+      rt.VmModule.from_file(
+          os.path.join(tempfile.gettempdir(), "missing_module.vmfb"))
+
+  def test_invoke_tracing(self):
+    m = create_simple_mul_module()
+    instance = rt.VmInstance()
+    context = rt.VmContext(instance, modules=[self.hal_module, m])
+    f = m.lookup_function("simple_mul")
+    abi = context.create_function_abi(self.device, self.htf, f)
+    rt.tracing.enable_thread()
+    with rt.tracing.ScopedEvent("VmTest#test_invoke_tracing"):
+      arg0 = np.array([1., 2., 3., 4.], dtype=np.float32)
+      arg1 = np.array([4., 5., 6., 7.], dtype=np.float32)
+      inputs = abi.raw_pack_inputs((arg0, arg1))
+      results = abi.allocate_results(inputs, static_alloc=False)
+      context.invoke(f, inputs, results)
+    if rt.tracing.is_available():
+      path = os.path.join(tempfile.gettempdir(), "vm_test.wtf-trace")
+      rt.tracing.flush(path)
+      self.assertTrue(os.path.exists(path))
+
   def test_dynamic_module_context(self):
     instance = rt.VmInstance()
     context = rt.VmContext(instance)
@@ -99,6 +140,29 @@ class VmTest(absltest.TestCase):
     print("RESULTS:", results)
     np.testing.assert_allclose(results[0], [4., 10., 18., 28.])
 
+  def test_module_function_abi(self):
+    m = create_simple_mul_module()
+    instance = rt.VmInstance()
+    f = m.lookup_function("simple_mul")
+    arg0 = np.array([1., 2., 3., 4.], dtype=np.float32)
+    arg1 = np.array([4., 5., 6., 7.], dtype=np.float32)
+    for _ in range(2):
+      context = rt.VmContext(instance, modules=[self.hal_module, m])
+      abi = m.create_function_abi(self.device, self.htf, f)
+      inputs = abi.raw_pack_inputs((arg0, arg1))
+      allocated_results = abi.allocate_results(inputs, static_alloc=False)
+      context.invoke(f, inputs, allocated_results)
+      results = abi.raw_unpack_results(allocated_results)
+      np.testing.assert_allclose(results[0], [4., 10., 18., 28.])
+    self.assertEqual(1, m.marshalling_plan_count)
+
+  def test_module_function_abi_foreign_function(self):
+    m = create_simple_mul_module()
+    other = create_simple_mul_module()
+    f = other.lookup_function("simple_mul")
+    with self.assertRaisesRegex(ValueError, "does not belong"):
+      m.create_function_abi(self.device, self.htf, f)
+
 
 if __name__ == "__main__":
   absltest.main()
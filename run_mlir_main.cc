@@ -36,11 +36,24 @@
 // used to separate the compiler flags from the runtime flags, such as:
 //   iree-run-mlir -iree-hal-target-backends=vulkan-spirv -- --logtostderr
 
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <sstream>
+#include <thread>  // NOLINT
 #include <utility>
+#include <vector>
 
 #include "absl/flags/flag.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
 #include "absl/strings/string_view.h"
+#include "absl/strings/strip.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/types/span.h"
 #include "iree/base/api.h"
 #include "iree/base/api_util.h"
@@ -56,6 +69,8 @@
 #include "iree/compiler/Translation/IREEVM.h"
 #include "iree/hal/api.h"
 #include "iree/modules/hal/hal_module.h"
+#include "iree/tools/compile_cache.h"
+#include "iree/tools/compile_stats.h"
 #include "iree/tools/vm_util.h"
 #include "iree/vm/api.h"
 #include "iree/vm/bytecode_module.h"
@@ -120,6 +135,50 @@ static llvm::cl::opt<bool> run_flag{
     llvm::cl::init(true),
 };
 
+static llvm::cl::opt<std::string> output_format_flag{
+    "output-format",
+    llvm::cl::desc("Format results are written in: text, npy (a numpy "
+                   "array of the single result), npz (a numpy archive of all "
+                   "results) or binary (raw element data)"),
+    llvm::cl::init("text"),
+};
+
+static llvm::cl::opt<std::string> output_file_flag{
+    "output-file",
+    llvm::cl::desc("File results are written to (defaults to stdout)"),
+    llvm::cl::init("-"),
+};
+
+static llvm::cl::opt<std::string> compile_cache_dir_flag{
+    "compile-cache-dir",
+    llvm::cl::desc("Directory of a content-addressed cache of compiled "
+                   "modules. Disabled if empty"),
+    llvm::cl::init(""),
+};
+
+static llvm::cl::opt<int64_t> compile_cache_max_size_flag{
+    "compile-cache-max-size-mb",
+    llvm::cl::desc("Maximum size of -compile-cache-dir before least recently "
+                   "used entries are evicted (0 for unbounded)"),
+    llvm::cl::init(1024),
+};
+
+static llvm::cl::opt<std::string> compile_stats_flag{
+    "compile-stats",
+    llvm::cl::desc("Writes per-pass compile time and peak memory statistics "
+                   "to the given JSON file. Memory increases are measured on "
+                   "the peak of the whole process and cannot be attributed to "
+                   "one pass with -jobs > 1"),
+    llvm::cl::init(""),
+};
+
+static llvm::cl::opt<int> jobs_flag{
+    "jobs",
+    llvm::cl::desc("Number of splits and target backends to translate and "
+                   "evaluate concurrently. The -print-* flags force 1"),
+    llvm::cl::init(1),
+};
+
 static llvm::cl::list<std::string> run_args_flag{
     "run-arg",
     llvm::cl::desc("Argument passed to the execution flag parser"),
@@ -129,6 +188,24 @@ static llvm::cl::list<std::string> run_args_flag{
 namespace iree {
 namespace {
 
+// Destination for function results.
+struct ResultsOutput {
+  OutputFormat format = OutputFormat::kText;
+  // Function results are written here.
+  std::ostream* stream = &std::cout;
+  // Progress messages such as 'EXEC @foo' are written here. May be the same
+  // as |stream|.
+  std::ostream* log_stream = &std::cout;
+};
+
+// A chunk of the input file to be translated and evaluated as one module.
+struct SourceChunk {
+  llvm::StringRef source;
+  std::string identifier;
+  // Line the chunk starts at in the input file, used for error reporting.
+  unsigned split_line = 0;
+};
+
 // Returns a driver name capable of handling input from the given backend.
 std::string BackendToDriverName(std::string backend) {
   size_t dash = backend.find('-');
@@ -160,33 +237,55 @@ StatusOr<std::vector<std::string>> GetTargetBackends() {
   return target_backends;
 }
 
-// Prepares a module for evaluation by running MLIR import and IREE translation.
-// Returns the serialized flatbuffer data.
-StatusOr<std::string> PrepareModule(
-    std::string target_backend,
-    std::unique_ptr<llvm::MemoryBuffer> file_buffer) {
-  mlir::MLIRContext context;
-
+// Parses the input MLIR module and runs the target independent Flow
+// transformation pipeline on it. The result is shared by all target backends.
+StatusOr<mlir::OwningModuleRef> PrepareFlowModule(
+    mlir::MLIRContext* context, std::unique_ptr<llvm::MemoryBuffer> file_buffer,
+    CompileStats* compile_stats) {
   // Parse input MLIR module.
   llvm::SourceMgr source_mgr;
   source_mgr.AddNewSourceBuffer(std::move(file_buffer), llvm::SMLoc());
   mlir::OwningModuleRef mlir_module =
-      mlir::parseSourceFile(source_mgr, &context);
+      mlir::parseSourceFile(source_mgr, context);
+  if (!mlir_module) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "Failed to parse input MLIR module";
+  }
 
   if (export_all_flag) {
     for (auto function : mlir_module->getOps<mlir::FuncOp>()) {
-      function.setAttr("iree.module.export", mlir::UnitAttr::get(&context));
+      function.setAttr("iree.module.export", mlir::UnitAttr::get(context));
     }
   }
 
+  mlir::PassManager pass_manager(context);
+  mlir::applyPassManagerCLOptions(pass_manager);
+  if (compile_stats) compile_stats->Instrument(&pass_manager, "flow");
+  mlir::iree_compiler::IREE::Flow::buildFlowTransformPassPipeline(pass_manager);
+  if (failed(pass_manager.run(mlir_module.get()))) {
+    return InternalErrorBuilder(IREE_LOC)
+           << "Conversion from source -> flow failed";
+  }
+  return mlir_module;
+}
+
+// Prepares a module for evaluation by running the IREE translation for
+// |target_backend| on |mlir_module|, a clone of the module returned by
+// PrepareFlowModule. Returns the serialized flatbuffer data.
+StatusOr<std::string> PrepareModule(std::string target_backend,
+                                    mlir::OwningModuleRef mlir_module,
+                                    CompileStats* compile_stats) {
   // Translate from MLIR to IREE bytecode.
   LOG(INFO) << "Compiling for target backend '" << target_backend << "'...";
   auto executable_options =
       mlir::iree_compiler::IREE::HAL::getExecutableTargetOptionsFromFlags();
-  executable_options.targets = {std::move(target_backend)};
+  executable_options.targets = {target_backend};
   mlir::PassManager pass_manager(mlir_module->getContext());
   mlir::applyPassManagerCLOptions(pass_manager);
-  mlir::iree_compiler::IREE::Flow::buildFlowTransformPassPipeline(pass_manager);
+  if (compile_stats) {
+    compile_stats->Instrument(&pass_manager,
+                              absl::StripSuffix(target_backend, "*"));
+  }
   mlir::iree_compiler::IREE::HAL::buildHALTransformPassPipeline(
       pass_manager, executable_options);
   mlir::iree_compiler::IREE::VM::buildVMTransformPassPipeline(pass_manager);
@@ -194,7 +293,7 @@ StatusOr<std::string> PrepareModule(
       mlir::iree_compiler::IREE::createDropCompilerHintsPass());
   if (failed(pass_manager.run(mlir_module.get()))) {
     return InternalErrorBuilder(IREE_LOC)
-           << "Conversion from source -> vm failed";
+           << "Conversion from flow -> vm failed";
   }
 
   if (print_mlir_flag) {
@@ -205,12 +304,17 @@ StatusOr<std::string> PrepareModule(
       mlir::iree_compiler::IREE::VM::getBytecodeTargetOptionsFromFlags();
   std::string binary_contents;
   llvm::raw_string_ostream binary_output(binary_contents);
-  if (failed(mlir::iree_compiler::IREE::VM::translateModuleToBytecode(
-          mlir_module.get(), bytecode_options, binary_output))) {
-    return InternalErrorBuilder(IREE_LOC)
-           << "Serialization to flatbuffer bytecode (binary) failed";
+  {
+    ScopedCompileStep step(compile_stats,
+                           absl::StripSuffix(target_backend, "*"),
+                           "translateModuleToBytecode");
+    if (failed(mlir::iree_compiler::IREE::VM::translateModuleToBytecode(
+            mlir_module.get(), bytecode_options, binary_output))) {
+      return InternalErrorBuilder(IREE_LOC)
+             << "Serialization to flatbuffer bytecode (binary) failed";
+    }
+    binary_output.flush();
   }
-  binary_output.flush();
 
   // Print the annotated MLIR and flatbuffer; easiest way right now is to just
   // do it all again.
@@ -244,28 +348,36 @@ StatusOr<std::string> PrepareModule(
   return binary_contents;
 }
 
-// Evaluates a single function in its own fiber, printing the results to stdout.
+// Evaluates a single function in its own fiber, writing the results to
+// |output|.
 Status EvaluateFunction(iree_vm_context_t* context,
                         iree_hal_allocator_t* allocator,
-                        iree_vm_function_t function) {
+                        iree_vm_function_t function,
+                        const ResultsOutput& output) {
   auto function_name = iree_vm_function_name(&function);
-  std::cout << "EXEC @"
+  *output.log_stream << "EXEC @"
             << absl::string_view(function_name.data, function_name.size)
             << std::endl;
   ASSIGN_OR_RETURN(auto input_descs, ParseInputSignature(function));
-  ASSIGN_OR_RETURN(
-      auto* input_list,
-      ParseToVariantList(input_descs, allocator,
-                         absl::MakeConstSpan(&input_values_flag.front(),
-                                             input_values_flag.size())));
-
+  if (input_values_flag.size() != input_descs.size()) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "Signature mismatch; expected " << input_descs.size()
+           << " inputs but received " << input_values_flag.size();
+  }
   ASSIGN_OR_RETURN(auto output_descs, ParseOutputSignature(function));
-  // Prepare outputs list to accept the results from the invocation.
+
+  // Both lists are allocated once with the capacity of the signature and
+  // reset in place instead of being reallocated around the invocation.
+  iree_vm_variant_list_t* input_list = nullptr;
+  RETURN_IF_ERROR(AllocateReusableVariantList(
+      input_descs.size(), IREE_ALLOCATOR_SYSTEM, &input_list));
   iree_vm_variant_list_t* output_list = nullptr;
-  RETURN_IF_ERROR(FromApiStatus(
-      iree_vm_variant_list_alloc(output_descs.size(), IREE_ALLOCATOR_SYSTEM,
-                                 &output_list),
-      IREE_LOC));
+  RETURN_IF_ERROR(AllocateReusableVariantList(
+      output_descs.size(), IREE_ALLOCATOR_SYSTEM, &output_list));
+  for (int i = 0; i < input_descs.size(); ++i) {
+    RETURN_IF_ERROR(AppendInputToVariantList(input_descs[i], allocator,
+                                             input_values_flag[i], input_list));
+  }
 
   // Synchronously invoke the function.
   RETURN_IF_ERROR(FromApiStatus(
@@ -273,19 +385,23 @@ Status EvaluateFunction(iree_vm_context_t* context,
                      output_list, IREE_ALLOCATOR_SYSTEM),
       IREE_LOC));
 
-  iree_vm_variant_list_free(input_list);
+  // Drop the input buffers before the results are written.
+  RETURN_IF_ERROR(ResetVariantList(input_list));
 
-  // Print outputs.
-  RETURN_IF_ERROR(PrintVariantList(output_descs, output_list));
-  iree_vm_variant_list_free(output_list);
+  // Write outputs.
+  RETURN_IF_ERROR(WriteVariantList(output_descs, output_list, output.format,
+                                   output.stream));
 
+  RETURN_IF_ERROR(FreeReusableVariantList(input_list, IREE_ALLOCATOR_SYSTEM));
+  RETURN_IF_ERROR(FreeReusableVariantList(output_list, IREE_ALLOCATOR_SYSTEM));
   return OkStatus();
 }
 
 // Evaluates all exported functions within given module.
 Status EvaluateFunctions(iree_vm_instance_t* instance,
                          absl::string_view driver_name,
-                         const std::string& flatbuffer_data) {
+                         absl::string_view flatbuffer_data,
+                         const ResultsOutput& output) {
   LOG(INFO) << "Evaluating all functions in module for driver '" << driver_name
             << "'...";
 
@@ -334,8 +450,8 @@ Status EvaluateFunctions(iree_vm_instance_t* instance,
         << "Creating context";
 
     // Invoke the function and print results.
-    RETURN_IF_ERROR(
-        EvaluateFunction(context, iree_hal_device_allocator(device), function))
+    RETURN_IF_ERROR(EvaluateFunction(context, iree_hal_device_allocator(device),
+                                     function, output))
         << "Evaluating export function " << ordinal;
 
     iree_vm_context_release(context);
@@ -358,35 +474,286 @@ Status EvaluateFunctions(iree_vm_instance_t* instance,
   return evaluate_status;
 }
 
-// Translates and runs a single LLVM file buffer.
-Status EvaluateFile(std::unique_ptr<llvm::MemoryBuffer> file_buffer) {
-  // TODO(benvanik): move to instance-based registration.
-  RETURN_IF_ERROR(FromApiStatus(iree_hal_module_register_types(), IREE_LOC))
-      << "Registering HAL types";
+// The module of a source chunk for one target backend, either mapped from the
+// compile cache or translated from the chunk's Flow module.
+struct BackendModule {
+  std::string target_backend;
+  std::string cache_key;
+  ref_ptr<FileMapping> cached_module;
+  std::string compiled_module;
+
+  absl::string_view flatbuffer_data() const {
+    if (!cached_module) return compiled_module;
+    return absl::string_view(
+        reinterpret_cast<const char*>(cached_module->data().data()),
+        cached_module->data().size());
+  }
+};
+
+// Looks up the module of |chunk| for |target_backend| in |compile_cache|, if
+// any. The returned module has no |cached_module| on a miss.
+BackendModule LookupBackendModule(const SourceChunk& chunk,
+                                  const std::string& target_backend,
+                                  CompileCache* compile_cache) {
+  BackendModule module;
+  module.target_backend = target_backend;
+  if (!compile_cache) return module;
+  module.cache_key = ComputeCompileCacheKey(
+      chunk.source,
+      mlir::iree_compiler::IREE::VM::getBytecodeTargetOptionsFromFlags(),
+      {target_backend}, absl::StrCat("export_all=", export_all_flag));
+  auto cached_module_or = compile_cache->Lookup(module.cache_key);
+  if (cached_module_or.ok()) {
+    LOG(INFO) << "Using cached module for target backend '" << target_backend
+              << "'";
+    module.cached_module = std::move(cached_module_or).ValueOrDie();
+  }
+  return module;
+}
+
+// Parses |chunk| in |context| and runs the Flow pipeline on it.
+StatusOr<mlir::OwningModuleRef> PrepareChunkFlowModule(
+    const SourceChunk& chunk, mlir::MLIRContext* context,
+    CompileStats* compile_stats) {
+  auto file_buffer =
+      llvm::MemoryBuffer::getMemBufferCopy(chunk.source, chunk.identifier);
+  return PrepareFlowModule(context, std::move(file_buffer), compile_stats);
+}
+
+// Translates |mlir_module|, a clone of the chunk's Flow module, into |module|
+// unless it was found in the compile cache and then evaluates all of its
+// functions in a new instance.
+Status CompileAndEvaluateBackendModule(mlir::OwningModuleRef mlir_module,
+                                       CompileCache* compile_cache,
+                                       CompileStats* compile_stats,
+                                       BackendModule* module,
+                                       const ResultsOutput& output) {
+  if (!module->cached_module) {
+    ASSIGN_OR_RETURN(module->compiled_module,
+                     PrepareModule(module->target_backend + '*',
+                                   std::move(mlir_module), compile_stats),
+                     _ << "Translating module");
+    if (compile_cache) {
+      auto store_status =
+          compile_cache->Store(module->cache_key, module->compiled_module);
+      if (!store_status.ok()) {
+        LOG(WARNING) << "Failed to store module in compile cache: "
+                     << store_status;
+      }
+    }
+  }
 
   iree_vm_instance_t* instance = nullptr;
   RETURN_IF_ERROR(FromApiStatus(
       iree_vm_instance_create(IREE_ALLOCATOR_SYSTEM, &instance), IREE_LOC))
       << "Create instance";
+  Status status =
+      EvaluateFunctions(instance, BackendToDriverName(module->target_backend),
+                        module->flatbuffer_data(), output);
+  iree_vm_instance_release(instance);
+  RETURN_IF_ERROR(status) << "Evaluating functions";
+  return OkStatus();
+}
 
-  ASSIGN_OR_RETURN(auto target_backends, GetTargetBackends());
+// Translates and runs a single source chunk for all |target_backends| in
+// order, stopping at the first failure. The input is parsed and lowered
+// through Flow once, when the first backend misses the cache, and then cloned
+// for each backend.
+Status EvaluateChunk(const SourceChunk& chunk,
+                     absl::Span<const std::string> target_backends,
+                     CompileCache* compile_cache,
+                     CompileStats* compile_stats,
+                     const ResultsOutput& output) {
+  mlir::MLIRContext context;
+  mlir::OwningModuleRef flow_module;
   for (const auto& target_backend : target_backends) {
-    // Prepare the module for execution and evaluate it.
-    auto cloned_file_buffer = llvm::MemoryBuffer::getMemBufferCopy(
-        file_buffer->getBuffer(), file_buffer->getBufferIdentifier());
-    ASSIGN_OR_RETURN(
-        auto flatbuffer_data,
-        PrepareModule(target_backend + '*', std::move(cloned_file_buffer)),
-        _ << "Translating module");
-    RETURN_IF_ERROR(EvaluateFunctions(
-        instance, BackendToDriverName(target_backend), flatbuffer_data))
-        << "Evaluating functions";
+    auto module = LookupBackendModule(chunk, target_backend, compile_cache);
+    mlir::OwningModuleRef mlir_module;
+    if (!module.cached_module) {
+      if (!flow_module) {
+        ASSIGN_OR_RETURN(
+            flow_module,
+            PrepareChunkFlowModule(chunk, &context, compile_stats),
+            _ << "Translating module");
+      }
+      mlir_module = flow_module->clone();
+    }
+    RETURN_IF_ERROR(CompileAndEvaluateBackendModule(
+        std::move(mlir_module), compile_cache, compile_stats, &module,
+        output));
   }
-
-  iree_vm_instance_release(instance);
   return OkStatus();
 }
 
+// Runs scheduled tasks on a fixed number of threads. Tasks may schedule more
+// tasks and Run returns once all of them have finished.
+class JobQueue {
+ public:
+  void Schedule(std::function<void()> task) {
+    absl::MutexLock lock(&mutex_);
+    tasks_.push_back(std::move(task));
+  }
+
+  void Run(int thread_count) {
+    std::vector<std::thread> threads;
+    for (int i = 0; i < thread_count; ++i) {
+      threads.emplace_back([this]() { RunTasks(); });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+
+ private:
+  void RunTasks() {
+    while (true) {
+      std::function<void()> task;
+      {
+        absl::MutexLock lock(&mutex_);
+        mutex_.Await(absl::Condition(this, &JobQueue::HasTaskOrIsDone));
+        if (tasks_.empty()) return;
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+        ++running_count_;
+      }
+      task();
+      absl::MutexLock lock(&mutex_);
+      --running_count_;
+    }
+  }
+
+  bool HasTaskOrIsDone() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    return !tasks_.empty() || running_count_ == 0;
+  }
+
+  absl::Mutex mutex_;
+  std::deque<std::function<void()>> tasks_ ABSL_GUARDED_BY(mutex_);
+  int running_count_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+// Evaluates all |chunks| for all |target_backends| and returns the status of
+// each chunk. With -jobs > 1 the chunks are prepared concurrently and, once a
+// chunk's Flow module is ready, each of its target backends is translated and
+// evaluated as a job of its own. Output of each job is buffered and emitted in
+// order, dropping backends that a serial run would have skipped after a
+// failure, so that results and statuses are identical to a serial run.
+std::vector<Status> EvaluateChunks(
+    absl::Span<const SourceChunk> chunks,
+    absl::Span<const std::string> target_backends,
+    CompileCache* compile_cache, CompileStats* compile_stats,
+    const ResultsOutput& output) {
+  std::vector<Status> chunk_statuses(chunks.size());
+  if (jobs_flag <= 1) {
+    for (int i = 0; i < chunks.size(); ++i) {
+      chunk_statuses[i] = EvaluateChunk(chunks[i], target_backends,
+                                        compile_cache, compile_stats, output);
+    }
+    return chunk_statuses;
+  }
+
+  struct BackendJob {
+    BackendModule module;
+    // Clone of the chunk's Flow module to translate on a cache miss.
+    mlir::OwningModuleRef mlir_module;
+    std::stringstream results;
+    std::stringstream log;
+    Status status;
+  };
+  struct ChunkJob {
+    // Shared by the backend jobs of the chunk and released by the last one.
+    std::unique_ptr<mlir::MLIRContext> context;
+    mlir::OwningModuleRef flow_module;
+    Status flow_status;
+    std::vector<BackendJob> backends;
+    std::atomic<int> pending_backend_count{0};
+  };
+  std::vector<ChunkJob> chunk_jobs(chunks.size());
+  bool shared_stream = output.stream == output.log_stream;
+  JobQueue queue;
+
+  auto run_backend_job = [&](ChunkJob* chunk_job, BackendJob* job) {
+    ResultsOutput job_output;
+    job_output.format = output.format;
+    job_output.stream = &job->results;
+    job_output.log_stream = shared_stream ? &job->results : &job->log;
+    auto evaluate = [&]() -> Status {
+      if (!job->module.cached_module) {
+        RETURN_IF_ERROR(chunk_job->flow_status) << "Translating module";
+      }
+      return CompileAndEvaluateBackendModule(std::move(job->mlir_module),
+                                             compile_cache, compile_stats,
+                                             &job->module, job_output);
+    };
+    job->status = evaluate();
+    if (--chunk_job->pending_backend_count == 0) {
+      chunk_job->flow_module = mlir::OwningModuleRef();
+      chunk_job->context.reset();
+    }
+  };
+
+  auto run_chunk_job = [&](int chunk_index) {
+    const auto& chunk = chunks[chunk_index];
+    auto& chunk_job = chunk_jobs[chunk_index];
+    chunk_job.backends = std::vector<BackendJob>(target_backends.size());
+    bool needs_flow_module = false;
+    for (int i = 0; i < target_backends.size(); ++i) {
+      auto& module = chunk_job.backends[i].module;
+      module = LookupBackendModule(chunk, target_backends[i], compile_cache);
+      needs_flow_module |= !module.cached_module;
+    }
+    if (needs_flow_module) {
+      chunk_job.context = std::make_unique<mlir::MLIRContext>();
+      auto flow_module_or =
+          PrepareChunkFlowModule(chunk, chunk_job.context.get(), compile_stats);
+      if (flow_module_or.ok()) {
+        chunk_job.flow_module = std::move(flow_module_or).ValueOrDie();
+      } else {
+        chunk_job.flow_status = std::move(flow_module_or).status();
+      }
+    }
+
+    // Clones are made here so that backend jobs never read the shared Flow
+    // module while another one is being cloned from it.
+    chunk_job.pending_backend_count = chunk_job.backends.size();
+    for (auto& job : chunk_job.backends) {
+      if (!job.module.cached_module && chunk_job.flow_module) {
+        job.mlir_module = chunk_job.flow_module->clone();
+      }
+      queue.Schedule([&run_backend_job, &chunk_job, &job]() {
+        run_backend_job(&chunk_job, &job);
+      });
+    }
+  };
+
+  for (int i = 0; i < chunks.size(); ++i) {
+    queue.Schedule([&run_chunk_job, i]() { run_chunk_job(i); });
+  }
+  queue.Run(std::min<int>(jobs_flag, chunks.size() * target_backends.size()));
+
+  // Emit output in serial order, dropping backends that a serial run would
+  // have skipped after a failure.
+  for (int i = 0; i < chunks.size(); ++i) {
+    for (auto& job : chunk_jobs[i].backends) {
+      *output.log_stream << job.log.str();
+      *output.stream << job.results.str();
+      if (!job.status.ok()) {
+        chunk_statuses[i] = std::move(job.status);
+        break;
+      }
+    }
+  }
+  return chunk_statuses;
+}
+
+// Logs hit/miss statistics of |compile_cache|, if any.
+void LogCompileCacheStats(CompileCache* compile_cache) {
+  if (!compile_cache) return;
+  auto stats = compile_cache->stats();
+  LOG(INFO) << "Compile cache '" << compile_cache->directory()
+            << "': " << stats.hits << " hits, " << stats.misses << " misses, "
+            << stats.stores << " stores, " << stats.evictions << " evictions";
+}
+
 // Runs the given .mlir file based on the current flags.
 Status RunFile(const std::string& mlir_filename) {
   // Load input file/from stdin.
@@ -398,15 +765,80 @@ Status RunFile(const std::string& mlir_filename) {
            << error_message;
   }
 
+  ResultsOutput output;
+  ASSIGN_OR_RETURN(output.format, ParseOutputFormat(output_format_flag));
+  std::ofstream output_file_stream;
+  if (output_file_flag != "-") {
+    output_file_stream.open(output_file_flag, std::ios::binary);
+    if (!output_file_stream.is_open()) {
+      return InvalidArgumentErrorBuilder(IREE_LOC)
+             << "Unable to open output file '" << output_file_flag << "'";
+    }
+    output.stream = &output_file_stream;
+  } else if (output.format != OutputFormat::kText) {
+    // Keep stdout clean when binary results are written to it.
+    output.log_stream = &std::cerr;
+  }
+
+  // TODO(benvanik): move to instance-based registration.
+  RETURN_IF_ERROR(FromApiStatus(iree_hal_module_register_types(), IREE_LOC))
+      << "Registering HAL types";
+  ASSIGN_OR_RETURN(auto target_backends, GetTargetBackends());
+
+  // Printing flags write to stderr while translating, outside of the
+  // buffered output of each job, so jobs would interleave their output.
+  if (jobs_flag > 1 &&
+      (print_mlir_flag || print_annotated_mlir_flag || print_flatbuffer_flag)) {
+    LOG(WARNING) << "Ignoring -jobs=" << jobs_flag
+                 << " as -print-* flags require serial evaluation";
+    jobs_flag = 1;
+  }
+
+  // Printing flags need the compiler to run, so they bypass the cache. So do
+  // compiler options the cache key does not cover.
+  std::unique_ptr<CompileCache> compile_cache;
+  auto unkeyed_options = GetUnkeyedCompilerOptions();
+  if (!compile_cache_dir_flag.empty() && !unkeyed_options.empty()) {
+    LOG(WARNING) << "Not using -compile-cache-dir as it does not cover -"
+                 << absl::StrJoin(unkeyed_options, ", -");
+  }
+  if (!compile_cache_dir_flag.empty() && unkeyed_options.empty() &&
+      !print_mlir_flag && !print_annotated_mlir_flag &&
+      !print_flatbuffer_flag) {
+    ASSIGN_OR_RETURN(
+        compile_cache,
+        CompileCache::Open(compile_cache_dir_flag,
+                           static_cast<uint64_t>(compile_cache_max_size_flag)
+                               << 20));
+  }
+
+  // Statistics are aggregated over all chunks and backends.
+  std::unique_ptr<CompileStats> compile_stats;
+  if (!compile_stats_flag.empty()) {
+    compile_stats = std::make_unique<CompileStats>();
+  }
+  auto write_compile_stats = [&]() -> Status {
+    if (!compile_stats) return OkStatus();
+    return compile_stats->WriteJsonFile(compile_stats_flag);
+  };
+
+  auto* full_buffer = file.get();
   if (!split_input_file_flag) {
     // Use entire buffer as a single module.
-    return EvaluateFile(std::move(file));
+    SourceChunk chunk;
+    chunk.source = full_buffer->getBuffer();
+    chunk.identifier = full_buffer->getBufferIdentifier().str();
+    auto chunk_statuses =
+        EvaluateChunks({chunk}, target_backends, compile_cache.get(),
+                       compile_stats.get(), output);
+    LogCompileCacheStats(compile_cache.get());
+    RETURN_IF_ERROR(write_compile_stats());
+    return std::move(chunk_statuses[0]);
   }
 
   // Split the buffer into separate modules and evaluate independently.
   // This matches the -split-input-file arg to mlir-opt.
   const char kSplitMarker[] = "// -----";
-  auto* full_buffer = file.get();
   llvm::SmallVector<llvm::StringRef, 8> source_buffers;
   full_buffer->getBuffer().split(source_buffers, kSplitMarker);
 
@@ -414,19 +846,31 @@ Status RunFile(const std::string& mlir_filename) {
   llvm::SourceMgr file_source_mgr;
   file_source_mgr.AddNewSourceBuffer(std::move(file), llvm::SMLoc());
 
-  // Process each chunk in turn. Only return the first error (but log all).
-  Status any_failure;
+  std::vector<SourceChunk> chunks;
   for (auto& sub_source_buffer : source_buffers) {
     auto split_loc = llvm::SMLoc::getFromPointer(sub_source_buffer.data());
-    unsigned split_line = file_source_mgr.getLineAndColumn(split_loc).first;
-    auto sub_buffer = llvm::MemoryBuffer::getMemBufferCopy(
-        sub_source_buffer, full_buffer->getBufferIdentifier() +
-                               llvm::Twine(" split at line #") +
-                               llvm::Twine(split_line));
-    auto sub_failure = EvaluateFile(std::move(sub_buffer));
+    SourceChunk chunk;
+    chunk.source = sub_source_buffer;
+    chunk.split_line = file_source_mgr.getLineAndColumn(split_loc).first;
+    chunk.identifier = (full_buffer->getBufferIdentifier() +
+                        llvm::Twine(" split at line #") +
+                        llvm::Twine(chunk.split_line))
+                           .str();
+    chunks.push_back(std::move(chunk));
+  }
+
+  // Process each chunk. Only return the first error (but log all).
+  auto chunk_statuses = EvaluateChunks(chunks, target_backends,
+                                       compile_cache.get(),
+                                       compile_stats.get(), output);
+  LogCompileCacheStats(compile_cache.get());
+  RETURN_IF_ERROR(write_compile_stats());
+  Status any_failure;
+  for (int i = 0; i < chunks.size(); ++i) {
+    auto& sub_failure = chunk_statuses[i];
     if (!sub_failure.ok()) {
-      LOG(ERROR) << "Failure for split at line #" << split_line << ": "
-                 << sub_failure;
+      LOG(ERROR) << "Failure for split at line #" << chunks[i].split_line
+                 << ": " << sub_failure;
       if (any_failure.ok()) {
         any_failure = std::move(sub_failure);
       }
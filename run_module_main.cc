@@ -12,16 +12,21 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <fstream>
 #include <iostream>
+#include <memory>
 
 #include "absl/flags/flag.h"
+#include "absl/memory/memory.h"
 #include "absl/strings/string_view.h"
 #include "iree/base/api_util.h"
-#include "iree/base/file_io.h"
 #include "iree/base/init.h"
 #include "iree/base/source_location.h"
 #include "iree/base/status.h"
+#include "iree/base/tracing.h"
 #include "iree/modules/hal/hal_module.h"
+#include "iree/tools/execution_profile.h"
+#include "iree/tools/module_server.h"
 #include "iree/tools/vm_util.h"
 #include "iree/vm/bytecode_module.h"
 
@@ -45,49 +50,65 @@ ABSL_FLAG(std::vector<std::string>, inputs, {},
           "Due to the absence of repeated flags in absl, commas should not be "
           "used to separate elements. They are reserved for separating input "
           "values:\n"
-          "2x2xi32=[[1 2][3 4]], 1x2xf32=[[1 2]]");
+          "2x2xi32=[[1 2][3 4]], 1x2xf32=[[1 2]]\n"
+          "Buffers may also be memory mapped from binary files:\n"
+          "@input.npy, 2x2xf32=@raw_input.bin, @buffer_data_def.fb");
+
+ABSL_FLAG(std::string, output_format, "text",
+          "Format results are written in: 'text' (truncated, human readable), "
+          "'npy' (a numpy array of the single result), 'npz' (a numpy "
+          "archive of all results) or 'binary' (raw element data of each "
+          "result).");
+
+ABSL_FLAG(std::string, output_file, "-",
+          "File results are written to. Defaults to stdout.");
+
+ABSL_FLAG(std::string, profile, "",
+          "Optional file to write an execution profile of the invocation to: "
+          "per-function call counts with inclusive and exclusive time as JSON "
+          "if the path ends with '.json', or collapsed stacks for flamegraph "
+          "tools otherwise.");
+
+ABSL_FLAG(std::string, trace_file, "",
+          "Optional file to write a Web Tracing Framework trace of loading, "
+          "marshalling and invocation to. Requires a build with tracing "
+          "enabled (WTF_ENABLE).");
+
+ABSL_FLAG(bool, server, false,
+          "Keeps the module and context loaded and serves a stream of "
+          "invocation requests read from stdin, writing one response per "
+          "request to stdout, instead of running --entry_function once. "
+          "Requires --input_file, as stdin carries the requests. See "
+          "iree/tools/module_server.h for the protocol.");
+
+ABSL_FLAG(std::string, server_socket, "",
+          "Serves requests like --server on connections to the Unix domain "
+          "socket at this path, one connection at a time, until a client "
+          "requests a shutdown.");
 
 namespace iree {
 namespace {
 
-StatusOr<std::string> GetModuleContentsFromFlags() {
-  auto input_file = absl::GetFlag(FLAGS_input_file);
-  std::string contents;
-  if (input_file == "-") {
-    contents = std::string{std::istreambuf_iterator<char>(std::cin),
-                           std::istreambuf_iterator<char>()};
+// Serves requests against the loaded module until the input ends or a client
+// requests a shutdown.
+Status RunServer(iree_vm_context_t* context, iree_vm_module_t* input_module,
+                 iree_hal_device_t* device) {
+  ModuleServer server(context, input_module,
+                      iree_hal_device_allocator(device));
+  std::string server_socket = absl::GetFlag(FLAGS_server_socket);
+  if (!server_socket.empty()) {
+    std::cerr << "Serving module on " << server_socket << "\n";
+    RETURN_IF_ERROR(server.ServeUnixSocket(server_socket));
   } else {
-    ASSIGN_OR_RETURN(contents, file_io::GetFileContents(input_file));
+    RETURN_IF_ERROR(server.Serve(&std::cin, &std::cout));
   }
-  return contents;
+  std::cerr << "Served " << server.request_count() << " requests\n";
+  return OkStatus();
 }
 
-Status Run() {
-  RETURN_IF_ERROR(FromApiStatus(iree_hal_module_register_types(), IREE_LOC))
-      << "registering HAL types";
-  iree_vm_instance_t* instance = nullptr;
-  RETURN_IF_ERROR(FromApiStatus(
-      iree_vm_instance_create(IREE_ALLOCATOR_SYSTEM, &instance), IREE_LOC))
-      << "creating instance";
-
-  ASSIGN_OR_RETURN(auto module_data, GetModuleContentsFromFlags());
-  iree_vm_module_t* input_module = nullptr;
-  RETURN_IF_ERROR(LoadBytecodeModule(module_data, &input_module));
-
-  iree_hal_device_t* device = nullptr;
-  RETURN_IF_ERROR(CreateDevice(absl::GetFlag(FLAGS_driver), &device));
-  iree_vm_module_t* hal_module = nullptr;
-  RETURN_IF_ERROR(CreateHalModule(device, &hal_module));
-
-  iree_vm_context_t* context = nullptr;
-  // Order matters. The input module will likely be dependent on the hal module.
-  std::array<iree_vm_module_t*, 2> modules = {hal_module, input_module};
-  RETURN_IF_ERROR(FromApiStatus(iree_vm_context_create_with_modules(
-                                    instance, modules.data(), modules.size(),
-                                    IREE_ALLOCATOR_SYSTEM, &context),
-                                IREE_LOC))
-      << "creating context";
-
+// Runs --entry_function once with --inputs.
+Status RunFunction(iree_vm_context_t* context, iree_vm_module_t* input_module,
+                   iree_hal_device_t* device) {
   std::string function_name = absl::GetFlag(FLAGS_entry_function);
   iree_vm_function_t function;
   RETURN_IF_ERROR(FromApiStatus(
@@ -113,21 +134,98 @@ Status Run() {
                                                IREE_ALLOCATOR_SYSTEM, &outputs),
                     IREE_LOC));
 
-  std::cout << "EXEC @" << function_name << "\n";
+  ASSIGN_OR_RETURN(auto output_format,
+                   ParseOutputFormat(absl::GetFlag(FLAGS_output_format)));
+  std::string output_file = absl::GetFlag(FLAGS_output_file);
+  std::ofstream output_file_stream;
+  std::ostream* output_stream = &std::cout;
+  if (output_file != "-") {
+    output_file_stream.open(output_file, std::ios::binary);
+    if (!output_file_stream.is_open()) {
+      return InvalidArgumentErrorBuilder(IREE_LOC)
+             << "Unable to open output file '" << output_file << "'";
+    }
+    output_stream = &output_file_stream;
+  }
+  // Keep stdout clean when binary results are written to it.
+  std::ostream* log_stream =
+      output_format != OutputFormat::kText && output_stream == &std::cout
+          ? &std::cerr
+          : &std::cout;
+
+  std::string profile_path = absl::GetFlag(FLAGS_profile);
+  std::unique_ptr<ExecutionProfile> profile;
+  if (!profile_path.empty()) profile = absl::make_unique<ExecutionProfile>();
+
+  *log_stream << "EXEC @" << function_name << "\n";
+  {
+    ScopedProfileFunction profile_function(profile.get(), function_name);
+    IREE_TRACE_SCOPE0("iree-run-module#Invoke");
+    RETURN_IF_ERROR(
+        FromApiStatus(iree_vm_invoke(context, function, /*policy=*/nullptr,
+                                     inputs, outputs, IREE_ALLOCATOR_SYSTEM),
+                      IREE_LOC))
+        << "invoking function " << function_name;
+  }
+  if (profile) RETURN_IF_ERROR(profile->WriteFile(profile_path));
+
   RETURN_IF_ERROR(
-      FromApiStatus(iree_vm_invoke(context, function, /*policy=*/nullptr,
-                                   inputs, outputs, IREE_ALLOCATOR_SYSTEM),
-                    IREE_LOC))
-      << "invoking function " << function_name;
+      WriteVariantList(output_descs, outputs, output_format, output_stream))
+      << "writing results";
+
+  RETURN_IF_ERROR(FromApiStatus(iree_vm_variant_list_free(inputs), IREE_LOC));
+  RETURN_IF_ERROR(FromApiStatus(iree_vm_variant_list_free(outputs), IREE_LOC));
+  return OkStatus();
+}
 
-  RETURN_IF_ERROR(PrintVariantList(output_descs, outputs))
-      << "printing results";
+Status Run() {
+  IREE_TRACE_THREAD_ENABLE("iree-run-module");
+  if (absl::GetFlag(FLAGS_server) &&
+      absl::GetFlag(FLAGS_server_socket).empty() &&
+      absl::GetFlag(FLAGS_input_file) == "-") {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "--server reads requests from stdin and cannot also read the "
+              "module from it; pass the module with --input_file";
+  }
+  RETURN_IF_ERROR(FromApiStatus(iree_hal_module_register_types(), IREE_LOC))
+      << "registering HAL types";
+  iree_vm_instance_t* instance = nullptr;
+  RETURN_IF_ERROR(FromApiStatus(
+      iree_vm_instance_create(IREE_ALLOCATOR_SYSTEM, &instance), IREE_LOC))
+      << "creating instance";
+
+  iree_vm_module_t* input_module = nullptr;
+  RETURN_IF_ERROR(LoadBytecodeModuleFromFile(absl::GetFlag(FLAGS_input_file),
+                                             &input_module));
+
+  iree_hal_device_t* device = nullptr;
+  RETURN_IF_ERROR(CreateDevice(absl::GetFlag(FLAGS_driver), &device));
+  iree_vm_module_t* hal_module = nullptr;
+  RETURN_IF_ERROR(CreateHalModule(device, &hal_module));
+
+  iree_vm_context_t* context = nullptr;
+  {
+    IREE_TRACE_SCOPE0("iree-run-module#CreateContext");
+    // Order matters. The input module will likely be dependent on the hal
+    // module.
+    std::array<iree_vm_module_t*, 2> modules = {hal_module, input_module};
+    RETURN_IF_ERROR(FromApiStatus(iree_vm_context_create_with_modules(
+                                      instance, modules.data(), modules.size(),
+                                      IREE_ALLOCATOR_SYSTEM, &context),
+                                  IREE_LOC))
+        << "creating context";
+  }
+
+  if (absl::GetFlag(FLAGS_server) ||
+      !absl::GetFlag(FLAGS_server_socket).empty()) {
+    RETURN_IF_ERROR(RunServer(context, input_module, device));
+  } else {
+    RETURN_IF_ERROR(RunFunction(context, input_module, device));
+  }
 
   // TODO(gcmn): Some nice wrappers to make this pattern shorter with generated
   // error messages.
   // Deallocate:
-  RETURN_IF_ERROR(FromApiStatus(iree_vm_variant_list_free(inputs), IREE_LOC));
-  RETURN_IF_ERROR(FromApiStatus(iree_vm_variant_list_free(outputs), IREE_LOC));
   RETURN_IF_ERROR(FromApiStatus(iree_vm_module_release(hal_module), IREE_LOC));
   RETURN_IF_ERROR(
       FromApiStatus(iree_vm_module_release(input_module), IREE_LOC));
@@ -141,7 +239,14 @@ Status Run() {
 
 extern "C" int main(int argc, char** argv) {
   InitializeEnvironment(&argc, &argv);
+  if (absl::GetFlag(FLAGS_server)) {
+    // stdout only carries responses; requests are buffered without syncing
+    // with stdio. This only takes effect before the first stream operation.
+    std::ios::sync_with_stdio(false);
+  }
   CHECK_OK(Run());
+  std::string trace_file = absl::GetFlag(FLAGS_trace_file);
+  if (!trace_file.empty()) FlushTrace(absl::string_view(trace_file));
   return 0;
 }
 
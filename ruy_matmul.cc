@@ -0,0 +1,231 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "iree/tools/ruy_matmul.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "tensorflow/lite/experimental/ruy/ruy.h"
+
+namespace iree {
+
+namespace {
+
+struct CpuThreadBudget {
+  absl::Mutex mutex;
+  int thread_count ABSL_GUARDED_BY(mutex) = 1;
+  // Threads of |thread_count| not taken by a running call. Goes negative while
+  // calls started before the budget was lowered are running.
+  int available_count ABSL_GUARDED_BY(mutex) = 1;
+};
+
+CpuThreadBudget* GetCpuThreadBudget() {
+  static CpuThreadBudget* budget = new CpuThreadBudget();
+  return budget;
+}
+
+// Takes the threads for one call from the budget, at least one for the
+// calling thread, and returns them when destroyed.
+class CpuThreadReservation {
+ public:
+  CpuThreadReservation() {
+    auto* budget = GetCpuThreadBudget();
+    absl::MutexLock lock(&budget->mutex);
+    thread_count_ = std::max(
+        1, std::min(budget->available_count, budget->thread_count));
+    budget->available_count -= thread_count_;
+  }
+
+  ~CpuThreadReservation() {
+    auto* budget = GetCpuThreadBudget();
+    absl::MutexLock lock(&budget->mutex);
+    budget->available_count += thread_count_;
+  }
+
+  CpuThreadReservation(const CpuThreadReservation&) = delete;
+  CpuThreadReservation& operator=(const CpuThreadReservation&) = delete;
+
+  int thread_count() const { return thread_count_; }
+
+ private:
+  int thread_count_;
+};
+
+// Each calling thread owns its context, and with it a pool of ruy worker
+// threads and the packing buffers it uses, so concurrent calls never share
+// one.
+ruy::Context* GetThreadRuyContext() {
+  static thread_local ruy::Context context;
+  return &context;
+}
+
+}  // namespace
+
+void SetCpuThreadCount(int thread_count) {
+  if (thread_count <= 0) {
+    thread_count = std::max(1u, std::thread::hardware_concurrency());
+  }
+  auto* budget = GetCpuThreadBudget();
+  absl::MutexLock lock(&budget->mutex);
+  budget->available_count += thread_count - budget->thread_count;
+  budget->thread_count = thread_count;
+}
+
+int GetCpuThreadCount() {
+  auto* budget = GetCpuThreadBudget();
+  absl::MutexLock lock(&budget->mutex);
+  return budget->thread_count;
+}
+
+Status RuyMatMul(absl::Span<const float> lhs, absl::Span<const float> rhs,
+                 absl::Span<const float> bias, int m, int k, int n,
+                 absl::Span<float> out) {
+  if (m < 0 || k < 0 || n < 0 || lhs.size() != static_cast<size_t>(m) * k ||
+      rhs.size() != static_cast<size_t>(k) * n ||
+      out.size() != static_cast<size_t>(m) * n ||
+      (!bias.empty() && bias.size() != static_cast<size_t>(n))) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "MatMul buffers do not match the shape [" << m << ", " << k
+           << "] x [" << k << ", " << n << "]";
+  }
+  if (out.empty()) return OkStatus();
+
+  // ruy multiplies column-major matrices and adds the bias per destination
+  // row. Row-major matrices are column-major transposes, so out^T = rhs^T *
+  // lhs^T is computed on the same memory which puts the bias per column of
+  // |out|.
+  ruy::Matrix<float> ruy_lhs;
+  ruy::MakeSimpleLayout(n, k, ruy::Order::kColMajor, &ruy_lhs.layout);
+  ruy_lhs.data = rhs.data();
+  ruy::Matrix<float> ruy_rhs;
+  ruy::MakeSimpleLayout(k, m, ruy::Order::kColMajor, &ruy_rhs.layout);
+  ruy_rhs.data = lhs.data();
+  ruy::Matrix<float> ruy_dst;
+  ruy::MakeSimpleLayout(n, m, ruy::Order::kColMajor, &ruy_dst.layout);
+  ruy_dst.data = out.data();
+  ruy::BasicSpec<float, float> spec;
+  if (!bias.empty()) spec.bias = bias.data();
+
+  CpuThreadReservation reservation;
+  auto* context = GetThreadRuyContext();
+  context->max_num_threads = reservation.thread_count();
+  ruy::Mul<ruy::kAllPaths>(ruy_lhs, ruy_rhs, spec, context, &ruy_dst);
+  return OkStatus();
+}
+
+int Conv2DParams::output_height() const {
+  int filter_extent = (filter_height - 1) * dilation_height + 1;
+  return (input_height + padding_top + padding_bottom - filter_extent) /
+             stride_height +
+         1;
+}
+
+int Conv2DParams::output_width() const {
+  int filter_extent = (filter_width - 1) * dilation_width + 1;
+  return (input_width + padding_left + padding_right - filter_extent) /
+             stride_width +
+         1;
+}
+
+Status RuyConv2D(const Conv2DParams& params, absl::Span<const float> input,
+                 absl::Span<const float> filter, absl::Span<const float> bias,
+                 absl::Span<float> output) {
+  if (params.stride_height <= 0 || params.stride_width <= 0 ||
+      params.dilation_height <= 0 || params.dilation_width <= 0 ||
+      params.output_height() <= 0 || params.output_width() <= 0) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "Invalid convolution strides, dilations or padding";
+  }
+  int64_t output_pixels = static_cast<int64_t>(params.batch) *
+                          params.output_height() * params.output_width();
+  int64_t patch_size = static_cast<int64_t>(params.filter_height) *
+                       params.filter_width * params.input_channels;
+  if (params.batch < 0 || params.input_channels < 0 ||
+      params.filter_height <= 0 || params.filter_width <= 0 ||
+      output_pixels > std::numeric_limits<int>::max() ||
+      patch_size > std::numeric_limits<int>::max()) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "Convolution of " << output_pixels << " output pixels with "
+           << patch_size << " element patches is not supported";
+  }
+  if (input.size() != static_cast<size_t>(params.batch) *
+                          params.input_height * params.input_width *
+                          params.input_channels) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "Convolution input size " << input.size()
+           << " does not match its shape";
+  }
+  // Checked before the patches are allocated for them.
+  if (params.output_channels < 0 ||
+      filter.size() != static_cast<size_t>(patch_size) *
+                           params.output_channels ||
+      output.size() != static_cast<size_t>(output_pixels) *
+                           params.output_channels) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "Convolution filter or output size does not match its shape";
+  }
+
+  if (params.filter_height == 1 && params.filter_width == 1 &&
+      params.stride_height == 1 && params.stride_width == 1 &&
+      params.padding_top == 0 && params.padding_bottom == 0 &&
+      params.padding_left == 0 && params.padding_right == 0) {
+    return RuyMatMul(input, filter, bias, static_cast<int>(output_pixels),
+                     static_cast<int>(patch_size), params.output_channels,
+                     output);
+  }
+
+  // Each row holds the (zero padded) input patch of one output pixel in the
+  // same [filter_height, filter_width, input_channels] order as the filter.
+  std::vector<float> patches(static_cast<size_t>(output_pixels) * patch_size,
+                             0.0f);
+  float* patch = patches.data();
+  for (int b = 0; b < params.batch; ++b) {
+    for (int oy = 0; oy < params.output_height(); ++oy) {
+      for (int ox = 0; ox < params.output_width(); ++ox) {
+        for (int fy = 0; fy < params.filter_height; ++fy) {
+          int iy = oy * params.stride_height - params.padding_top +
+                   fy * params.dilation_height;
+          for (int fx = 0; fx < params.filter_width; ++fx) {
+            int ix = ox * params.stride_width - params.padding_left +
+                     fx * params.dilation_width;
+            if (iy < 0 || iy >= params.input_height || ix < 0 ||
+                ix >= params.input_width) {
+              continue;
+            }
+            std::memcpy(
+                patch + (fy * params.filter_width + fx) * params.input_channels,
+                input.data() +
+                    ((static_cast<size_t>(b) * params.input_height + iy) *
+                         params.input_width +
+                     ix) *
+                        params.input_channels,
+                params.input_channels * sizeof(float));
+          }
+        }
+        patch += patch_size;
+      }
+    }
+  }
+  return RuyMatMul(patches, filter, bias, static_cast<int>(output_pixels),
+                   static_cast<int>(patch_size), params.output_channels,
+                   output);
+}
+
+}  // namespace iree
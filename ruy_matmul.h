@@ -0,0 +1,76 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef IREE_TOOLS_RUY_MATMUL_H_
+#define IREE_TOOLS_RUY_MATMUL_H_
+
+#include "absl/types/span.h"
+#include "iree/base/status.h"
+
+namespace iree {
+
+// CPU matmuls and convolutions run on a ruy context owned by the calling
+// thread, so calls from concurrent threads run in parallel. Each context keeps
+// a worker pool of its own. The process-wide budget caps how many threads run
+// matmuls at once, not how many are created: a call uses as many threads as
+// are left in the budget, up to the whole budget, and at least its calling
+// thread.
+
+// Sets the number of threads in the budget. A |thread_count| <= 0 uses all
+// hardware threads. Defaults to 1.
+void SetCpuThreadCount(int thread_count);
+int GetCpuThreadCount();
+
+// Computes |out| = |lhs| * |rhs| + |bias| for the row-major matrices |lhs| of
+// shape [m, k] and |rhs| of shape [k, n] into the row-major [m, n] |out|.
+// |bias| is either empty or has one value per output column.
+Status RuyMatMul(absl::Span<const float> lhs, absl::Span<const float> rhs,
+                 absl::Span<const float> bias, int m, int k, int n,
+                 absl::Span<float> out);
+
+// Shape of a 2D convolution of an NHWC input with an HWIO filter.
+struct Conv2DParams {
+  int batch = 1;
+  int input_height = 0;
+  int input_width = 0;
+  int input_channels = 0;
+  int filter_height = 1;
+  int filter_width = 1;
+  int output_channels = 0;
+  int stride_height = 1;
+  int stride_width = 1;
+  int dilation_height = 1;
+  int dilation_width = 1;
+  // Zero padding added before and after each spatial dimension.
+  int padding_top = 0;
+  int padding_bottom = 0;
+  int padding_left = 0;
+  int padding_right = 0;
+
+  int output_height() const;
+  int output_width() const;
+};
+
+// Computes the convolution of the NHWC |input| with the HWIO |filter| plus the
+// per output channel |bias| (or no bias if empty) into the NHWC |output|.
+// The input is lowered to a matrix of patches (im2col) that is multiplied with
+// the filter through RuyMatMul; 1x1 convolutions with unit strides and no
+// padding multiply the input directly.
+Status RuyConv2D(const Conv2DParams& params, absl::Span<const float> input,
+                 absl::Span<const float> filter, absl::Span<const float> bias,
+                 absl::Span<float> output);
+
+}  // namespace iree
+
+#endif  // IREE_TOOLS_RUY_MATMUL_H_
@@ -0,0 +1,172 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "iree/tools/ruy_matmul.h"
+
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "iree/base/status_matchers.h"
+#include "iree/testing/gtest.h"
+
+namespace iree {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::FloatNear;
+using ::testing::Pointwise;
+
+// Returns |count| deterministic values in [-1, 1).
+std::vector<float> MakeValues(int count, int seed) {
+  std::vector<float> values(count);
+  for (int i = 0; i < count; ++i) {
+    values[i] = ((i * 37 + seed * 11) % 64) / 32.0f - 1.0f;
+  }
+  return values;
+}
+
+std::vector<float> ReferenceMatMul(const std::vector<float>& lhs,
+                                   const std::vector<float>& rhs, int m, int k,
+                                   int n) {
+  std::vector<float> out(m * n, 0.0f);
+  for (int i = 0; i < m; ++i) {
+    for (int j = 0; j < n; ++j) {
+      for (int p = 0; p < k; ++p) {
+        out[i * n + j] += lhs[i * k + p] * rhs[p * n + j];
+      }
+    }
+  }
+  return out;
+}
+
+TEST(RuyMatMulTest, ThreadCount) {
+  SetCpuThreadCount(3);
+  EXPECT_EQ(GetCpuThreadCount(), 3);
+  SetCpuThreadCount(0);
+  EXPECT_GE(GetCpuThreadCount(), 1);
+  SetCpuThreadCount(1);
+}
+
+TEST(RuyMatMulTest, MatMulWithBias) {
+  std::vector<float> lhs = {1, 2, 3, 4, 5, 6};  // [2, 3]
+  std::vector<float> rhs = {1, 0, 0, 1, 1, 1};  // [3, 2]
+  std::vector<float> bias = {10, 20};
+  std::vector<float> out(4);
+  ASSERT_OK(RuyMatMul(lhs, rhs, bias, 2, 3, 2, absl::MakeSpan(out)));
+  EXPECT_THAT(out, ElementsAre(14, 25, 20, 31));
+  EXPECT_TRUE(IsInvalidArgument(
+      RuyMatMul(lhs, rhs, bias, 3, 3, 2, absl::MakeSpan(out))));
+}
+
+TEST(RuyMatMulTest, MultiThreadedMatchesReference) {
+  const int m = 67, k = 129, n = 93;
+  auto lhs = MakeValues(m * k, 1);
+  auto rhs = MakeValues(k * n, 2);
+  auto expected = ReferenceMatMul(lhs, rhs, m, k, n);
+  for (int thread_count : {1, 4}) {
+    SetCpuThreadCount(thread_count);
+    std::vector<float> out(m * n);
+    ASSERT_OK(RuyMatMul(lhs, rhs, {}, m, k, n, absl::MakeSpan(out)));
+    EXPECT_THAT(out, Pointwise(FloatNear(1e-4f), expected));
+  }
+  SetCpuThreadCount(1);
+}
+
+TEST(RuyMatMulTest, ConcurrentCallers) {
+  const int m = 41, k = 77, n = 53;
+  auto lhs = MakeValues(m * k, 5);
+  auto rhs = MakeValues(k * n, 6);
+  auto expected = ReferenceMatMul(lhs, rhs, m, k, n);
+  // More callers than threads in the budget still all run, each on at least
+  // its own thread.
+  SetCpuThreadCount(2);
+  std::vector<std::vector<float>> outs(4, std::vector<float>(m * n));
+  std::vector<std::thread> threads;
+  for (auto& out : outs) {
+    threads.emplace_back([&]() {
+      for (int i = 0; i < 8; ++i) {
+        CHECK_OK(RuyMatMul(lhs, rhs, {}, m, k, n, absl::MakeSpan(out)));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (const auto& out : outs) {
+    EXPECT_THAT(out, Pointwise(FloatNear(1e-4f), expected));
+  }
+  SetCpuThreadCount(1);
+}
+
+TEST(RuyMatMulTest, Conv2DMatchesReference) {
+  Conv2DParams params;
+  params.batch = 2;
+  params.input_height = 5;
+  params.input_width = 6;
+  params.input_channels = 3;
+  params.filter_height = 3;
+  params.filter_width = 2;
+  params.output_channels = 4;
+  params.stride_height = 2;
+  params.dilation_width = 2;
+  params.padding_top = 1;
+  params.padding_bottom = 1;
+  ASSERT_EQ(params.output_height(), 3);
+  ASSERT_EQ(params.output_width(), 4);
+
+  auto input = MakeValues(2 * 5 * 6 * 3, 3);
+  auto filter = MakeValues(3 * 2 * 3 * 4, 4);
+  std::vector<float> bias = {0.5f, -0.5f, 1.0f, 0.0f};
+  std::vector<float> expected(2 * 3 * 4 * 4);
+  for (int b = 0; b < 2; ++b) {
+    for (int oy = 0; oy < 3; ++oy) {
+      for (int ox = 0; ox < 4; ++ox) {
+        for (int oc = 0; oc < 4; ++oc) {
+          float sum = bias[oc];
+          for (int fy = 0; fy < 3; ++fy) {
+            for (int fx = 0; fx < 2; ++fx) {
+              int iy = oy * 2 - 1 + fy;
+              int ix = ox + fx * 2;
+              if (iy < 0 || iy >= 5 || ix < 0 || ix >= 6) continue;
+              for (int ic = 0; ic < 3; ++ic) {
+                sum += input[((b * 5 + iy) * 6 + ix) * 3 + ic] *
+                       filter[((fy * 2 + fx) * 3 + ic) * 4 + oc];
+              }
+            }
+          }
+          expected[((b * 3 + oy) * 4 + ox) * 4 + oc] = sum;
+        }
+      }
+    }
+  }
+
+  std::vector<float> output(expected.size());
+  ASSERT_OK(RuyConv2D(params, input, filter, bias, absl::MakeSpan(output)));
+  EXPECT_THAT(output, Pointwise(FloatNear(1e-4f), expected));
+}
+
+TEST(RuyMatMulTest, Conv2DRejectsOversizedShapes) {
+  Conv2DParams params;
+  params.batch = 1 << 16;
+  params.input_height = 1 << 10;
+  params.input_width = 1 << 10;
+  params.input_channels = 1;
+  params.output_channels = 1;
+  std::vector<float> values(1);
+  EXPECT_TRUE(IsInvalidArgument(RuyConv2D(params, values, values, {},
+                                          absl::MakeSpan(values))));
+}
+
+}  // namespace
+}  // namespace iree
@@ -0,0 +1,217 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "iree/tools/specialization_tuning.h"
+
+#include <fstream>
+#include <utility>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "flatbuffers/flatbuffers.h"
+#include "iree/base/file_io.h"
+#include "iree/schemas/bytecode_module_def_generated.h"
+
+namespace iree {
+
+const char kDefaultSpecializationVariant[] = "default";
+
+namespace {
+
+using ::iree::vm::CompressionTypeDef;
+
+// Returns the SPIR-V executable stored inline in |segment_def| or null if the
+// segment holds anything else.
+const SpirVExecutableDef* GetSpirVExecutable(
+    const vm::RodataSegmentDef* segment_def) {
+  const auto* data = segment_def->data();
+  if (segment_def->compression_type_type() != CompressionTypeDef::NONE ||
+      !data ||
+      data->size() < flatbuffers::FlatBufferBuilder::kFileIdentifierLength +
+                         sizeof(flatbuffers::uoffset_t) ||
+      !SpirVExecutableDefBufferHasIdentifier(data->data())) {
+    return nullptr;
+  }
+  flatbuffers::Verifier verifier(data->data(), data->size());
+  if (!VerifySpirVExecutableDefBuffer(verifier)) return nullptr;
+  return GetSpirVExecutableDef(data->data());
+}
+
+StatusOr<const vm::BytecodeModuleDef*> GetVerifiedModule(
+    absl::Span<const uint8_t> module_data) {
+  flatbuffers::Verifier verifier(module_data.data(), module_data.size());
+  if (!vm::VerifyBytecodeModuleDefBuffer(verifier)) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "Data is not a valid BytecodeModuleDef";
+  }
+  return vm::GetBytecodeModuleDef(module_data.data());
+}
+
+}  // namespace
+
+const VkSpecializationInfoDef* SelectSpecializationInfo(
+    const SpirVExecutableDef& executable_def, absl::string_view variant_name) {
+  if (variant_name != kDefaultSpecializationVariant &&
+      executable_def.specialization_variants()) {
+    for (const auto* variant_def : *executable_def.specialization_variants()) {
+      if (variant_def->name() &&
+          absl::string_view(variant_def->name()->c_str(),
+                            variant_def->name()->size()) == variant_name) {
+        return variant_def->specialization_info();
+      }
+    }
+  }
+  return executable_def.specialization_info();
+}
+
+// static
+StatusOr<TuningTable> TuningTable::Parse(absl::string_view contents) {
+  TuningTable tuning_table;
+  int line_number = 0;
+  for (absl::string_view line : absl::StrSplit(contents, '\n')) {
+    ++line_number;
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+    if (line.empty() || line.front() == '#') continue;
+    std::vector<absl::string_view> fields = absl::StrSplit(line, '\t');
+    if (fields.size() != 3) {
+      return InvalidArgumentErrorBuilder(IREE_LOC)
+             << "Tuning entry on line " << line_number
+             << " must have 3 tab separated fields but has " << fields.size();
+    }
+    tuning_table.Set(fields[0], fields[1], fields[2]);
+  }
+  return tuning_table;
+}
+
+// static
+StatusOr<TuningTable> TuningTable::LoadFile(const std::string& path) {
+  if (!file_io::FileExists(path).ok()) {
+    return NotFoundErrorBuilder(IREE_LOC)
+           << "Tuning file '" << path << "' does not exist";
+  }
+  ASSIGN_OR_RETURN(auto contents, file_io::GetFileContents(path));
+  return Parse(contents);
+}
+
+std::string TuningTable::Serialize() const {
+  std::string contents = "# device\texecutable tag\tvariant\n";
+  for (const auto& entry : variants_) {
+    absl::StrAppend(&contents, entry.first.first, "\t", entry.first.second,
+                    "\t", entry.second, "\n");
+  }
+  return contents;
+}
+
+Status TuningTable::SaveFile(const std::string& path) const {
+  std::ofstream file(path, std::ios::trunc);
+  file << Serialize();
+  if (!file.good()) {
+    return InternalErrorBuilder(IREE_LOC)
+           << "Unable to write tuning file '" << path << "'";
+  }
+  return OkStatus();
+}
+
+absl::string_view TuningTable::Lookup(absl::string_view device,
+                                      absl::string_view executable_tag) const {
+  auto it = variants_.find(
+      std::make_pair(std::string(device), std::string(executable_tag)));
+  if (it == variants_.end()) return kDefaultSpecializationVariant;
+  return it->second;
+}
+
+void TuningTable::Set(absl::string_view device,
+                      absl::string_view executable_tag,
+                      absl::string_view variant_name) {
+  variants_[std::make_pair(std::string(device), std::string(executable_tag))] =
+      std::string(variant_name);
+}
+
+StatusOr<std::vector<TunableExecutable>> FindTunableExecutables(
+    absl::Span<const uint8_t> module_data) {
+  ASSIGN_OR_RETURN(const auto* module_def, GetVerifiedModule(module_data));
+  std::vector<TunableExecutable> tunable_executables;
+  if (!module_def->rodata_segments()) return tunable_executables;
+  for (size_t i = 0; i < module_def->rodata_segments()->size(); ++i) {
+    const auto* executable_def =
+        GetSpirVExecutable(module_def->rodata_segments()->Get(i));
+    if (!executable_def || !executable_def->specialization_variants() ||
+        executable_def->specialization_variants()->size() == 0) {
+      continue;
+    }
+    TunableExecutable tunable_executable;
+    tunable_executable.rodata_ordinal = static_cast<int>(i);
+    if (executable_def->tag()) {
+      tunable_executable.tag = executable_def->tag()->str();
+    }
+    for (const auto* variant_def : *executable_def->specialization_variants()) {
+      std::string variant_name =
+          variant_def->name() ? variant_def->name()->str() : "";
+      if (variant_name == kDefaultSpecializationVariant) {
+        return InvalidArgumentErrorBuilder(IREE_LOC)
+               << "Executable '" << tunable_executable.tag
+               << "' has a variant named '" << kDefaultSpecializationVariant
+               << "', which is reserved for its own specialization_info";
+      }
+      tunable_executable.variant_names.push_back(std::move(variant_name));
+    }
+    tunable_executables.push_back(std::move(tunable_executable));
+  }
+  return tunable_executables;
+}
+
+StatusOr<std::string> ApplyTuningTable(absl::Span<const uint8_t> module_data,
+                                       const TuningTable& tuning_table,
+                                       absl::string_view device) {
+  ASSIGN_OR_RETURN(const auto* module_def, GetVerifiedModule(module_data));
+  // The specialization_info field of each executable is pointed at the table
+  // of the selected variant, which lives later in the same buffer, so the
+  // module is copied once and otherwise left unchanged.
+  std::string tuned_module(reinterpret_cast<const char*>(module_data.data()),
+                           module_data.size());
+  if (!module_def->rodata_segments()) return tuned_module;
+  for (const auto* segment_def : *module_def->rodata_segments()) {
+    const auto* executable_def = GetSpirVExecutable(segment_def);
+    if (!executable_def || !executable_def->specialization_variants()) {
+      continue;
+    }
+    absl::string_view executable_tag =
+        executable_def->tag() ? executable_def->tag()->c_str() : "";
+    absl::string_view variant_name =
+        tuning_table.Lookup(device, executable_tag);
+    const auto* specialization_info =
+        SelectSpecializationInfo(*executable_def, variant_name);
+    if (specialization_info == executable_def->specialization_info()) {
+      continue;
+    }
+
+    const uint8_t* field = executable_def->GetAddressOf(
+        SpirVExecutableDef::VT_SPECIALIZATION_INFO);
+    const uint8_t* target =
+        reinterpret_cast<const uint8_t*>(specialization_info);
+    if (!field || !target || target <= field) {
+      return UnimplementedErrorBuilder(IREE_LOC)
+             << "Variant '" << variant_name << "' of executable '"
+             << executable_tag
+             << "' cannot be selected in place; the executable and the "
+                "variant both need a specialization_info";
+    }
+    flatbuffers::WriteScalar<flatbuffers::uoffset_t>(
+        &tuned_module[field - module_data.data()],
+        static_cast<flatbuffers::uoffset_t>(target - field));
+  }
+  return tuned_module;
+}
+
+}  // namespace iree
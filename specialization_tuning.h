@@ -0,0 +1,100 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef IREE_TOOLS_SPECIALIZATION_TUNING_H_
+#define IREE_TOOLS_SPECIALIZATION_TUNING_H_
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "iree/base/status.h"
+#include "iree/schemas/spirv_executable_def_generated.h"
+
+namespace iree {
+
+// Name of the implicit variant that uses the executable's own
+// SpirVExecutableDef::specialization_info. Executables may not have a variant
+// of the same name.
+extern const char kDefaultSpecializationVariant[];
+
+// Returns the specialization constants of the variant named |variant_name| in
+// |executable_def|, falling back to its default specialization_info (which
+// may be null) if there is no such variant or |variant_name| is
+// kDefaultSpecializationVariant.
+const VkSpecializationInfoDef* SelectSpecializationInfo(
+    const SpirVExecutableDef& executable_def, absl::string_view variant_name);
+
+// Best specialization variant of each executable per device, as found by
+// autotuning. Devices are identified by a caller-chosen key such as the
+// VkPhysicalDeviceProperties::deviceName of the GPU.
+//
+// Tuning files contain one tab separated entry per line:
+//   <device>\t<executable tag>\t<variant name>
+// Empty lines and lines starting with '#' are ignored.
+class TuningTable {
+ public:
+  static StatusOr<TuningTable> Parse(absl::string_view contents);
+  // Returns NotFound if |path| does not exist.
+  static StatusOr<TuningTable> LoadFile(const std::string& path);
+
+  std::string Serialize() const;
+  Status SaveFile(const std::string& path) const;
+
+  // Returns the variant selected for |executable_tag| on |device| or
+  // kDefaultSpecializationVariant if there is no entry.
+  absl::string_view Lookup(absl::string_view device,
+                           absl::string_view executable_tag) const;
+  void Set(absl::string_view device, absl::string_view executable_tag,
+           absl::string_view variant_name);
+
+  size_t size() const { return variants_.size(); }
+
+ private:
+  // Variant names keyed by (device, executable tag).
+  std::map<std::pair<std::string, std::string>, std::string> variants_;
+};
+
+// A SPIR-V executable stored in a module's rodata that has specialization
+// variants to choose between.
+struct TunableExecutable {
+  int rodata_ordinal = 0;
+  std::string tag;
+  // Names of the specialization_variants, excluding the default.
+  std::vector<std::string> variant_names;
+};
+
+// Returns the tunable executables in the bytecode module |module_data|.
+// Compressed rodata segments are not inspected. Returns
+// InvalidArgument if a variant is named kDefaultSpecializationVariant.
+StatusOr<std::vector<TunableExecutable>> FindTunableExecutables(
+    absl::Span<const uint8_t> module_data);
+
+// Returns a copy of the bytecode module |module_data| where the
+// specialization_info of each tunable executable refers to that of the
+// variant |tuning_table| selects for it on |device|. The result runs the
+// tuned configurations on any runtime, as they are applied ahead of time.
+// Only the references are patched, so the copy has the same size and layout
+// as |module_data|. Selecting a variant of an executable without a default
+// specialization_info, or a variant without one, is not supported.
+StatusOr<std::string> ApplyTuningTable(absl::Span<const uint8_t> module_data,
+                                       const TuningTable& tuning_table,
+                                       absl::string_view device);
+
+}  // namespace iree
+
+#endif  // IREE_TOOLS_SPECIALIZATION_TUNING_H_
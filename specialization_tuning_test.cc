@@ -0,0 +1,168 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "iree/tools/specialization_tuning.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "flatbuffers/flatbuffers.h"
+#include "iree/base/status_matchers.h"
+#include "iree/schemas/bytecode_module_def_generated.h"
+#include "iree/testing/gtest.h"
+
+namespace iree {
+namespace {
+
+using ::iree::vm::BytecodeModuleDef;
+using ::iree::vm::BytecodeModuleDefT;
+
+// Returns specialization constants setting constant 0 (the workgroup size).
+std::unique_ptr<VkSpecializationInfoDefT> WorkgroupSize(uint32_t size) {
+  auto specialization_info = absl::make_unique<VkSpecializationInfoDefT>();
+  specialization_info->map_entries.push_back(
+      absl::make_unique<VkSpecializationMapEntryDefT>());
+  specialization_info->map_entries.back()->constant_id = 0;
+  specialization_info->map_entries.back()->uint32_value = size;
+  return specialization_info;
+}
+
+// Builds a module whose second rodata segment is a SPIR-V executable with a
+// default workgroup size of 32 and variants "wg64" and "wg128", or the
+// workgroup sizes 64, 128, ... named by |variant_names|.
+std::vector<uint8_t> BuildModule(
+    const std::vector<std::string>& variant_names = {"wg64", "wg128"}) {
+  SpirVExecutableDefT executable_def;
+  executable_def.tag = "dispatch_0";
+  executable_def.entry_points.push_back("main");
+  executable_def.specialization_info = WorkgroupSize(32);
+  uint32_t size = 64;
+  for (const auto& variant_name : variant_names) {
+    executable_def.specialization_variants.push_back(
+        absl::make_unique<VkSpecializationVariantDefT>());
+    executable_def.specialization_variants.back()->name = variant_name;
+    executable_def.specialization_variants.back()->specialization_info =
+        WorkgroupSize(size);
+    size *= 2;
+  }
+  flatbuffers::FlatBufferBuilder executable_fbb;
+  executable_fbb.Finish(SpirVExecutableDef::Pack(executable_fbb,
+                                                 &executable_def),
+                        SpirVExecutableDefIdentifier());
+
+  BytecodeModuleDefT module_def;
+  module_def.name = "module";
+  module_def.rodata_segments.push_back(
+      absl::make_unique<vm::RodataSegmentDefT>());
+  module_def.rodata_segments.back()->data.resize(16);
+  module_def.rodata_segments.push_back(
+      absl::make_unique<vm::RodataSegmentDefT>());
+  module_def.rodata_segments.back()->data.assign(
+      executable_fbb.GetBufferPointer(),
+      executable_fbb.GetBufferPointer() + executable_fbb.GetSize());
+
+  flatbuffers::FlatBufferBuilder fbb;
+  fbb.Finish(BytecodeModuleDef::Pack(fbb, &module_def),
+             vm::BytecodeModuleDefIdentifier());
+  return std::vector<uint8_t>(fbb.GetBufferPointer(),
+                              fbb.GetBufferPointer() + fbb.GetSize());
+}
+
+// Returns the workgroup size the executable in |module_data| is specialized
+// with by default.
+uint32_t DefaultWorkgroupSize(const std::string& module_data) {
+  const auto* module_def = vm::GetBytecodeModuleDef(module_data.data());
+  const auto* executable_def = GetSpirVExecutableDef(
+      module_def->rodata_segments()->Get(1)->data()->data());
+  return executable_def->specialization_info()
+      ->map_entries()
+      ->Get(0)
+      ->uint32_value();
+}
+
+TEST(SpecializationTuningTest, TuningTableRoundTrip) {
+  TuningTable tuning_table;
+  EXPECT_EQ(tuning_table.Lookup("gpu", "dispatch_0"),
+            kDefaultSpecializationVariant);
+  tuning_table.Set("GPU Model A", "dispatch_0", "wg64");
+  tuning_table.Set("GPU Model B", "dispatch_0", "wg128");
+
+  ASSERT_OK_AND_ASSIGN(auto parsed_table,
+                       TuningTable::Parse(tuning_table.Serialize()));
+  EXPECT_EQ(parsed_table.size(), 2);
+  EXPECT_EQ(parsed_table.Lookup("GPU Model A", "dispatch_0"), "wg64");
+  EXPECT_EQ(parsed_table.Lookup("GPU Model B", "dispatch_0"), "wg128");
+
+  EXPECT_TRUE(IsInvalidArgument(
+      TuningTable::Parse("gpu\tdispatch_0\n").status()));
+  EXPECT_TRUE(IsNotFound(
+      TuningTable::LoadFile(::testing::TempDir() + "/missing.tuning")
+          .status()));
+}
+
+TEST(SpecializationTuningTest, FindTunableExecutables) {
+  auto module_data = BuildModule();
+  ASSERT_OK_AND_ASSIGN(auto tunable_executables,
+                       FindTunableExecutables(module_data));
+  ASSERT_EQ(tunable_executables.size(), 1);
+  EXPECT_EQ(tunable_executables[0].rodata_ordinal, 1);
+  EXPECT_EQ(tunable_executables[0].tag, "dispatch_0");
+  EXPECT_EQ(tunable_executables[0].variant_names,
+            std::vector<std::string>({"wg64", "wg128"}));
+
+  // The default variant name is reserved.
+  EXPECT_TRUE(IsInvalidArgument(
+      FindTunableExecutables(BuildModule({"wg64", "default"})).status()));
+}
+
+TEST(SpecializationTuningTest, ApplyTuningTable) {
+  auto module_data = BuildModule();
+  TuningTable tuning_table;
+  tuning_table.Set("gpu", "dispatch_0", "wg128");
+
+  ASSERT_OK_AND_ASSIGN(auto tuned_data,
+                       ApplyTuningTable(module_data, tuning_table, "gpu"));
+  EXPECT_EQ(DefaultWorkgroupSize(tuned_data), 128);
+  // Only the reference to the selected variant is patched.
+  EXPECT_EQ(tuned_data.size(), module_data.size());
+  flatbuffers::Verifier verifier(
+      reinterpret_cast<const uint8_t*>(tuned_data.data()), tuned_data.size());
+  EXPECT_TRUE(vm::VerifyBytecodeModuleDefBuffer(verifier));
+
+  // Other devices and unknown variants keep the default.
+  ASSERT_OK_AND_ASSIGN(auto untuned_data, ApplyTuningTable(module_data,
+                                                           tuning_table,
+                                                           "other gpu"));
+  EXPECT_EQ(DefaultWorkgroupSize(untuned_data), 32);
+  tuning_table.Set("gpu", "dispatch_0", "wg256");
+  ASSERT_OK_AND_ASSIGN(auto stale_data,
+                       ApplyTuningTable(module_data, tuning_table, "gpu"));
+  EXPECT_EQ(DefaultWorkgroupSize(stale_data), 32);
+}
+
+TEST(SpecializationTuningTest, DefaultVariantNameSelectsDefault) {
+  auto module_data = BuildModule({"default"});
+  const auto* module_def = vm::GetBytecodeModuleDef(module_data.data());
+  const auto* executable_def = GetSpirVExecutableDef(
+      module_def->rodata_segments()->Get(1)->data()->data());
+  EXPECT_EQ(
+      SelectSpecializationInfo(*executable_def, kDefaultSpecializationVariant),
+      executable_def->specialization_info());
+}
+
+}  // namespace
+}  // namespace iree
@@ -0,0 +1,18 @@
+// iree-benchmark-module registers a benchmark per exported function when no
+// entry function is specified.
+// RUN: iree-translate --iree-hal-target-backends=interpreter-bytecode -iree-mlir-to-vm-bytecode-module %s | iree-benchmark-module --driver=interpreter --inputs="i32=-2" --benchmark_out=${TEST_TMPDIR?}/baseline.json --benchmark_out_format=json | IreeFileCheck %s
+
+// Comparing against the results just written (only checking exit codes).
+// RUN: iree-translate --iree-hal-target-backends=interpreter-bytecode -iree-mlir-to-vm-bytecode-module %s | iree-benchmark-module --driver=interpreter --inputs="i32=-2" --baseline_file=${TEST_TMPDIR?}/baseline.json --regression_threshold=100
+
+// CHECK: BM_abs
+func @abs(%input : tensor<i32>) -> (tensor<i32>) attributes { iree.module.export } {
+  %result = "xla_hlo.abs"(%input) : (tensor<i32>) -> tensor<i32>
+  return %result : tensor<i32>
+}
+
+// CHECK: BM_neg
+func @neg(%input : tensor<i32>) -> (tensor<i32>) attributes { iree.module.export } {
+  %result = "xla_hlo.neg"(%input) : (tensor<i32>) -> tensor<i32>
+  return %result : tensor<i32>
+}
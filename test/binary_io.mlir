@@ -0,0 +1,16 @@
+// Writes results as .npy/raw binary and reads them back as file inputs.
+
+// iree-run-module
+// RUN: iree-translate --iree-hal-target-backends=interpreter-bytecode -iree-mlir-to-vm-bytecode-module %s -o ${TEST_TMPDIR?}/bc.module && iree-run-module --input_file=${TEST_TMPDIR?}/bc.module --entry_function=negate --inputs="2x2xf32=[1 2][3 4]" --output_format=npy --output_file=${TEST_TMPDIR?}/out.npy && iree-run-module --input_file=${TEST_TMPDIR?}/bc.module --entry_function=negate --inputs="@${TEST_TMPDIR?}/out.npy" | IreeFileCheck %s
+
+// RUN: iree-translate --iree-hal-target-backends=interpreter-bytecode -iree-mlir-to-vm-bytecode-module %s -o ${TEST_TMPDIR?}/bc.module && iree-run-module --input_file=${TEST_TMPDIR?}/bc.module --entry_function=negate --inputs="2x2xf32=[1 2][3 4]" --output_format=binary --output_file=${TEST_TMPDIR?}/out.bin && iree-run-module --input_file=${TEST_TMPDIR?}/bc.module --entry_function=negate --inputs="2x2xf32=@${TEST_TMPDIR?}/out.bin" | IreeFileCheck %s
+
+// iree-run-mlir
+// RUN: iree-run-mlir --iree-hal-target-backends=interpreter-bytecode --input-value="2x2xf32=[1 2][3 4]" --output-format=npy --output-file=${TEST_TMPDIR?}/mlir_out.npy %s && iree-run-mlir --iree-hal-target-backends=interpreter-bytecode --input-value="@${TEST_TMPDIR?}/mlir_out.npy" %s | IreeFileCheck %s
+
+// CHECK-LABEL: EXEC @negate
+func @negate(%input : tensor<2x2xf32>) -> (tensor<2x2xf32>) attributes { iree.module.export } {
+  %result = "xla_hlo.neg"(%input) : (tensor<2x2xf32>) -> tensor<2x2xf32>
+  return %result : tensor<2x2xf32>
+}
+// CHECK: 2x2xf32=[1 2][3 4]
@@ -0,0 +1,25 @@
+// Splits and target backends are evaluated as separate concurrent jobs whose
+// output must still match a serial run.
+
+// RUN: (iree-run-mlir --iree-hal-target-backends=interpreter-bytecode,interpreter-bytecode -jobs=4 --input-value="i32=-2" %s) | IreeFileCheck %s
+// RUN: [[ $IREE_VULKAN_DISABLE == 1 ]] || ((iree-run-mlir --iree-hal-target-backends=interpreter-bytecode,vulkan-spirv -jobs=4 --input-value="i32=-2" %s) | IreeFileCheck %s)
+
+// CHECK-LABEL: EXEC @abs
+// CHECK-NEXT: i32=2
+// CHECK-NEXT: EXEC @abs
+// CHECK-NEXT: i32=2
+func @abs(%input : tensor<i32>) -> (tensor<i32>) attributes { iree.module.export } {
+  %result = "xla_hlo.abs"(%input) : (tensor<i32>) -> tensor<i32>
+  return %result : tensor<i32>
+}
+
+// -----
+
+// CHECK-NEXT: EXEC @neg
+// CHECK-NEXT: i32=2
+// CHECK-NEXT: EXEC @neg
+// CHECK-NEXT: i32=2
+func @neg(%input : tensor<i32>) -> (tensor<i32>) attributes { iree.module.export } {
+  %result = "xla_hlo.neg"(%input) : (tensor<i32>) -> tensor<i32>
+  return %result : tensor<i32>
+}
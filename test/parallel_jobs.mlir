@@ -0,0 +1,27 @@
+// Output ordering must match a serial run when evaluating splits concurrently.
+
+// RUN: (iree-run-mlir --iree-hal-target-backends=interpreter-bytecode -jobs=4 --input-value="i32=-2" %s) | IreeFileCheck %s
+
+// CHECK-LABEL: EXEC @abs
+func @abs(%input : tensor<i32>) -> (tensor<i32>) attributes { iree.module.export } {
+  %result = "xla_hlo.abs"(%input) : (tensor<i32>) -> tensor<i32>
+  return %result : tensor<i32>
+}
+// CHECK: i32=2
+
+// -----
+
+// CHECK-LABEL: EXEC @neg
+func @neg(%input : tensor<i32>) -> (tensor<i32>) attributes { iree.module.export } {
+  %result = "xla_hlo.neg"(%input) : (tensor<i32>) -> tensor<i32>
+  return %result : tensor<i32>
+}
+// CHECK: i32=2
+
+// -----
+
+// CHECK-LABEL: EXEC @identity
+func @identity(%input : tensor<i32>) -> (tensor<i32>) attributes { iree.module.export } {
+  return %input : tensor<i32>
+}
+// CHECK: i32=-2
@@ -0,0 +1,13 @@
+// iree-run-module --server answers requests read from stdin.
+// RUN: iree-translate --iree-hal-target-backends=interpreter-bytecode -iree-mlir-to-vm-bytecode-module %s -o ${TEST_TMPDIR?}/bc.module && (printf 'call scalar 1\ni32=42\nquit\n' | iree-run-module --server --driver=interpreter --input_file=${TEST_TMPDIR?}/bc.module) | IreeFileCheck %s
+
+// The module cannot also be read from stdin.
+// RUN: (printf 'quit\n' | iree-run-module --server --driver=interpreter --input_file=- 2>&1 || true) | IreeFileCheck %s --check-prefix=STDIN
+
+// CHECK: ok
+// CHECK-NEXT: i32=42
+func @scalar(%arg0 : i32) -> i32 attributes { iree.module.export } {
+  return %arg0 : i32
+}
+
+// STDIN: cannot also read the module from it
@@ -8,6 +8,9 @@
 
 // RUN: [[ $IREE_VULKAN_DISABLE == 1 ]] || (iree-translate --iree-hal-target-backends=interpreter-bytecode -iree-mlir-to-vm-bytecode-module %s -o ${TEST_TMPDIR?}/bc.module && iree-benchmark-module --driver=interpreter --entry_function=abs --inputs="i32=-2" --input_file=${TEST_TMPDIR?}/bc.module)
 
+// iree-benchmark-module throughput mode (only checking exit codes).
+// RUN: iree-translate --iree-hal-target-backends=interpreter-bytecode -iree-mlir-to-vm-bytecode-module %s -o ${TEST_TMPDIR?}/bc.module && iree-benchmark-module --driver=interpreter --entry_function=abs --inputs="i32=-2" --input_file=${TEST_TMPDIR?}/bc.module --throughput_threads=2
+
 // iree-run-mlir
 // RUN: (iree-run-mlir --iree-hal-target-backends=interpreter-bytecode --input-value="i32=-2" %s) | IreeFileCheck %s
 
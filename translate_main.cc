@@ -17,6 +17,7 @@
 // We need this entry function because we want to register PassManager CLI
 // options, which is missing in MLIR's translation main entry function.
 
+#include "iree/tools/compile_stats.h"
 #include "llvm/Support/InitLLVM.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/SourceMgr.h"
@@ -43,6 +44,12 @@ static llvm::cl::opt<bool> splitInputFile(
                    "process each chunk independently"),
     llvm::cl::init(false));
 
+static llvm::cl::opt<std::string> compileStatsFilename(
+    "compile-stats",
+    llvm::cl::desc("Writes compile time and peak memory statistics to the "
+                   "given JSON file"),
+    llvm::cl::value_desc("filename"), llvm::cl::init(""));
+
 int main(int argc, char **argv) {
   llvm::InitLLVM y(argc, argv);
 
@@ -68,9 +75,18 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  // Translations build their own pass managers so only the time and memory of
+  // each translation as a whole is recorded.
+  std::unique_ptr<iree::CompileStats> compileStats;
+  if (!compileStatsFilename.empty()) {
+    compileStats = std::make_unique<iree::CompileStats>();
+  }
+
   /// Processes the memory buffer with a new MLIRContext.
   auto processBuffer = [&](std::unique_ptr<llvm::MemoryBuffer> ownedBuffer,
                            llvm::raw_ostream &os) {
+    iree::ScopedCompileStep step(compileStats.get(), "iree-translate",
+                                 "translate");
     mlir::MLIRContext context;
     llvm::SourceMgr sourceMgr;
     sourceMgr.AddNewSourceBuffer(std::move(ownedBuffer), llvm::SMLoc());
@@ -86,6 +102,14 @@ int main(int argc, char **argv) {
     if (failed(processBuffer(std::move(input), output->os()))) return 1;
   }
 
+  if (compileStats) {
+    auto status = compileStats->WriteJsonFile(compileStatsFilename);
+    if (!status.ok()) {
+      llvm::errs() << status.ToString() << "\n";
+      return 1;
+    }
+  }
+
   output->keep();
   return 0;
 }
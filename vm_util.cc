@@ -14,22 +14,38 @@
 
 #include "iree/tools/vm_util.h"
 
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <iterator>
 #include <ostream>
 
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
 #include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
 #include "absl/strings/strip.h"
 #include "absl/types/span.h"
+#include "flatbuffers/flatbuffers.h"
 #include "iree/base/api_util.h"
 #include "iree/base/buffer_string_util.h"
+#include "iree/base/file_mapping.h"
 #include "iree/base/shape.h"
 #include "iree/base/shaped_buffer.h"
 #include "iree/base/shaped_buffer_string_util.h"
 #include "iree/base/signature_mangle.h"
 #include "iree/base/status.h"
+#include "iree/base/tracing.h"
 #include "iree/modules/hal/hal_module.h"
+#include "iree/schemas/buffer_data_def_generated.h"
+#include "iree/schemas/bytecode_module_def_generated.h"
 #include "iree/vm/bytecode_module.h"
 #include "iree/vm/module.h"
+#include "iree/vm/ref.h"
 #include "iree/vm/variant_list.h"
 
 namespace iree {
@@ -80,10 +96,590 @@ StatusOr<std::vector<RawSignatureParser::Description>> ParseOutputSignature(
   return output_descs;
 }
 
+namespace {
+
+// Allocates a host-local, device-visible buffer and copies |contents| into it.
+Status AllocateBufferWithContents(iree_hal_allocator_t* allocator,
+                                  absl::Span<const uint8_t> contents,
+                                  iree_hal_buffer_t** out_buffer) {
+  // TODO(benvanik): combined function for linear to optimal upload.
+  RETURN_IF_ERROR(FromApiStatus(
+      iree_hal_allocator_allocate_buffer(
+          allocator,
+          static_cast<iree_hal_memory_type_t>(
+              IREE_HAL_MEMORY_TYPE_HOST_LOCAL |
+              IREE_HAL_MEMORY_TYPE_DEVICE_VISIBLE),
+          static_cast<iree_hal_buffer_usage_t>(IREE_HAL_BUFFER_USAGE_ALL |
+                                               IREE_HAL_BUFFER_USAGE_CONSTANT),
+          contents.size(), out_buffer),
+      IREE_LOC))
+      << "Allocating buffer";
+  RETURN_IF_ERROR(FromApiStatus(
+      iree_hal_buffer_write_data(*out_buffer, 0, contents.data(),
+                                 contents.size()),
+      IREE_LOC))
+      << "Populating buffer contents ";
+  return OkStatus();
+}
+
+// Wraps |contents| in a heap buffer without copying. The memory must remain
+// valid for the lifetime of the buffer.
+Status WrapBufferContents(absl::Span<const uint8_t> contents,
+                          iree_hal_buffer_t** out_buffer) {
+  iree_byte_span_t span{const_cast<uint8_t*>(contents.data()),
+                        contents.size()};
+  RETURN_IF_ERROR(FromApiStatus(
+      iree_hal_heap_buffer_wrap(
+          static_cast<iree_hal_memory_type_t>(
+              IREE_HAL_MEMORY_TYPE_HOST_LOCAL |
+              IREE_HAL_MEMORY_TYPE_DEVICE_VISIBLE),
+          IREE_HAL_MEMORY_ACCESS_READ,
+          static_cast<iree_hal_buffer_usage_t>(IREE_HAL_BUFFER_USAGE_ALL |
+                                               IREE_HAL_BUFFER_USAGE_CONSTANT),
+          span, IREE_ALLOCATOR_SYSTEM, out_buffer),
+      IREE_LOC))
+      << "Wrapping mapped buffer contents";
+  return OkStatus();
+}
+
+// Returns true if |input_string| references a file instead of holding text
+// contents, e.g. '@foo.npy' or '2x2xf32=@foo.bin'.
+bool IsFileInput(absl::string_view input_string) {
+  input_string = absl::StripAsciiWhitespace(input_string);
+  return absl::StartsWith(input_string, "@") ||
+         absl::StrContains(input_string, "=@");
+}
+
+// Returns the element type string used by the text format for |type|.
+absl::string_view ScalarTypeToString(AbiConstants::ScalarType type) {
+  switch (type) {
+    case AbiConstants::ScalarType::kIeeeFloat16:
+      return "f16";
+    case AbiConstants::ScalarType::kIeeeFloat32:
+      return "f32";
+    case AbiConstants::ScalarType::kIeeeFloat64:
+      return "f64";
+    case AbiConstants::ScalarType::kSint8:
+      return "i8";
+    case AbiConstants::ScalarType::kSint16:
+      return "i16";
+    case AbiConstants::ScalarType::kSint32:
+      return "i32";
+    case AbiConstants::ScalarType::kSint64:
+      return "i64";
+    case AbiConstants::ScalarType::kUint8:
+      return "u8";
+    case AbiConstants::ScalarType::kUint16:
+      return "u16";
+    case AbiConstants::ScalarType::kUint32:
+      return "u32";
+    case AbiConstants::ScalarType::kUint64:
+      return "u64";
+    default:
+      return "";
+  }
+}
+
+// Returns the numpy dtype descriptor (ignoring byte order) for |type|.
+absl::string_view ScalarTypeToNpyDescr(AbiConstants::ScalarType type) {
+  switch (type) {
+    case AbiConstants::ScalarType::kIeeeFloat16:
+      return "f2";
+    case AbiConstants::ScalarType::kIeeeFloat32:
+      return "f4";
+    case AbiConstants::ScalarType::kIeeeFloat64:
+      return "f8";
+    case AbiConstants::ScalarType::kSint8:
+      return "i1";
+    case AbiConstants::ScalarType::kSint16:
+      return "i2";
+    case AbiConstants::ScalarType::kSint32:
+      return "i4";
+    case AbiConstants::ScalarType::kSint64:
+      return "i8";
+    case AbiConstants::ScalarType::kUint8:
+      return "u1";
+    case AbiConstants::ScalarType::kUint16:
+      return "u2";
+    case AbiConstants::ScalarType::kUint32:
+      return "u4";
+    case AbiConstants::ScalarType::kUint64:
+      return "u8";
+    default:
+      return "";
+  }
+}
+
+// Verifies that |dims| loaded from |path| are compatible with |desc|.
+Status ValidateFileShape(const RawSignatureParser::Description& desc,
+                         absl::Span<const int> dims, absl::string_view path) {
+  bool matches = dims.size() == desc.dims.size();
+  for (int i = 0; matches && i < dims.size(); ++i) {
+    // Negative dims in the signature are dynamic.
+    matches = desc.dims[i] < 0 || desc.dims[i] == dims[i];
+  }
+  if (!matches) {
+    std::string desc_str;
+    desc.ToString(desc_str);
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "Shape of '" << path << "' (" << absl::StrJoin(dims, "x")
+           << ") does not match signature " << desc_str;
+  }
+  return OkStatus();
+}
+
+// Parses the header of a .npy file (format versions 1-3) and returns the
+// contents following it in |out_contents|.
+// See https://numpy.org/doc/stable/reference/generated/numpy.lib.format.html
+Status ParseNpyFile(absl::Span<const uint8_t> file_data,
+                    absl::string_view path, absl::string_view expected_descr,
+                    std::vector<int>* out_dims,
+                    absl::Span<const uint8_t>* out_contents) {
+  static constexpr char kMagic[] = "\x93NUMPY";
+  static constexpr size_t kMagicSize = sizeof(kMagic) - 1;
+  if (file_data.size() < kMagicSize + 4 ||
+      std::memcmp(file_data.data(), kMagic, kMagicSize) != 0) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "'" << path << "' is not a .npy file";
+  }
+  uint8_t major_version = file_data[kMagicSize];
+  size_t header_offset = 0;
+  size_t header_length = 0;
+  if (major_version == 1) {
+    header_offset = kMagicSize + 4;
+    header_length = file_data[8] | (file_data[9] << 8);
+  } else if (file_data.size() >= kMagicSize + 6) {
+    header_offset = kMagicSize + 6;
+    header_length = file_data[8] | (file_data[9] << 8) |
+                    (file_data[10] << 16) |
+                    (static_cast<size_t>(file_data[11]) << 24);
+  }
+  if (!header_offset || header_offset + header_length > file_data.size()) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "Invalid .npy header in '" << path << "'";
+  }
+  absl::string_view header(
+      reinterpret_cast<const char*>(file_data.data()) + header_offset,
+      header_length);
+
+  // The header is a python dict literal such as:
+  //   {'descr': '<f4', 'fortran_order': False, 'shape': (2, 3), }
+  auto find_value = [&](absl::string_view key) -> absl::string_view {
+    size_t pos = header.find(key);
+    if (pos == absl::string_view::npos) return {};
+    absl::string_view value = header.substr(pos + key.size());
+    value = absl::StripLeadingAsciiWhitespace(value);
+    absl::ConsumePrefix(&value, ":");
+    return absl::StripLeadingAsciiWhitespace(value);
+  };
+  absl::string_view descr = find_value("'descr'");
+  if (!absl::ConsumePrefix(&descr, "'") ||
+      descr.find('\'') == absl::string_view::npos) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "Missing dtype in .npy header of '" << path << "'";
+  }
+  descr = descr.substr(0, descr.find('\''));
+  // Only little-endian (or byte-order agnostic) data can be used as-is.
+  if (!absl::ConsumePrefix(&descr, "<") && !absl::ConsumePrefix(&descr, "|")) {
+    absl::ConsumePrefix(&descr, "=");
+  }
+  if (descr != expected_descr) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "dtype '" << descr << "' of '" << path
+           << "' does not match expected '" << expected_descr << "'";
+  }
+  if (!absl::StartsWith(find_value("'fortran_order'"), "False")) {
+    return UnimplementedErrorBuilder(IREE_LOC)
+           << "Fortran-ordered .npy files are not supported ('" << path
+           << "')";
+  }
+  absl::string_view shape_str = find_value("'shape'");
+  if (!absl::ConsumePrefix(&shape_str, "(") ||
+      shape_str.find(')') == absl::string_view::npos) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "Missing shape in .npy header of '" << path << "'";
+  }
+  shape_str = shape_str.substr(0, shape_str.find(')'));
+  out_dims->clear();
+  for (absl::string_view dim_str :
+       absl::StrSplit(shape_str, ',', absl::SkipWhitespace())) {
+    int dim;
+    if (!absl::SimpleAtoi(dim_str, &dim)) {
+      return InvalidArgumentErrorBuilder(IREE_LOC)
+             << "Invalid shape '" << shape_str << "' in .npy header of '"
+             << path << "'";
+    }
+    out_dims->push_back(dim);
+  }
+  *out_contents = file_data.subspan(header_offset + header_length);
+  return OkStatus();
+}
+
+// Parses the '[shape]xtype' prefix of a raw file input such as
+// '2x2xf32=@foo.bin'.
+Status ParseRawFileShape(absl::string_view shape_and_type,
+                         absl::string_view expected_type,
+                         std::vector<int>* out_dims) {
+  std::vector<absl::string_view> parts = absl::StrSplit(shape_and_type, 'x');
+  if (parts.back() != expected_type) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "Element type '" << parts.back()
+           << "' does not match expected '" << expected_type << "'";
+  }
+  out_dims->clear();
+  for (int i = 0; i + 1 < parts.size(); ++i) {
+    int dim;
+    if (!absl::SimpleAtoi(parts[i], &dim)) {
+      return InvalidArgumentErrorBuilder(IREE_LOC)
+             << "Invalid shape '" << shape_and_type << "'";
+    }
+    out_dims->push_back(dim);
+  }
+  return OkStatus();
+}
+
+// Locates the element data of a buffer input for |desc| in |data|, which is
+// named |name| in errors and holds either:
+//   raw little-endian element data of the '[shape]xtype' |shape_and_type|,
+//   a numpy .npy file if |is_npy|, or
+//   a BufferDataDef flatbuffer otherwise.
+// Splat BufferDataDefs are expanded into |expanded_contents|, which
+// |out_contents| then references.
+Status ParseBufferData(const RawSignatureParser::Description& desc,
+                       absl::string_view shape_and_type, bool is_npy,
+                       absl::string_view name, absl::Span<const uint8_t> data,
+                       std::vector<uint8_t>* expanded_contents,
+                       absl::Span<const uint8_t>* out_contents) {
+  size_t element_size =
+      AbiConstants::kScalarTypeSize[static_cast<unsigned>(
+          desc.buffer.scalar_type)];
+
+  std::vector<int> dims;
+  absl::Span<const uint8_t> contents;
+  if (!shape_and_type.empty()) {
+    RETURN_IF_ERROR(ParseRawFileShape(
+        shape_and_type, ScalarTypeToString(desc.buffer.scalar_type), &dims))
+        << "Parsing '" << shape_and_type << "' of '" << name << "'";
+    contents = data;
+  } else if (is_npy) {
+    RETURN_IF_ERROR(ParseNpyFile(data, name,
+                                 ScalarTypeToNpyDescr(desc.buffer.scalar_type),
+                                 &dims, &contents));
+  } else {
+    flatbuffers::Verifier verifier(data.data(), data.size());
+    if (!verifier.VerifyBuffer<BufferDataDef>(nullptr)) {
+      return InvalidArgumentErrorBuilder(IREE_LOC)
+             << "'" << name << "' is not a valid BufferDataDef";
+    }
+    const auto* buffer_data = flatbuffers::GetRoot<BufferDataDef>(data.data());
+    if (buffer_data->element_width() != element_size ||
+        !buffer_data->contents()) {
+      return InvalidArgumentErrorBuilder(IREE_LOC)
+             << "BufferDataDef '" << name << "' has element width "
+             << buffer_data->element_width() << " but expected "
+             << element_size;
+    }
+    if (buffer_data->shape()) {
+      dims.assign(buffer_data->shape()->begin(), buffer_data->shape()->end());
+    }
+    contents = absl::MakeConstSpan(
+        reinterpret_cast<const uint8_t*>(buffer_data->contents()->data()),
+        buffer_data->contents()->size());
+    if (buffer_data->encoding() == BufferConstantEncoding::SPLAT) {
+      // Splats store a single element that must be expanded.
+      if (contents.size() != element_size) {
+        return InvalidArgumentErrorBuilder(IREE_LOC)
+               << "Splat BufferDataDef '" << name
+               << "' must contain exactly one element";
+      }
+      size_t element_count = 1;
+      for (int dim : dims) element_count *= dim;
+      expanded_contents->resize(element_count * element_size);
+      for (size_t i = 0; i < element_count; ++i) {
+        std::memcpy(expanded_contents->data() + i * element_size,
+                    contents.data(), element_size);
+      }
+      contents = *expanded_contents;
+    }
+  }
+
+  RETURN_IF_ERROR(ValidateFileShape(desc, dims, name));
+  size_t element_count = 1;
+  for (int dim : dims) element_count *= dim;
+  if (contents.size() != element_count * element_size) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "'" << name << "' holds " << contents.size()
+           << " bytes of data but its shape requires "
+           << element_count * element_size;
+  }
+  *out_contents = contents;
+  return OkStatus();
+}
+
+// Loads a buffer input from a file reference in |input_string|:
+//   @path.npy: a numpy .npy file.
+//   [shape]xtype=@path: raw little-endian element data.
+//   @path: a BufferDataDef flatbuffer.
+// Files are memory mapped. If |imported_mappings| is provided dense contents
+// are wrapped directly in a heap buffer and the mapping is retained in
+// |imported_mappings|; otherwise the contents are copied into a buffer from
+// |allocator|.
+Status LoadBufferFromFile(const RawSignatureParser::Description& desc,
+                          absl::string_view input_string,
+                          iree_hal_allocator_t* allocator,
+                          std::vector<ref_ptr<FileMapping>>* imported_mappings,
+                          iree_hal_buffer_t** out_buffer) {
+  input_string = absl::StripAsciiWhitespace(input_string);
+  size_t at_pos = input_string.find('@');
+  absl::string_view shape_and_type = absl::StripSuffix(
+      input_string.substr(0, at_pos), "=");
+  absl::string_view path = input_string.substr(at_pos + 1);
+
+  ASSIGN_OR_RETURN(auto file_mapping, FileMapping::OpenRead(std::string(path)),
+                   _ << "Mapping input file '" << path << "'");
+  absl::Span<const uint8_t> contents;
+  std::vector<uint8_t> expanded_contents;
+  RETURN_IF_ERROR(ParseBufferData(desc, shape_and_type,
+                                  absl::EndsWith(path, ".npy"), path,
+                                  file_mapping->data(), &expanded_contents,
+                                  &contents));
+
+  if (imported_mappings && expanded_contents.empty()) {
+    RETURN_IF_ERROR(WrapBufferContents(contents, out_buffer));
+    imported_mappings->push_back(std::move(file_mapping));
+    return OkStatus();
+  }
+  return AllocateBufferWithContents(allocator, contents, out_buffer);
+}
+
+// Returns a .npy (format version 1.0) header for an array of |type| with
+// |dims|. The header is padded so that the data following it is 64 byte
+// aligned.
+std::string MakeNpyHeader(AbiConstants::ScalarType type,
+                          absl::Span<const int> dims) {
+  size_t element_size =
+      AbiConstants::kScalarTypeSize[static_cast<unsigned>(type)];
+  std::string shape_str = absl::StrJoin(dims, ", ");
+  if (dims.size() == 1) shape_str += ",";
+  std::string dict =
+      absl::StrCat("{'descr': '", element_size == 1 ? "|" : "<",
+                   ScalarTypeToNpyDescr(type),
+                   "', 'fortran_order': False, 'shape': (", shape_str, "), }");
+  static constexpr size_t kPreambleSize = 10;
+  // Pad with spaces and terminate with a newline per the format spec.
+  size_t padded_size = ((kPreambleSize + dict.size() + 1 + 63) / 64) * 64;
+  dict.resize(padded_size - kPreambleSize - 1, ' ');
+  dict += '\n';
+  std::string header("\x93NUMPY\x01\x00", 8);
+  header += static_cast<char>(dict.size() & 0xFF);
+  header += static_cast<char>((dict.size() >> 8) & 0xFF);
+  header += dict;
+  return header;
+}
+
+// Returns the CRC-32 used by zip files of |data|, continuing from |crc|.
+uint32_t Crc32(uint32_t crc, absl::Span<const uint8_t> data) {
+  static const auto* table = [] {
+    auto* table = new std::array<uint32_t, 256>();
+    for (uint32_t i = 0; i < table->size(); ++i) {
+      uint32_t value = i;
+      for (int bit = 0; bit < 8; ++bit) {
+        value = (value & 1) ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+      }
+      (*table)[i] = value;
+    }
+    return table;
+  }();
+  crc = ~crc;
+  for (uint8_t byte : data) {
+    crc = (*table)[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+void AppendLittleEndian16(uint16_t value, std::string* out) {
+  out->push_back(static_cast<char>(value & 0xFF));
+  out->push_back(static_cast<char>(value >> 8));
+}
+
+void AppendLittleEndian32(uint32_t value, std::string* out) {
+  AppendLittleEndian16(static_cast<uint16_t>(value & 0xFFFF), out);
+  AppendLittleEndian16(static_cast<uint16_t>(value >> 16), out);
+}
+
+// Writes .npy arrays to |os| as an uncompressed .npz (zip) archive with
+// arr_<n>.npy entries like numpy.savez does. Entries are streamed as they are
+// added; the archive is only valid after Finish.
+class NpzWriter {
+ public:
+  explicit NpzWriter(std::ostream* os) : os_(os) {}
+
+  // Adds the array with the .npy |header| followed by |data|.
+  Status AddArray(absl::string_view header, absl::Span<const uint8_t> data) {
+    std::string name = absl::StrCat("arr_", entry_count_, ".npy");
+    uint64_t size = header.size() + data.size();
+    if (size > UINT32_MAX || offset_ + size > UINT32_MAX) {
+      return UnimplementedErrorBuilder(IREE_LOC)
+             << "npz archives larger than 4GiB are not supported";
+    }
+    uint32_t crc = Crc32(
+        Crc32(0, absl::MakeConstSpan(
+                     reinterpret_cast<const uint8_t*>(header.data()),
+                     header.size())),
+        data);
+
+    // The local file header and the central directory record share the
+    // fields following their signature and versions.
+    std::string fields;
+    AppendLittleEndian16(0, &fields);  // flags
+    AppendLittleEndian16(0, &fields);  // compression method: stored
+    AppendLittleEndian16(0, &fields);  // modification time
+    AppendLittleEndian16(kDosEpochDate, &fields);
+    AppendLittleEndian32(crc, &fields);
+    AppendLittleEndian32(static_cast<uint32_t>(size), &fields);
+    AppendLittleEndian32(static_cast<uint32_t>(size), &fields);
+    AppendLittleEndian16(static_cast<uint16_t>(name.size()), &fields);
+    AppendLittleEndian16(0, &fields);  // extra field length
+
+    std::string local_header;
+    AppendLittleEndian32(kLocalFileHeaderSignature, &local_header);
+    AppendLittleEndian16(kZipVersion, &local_header);
+    local_header += fields;
+    local_header += name;
+
+    AppendLittleEndian32(kCentralDirectorySignature, &central_directory_);
+    AppendLittleEndian16(kZipVersion, &central_directory_);  // made by
+    AppendLittleEndian16(kZipVersion, &central_directory_);  // needed
+    central_directory_ += fields;
+    AppendLittleEndian16(0, &central_directory_);  // comment length
+    AppendLittleEndian16(0, &central_directory_);  // disk number
+    AppendLittleEndian16(0, &central_directory_);  // internal attributes
+    AppendLittleEndian32(0, &central_directory_);  // external attributes
+    AppendLittleEndian32(static_cast<uint32_t>(offset_), &central_directory_);
+    central_directory_ += name;
+
+    *os_ << local_header << header;
+    os_->write(reinterpret_cast<const char*>(data.data()), data.size());
+    offset_ += local_header.size() + size;
+    ++entry_count_;
+    return OkStatus();
+  }
+
+  // Writes the central directory that completes the archive.
+  Status Finish() {
+    std::string end_record;
+    AppendLittleEndian32(kEndOfCentralDirectorySignature, &end_record);
+    AppendLittleEndian16(0, &end_record);  // disk number
+    AppendLittleEndian16(0, &end_record);  // central directory disk
+    AppendLittleEndian16(static_cast<uint16_t>(entry_count_), &end_record);
+    AppendLittleEndian16(static_cast<uint16_t>(entry_count_), &end_record);
+    AppendLittleEndian32(static_cast<uint32_t>(central_directory_.size()),
+                         &end_record);
+    AppendLittleEndian32(static_cast<uint32_t>(offset_), &end_record);
+    AppendLittleEndian16(0, &end_record);  // comment length
+    *os_ << central_directory_ << end_record;
+    return OkStatus();
+  }
+
+ private:
+  static constexpr uint32_t kLocalFileHeaderSignature = 0x04034B50;
+  static constexpr uint32_t kCentralDirectorySignature = 0x02014B50;
+  static constexpr uint32_t kEndOfCentralDirectorySignature = 0x06054B50;
+  static constexpr uint16_t kZipVersion = 20;
+  // 1980-01-01, the earliest date zip files can hold.
+  static constexpr uint16_t kDosEpochDate = (1 << 5) | 1;
+
+  std::ostream* os_;
+  uint64_t offset_ = 0;
+  int entry_count_ = 0;
+  std::string central_directory_;
+};
+
+}  // namespace
+
+Status AppendInputToVariantList(
+    const RawSignatureParser::Description& desc,
+    iree_hal_allocator_t* allocator, absl::string_view input_string,
+    iree_vm_variant_list_t* variant_list,
+    std::vector<ref_ptr<FileMapping>>* imported_mappings) {
+  std::string desc_str;
+  desc.ToString(desc_str);
+  switch (desc.type) {
+    case RawSignatureParser::Type::kScalar: {
+      if (desc.scalar.type != AbiConstants::ScalarType::kSint32) {
+        return UnimplementedErrorBuilder(IREE_LOC)
+               << "Unsupported signature scalar type: " << desc_str;
+      }
+      absl::string_view input_view = absl::StripAsciiWhitespace(input_string);
+      input_view = absl::StripPrefix(input_view, "\"");
+      input_view = absl::StripSuffix(input_view, "\"");
+      if (!absl::ConsumePrefix(&input_view, "i32=")) {
+        return InvalidArgumentErrorBuilder(IREE_LOC)
+               << "Parsing '" << input_string
+               << "'. Has i32 descriptor but does not start with 'i32='";
+      }
+      int32_t val;
+      if (!absl::SimpleAtoi(input_view, &val)) {
+        return InvalidArgumentErrorBuilder(IREE_LOC)
+               << "Converting '" << input_view << "' to i32 when parsing '"
+               << input_string << "'";
+      }
+      return FromApiStatus(iree_vm_variant_list_append_value(
+                               variant_list, IREE_VM_VALUE_MAKE_I32(val)),
+                           IREE_LOC);
+    }
+    case RawSignatureParser::Type::kBuffer: {
+      iree_hal_buffer_t* buf = nullptr;
+      if (IsFileInput(input_string)) {
+        RETURN_IF_ERROR(LoadBufferFromFile(desc, input_string, allocator,
+                                           imported_mappings, &buf));
+      } else {
+        ASSIGN_OR_RETURN(auto shaped_buffer,
+                         ParseShapedBufferFromString(input_string),
+                         _ << "Parsing value '" << input_string << "'");
+        RETURN_IF_ERROR(AllocateBufferWithContents(
+            allocator, shaped_buffer.contents(), &buf));
+      }
+      auto buf_ref = iree_hal_buffer_move_ref(buf);
+      return FromApiStatus(
+          iree_vm_variant_list_append_ref_move(variant_list, &buf_ref),
+          IREE_LOC);
+    }
+    default:
+      return UnimplementedErrorBuilder(IREE_LOC)
+             << "Unsupported signature type: " << desc_str;
+  }
+}
+
+Status AppendBufferDataToVariantList(
+    const RawSignatureParser::Description& desc,
+    iree_hal_allocator_t* allocator, absl::string_view shape_and_type,
+    absl::Span<const uint8_t> data, iree_vm_variant_list_t* variant_list) {
+  if (desc.type != RawSignatureParser::Type::kBuffer) {
+    std::string desc_str;
+    desc.ToString(desc_str);
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "Binary data given for non-buffer signature " << desc_str;
+  }
+  absl::Span<const uint8_t> contents;
+  std::vector<uint8_t> expanded_contents;
+  RETURN_IF_ERROR(ParseBufferData(desc, shape_and_type,
+                                  /*is_npy=*/shape_and_type.empty(),
+                                  "<inline data>", data, &expanded_contents,
+                                  &contents));
+  iree_hal_buffer_t* buf = nullptr;
+  RETURN_IF_ERROR(AllocateBufferWithContents(allocator, contents, &buf));
+  auto buf_ref = iree_hal_buffer_move_ref(buf);
+  return FromApiStatus(
+      iree_vm_variant_list_append_ref_move(variant_list, &buf_ref), IREE_LOC);
+}
+
 StatusOr<iree_vm_variant_list_t*> ParseToVariantList(
     absl::Span<const RawSignatureParser::Description> descs,
     iree_hal_allocator_t* allocator,
-    absl::Span<const std::string> input_strings) {
+    absl::Span<const std::string> input_strings,
+    std::vector<ref_ptr<FileMapping>>* imported_mappings) {
+  IREE_TRACE_SCOPE0("VmUtil#ParseToVariantList");
   if (input_strings.size() != descs.size()) {
     return InvalidArgumentErrorBuilder(IREE_LOC)
            << "Signature mismatch; expected " << descs.size()
@@ -95,69 +691,9 @@ StatusOr<iree_vm_variant_list_t*> ParseToVariantList(
                                  &variant_list),
       IREE_LOC));
   for (int i = 0; i < input_strings.size(); ++i) {
-    auto input_string = input_strings[i];
-    auto desc = descs[i];
-    std::string desc_str;
-    desc.ToString(desc_str);
-    switch (desc.type) {
-      case RawSignatureParser::Type::kScalar: {
-        if (desc.scalar.type != AbiConstants::ScalarType::kSint32) {
-          return UnimplementedErrorBuilder(IREE_LOC)
-                 << "Unsupported signature scalar type: " << desc_str;
-        }
-        absl::string_view input_view = absl::StripAsciiWhitespace(input_string);
-        input_view = absl::StripPrefix(input_view, "\"");
-        input_view = absl::StripSuffix(input_view, "\"");
-        if (!absl::ConsumePrefix(&input_view, "i32=")) {
-          return InvalidArgumentErrorBuilder(IREE_LOC)
-                 << "Parsing '" << input_string
-                 << "'. Has i32 descriptor but does not start with 'i32='";
-        }
-        int32_t val;
-        if (!absl::SimpleAtoi(input_view, &val)) {
-          return InvalidArgumentErrorBuilder(IREE_LOC)
-                 << "Converting '" << input_view << "' to i32 when parsing '"
-                 << input_string << "'";
-        }
-        iree_vm_variant_list_append_value(variant_list,
-                                          IREE_VM_VALUE_MAKE_I32(val));
-        break;
-      }
-      case RawSignatureParser::Type::kBuffer: {
-        ASSIGN_OR_RETURN(auto shaped_buffer,
-                         ParseShapedBufferFromString(input_string),
-                         _ << "Parsing value '" << input_string << "'");
-        iree_hal_buffer_t* buf = nullptr;
-        // TODO(benvanik): combined function for linear to optimal upload.
-        iree_device_size_t allocation_size =
-            shaped_buffer.shape().element_count() *
-            shaped_buffer.element_size();
-        RETURN_IF_ERROR(FromApiStatus(
-            iree_hal_allocator_allocate_buffer(
-                allocator,
-                static_cast<iree_hal_memory_type_t>(
-                    IREE_HAL_MEMORY_TYPE_HOST_LOCAL |
-                    IREE_HAL_MEMORY_TYPE_DEVICE_VISIBLE),
-                static_cast<iree_hal_buffer_usage_t>(
-                    IREE_HAL_BUFFER_USAGE_ALL | IREE_HAL_BUFFER_USAGE_CONSTANT),
-                allocation_size, &buf),
-            IREE_LOC))
-            << "Allocating buffer";
-        RETURN_IF_ERROR(FromApiStatus(
-            iree_hal_buffer_write_data(buf, 0, shaped_buffer.contents().data(),
-                                       shaped_buffer.contents().size()),
-            IREE_LOC))
-            << "Populating buffer contents ";
-        auto buf_ref = iree_hal_buffer_move_ref(buf);
-        RETURN_IF_ERROR(FromApiStatus(
-            iree_vm_variant_list_append_ref_move(variant_list, &buf_ref),
-            IREE_LOC));
-        break;
-      }
-      default:
-        return UnimplementedErrorBuilder(IREE_LOC)
-               << "Unsupported signature type: " << desc_str;
-    }
+    RETURN_IF_ERROR(AppendInputToVariantList(descs[i], allocator,
+                                             input_strings[i], variant_list,
+                                             imported_mappings));
   }
   return variant_list;
 }
@@ -261,6 +797,209 @@ Status PrintVariantList(absl::Span<const RawSignatureParser::Description> descs,
   return OkStatus();
 }
 
+StatusOr<OutputFormat> ParseOutputFormat(absl::string_view format_name) {
+  if (format_name == "text") {
+    return OutputFormat::kText;
+  } else if (format_name == "npy") {
+    return OutputFormat::kNumpy;
+  } else if (format_name == "npz") {
+    return OutputFormat::kNumpyArchive;
+  } else if (format_name == "binary") {
+    return OutputFormat::kBinary;
+  }
+  return InvalidArgumentErrorBuilder(IREE_LOC)
+         << "Unknown output format '" << format_name
+         << "'; expected one of text, npy, npz or binary";
+}
+
+Status WriteVariantList(absl::Span<const RawSignatureParser::Description> descs,
+                        iree_vm_variant_list_t* variant_list,
+                        OutputFormat format, std::ostream* os) {
+  IREE_TRACE_SCOPE0("VmUtil#WriteVariantList");
+  if (format == OutputFormat::kText) {
+    return PrintVariantList(descs, variant_list, os);
+  }
+  if (format == OutputFormat::kNumpy &&
+      iree_vm_variant_list_size(variant_list) > 1) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "A .npy file holds a single array but there are "
+           << iree_vm_variant_list_size(variant_list)
+           << " results; use the npz format for multiple results";
+  }
+  bool with_npy_headers = format == OutputFormat::kNumpy ||
+                          format == OutputFormat::kNumpyArchive;
+  NpzWriter npz_writer(os);
+  // Writes the result with the (possibly empty) .npy |header| and |data|.
+  auto write_result = [&](absl::string_view header,
+                          absl::Span<const uint8_t> data) -> Status {
+    if (format == OutputFormat::kNumpyArchive) {
+      return npz_writer.AddArray(header, data);
+    }
+    *os << header;
+    os->write(reinterpret_cast<const char*>(data.data()), data.size());
+    return OkStatus();
+  };
+
+  for (int i = 0; i < iree_vm_variant_list_size(variant_list); ++i) {
+    iree_vm_variant_t* variant = iree_vm_variant_list_get(variant_list, i);
+    if (!variant) {
+      return InvalidArgumentErrorBuilder(IREE_LOC)
+             << "variant " << i << "not present";
+    }
+
+    const auto& desc = descs[i];
+    std::string desc_str;
+    desc.ToString(desc_str);
+
+    switch (desc.type) {
+      case RawSignatureParser::Type::kScalar: {
+        if (variant->value_type != IREE_VM_VALUE_TYPE_I32 ||
+            desc.scalar.type != AbiConstants::ScalarType::kSint32) {
+          return UnimplementedErrorBuilder(IREE_LOC)
+                 << "Unsupported signature scalar type: " << desc_str;
+        }
+        RETURN_IF_ERROR(write_result(
+            with_npy_headers ? MakeNpyHeader(desc.scalar.type, {}) : "",
+            absl::MakeConstSpan(reinterpret_cast<const uint8_t*>(&variant->i32),
+                                sizeof(variant->i32))));
+        break;
+      }
+      case RawSignatureParser::Type::kBuffer: {
+        auto* buffer = iree_hal_buffer_deref(&variant->ref);
+        if (variant->value_type != IREE_VM_VALUE_TYPE_NONE || !buffer) {
+          return InvalidArgumentErrorBuilder(IREE_LOC)
+                 << "variant " << i << " is not a buffer but descriptor "
+                 << "information " << desc_str;
+        }
+
+        iree_hal_mapped_memory_t mapped_memory;
+        RETURN_IF_ERROR(FromApiStatus(
+            iree_hal_buffer_map(buffer, IREE_HAL_MEMORY_ACCESS_READ, 0,
+                                IREE_WHOLE_BUFFER, &mapped_memory),
+            IREE_LOC))
+            << "mapping hal buffer";
+        std::string header;
+        if (with_npy_headers) {
+          // Dynamic dimensions are not known from the signature; a single
+          // dynamic dimension can be inferred from the buffer size unless
+          // the other dimensions hold no elements.
+          std::vector<int> dims(desc.dims.begin(), desc.dims.end());
+          size_t static_element_count = 1;
+          int dynamic_dim_count = 0;
+          for (int dim : dims) {
+            if (dim < 0) {
+              ++dynamic_dim_count;
+            } else {
+              static_element_count *= dim;
+            }
+          }
+          size_t element_size =
+              AbiConstants::kScalarTypeSize[static_cast<unsigned>(
+                  desc.buffer.scalar_type)];
+          if (dynamic_dim_count > 1 ||
+              (dynamic_dim_count == 1 && static_element_count == 0)) {
+            iree_hal_buffer_unmap(buffer, &mapped_memory);
+            return UnimplementedErrorBuilder(IREE_LOC)
+                   << "Cannot determine the shape of result " << i << ": "
+                   << desc_str;
+          }
+          for (int& dim : dims) {
+            if (dim < 0) {
+              dim = mapped_memory.contents.data_length /
+                    (static_element_count * element_size);
+            }
+          }
+          header = MakeNpyHeader(desc.buffer.scalar_type, dims);
+        }
+        // Written straight from the mapped memory without staging.
+        Status write_status = write_result(
+            header, absl::MakeConstSpan(mapped_memory.contents.data,
+                                        mapped_memory.contents.data_length));
+        iree_hal_buffer_unmap(buffer, &mapped_memory);
+        RETURN_IF_ERROR(write_status);
+        break;
+      }
+      default:
+        return UnimplementedErrorBuilder(IREE_LOC)
+               << "Unsupported signature type: " << desc_str;
+    }
+  }
+
+  if (format == OutputFormat::kNumpyArchive) {
+    RETURN_IF_ERROR(npz_writer.Finish());
+  }
+  os->flush();
+  if (!os->good()) {
+    return InternalErrorBuilder(IREE_LOC) << "Failed writing results";
+  }
+  return OkStatus();
+}
+
+Status AllocateReusableVariantList(iree_host_size_t capacity,
+                                   iree_allocator_t allocator,
+                                   iree_vm_variant_list_t** out_list) {
+  void* list_storage = nullptr;
+  RETURN_IF_ERROR(FromApiStatus(
+      iree_allocator_alloc(allocator, IREE_ALLOCATION_MODE_ZERO_CONTENTS,
+                           iree_vm_variant_list_alloc_size(capacity),
+                           &list_storage),
+      IREE_LOC))
+      << "Allocating variant list storage";
+  RETURN_IF_ERROR(FromApiStatus(
+      iree_vm_variant_list_init(list_storage, capacity, out_list), IREE_LOC))
+      << "Initializing variant list";
+  return OkStatus();
+}
+
+// Releases all ref values held by |list|.
+static void ReleaseVariantListRefs(iree_vm_variant_list_t* list) {
+  for (iree_host_size_t i = 0; i < iree_vm_variant_list_size(list); ++i) {
+    iree_vm_variant_t* variant = iree_vm_variant_list_get(list, i);
+    if (IREE_VM_VARIANT_IS_REF(variant)) {
+      iree_vm_ref_release(&variant->ref);
+    }
+  }
+}
+
+iree_status_t ResetVariantListRaw(iree_vm_variant_list_t* list) {
+  ReleaseVariantListRefs(list);
+  // Reinitialize in place; the list header lives at the start of its storage.
+  iree_host_size_t capacity = iree_vm_variant_list_capacity(list);
+  return iree_vm_variant_list_init(list, capacity, &list);
+}
+
+Status ResetVariantList(iree_vm_variant_list_t* list) {
+  RETURN_IF_ERROR(FromApiStatus(ResetVariantListRaw(list), IREE_LOC))
+      << "Resetting variant list";
+  return OkStatus();
+}
+
+Status FreeReusableVariantList(iree_vm_variant_list_t* list,
+                               iree_allocator_t allocator) {
+  ReleaseVariantListRefs(list);
+  iree_allocator_free(allocator, list);
+  return OkStatus();
+}
+
+iree_allocator_t CountingAllocator::allocator() {
+  return {this /* self */, &CountingAllocator::Alloc /* alloc */,
+          &CountingAllocator::Free /* free */};
+}
+
+iree_status_t CountingAllocator::Alloc(void* self, iree_allocation_mode_t mode,
+                                       iree_host_size_t byte_length,
+                                       void** out_ptr) {
+  auto* counting_allocator = static_cast<CountingAllocator*>(self);
+  ++counting_allocator->allocation_count_;
+  const auto& base = counting_allocator->base_allocator_;
+  return base.alloc(base.self, mode, byte_length, out_ptr);
+}
+
+iree_status_t CountingAllocator::Free(void* self, void* ptr) {
+  const auto& base = static_cast<CountingAllocator*>(self)->base_allocator_;
+  return base.free(base.self, ptr);
+}
+
 Status CreateDevice(absl::string_view driver_name,
                     iree_hal_device_t** out_device) {
   LOG(INFO) << "Creating driver and device for '" << driver_name << "'...";
@@ -289,8 +1028,21 @@ Status CreateHalModule(iree_hal_device_t* device,
   return OkStatus();
 }
 
+Status ValidateBytecodeModule(absl::Span<const uint8_t> module_data) {
+  flatbuffers::Verifier verifier(module_data.data(), module_data.size());
+  if (!vm::VerifyBytecodeModuleDefBuffer(verifier)) {
+    return InvalidArgumentErrorBuilder(IREE_LOC)
+           << "Data is not a valid BytecodeModuleDef";
+  }
+  return OkStatus();
+}
+
 Status LoadBytecodeModule(absl::string_view module_data,
                           iree_vm_module_t** out_module) {
+  IREE_TRACE_SCOPE0("VmUtil#LoadBytecodeModule");
+  RETURN_IF_ERROR(ValidateBytecodeModule(absl::MakeConstSpan(
+      reinterpret_cast<const uint8_t*>(module_data.data()),
+      module_data.size())));
   RETURN_IF_ERROR(FromApiStatus(
       iree_vm_bytecode_module_create(
           iree_const_byte_span_t{
@@ -301,4 +1053,85 @@ Status LoadBytecodeModule(absl::string_view module_data,
       << "Deserializing module";
   return OkStatus();
 }
+
+namespace {
+
+// Frees the module archive by dropping the file mapping it lives in. |self| is
+// a heap allocated ref_ptr<FileMapping> owned by the allocator.
+iree_status_t ReleaseMappedArchive(void* self, void* ptr) {
+  delete static_cast<ref_ptr<FileMapping>*>(self);
+  return IREE_STATUS_OK;
+}
+
+// Frees the module archive by deleting the string it lives in. |self| is a
+// heap allocated std::string owned by the allocator.
+iree_status_t ReleaseStringArchive(void* self, void* ptr) {
+  delete static_cast<std::string*>(self);
+  return IREE_STATUS_OK;
+}
+
+}  // namespace
+
+Status LoadBytecodeModuleFromString(
+    std::string module_data, iree_vm_module_t** out_module,
+    absl::Span<const uint8_t>* out_module_data) {
+  IREE_TRACE_SCOPE0("VmUtil#LoadBytecodeModuleFromString");
+  RETURN_IF_ERROR(ValidateBytecodeModule(absl::MakeConstSpan(
+      reinterpret_cast<const uint8_t*>(module_data.data()),
+      module_data.size())));
+  // The string is kept alive until the module frees its archive.
+  auto* retained_data = new std::string(std::move(module_data));
+  auto archive_data = absl::MakeConstSpan(
+      reinterpret_cast<const uint8_t*>(retained_data->data()),
+      retained_data->size());
+  iree_allocator_t archive_allocator = {retained_data /* self */,
+                                        nullptr /* alloc */,
+                                        &ReleaseStringArchive /* free */};
+  iree_status_t status = iree_vm_bytecode_module_create(
+      iree_const_byte_span_t{archive_data.data(), archive_data.size()},
+      archive_allocator, IREE_ALLOCATOR_SYSTEM, out_module);
+  if (status != IREE_STATUS_OK) {
+    delete retained_data;
+  }
+  RETURN_IF_ERROR(FromApiStatus(status, IREE_LOC)) << "Deserializing module";
+  if (out_module_data) *out_module_data = archive_data;
+  return OkStatus();
+}
+
+Status LoadBytecodeModuleFromFile(absl::string_view path,
+                                  iree_vm_module_t** out_module,
+                                  absl::Span<const uint8_t>* out_module_data) {
+  IREE_TRACE_SCOPE0("VmUtil#LoadBytecodeModuleFromFile");
+  if (path == "-") {
+    // stdin cannot be mapped; read it into a string owned by the module.
+    std::string contents{std::istreambuf_iterator<char>(std::cin),
+                         std::istreambuf_iterator<char>()};
+    RETURN_IF_ERROR(LoadBytecodeModuleFromString(std::move(contents),
+                                                 out_module, out_module_data))
+        << "Loading module from stdin";
+    return OkStatus();
+  }
+
+  ASSIGN_OR_RETURN(auto file_mapping, FileMapping::OpenRead(std::string(path)),
+                   _ << "Mapping module file '" << path << "'");
+  auto archive_data = file_mapping->data();
+  RETURN_IF_ERROR(ValidateBytecodeModule(archive_data))
+      << "Loading module '" << path << "'";
+  // The mapping is kept alive until the module frees its archive.
+  auto* retained_mapping = new ref_ptr<FileMapping>(std::move(file_mapping));
+  iree_allocator_t archive_allocator = {
+      retained_mapping /* self */, nullptr /* alloc */,
+      &ReleaseMappedArchive /* free */};
+  iree_status_t status = iree_vm_bytecode_module_create(
+      iree_const_byte_span_t{archive_data.data(), archive_data.size()},
+      archive_allocator, IREE_ALLOCATOR_SYSTEM, out_module);
+  if (status != IREE_STATUS_OK) {
+    delete retained_mapping;
+  }
+  RETURN_IF_ERROR(FromApiStatus(status, IREE_LOC))
+      << "Deserializing module '" << path << "'";
+  if (out_module_data) *out_module_data = archive_data;
+  return OkStatus();
+}
+
 }  // namespace iree
@@ -15,10 +15,17 @@
 #ifndef IREE_TOOLS_VM_UTIL_H_
 #define IREE_TOOLS_VM_UTIL_H_
 
+#include <atomic>
+#include <cstdint>
 #include <iostream>
 #include <ostream>
+#include <vector>
 
+#include "absl/strings/string_view.h"
 #include "absl/types/span.h"
+#include "iree/base/api.h"
+#include "iree/base/file_mapping.h"
+#include "iree/base/ref_ptr.h"
 #include "iree/base/signature_mangle.h"
 #include "iree/base/status.h"
 #include "iree/hal/api.h"
@@ -47,13 +54,41 @@ StatusOr<std::vector<RawSignatureParser::Description>> ParseOutputSignature(
 //   [shape]xtype=[value]
 // described in
 // https://github.com/google/iree/tree/master/iree/base/buffer_string_util.h
+// or reference a file that is memory mapped instead of parsed:
+//   @path.npy             a numpy .npy file (little-endian, C order)
+//   [shape]xtype=@path    raw element data
+//   @path                 a BufferDataDef flatbuffer (buffer_data_def.fbs)
 // Uses |allocator| to allocate the buffers.
+// If |imported_mappings| is provided then file contents are imported into
+// host heap buffers without copying and the file mappings are appended to it;
+// they must outlive the returned buffers. This is only valid for devices that
+// can access host memory directly.
 // Uses descriptors in |descs| for type information and validation.
 // The returned variant list must be freed by the caller.
 StatusOr<iree_vm_variant_list_t*> ParseToVariantList(
     absl::Span<const RawSignatureParser::Description> descs,
     iree_hal_allocator_t* allocator,
-    absl::Span<const std::string> input_strings);
+    absl::Span<const std::string> input_strings,
+    std::vector<ref_ptr<FileMapping>>* imported_mappings = nullptr);
+
+// Parses a single |input_string| for |desc| in any of the formats accepted by
+// ParseToVariantList and appends the value to |variant_list|, which must have
+// capacity for it.
+Status AppendInputToVariantList(
+    const RawSignatureParser::Description& desc,
+    iree_hal_allocator_t* allocator, absl::string_view input_string,
+    iree_vm_variant_list_t* variant_list,
+    std::vector<ref_ptr<FileMapping>>* imported_mappings = nullptr);
+
+// Appends a buffer for |desc| whose data is held in memory instead of a file
+// to |variant_list|. |data| holds either raw little-endian element data of
+// the '[shape]xtype' |shape_and_type| or, if |shape_and_type| is empty, a
+// numpy .npy file. The data is copied into a buffer from |allocator| so it
+// need not outlive the call.
+Status AppendBufferDataToVariantList(
+    const RawSignatureParser::Description& desc,
+    iree_hal_allocator_t* allocator, absl::string_view shape_and_type,
+    absl::Span<const uint8_t> data, iree_vm_variant_list_t* variant_list);
 
 // Prints a variant list of VM scalars and buffers to |os|.
 // Prints scalars in the format:
@@ -67,6 +102,76 @@ Status PrintVariantList(absl::Span<const RawSignatureParser::Description> descs,
                         iree_vm_variant_list_t* variant_list,
                         std::ostream* os = &std::cout);
 
+// Formats that results can be written in by WriteVariantList.
+enum class OutputFormat {
+  // Human readable text as produced by PrintVariantList.
+  kText,
+  // A numpy .npy array of the single result.
+  kNumpy,
+  // A numpy .npz archive with one arr_<n>.npy array per result, as written by
+  // numpy.savez.
+  kNumpyArchive,
+  // Raw little-endian element data of each result, concatenated.
+  kBinary,
+};
+
+// Parses an output format name (text, npy, npz or binary).
+StatusOr<OutputFormat> ParseOutputFormat(absl::string_view format_name);
+
+// Writes a variant list of VM scalars and buffers to |os| in |format|.
+// Binary formats are written directly from the mapped buffer memory without
+// intermediate copies. The npy format only holds a single result; lists with
+// more results have to be written as npz.
+// Uses descriptors in |descs| for type information and validation.
+Status WriteVariantList(absl::Span<const RawSignatureParser::Description> descs,
+                        iree_vm_variant_list_t* variant_list,
+                        OutputFormat format, std::ostream* os = &std::cout);
+
+// Allocates a variant list with storage for |capacity| values that can be
+// cleared with ResetVariantList and reused across invocations without further
+// allocations.
+// The returned |out_list| must be freed with FreeReusableVariantList.
+Status AllocateReusableVariantList(iree_host_size_t capacity,
+                                   iree_allocator_t allocator,
+                                   iree_vm_variant_list_t** out_list);
+
+// Releases all values in a list from AllocateReusableVariantList and resets
+// its size to 0 while retaining its capacity and storage.
+Status ResetVariantList(iree_vm_variant_list_t* list);
+
+// ResetVariantList returning the raw API status, for benchmarked loops that
+// avoid Status conversions.
+iree_status_t ResetVariantListRaw(iree_vm_variant_list_t* list);
+
+// Releases all values in a list from AllocateReusableVariantList and frees it
+// using the same |allocator| it was allocated with.
+Status FreeReusableVariantList(iree_vm_variant_list_t* list,
+                               iree_allocator_t allocator);
+
+// Wraps another allocator and counts the allocations made through it.
+// Used by tooling to verify that steady-state invocations do not allocate.
+class CountingAllocator {
+ public:
+  explicit CountingAllocator(
+      iree_allocator_t base_allocator = IREE_ALLOCATOR_SYSTEM)
+      : base_allocator_(base_allocator) {}
+
+  // Returns an allocator that forwards to the base allocator and counts.
+  // Only valid for the lifetime of this object.
+  iree_allocator_t allocator();
+
+  // Total number of allocations made so far.
+  int64_t allocation_count() const { return allocation_count_.load(); }
+
+ private:
+  static iree_status_t Alloc(void* self, iree_allocation_mode_t mode,
+                             iree_host_size_t byte_length, void** out_ptr);
+  static iree_status_t Free(void* self, void* ptr);
+
+  iree_allocator_t base_allocator_;
+  std::atomic<int64_t> allocation_count_{0};
+};
+
 // Creates the default device for |driver| in |out_device|.
 // The returned |out_device| must be released by the caller.
 Status CreateDevice(absl::string_view driver_name,
@@ -77,11 +182,33 @@ Status CreateDevice(absl::string_view driver_name,
 Status CreateHalModule(iree_hal_device_t* device,
                        iree_vm_module_t** out_module);
 
+// Verifies the bytecode module flatbuffer in |module_data|.
+Status ValidateBytecodeModule(absl::Span<const uint8_t> module_data);
+
 // Loads a VM bytecode from an opaque string.
 // The returned |out_module| must be released by the caller.
 Status LoadBytecodeModule(absl::string_view module_data,
                           iree_vm_module_t** out_module);
 
+// Loads a VM bytecode module from |module_data|, which is kept alive for the
+// lifetime of the module instead of being copied.
+// If |out_module_data| is not null it receives the module archive, which stays
+// valid for the lifetime of the module.
+// The returned |out_module| must be released by the caller.
+Status LoadBytecodeModuleFromString(
+    std::string module_data, iree_vm_module_t** out_module,
+    absl::Span<const uint8_t>* out_module_data = nullptr);
+
+// Loads a VM bytecode module from the file at |path| ('-' for stdin).
+// Files are memory mapped read-only and the mapping is kept alive for the
+// lifetime of the module instead of being read and copied into memory.
+// If |out_module_data| is not null it receives the module archive, which stays
+// valid for the lifetime of the module.
+// The returned |out_module| must be released by the caller.
+Status LoadBytecodeModuleFromFile(
+    absl::string_view path, iree_vm_module_t** out_module,
+    absl::Span<const uint8_t>* out_module_data = nullptr);
+
 }  // namespace iree
 
 #endif  // IREE_TOOLS_VM_UTIL_H_
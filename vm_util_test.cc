@@ -14,7 +14,10 @@
 
 #include "iree/tools/vm_util.h"
 
+#include <fstream>
 #include <sstream>
+#include <string>
+#include <vector>
 
 #include "iree/base/api.h"
 #include "iree/base/status_matchers.h"
@@ -110,5 +113,194 @@ TEST_F(VmUtilTest, ParsePrintMultipleBuffers) {
   IREE_ASSERT_OK(iree_vm_variant_list_free(variant_list));
 }
 
+TEST_F(VmUtilTest, ParseRawFileBuffer) {
+  std::string path = ::testing::TempDir() + "/raw_input.bin";
+  int32_t values[] = {42, 43, 44, 45};
+  std::ofstream(path, std::ios::binary)
+      .write(reinterpret_cast<const char*>(values), sizeof(values));
+  RawSignatureParser::Description desc;
+  desc.type = RawSignatureParser::Type::kBuffer;
+  desc.buffer.scalar_type = AbiConstants::ScalarType::kSint32;
+  desc.dims = {2, 2};
+
+  ASSERT_OK_AND_ASSIGN(auto* variant_list,
+                       ParseToVariantList({desc}, allocator_,
+                                          {absl::StrCat("2x2xi32=@", path)}));
+  std::stringstream os;
+  ASSERT_OK(PrintVariantList({desc}, variant_list, &os));
+  EXPECT_EQ(os.str(), "2x2xi32=[42 43][44 45]\n");
+
+  IREE_ASSERT_OK(iree_vm_variant_list_free(variant_list));
+}
+
+TEST_F(VmUtilTest, ImportNpyFileBuffer) {
+  std::string path = ::testing::TempDir() + "/input.npy";
+  std::string header =
+      "{'descr': '<f4', 'fortran_order': False, 'shape': (2, 3), }";
+  // Pad the header to a multiple of 64 bytes as numpy does.
+  header.resize(64 - 10 - 1, ' ');
+  header += "\n";
+  float values[] = {1, 2, 3, 4, 5, 6};
+  {
+    std::ofstream file(path, std::ios::binary);
+    file.write("\x93NUMPY\x01\x00", 8);
+    file.put(static_cast<char>(header.size() & 0xFF));
+    file.put(static_cast<char>(header.size() >> 8));
+    file << header;
+    file.write(reinterpret_cast<const char*>(values), sizeof(values));
+  }
+  RawSignatureParser::Description desc;
+  desc.type = RawSignatureParser::Type::kBuffer;
+  desc.buffer.scalar_type = AbiConstants::ScalarType::kIeeeFloat32;
+  desc.dims = {2, 3};
+
+  std::vector<ref_ptr<FileMapping>> mappings;
+  ASSERT_OK_AND_ASSIGN(
+      auto* variant_list,
+      ParseToVariantList({desc}, allocator_, {absl::StrCat("@", path)},
+                         &mappings));
+  EXPECT_EQ(mappings.size(), 1);
+  std::stringstream os;
+  ASSERT_OK(PrintVariantList({desc}, variant_list, &os));
+  EXPECT_EQ(os.str(), "2x3xf32=[1 2 3][4 5 6]\n");
+
+  IREE_ASSERT_OK(iree_vm_variant_list_free(variant_list));
+}
+
+TEST_F(VmUtilTest, ParseFileBufferShapeMismatch) {
+  std::string path = ::testing::TempDir() + "/short_input.bin";
+  int32_t values[] = {42, 43, 44};
+  std::ofstream(path, std::ios::binary)
+      .write(reinterpret_cast<const char*>(values), sizeof(values));
+  RawSignatureParser::Description desc;
+  desc.type = RawSignatureParser::Type::kBuffer;
+  desc.buffer.scalar_type = AbiConstants::ScalarType::kSint32;
+  desc.dims = {2, 2};
+
+  EXPECT_FALSE(
+      ParseToVariantList({desc}, allocator_, {absl::StrCat("2x2xi32=@", path)})
+          .ok());
+}
+
+TEST_F(VmUtilTest, AppendInlineBufferData) {
+  RawSignatureParser::Description desc;
+  desc.type = RawSignatureParser::Type::kBuffer;
+  desc.buffer.scalar_type = AbiConstants::ScalarType::kSint32;
+  desc.dims = {2, 2};
+  int32_t values[] = {42, 43, 44, 45};
+  auto data = absl::MakeConstSpan(reinterpret_cast<const uint8_t*>(values),
+                                  sizeof(values));
+
+  iree_vm_variant_list_t* variant_list = nullptr;
+  ASSERT_OK(
+      AllocateReusableVariantList(2, IREE_ALLOCATOR_SYSTEM, &variant_list));
+  ASSERT_OK(AppendBufferDataToVariantList(desc, allocator_, "2x2xi32", data,
+                                          variant_list));
+  ASSERT_OK(AppendInputToVariantList(desc, allocator_, "2x2xi32=[1 2][3 4]",
+                                     variant_list));
+  std::stringstream os;
+  ASSERT_OK(PrintVariantList({desc, desc}, variant_list, &os));
+  EXPECT_EQ(os.str(), "2x2xi32=[42 43][44 45]\n2x2xi32=[1 2][3 4]\n");
+
+  ASSERT_OK(ResetVariantList(variant_list));
+  EXPECT_TRUE(IsInvalidArgument(AppendBufferDataToVariantList(
+      desc, allocator_, "2x2xi32", data.subspan(4), variant_list)));
+  EXPECT_TRUE(IsInvalidArgument(AppendBufferDataToVariantList(
+      desc, allocator_, "4xi32", data, variant_list)));
+
+  ASSERT_OK(FreeReusableVariantList(variant_list, IREE_ALLOCATOR_SYSTEM));
+}
+
+TEST_F(VmUtilTest, WriteBinaryBuffers) {
+  auto buf_string = "2x2xi32=[42 43][44 45]";
+  RawSignatureParser::Description desc;
+  desc.type = RawSignatureParser::Type::kBuffer;
+  desc.buffer.scalar_type = AbiConstants::ScalarType::kSint32;
+  desc.dims = {2, 2};
+
+  ASSERT_OK_AND_ASSIGN(auto* variant_list,
+                       ParseToVariantList({desc}, allocator_, {buf_string}));
+  int32_t values[] = {42, 43, 44, 45};
+  std::string expected_data(reinterpret_cast<const char*>(values),
+                            sizeof(values));
+
+  std::stringstream binary_os;
+  ASSERT_OK(WriteVariantList({desc}, variant_list, OutputFormat::kBinary,
+                             &binary_os));
+  EXPECT_EQ(binary_os.str(), expected_data);
+
+  std::stringstream npy_os;
+  ASSERT_OK(
+      WriteVariantList({desc}, variant_list, OutputFormat::kNumpy, &npy_os));
+  std::string npy_str = npy_os.str();
+  ASSERT_EQ(npy_str.size(), 64 + sizeof(values));
+  EXPECT_EQ(npy_str.substr(0, 6), "\x93NUMPY");
+  EXPECT_NE(npy_str.find("'descr': '<i4'"), std::string::npos);
+  EXPECT_NE(npy_str.find("'shape': (2, 2)"), std::string::npos);
+  EXPECT_EQ(npy_str.substr(64), expected_data);
+
+  IREE_ASSERT_OK(iree_vm_variant_list_free(variant_list));
+}
+
+TEST_F(VmUtilTest, WriteNumpyArchive) {
+  RawSignatureParser::Description desc;
+  desc.type = RawSignatureParser::Type::kBuffer;
+  desc.buffer.scalar_type = AbiConstants::ScalarType::kSint32;
+  desc.dims = {2, 2};
+
+  ASSERT_OK_AND_ASSIGN(
+      auto* variant_list,
+      ParseToVariantList({desc, desc}, allocator_,
+                         {"2x2xi32=[42 43][44 45]", "2x2xi32=[1 2][3 4]"}));
+  // A .npy file cannot hold more than one result.
+  std::stringstream npy_os;
+  EXPECT_TRUE(IsInvalidArgument(WriteVariantList(
+      {desc, desc}, variant_list, OutputFormat::kNumpy, &npy_os)));
+
+  std::stringstream npz_os;
+  ASSERT_OK(WriteVariantList({desc, desc}, variant_list,
+                             OutputFormat::kNumpyArchive, &npz_os));
+  std::string npz_str = npz_os.str();
+  // Two stored entries of a 30 byte local header, 9 byte name, 64 byte .npy
+  // header and 16 bytes of data, their 55 byte central directory records and
+  // the 22 byte end record.
+  ASSERT_EQ(npz_str.size(), 2 * (30 + 9 + 64 + 16) + 2 * 55 + 22);
+  EXPECT_EQ(npz_str.substr(0, 4), "PK\x03\x04");
+  EXPECT_EQ(npz_str.substr(30, 9), "arr_0.npy");
+  EXPECT_EQ(npz_str.substr(39, 6), "\x93NUMPY");
+  EXPECT_EQ(npz_str.substr(119 + 30, 9), "arr_1.npy");
+  int32_t values[] = {1, 2, 3, 4};
+  EXPECT_EQ(npz_str.substr(119 + 39 + 64, 16),
+            std::string(reinterpret_cast<const char*>(values),
+                        sizeof(values)));
+  std::string end_record = npz_str.substr(npz_str.size() - 22);
+  EXPECT_EQ(end_record.substr(0, 4), "PK\x05\x06");
+  EXPECT_EQ(end_record[10], 2);  // total entry count
+
+  IREE_ASSERT_OK(iree_vm_variant_list_free(variant_list));
+}
+
+TEST_F(VmUtilTest, ResetReusableVariantList) {
+  CountingAllocator counting_allocator;
+  iree_vm_variant_list_t* variant_list = nullptr;
+  ASSERT_OK(AllocateReusableVariantList(2, counting_allocator.allocator(),
+                                        &variant_list));
+  EXPECT_EQ(counting_allocator.allocation_count(), 1);
+
+  for (int i = 0; i < 3; ++i) {
+    IREE_ASSERT_OK(iree_vm_variant_list_append_value(
+        variant_list, IREE_VM_VALUE_MAKE_I32(i)));
+    IREE_ASSERT_OK(iree_vm_variant_list_append_value(
+        variant_list, IREE_VM_VALUE_MAKE_I32(i + 1)));
+    EXPECT_EQ(iree_vm_variant_list_size(variant_list), 2);
+    ASSERT_OK(ResetVariantList(variant_list));
+    EXPECT_EQ(iree_vm_variant_list_size(variant_list), 0);
+  }
+  EXPECT_EQ(counting_allocator.allocation_count(), 1);
+
+  ASSERT_OK(
+      FreeReusableVariantList(variant_list, counting_allocator.allocator()));
+}
+
 }  // namespace
 }  // namespace iree